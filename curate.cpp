@@ -1,21 +1,65 @@
 // curate.cpp — C++ refactor of the curate.sh workflow
-// Build: g++ -std=c++20 -O2 -o curate curate.cpp
+// Build: g++ -std=c++20 -O2 -pthread -o curate curate.cpp
 //
 // Runtime files (defaults):
 //   $CURATE_HOME (or CWD)
 //     ├── inbox.tsv
+//     ├── inbox/               # YYYY-MM.tsv month shards instead of inbox.tsv with `layout sharded`,
+//     │                        #   each with .bitmaps, .aggregates and .sketch sidecars
+//     ├── config.tsv           # per-home settings (key\tvalue), e.g. `layout sharded`
+//     ├── inbox.bitmaps        # tag/kind/week bitmaps + sorted flag for filters (rebuilt as needed)
+//     ├── aggregates.bin       # per-week counters behind `stats` (rebuilt as needed)
+//     ├── inbox.tsv.sketch     # per-week sketches behind `stats --approx` (archive/*.tsv.sketch too)
+//     ├── sync.bin             # per-week row hashes behind `sync` (updated as needed)
 //     ├── rules.tsv            # regex\tkind (created with sensible defaults on first run)
+//     ├── titles.tsv           # fetched page titles behind `titles fill` (url, fetched, status, title)
+//     ├── linkstatus.tsv       # last `check-links` result per URL (status, latency, redirect target)
+//     ├── snapshots/           # page text from `snapshot` (chunks.pack + chunks.idx, index.tsv)
+//     ├── .curate.sock         # Unix socket while `curate serve` runs
+//     ├── .inbox.lock          # serializes inbox appends and rewrites
 //     ├── templates/
 //     │     └── header.md      # included at top of digests unless --no-header
-//     └── digests/             # default output target for `digest`
+//     ├── digests/             # default output target for `digest`
+//     │     └── .manifest.tsv  # per-digest input hashes for `digest --incremental`
+//     └── index/               # full-text index for `search` (manifest.tsv + seg-*.idx)
 //
 // CLI:
 //   curate add <url> [tags...] [--title "..."] [--date YYYY-MM-DD]
 //   curate digest [-gt|--group-tags] [--tags-only] [-pd]
-//                 [--week YYYY-Www | --start YYYY-MM-DD --end YYYY-MM-DD]
-//                 [--no-header] [-o <path>|-]
-//   curate clear-inbox [--archive-dir <dir>]
+//                 [--week YYYY-Www | --start YYYY-MM-DD --end YYYY-MM-DD
+//                  | --all-weeks | --weeks YYYY-Www..YYYY-Www]
+//                 [--incremental] [--page-size N] [--no-header] [-o <path>|-]
+//                 [--format md|html|atom|rss [--feed-per-period] [--feed-url URL] [--feed-limit N|all]]
+//                 [--tag T]... [--any-tag T]... [--not-tag T]... [--kind K]
+//                 [--where EXPR [--explain]] [--dead-links mark|drop] [--home DIR]...
+//   curate clear-inbox [--archive-dir <dir>] [--week YYYY-Www | --before YYYY-MM-DD | --older-than Nd]
+//   curate sort [--include-archive] [--memory MB]
+//   curate migrate --layout sharded|single
+//   curate sync <other-home> [--dry-run]
 //   curate list [--limit N] [--since YYYY-MM-DD] [--until YYYY-MM-DD]
+//               [--tag T]... [--any-tag T]... [--not-tag T]... [--kind K]
+//               [--where EXPR [--explain]]
+//               [--domain HOST [--subdomains]] [--tail N] [--reverse] [--home DIR]...
+//   curate export [--format json|ndjson] [--since YYYY-MM-DD] [--until YYYY-MM-DD]
+//                 [--include-archive] [-o <path>|-]
+//                 [--where EXPR [--explain]]
+//   curate import <file|-> [--format csv|tsv|bookmarks-html|ndjson] [--skip-existing]
+//   curate search <terms...> [--kind K] [--tag T]... [--since YYYY-MM-DD] [--until YYYY-MM-DD] [--limit N]
+//   curate index [--rebuild]
+//   curate domains [--by-site] [--limit N]
+//   curate stats --by kind|domain|tag|week|month[,...] [--top N] [--format tsv|json]
+//                [--since YYYY-MM-DD] [--until YYYY-MM-DD] [--include-archive] [--where EXPR]
+//                [--approx] [--home DIR]...
+//   curate aggregates [--rebuild]
+//   curate serve
+//   curate http [--port N] [--bind ADDR] [--token T]
+//   curate titles fill [--since YYYY-MM-DD] [--until YYYY-MM-DD] [--concurrency N] [--per-host N]
+//                      [--timeout SECS] [--proxy URL] [-v]
+//   curate check-links [--since YYYY-MM-DD] [--until YYYY-MM-DD] [--include-archive] [--max-age DAYS]
+//                      [--concurrency N] [--per-host N] [--rate N] [--timeout SECS] [--proxy URL] [-v]
+//   curate snapshot [--since YYYY-MM-DD] [--until YYYY-MM-DD] [--include-archive] [--refresh]
+//                   [--concurrency N] [--per-host N] [--timeout SECS] [--proxy URL] [-v]
+//   curate snapshot show <url|id>
 //   curate help | -h | --help
 //
 // Notes:
@@ -28,32 +72,78 @@
 //
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <chrono>
+#include <cmath>
 #include <cctype>
+#include <charconv>
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <cstdint>
 #include <ctime>
+#include <deque>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <random>
 #include <regex>
 #include <set>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <tuple>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#include <sys/locking.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <csignal>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#endif
+#endif
+
 using namespace std;
 namespace fs = std::filesystem;
 
 using days = std::chrono::days;
 using sys_days = std::chrono::time_point<std::chrono::system_clock, days>;
 
+// Bumped whenever rendering output changes; part of every digest manifest hash.
+static const char* CURATE_VERSION = "2.1.0";
+
 // --- Portable localtime shim ---
 static inline void portable_localtime(const time_t* t, std::tm* out) {
 #ifdef _WIN32
@@ -65,6 +155,14 @@ static inline void portable_localtime(const time_t* t, std::tm* out) {
 
 // ===== Utilities =====
 static inline string toLower(string s){ for(char &c: s) c = (char)tolower((unsigned char)c); return s; }
+static inline bool iequalsAscii(string_view a, string_view b){
+    return a.size()==b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y){ return tolower((unsigned char)x)==tolower((unsigned char)y); });
+}
+// First case-insensitive occurrence of `needle` at or after `from`.
+static size_t ifindAscii(string_view hay, string_view needle, size_t from = 0){
+    for(size_t i=from; i+needle.size()<=hay.size(); ++i) if(iequalsAscii(hay.substr(i, needle.size()), needle)) return i;
+    return string_view::npos;
+}
 static inline string trim(const string &s){ size_t a=0,b=s.size(); while(a<b && isspace((unsigned char)s[a])) ++a; while(b>a && isspace((unsigned char)s[b-1])) --b; return s.substr(a,b-a);}
 
 static string getenvOr(const char* k, const string& defv){ const char* v = std::getenv(k); return v? string(v): defv; }
@@ -79,17 +177,40 @@ static string todayISO(){
     return oss.str();
 }
 
-static optional<sys_days> parseISODate(const string& s){
-    std::regex re("^(\\d{4})-(\\d{2})-(\\d{2})$");
-    std::smatch m;
-    if(!std::regex_match(s,m,re)) return nullopt;
-    int y=stoi(m[1]), mo=stoi(m[2]), d=stoi(m[3]);
+static inline string_view trimView(string_view s){
+    size_t a=0,b=s.size(); while(a<b && isspace((unsigned char)s[a])) ++a; while(b>a && isspace((unsigned char)s[b-1])) --b; return s.substr(a,b-a);
+}
+
+// Length of the well-formed UTF-8 sequence starting at s[i] (1 for ASCII), or 0 when the bytes
+// there are not one: a stray continuation byte, an overlong form, a surrogate, a code point past
+// U+10FFFF or a truncated tail. Encoders replace such bytes with kReplacementChar one at a time.
+static constexpr string_view kReplacementChar = "\xEF\xBF\xBD"; // U+FFFD
+static size_t utf8SeqLen(string_view s, size_t i){
+    auto b = [&](size_t k){ return (unsigned char)s[i+k]; };
+    unsigned char c = b(0);
+    if(c<0x80) return 1;
+    size_t n; unsigned char lo = 0x80, hi = 0xBF;
+    if(c>=0xC2 && c<=0xDF) n = 2;
+    else if(c>=0xE0 && c<=0xEF){ n = 3; if(c==0xE0) lo = 0xA0; else if(c==0xED) hi = 0x9F; }
+    else if(c>=0xF0 && c<=0xF4){ n = 4; if(c==0xF0) lo = 0x90; else if(c==0xF4) hi = 0x8F; }
+    else return 0;
+    if(i+n > s.size() || b(1)<lo || b(1)>hi) return 0;
+    for(size_t k=2;k<n;++k) if(b(k)<0x80 || b(k)>0xBF) return 0;
+    return n;
+}
+
+// YYYY-MM-DD, validated as a real calendar date. Hand-rolled because it runs once per inbox row.
+static optional<sys_days> parseISODate(string_view s){
+    if(s.size()!=10 || s[4]!='-' || s[7]!='-') return nullopt;
+    static const int POS[8] = {0,1,2,3,5,6,8,9};
+    int v[8];
+    for(int i=0;i<8;++i){ char c = s[size_t(POS[i])]; if(c<'0'||c>'9') return nullopt; v[i] = c-'0'; }
+    int y = v[0]*1000+v[1]*100+v[2]*10+v[3], mo = v[4]*10+v[5], d = v[6]*10+v[7];
     using namespace std::chrono;
     if(mo<1||mo>12||d<1||d>31) return nullopt;
-    sys_days z = sys_days{ year{y}/month{static_cast<unsigned>(mo)}/day{static_cast<unsigned>(d)} };
-    year_month_day ymd(z);
-    if(int(ymd.year())!=y || unsigned(ymd.month())!=unsigned(mo) || unsigned(ymd.day())!=unsigned(d)) return nullopt;
-    return z;
+    year_month_day ymd{ year{y}, month{static_cast<unsigned>(mo)}, day{static_cast<unsigned>(d)} };
+    if(!ymd.ok()) return nullopt;
+    return sys_days{ymd};
 }
 
 struct ISOWeek { int year; int week; sys_days monday; sys_days sunday; };
@@ -129,15 +250,50 @@ static ISOWeek weekBounds(int y, int w){
 
 static string fmtDate(sys_days z){
     std::chrono::year_month_day ymd(z);
-    std::ostringstream oss;
-    oss<< int(ymd.year()) <<"-"<< setw(2) << setfill('0') << unsigned(ymd.month()) <<"-"<< setw(2) << setfill('0') << unsigned(ymd.day());
-    return oss.str();
+    char buf[16]; snprintf(buf, sizeof(buf), "%04d-%02u-%02u", int(ymd.year()), unsigned(ymd.month()), unsigned(ymd.day()));
+    return buf;
 }
 
 static string fmtISOWeek(int y,int w){
     std::ostringstream oss; oss<<y<<"-W"<<setw(2)<<setfill('0')<<w; return oss.str();
 }
 
+static optional<pair<pair<int,int>,pair<int,int>>> parseISOWeekRangeStr(const string& s){
+    // YYYY-Www..YYYY-Www (inclusive)
+    size_t p = s.find("..");
+    if(p==string::npos) return nullopt;
+    auto a = parseISOWeekStr(s.substr(0,p)), b = parseISOWeekStr(s.substr(p+2));
+    if(!a || !b || *b < *a) return nullopt;
+    return {{*a,*b}};
+}
+
+// Day→week lookup over [lo,hi]: isoWeekFromDate runs once per week, not once per row.
+struct WeekLookup{
+    sys_days lo{}; vector<ISOWeek> weeks; vector<int> weekOfDay; // weekOfDay[d-lo] indexes weeks
+    WeekLookup(sys_days a, sys_days b): lo(a){
+        long n = (b - a).count() + 1; if(n<=0) return;
+        weekOfDay.resize(size_t(n));
+        for(long i=0;i<n;++i){
+            sys_days d = a + days(i);
+            if(weeks.empty() || d > weeks.back().sunday) weeks.push_back(isoWeekFromDate(d));
+            weekOfDay[size_t(i)] = int(weeks.size()) - 1;
+        }
+    }
+    int indexOf(sys_days d) const { long i = (d - lo).count(); return (i<0 || i>=(long)weekOfDay.size())? -1 : weekOfDay[size_t(i)]; }
+};
+
+// ===== Thread pool =====
+// Runs fn(0..n-1) on up to hardware_concurrency workers pulling from a shared counter.
+static void parallelFor(size_t n, const function<void(size_t)>& fn){
+    unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+    size_t nth = std::min<size_t>(hw, n);
+    if(nth<=1){ for(size_t i=0;i<n;++i) fn(i); return; }
+    std::atomic<size_t> next{0};
+    vector<std::thread> pool; pool.reserve(nth);
+    for(size_t t=0;t<nth;++t) pool.emplace_back([&]{ for(size_t i; (i = next.fetch_add(1)) < n; ) fn(i); });
+    for(auto& th: pool) th.join();
+}
+
 // ===== Record model =====
 struct Rec{
     sys_days date; string kind; string url; string title; string tags; // 5 columns
@@ -150,21 +306,279 @@ static vector<string> splitTabs(const string& line){
     return out;
 }
 
-static string joinTabs(const vector<string>& cols){
-    string s;
-    for(size_t i=0;i<cols.size();++i){ if(i) s.push_back('\t'); s += cols[i]; }
-    return s;
-}
-
 static bool fileExists(const fs::path& p){ std::error_code ec; return fs::exists(p,ec); }
 
+// FNV-1a 64; field() appends a unit separator so adjacent fields can't alias.
+struct Fnv64{
+    uint64_t h = 14695981039346656037ull;
+    Fnv64& add(string_view s){ for(unsigned char c: s){ h ^= c; h *= 1099511628211ull; } return *this; }
+    Fnv64& field(string_view s){ add(s); return add(string_view("\x1f",1)); }
+};
+
+static string hex64(uint64_t v){ char buf[17]; snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)v); return buf; }
+
+// Hash of the 4 KiB before `bytes`: cheap evidence that an indexed prefix was not rewritten.
+static string tailStamp(string_view data, uint64_t bytes){
+    uint64_t from = bytes > 4096? bytes - 4096 : 0;
+    return hex64(Fnv64().add(data.substr(size_t(from), size_t(bytes - from))).h);
+}
+
 // ===== Paths =====
-static fs::path curateHome(){ string h = getenvOr("CURATE_HOME", string(".")); return fs::path(h); }
+// CURATE_HOME may list several homes (see Federated homes): paths resolve against the first one,
+// or against the home a federated reader thread is currently working on.
+#ifdef _WIN32
+static constexpr char kHomeSep = ';';
+#else
+static constexpr char kHomeSep = ':';
+#endif
+static fs::path& threadHome(){ thread_local fs::path h; return h; }
+static fs::path curateHome(){
+    if(!threadHome().empty()) return threadHome();
+    string h = getenvOr("CURATE_HOME", string("."));
+    h.resize(std::min(h.size(), h.find(kHomeSep)));
+    return fs::path(h.empty()? "." : h);
+}
 static fs::path inboxPath(){ return curateHome()/ "inbox.tsv"; }
 static fs::path templatesDir(){ return curateHome()/ "templates"; }
 static fs::path headerPath(){ return templatesDir()/ "header.md"; }
 static fs::path digestsDir(){ return curateHome()/ "digests"; }
 
+// ===== Raw file descriptors =====
+// Thin portability layer so atomic writes go through one read/write/fsync/rename path.
+#ifdef _WIN32
+static int fdOpenRead(const fs::path& p){ return _wopen(p.c_str(), _O_RDONLY|_O_BINARY); }
+static int fdOpenAppend(const fs::path& p){ return _wopen(p.c_str(), _O_WRONLY|_O_CREAT|_O_APPEND|_O_BINARY, _S_IREAD|_S_IWRITE); }
+static int fdCreateExcl(const fs::path& p){ return _wopen(p.c_str(), _O_WRONLY|_O_CREAT|_O_EXCL|_O_BINARY, _S_IREAD|_S_IWRITE); }
+static int fdOpenWrite(const fs::path& p){ return _wopen(p.c_str(), _O_WRONLY|_O_CREAT|_O_TRUNC|_O_BINARY, _S_IREAD|_S_IWRITE); }
+static long fdRead(int fd, char* b, size_t n){ return _read(fd, b, (unsigned)n); }
+static long fdWrite(int fd, const char* b, size_t n){ return _write(fd, b, (unsigned)n); }
+static bool fdSync(int fd){ return _commit(fd)==0; }
+static void fdClose(int fd){ _close(fd); }
+static bool syncDir(const fs::path&){ return true; }
+static void fdCopyOwner(const fs::path&, int){}
+static long processId(){ return _getpid(); }
+#else
+static int fdOpenRead(const fs::path& p){ return ::open(p.c_str(), O_RDONLY|O_CLOEXEC); }
+static int fdOpenAppend(const fs::path& p){ return ::open(p.c_str(), O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0666); }
+static int fdCreateExcl(const fs::path& p){ return ::open(p.c_str(), O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0666); }
+static int fdOpenWrite(const fs::path& p){ return ::open(p.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666); }
+static long fdRead(int fd, char* b, size_t n){ for(;;){ ssize_t r = ::read(fd, b, n); if(r<0 && errno==EINTR) continue; return long(r); } }
+static long fdWrite(int fd, const char* b, size_t n){ for(;;){ ssize_t r = ::write(fd, b, n); if(r<0 && errno==EINTR) continue; return long(r); } }
+static bool fdSync(int fd){ return ::fsync(fd)==0; }
+static void fdClose(int fd){ ::close(fd); }
+static bool syncDir(const fs::path& d){ int fd = ::open(d.empty()? "." : d.c_str(), O_RDONLY|O_CLOEXEC); if(fd<0) return false; bool ok = ::fsync(fd)==0; ::close(fd); return ok; }
+// Gives fd the owner (where permitted) and permission bits of the file at `from`, if it exists.
+static void fdCopyOwner(const fs::path& from, int fd){
+    struct stat st;
+    if(::stat(from.c_str(), &st)!=0) return;
+    if(::fchown(fd, st.st_uid, st.st_gid)!=0){} // only root may give a file away; keep ours then
+    ::fchmod(fd, st.st_mode & 07777);
+}
+static long processId(){ return long(::getpid()); }
+#endif
+
+static bool fdWriteAll(int fd, const char* b, size_t n){
+    while(n){ long w = fdWrite(fd, b, n); if(w<=0) return false; b += w; n -= size_t(w); }
+    return true;
+}
+
+static size_t fdReadFull(int fd, char* b, size_t n){
+    size_t got = 0;
+    while(got<n){ long r = fdRead(fd, b+got, n-got); if(r<=0) break; got += size_t(r); }
+    return got;
+}
+
+// Destination for streamed output (an AtomicFile, stdout, a socket, ...).
+using ByteSink = function<void(string_view)>;
+
+// ===== Atomic file output =====
+// CURATE_FSYNC: never | file (default; fsync the temp file before rename) | full (also fsync the directory)
+enum class FsyncPolicy { never, file, full };
+
+static FsyncPolicy fsyncPolicy(){
+    static const FsyncPolicy P = []{
+        string v = toLower(getenvOr("CURATE_FSYNC", "file"));
+        if(v=="never"||v=="0"||v=="off") return FsyncPolicy::never;
+        if(v=="full"||v=="always") return FsyncPolicy::full;
+        return FsyncPolicy::file;
+    }();
+    return P;
+}
+
+// Replaces `target` atomically: bytes go through a reusable per-thread buffer (a private one while
+// another AtomicFile on the thread holds it) into a temp file in the same directory, which is
+// renamed over the target on commit(). While the output still matches the existing file
+// byte-for-byte nothing is written at all, so identical output leaves the old file (and its
+// mtime) untouched. A symlinked target is resolved first, so the link survives and its file is
+// replaced; the replacement keeps the old file's mode and, where permitted, owner. Anything that
+// is not a regular file (a FIFO, a terminal, /dev/stdout) is written straight through instead.
+class AtomicFile{
+public:
+    explicit AtomicFile(fs::path target): target_(std::move(target)), borrowed_(!threadBufferBusy()), buf_(borrowed_? threadBuffer() : own_){
+        if(borrowed_) threadBufferBusy() = true;
+        buf_.clear();
+        std::error_code ec;
+        auto st = fs::status(target_, ec);
+        string lex = target_.lexically_normal().generic_string();
+        if(lex.rfind("/dev/", 0)==0 || lex.rfind("/proc/", 0)==0 || (!ec && fs::exists(st) && !fs::is_regular_file(st))){
+            direct_ = true;
+            tmpFd_ = fdOpenWrite(target_);
+            if(tmpFd_<0) fail("cannot open " + target_.string() + ": " + strerror(errno));
+            return;
+        }
+        fs::path real = fs::weakly_canonical(target_, ec);
+        if(!ec && !real.empty()) target_ = std::move(real);
+        oldFd_ = fdOpenRead(target_);
+        same_ = oldFd_>=0;
+    }
+    AtomicFile(const AtomicFile&) = delete;
+    AtomicFile& operator=(const AtomicFile&) = delete;
+    ~AtomicFile(){ abort(); if(borrowed_) threadBufferBusy() = false; }
+
+    void write(string_view s){
+        if(failed_) return;
+        while(!s.empty()){
+            size_t room = kBufSize - buf_.size(), n = std::min(room, s.size());
+            buf_.append(s.data(), n); s.remove_prefix(n);
+            if(buf_.size()==kBufSize) flush();
+        }
+    }
+
+    // Returns false (see error()) if anything failed; the target is then left as it was.
+    bool commit(){
+        flush();
+        if(failed_){ abort(); return false; }
+        if(direct_){ fdClose(tmpFd_); tmpFd_ = -1; return true; }
+        if(same_){
+            char c; bool oldHasMore = fdRead(oldFd_, &c, 1) > 0;
+            if(!oldHasMore){ unchanged_ = true; closeOld(); return true; }
+            if(!diverge()){ abort(); return false; } // new content is a strict prefix of the old
+        }
+        if(tmpFd_<0 && !openTemp()){ abort(); return false; }
+        closeOld();
+        FsyncPolicy pol = fsyncPolicy();
+        if(pol!=FsyncPolicy::never && !fdSync(tmpFd_)){ fail("fsync failed"); abort(); return false; }
+        fdClose(tmpFd_); tmpFd_ = -1;
+        std::error_code ec; fs::rename(tmp_, target_, ec);
+        if(ec){ fail(ec.message()); abort(); return false; }
+        tmp_.clear();
+        if(pol==FsyncPolicy::full) syncDir(target_.parent_path());
+        return true;
+    }
+
+    bool unchanged() const { return unchanged_; }
+    const string& error() const { return err_; }
+
+private:
+    static constexpr size_t kBufSize = size_t(1) << 20;
+    static string& threadBuffer(){ thread_local string b; if(b.capacity()<kBufSize) b.reserve(kBufSize); return b; }
+    static bool& threadBufferBusy(){ thread_local bool busy = false; return busy; }
+
+    void fail(const string& why){ if(!failed_){ failed_ = true; err_ = why; } }
+    void closeOld(){ if(oldFd_>=0){ fdClose(oldFd_); oldFd_ = -1; } }
+
+    void abort(){
+        closeOld();
+        if(tmpFd_>=0){ fdClose(tmpFd_); tmpFd_ = -1; }
+        if(!tmp_.empty()){ std::error_code ec; fs::remove(tmp_, ec); tmp_.clear(); }
+    }
+
+    bool openTemp(){
+        fs::path dir = target_.parent_path();
+        std::error_code ec; if(!dir.empty()) fs::create_directories(dir, ec);
+        static std::atomic<unsigned> seq{0};
+        for(int attempt=0; attempt<100; ++attempt){
+            fs::path p = dir / ("." + target_.filename().string() + ".tmp-" + to_string(processId()) + "-" + to_string(seq.fetch_add(1)));
+            int fd = fdCreateExcl(p);
+            if(fd>=0){ fdCopyOwner(target_, fd); tmpFd_ = fd; tmp_ = p; return true; }
+            if(errno!=EEXIST) break;
+        }
+        fail(string("cannot create temp file next to ") + target_.string() + ": " + strerror(errno));
+        return false;
+    }
+
+    // First difference from the old file: start the temp file with the prefix that matched so far.
+    bool diverge(){
+        same_ = false;
+        if(!openTemp()) return false;
+        int src = fdOpenRead(target_);
+        if(src<0){ fail("cannot reread " + target_.string()); return false; }
+        string chunk(std::min<uint64_t>(matched_, kBufSize), '\0');
+        uint64_t left = matched_;
+        while(left){
+            size_t n = fdReadFull(src, chunk.data(), size_t(std::min<uint64_t>(left, chunk.size())));
+            if(n==0 || !fdWriteAll(tmpFd_, chunk.data(), n)){ fdClose(src); fail("copy failed"); return false; }
+            left -= n;
+        }
+        fdClose(src);
+        return true;
+    }
+
+    void flush(){
+        if(buf_.empty() || failed_) return;
+        if(same_){
+            cmp_.resize(buf_.size());
+            size_t got = fdReadFull(oldFd_, cmp_.data(), buf_.size());
+            if(got==buf_.size() && memcmp(cmp_.data(), buf_.data(), got)==0){ matched_ += got; buf_.clear(); return; }
+            if(!diverge()) return;
+        }
+        if(tmpFd_<0 && !openTemp()) return;
+        if(!fdWriteAll(tmpFd_, buf_.data(), buf_.size())) fail(string("write failed: ") + strerror(errno));
+        buf_.clear();
+    }
+
+    fs::path target_, tmp_;
+    bool borrowed_;
+    string own_;
+    string& buf_;
+    string cmp_, err_;
+    int oldFd_ = -1, tmpFd_ = -1;
+    uint64_t matched_ = 0;
+    bool same_ = false, unchanged_ = false, failed_ = false, direct_ = false;
+};
+
+// ===== Memory-mapped input =====
+// Read-only view of a whole file: mmap on POSIX, a plain read into memory elsewhere.
+class MappedFile{
+public:
+    explicit MappedFile(const fs::path& p){
+#ifdef _WIN32
+        int fd = fdOpenRead(p); if(fd<0) return;
+        char buf[1<<16]; long n;
+        while((n = fdRead(fd, buf, sizeof(buf))) > 0) fallback_.append(buf, size_t(n));
+        fdClose(fd);
+        data_ = fallback_.data(); size_ = fallback_.size(); ok_ = n==0;
+#else
+        int fd = fdOpenRead(p); if(fd<0) return;
+        struct stat st{};
+        if(::fstat(fd, &st)==0){
+            size_ = size_t(st.st_size);
+            if(size_==0) ok_ = true;
+            else {
+                void* m = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(m!=MAP_FAILED){ data_ = static_cast<const char*>(m); mapped_ = true; ok_ = true; ::madvise(m, size_, MADV_SEQUENTIAL); }
+            }
+        }
+        ::close(fd);
+#endif
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile(){
+#ifndef _WIN32
+        if(mapped_) ::munmap(const_cast<char*>(data_), size_);
+#endif
+    }
+    bool ok() const { return ok_; }
+    string_view view() const { return ok_? string_view(data_? data_ : "", size_) : string_view(); }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool ok_ = false, mapped_ = false;
+    string fallback_;
+};
+
 // ===== rules.tsv support =====
 static fs::path rulesPath(){ return curateHome() / "rules.tsv"; }
 
@@ -231,48 +645,364 @@ static fs::path defaultDigestPath(const string& rangeLabel, bool html){
 }
 
 // ===== Inbox IO =====
-static vector<Rec> loadInbox(){
-    vector<Rec> v;
-    if(!fileExists(inboxPath())) return v;
-    ifstream in(inboxPath());
-    string line;
-    while(getline(in,line)){
-        if(trim(line).empty()) continue;
-        auto cols = splitTabs(line);
-        string sdate = cols.size()>0? cols[0]: todayISO();
-        auto dopt = parseISODate(trim(sdate)); if(!dopt) continue; // skip bad row silently
-        string kind = cols.size()>1? cols[1]: "link";
-        string url  = cols.size()>2? cols[2]: "";
-        string title= cols.size()>3? cols[3]: "";
-        string tags = cols.size()>4? cols[4]: "";
-        v.push_back(Rec{*dopt, kind, url, title, tags});
+static fs::path archiveDir(){ return curateHome()/ "archive"; }
+
+// Archive segments written by clear-inbox, oldest first (names embed a sortable timestamp).
+static vector<fs::path> archiveFiles(){
+    vector<fs::path> v; std::error_code ec;
+    for(const auto& e: fs::directory_iterator(archiveDir(), ec)){
+        if(e.is_regular_file(ec) && e.path().extension()==".tsv") v.push_back(e.path());
     }
+    sort(v.begin(), v.end());
     return v;
 }
 
-static bool appendInbox(const Rec& r){
-    fs::create_directories(curateHome());
-    ofstream out(inboxPath(), ios::app);
-    if(!out) return false;
-    vector<string> cols = { fmtDate(r.date), r.kind, r.url, r.title, r.tags };
-    out<< joinTabs(cols) <<"\n";
+// config.tsv holds per-home settings as `key<TAB>value` lines ('#' starts a comment). With
+// `layout<TAB>sharded` the live inbox is one file per month of row dates, inbox/YYYY-MM.tsv,
+// instead of a single inbox.tsv: a ranged read opens only the months it covers, and rotating or
+// rewriting touches only the shards involved. `curate migrate` converts a home either way.
+static fs::path configPath(){ return curateHome()/ "config.tsv"; }
+static fs::path shardsDir(){ return curateHome()/ "inbox"; }
+
+static map<string,string> loadConfig(){
+    map<string,string> m;
+    ifstream in(configPath()); string line;
+    while(getline(in, line)){
+        string_view l = trimView(line);
+        size_t tab = l.find('\t');
+        if(l.empty() || l[0]=='#' || tab==string_view::npos) continue;
+        m[string(trimView(l.substr(0, tab)))] = string(trimView(l.substr(tab+1)));
+    }
+    return m;
+}
+
+// The layout is read from config.tsv once per home; saveConfig forgets it, as do the long-running
+// servers when they see config.tsv change.
+static std::mutex& layoutMutex(){ static std::mutex m; return m; }
+static map<string,bool>& layoutCache(){ static map<string,bool> c; return c; }
+static void forgetLayout(){ std::lock_guard<std::mutex> g(layoutMutex()); layoutCache().erase(curateHome().string()); }
+
+static bool saveConfig(const map<string,string>& m){
+    AtomicFile o(configPath());
+    for(const auto& [k,v]: m){ o.write(k); o.write("\t"); o.write(v); o.write("\n"); }
+    bool ok = o.commit();
+    forgetLayout();
+    return ok;
+}
+
+static bool shardedInbox(){
+    string home = curateHome().string();
+    {
+        std::lock_guard<std::mutex> g(layoutMutex());
+        if(auto it = layoutCache().find(home); it!=layoutCache().end()) return it->second;
+    }
+    auto m = loadConfig(); auto it = m.find("layout");
+    bool sharded = it!=m.end() && it->second=="sharded";
+    std::lock_guard<std::mutex> g(layoutMutex());
+    layoutCache()[home] = sharded;
+    return sharded;
+}
+
+// First and last day of the month a shard file is named after; nullopt for any other file.
+static optional<pair<sys_days,sys_days>> shardMonth(const fs::path& p){
+    string n = p.filename().string();
+    if(n.size()!=11 || n.substr(7)!=".tsv") return nullopt;
+    auto first = parseISODate(n.substr(0, 7) + "-01");
+    if(!first) return nullopt;
+    std::chrono::year_month_day ymd(*first);
+    return pair{*first, sys_days{ymd.year()/ymd.month()/std::chrono::last}};
+}
+
+// The live inbox files whose rows may fall in [lo, hi]: inbox.tsv, or the month shards
+// overlapping the range, oldest first.
+static vector<fs::path> inboxFiles(sys_days lo = sys_days::min(), sys_days hi = sys_days::max()){
+    if(!shardedInbox()) return {inboxPath()};
+    vector<fs::path> v; std::error_code ec;
+    for(const auto& e: fs::directory_iterator(shardsDir(), ec)){
+        auto m = e.is_regular_file(ec)? shardMonth(e.path()) : nullopt;
+        if(m && m->second>=lo && m->first<=hi) v.push_back(e.path());
+    }
+    sort(v.begin(), v.end());
+    return v;
+}
+
+// One inbox row as views into the underlying buffer; valid only while that buffer lives.
+struct RecView{ sys_days date; string_view dateText, kind, url, title, tags; };
+
+// Same rules as the original getline parser: blank lines and rows with a bad date are skipped,
+// missing columns default (kind → "link"), columns past the fifth are ignored.
+static bool parseRecLine(string_view line, RecView& r){
+    if(trimView(line).empty()) return false;
+    string_view f[5]; size_t n = 0, start = 0;
+    for(size_t i=0;i<=line.size() && n<5;++i){
+        if(i==line.size() || line[i]=='\t'){ f[n++] = line.substr(start, i-start); start = i+1; }
+    }
+    r.dateText = trimView(f[0]);
+    auto d = parseISODate(r.dateText); if(!d) return false;
+    r.date  = *d;
+    r.kind  = n>1? f[1] : string_view("link");
+    r.url   = n>2? f[2] : string_view();
+    r.title = n>3? f[3] : string_view();
+    r.tags  = n>4? f[4] : string_view();
     return true;
 }
 
+// Calls fn(const RecView&) for each valid row in `data`; fn may return false to stop early.
+template<class F> static void forEachRecView(string_view data, F&& fn){
+    size_t pos = 0; RecView r;
+    while(pos < data.size()){
+        const void* nl = memchr(data.data()+pos, '\n', data.size()-pos);
+        size_t end = nl? size_t(static_cast<const char*>(nl) - data.data()) : data.size();
+        if(parseRecLine(data.substr(pos, end-pos), r)){
+            if constexpr (std::is_same_v<decltype(fn(r)), bool>){ if(!fn(r)) return; }
+            else fn(r);
+        }
+        pos = end + 1;
+    }
+}
+
+// The same rows from the last to the first: walks back from EOF, so stopping after a few rows
+// touches only the file's final pages whatever its size.
+template<class F> static void forEachRecViewBackward(string_view data, F&& fn){
+    size_t end = data.size(); RecView r;
+    while(end > 0){
+        size_t b = end;
+        if(data[b-1]=='\n') --end, --b;
+        while(b>0 && data[b-1]!='\n') --b;
+        if(parseRecLine(data.substr(b, end-b), r) && !fn(r)) return;
+        end = b;
+    }
+}
+
+static Rec toRec(const RecView& v){ return Rec{v.date, string(v.kind), string(v.url), string(v.title), string(v.tags)}; }
+
+// Set by `curate serve` and `curate http`: each live inbox file (inbox.tsv, or every month shard)
+// stays parsed in memory, keyed by path, and only appended lines are parsed on the next load; any
+// other change to a file starts that file over.
+struct ResidentInbox{ uint64_t bytes = 0; string tail; vector<Rec> rows; };
+static unique_ptr<map<string,ResidentInbox>>& residentInbox(){ static unique_ptr<map<string,ResidentInbox>> r; return r; }
+
+// Brings `res` up to date with the inbox bytes `d`; a partial last line is left out.
+static void syncResidentInbox(ResidentInbox& res, string_view d){
+    if(res.bytes > d.size() || tailStamp(d, res.bytes)!=res.tail) res = ResidentInbox{};
+    size_t pos = size_t(res.bytes), end = d.size();
+    while(end>pos && d[end-1]!='\n') --end;
+    if(end > pos){
+        forEachRecView(d.substr(pos, end-pos), [&](const RecView& r){ res.rows.push_back(toRec(r)); });
+        res.bytes = end; res.tail = tailStamp(d, end);
+    }
+}
+
+static vector<Rec> loadInbox(){
+    auto& res = residentInbox();
+    vector<Rec> rows;
+    set<string> live;
+    for(const auto& p: inboxFiles()){
+        MappedFile f(p);
+        string_view d = f.view();
+        if(!res){ forEachRecView(d, [&](const RecView& r){ rows.push_back(toRec(r)); }); continue; }
+        ResidentInbox& r = (*res)[p.string()];
+        live.insert(p.string());
+        syncResidentInbox(r, d);
+        rows.insert(rows.end(), r.rows.begin(), r.rows.end());
+        forEachRecView(d.substr(size_t(r.bytes)), [&](const RecView& v){ rows.push_back(toRec(v)); });
+    }
+    if(res) std::erase_if(*res, [&](const auto& e){ return !live.count(e.first); }); // shards gone since
+    return rows;
+}
+
+// Writers serialize on $CURATE_HOME/.inbox.lock (advisory; readers never take it): appends hold
+// it per write, rewrites (clear-inbox, titles fill) from reading the inbox to renaming the new one
+// into place, so no append can land in a file that is about to be replaced.
+class InboxLock{
+public:
+    InboxLock(){
+        fs::path p = curateHome()/ ".inbox.lock";
+        std::error_code ec; fs::create_directories(curateHome(), ec);
+        fd_ = fdOpenAppend(p);
+        if(fd_<0) return;
+#ifdef _WIN32
+        while(_locking(fd_, _LK_LOCK, 1)!=0){} // _LK_LOCK gives up after ~10 s; keep waiting
+#else
+        while(::flock(fd_, LOCK_EX)!=0 && errno==EINTR){}
+#endif
+    }
+    InboxLock(const InboxLock&) = delete;
+    InboxLock& operator=(const InboxLock&) = delete;
+    ~InboxLock(){
+        if(fd_<0) return;
+#ifdef _WIN32
+        _lseek(fd_, 0, SEEK_SET); _locking(fd_, _LK_UNLCK, 1);
+#endif
+        fdClose(fd_); // releases the flock
+    }
+
+private:
+    int fd_ = -1;
+};
+
+// Pull-based reader over a file in fixed-size blocks: memory is one block (or the longest line),
+// however large the file.
+class LineReader{
+public:
+    explicit LineReader(const fs::path& p, size_t block = size_t(1) << 20): fd_(fdOpenRead(p)), block_(block){}
+    LineReader(const LineReader&) = delete;
+    LineReader& operator=(const LineReader&) = delete;
+    ~LineReader(){ if(fd_>=0) fdClose(fd_); }
+    bool ok() const { return fd_>=0; }
+
+    // The next line without its '\n' (valid until the next call); false at end of file.
+    // `nl` reports whether the line was terminated (only the last one may not be).
+    bool next(string_view& line, bool* nl = nullptr){
+        for(;;){
+            if(size_t e = buf_.find('\n', pos_); e!=string::npos){
+                line = string_view(buf_).substr(pos_, e-pos_); pos_ = e + 1;
+                if(nl) *nl = true;
+                return true;
+            }
+            if(eof_ || fd_<0){
+                if(pos_ >= buf_.size()) return false;
+                line = string_view(buf_).substr(pos_); pos_ = buf_.size();
+                if(nl) *nl = false;
+                return true;
+            }
+            buf_.erase(0, pos_); pos_ = 0;
+            size_t have = buf_.size();
+            buf_.resize(have + block_);
+            long n = fdRead(fd_, buf_.data() + have, block_);
+            buf_.resize(have + size_t(std::max(0L, n)));
+            if(n<=0) eof_ = true;
+        }
+    }
+
+private:
+    int fd_;
+    size_t block_, pos_ = 0;
+    string buf_;
+    bool eof_ = false;
+};
+
+// Batched appends: rows are formatted into one buffer and reach inbox.tsv with a single
+// O_APPEND write per batch, under the inbox lock (the file is reopened for each batch, so a
+// batch never goes to an inbox that clear-inbox has just replaced). TABs and newlines inside
+// fields become spaces so a row stays a row. With the sharded layout each row goes to the shard
+// of its month, one write per shard touched.
+class InboxAppender{
+public:
+    // batch: bytes buffered before a write; SIZE_MAX holds everything for one write at close().
+    // An empty path means the live inbox, whatever its layout.
+    explicit InboxAppender(fs::path p = {}, size_t batch = kBatch): path_(std::move(p)), batch_(batch){ buf_.reserve(std::min(batch_, kBatch) + 4096); }
+    InboxAppender(const InboxAppender&) = delete;
+    InboxAppender& operator=(const InboxAppender&) = delete;
+    ~InboxAppender(){ close(); }
+
+    void add(sys_days date, string_view kind, string_view url, string_view title, string_view tags){
+        buf_ += fmtDate(date);
+        for(string_view f: {kind, url, title, tags}){ buf_ += '\t'; appendField(f); }
+        buf_ += '\n'; ++rows_;
+        if(buf_.size() >= batch_) flush();
+    }
+    void add(const Rec& r){ add(r.date, r.kind, r.url, r.title, r.tags); }
+
+    bool flush(){
+        if(buf_.empty()) return ok_;
+        if(ok_){
+            InboxLock lock;
+            if(!path_.empty() || !shardedInbox()) ok_ = appendFile(path_.empty()? inboxPath() : path_, buf_);
+            else {
+                map<string,string> byMonth; // every line starts with its YYYY-MM-DD date
+                for(size_t pos = 0; pos < buf_.size(); ){
+                    size_t end = buf_.find('\n', pos) + 1;
+                    byMonth[buf_.substr(pos, 7)].append(buf_, pos, end-pos);
+                    pos = end;
+                }
+                for(const auto& [month, rows]: byMonth) ok_ = ok_ && appendFile(shardsDir()/ (month + ".tsv"), rows);
+            }
+        }
+        buf_.clear();
+        return ok_;
+    }
+    bool close(){ return flush(); }
+    size_t rows() const { return rows_; }
+
+private:
+    static constexpr size_t kBatch = size_t(1) << 20;
+    static bool appendFile(const fs::path& p, string_view data){
+        std::error_code ec; if(p.has_parent_path()) fs::create_directories(p.parent_path(), ec);
+        int fd = fdOpenAppend(p);
+        bool ok = fd>=0 && fdWriteAll(fd, data.data(), data.size());
+        if(fd>=0) fdClose(fd);
+        return ok;
+    }
+    void appendField(string_view f){
+        size_t run = 0;
+        for(size_t i=0;i<f.size();++i){
+            char c = f[i];
+            if(c!='\t' && c!='\n' && c!='\r') continue;
+            buf_.append(f.data()+run, i-run); buf_ += ' '; run = i+1;
+        }
+        buf_.append(f.data()+run, f.size()-run);
+    }
+    fs::path path_;
+    size_t batch_;
+    string buf_;
+    size_t rows_ = 0;
+    bool ok_ = true;
+};
+
+static bool appendInbox(const Rec& r){
+    InboxAppender out;
+    out.add(r);
+    return out.close();
+}
+
 // ===== Kind detection via rules.tsv =====
+// Compiled once per process; `curate serve` reloads them when rules.tsv changes.
+static std::vector<Rule>& kindRules(){ static std::vector<Rule> R = loadRules(); return R; }
+
 static string detectKind(const string& url){
-    static const std::vector<Rule> RULES = loadRules(); // loaded once per process
-    for(const auto& r : RULES){
+    for(const auto& r : kindRules()){
         if(std::regex_search(url, r.re)) return r.kind;
     }
     return "article";
 }
 
-static string urlDomain(const string& url){
-    std::regex re(R"((?:https?://)?([^/]+))", std::regex_constants::icase);
-    std::smatch m;
-    if(std::regex_search(url,m,re)) return m[1];
-    return url;
+// The first run of non-'/' characters after an optional http(s):// — what the old
+// (?:https?://)?([^/]+) regex matched — without building a regex per row.
+static string_view urlDomainView(string_view url){
+    auto scheme = [&](string_view s){ return url.size()>s.size() && url[s.size()]!='/' && iequalsAscii(url.substr(0, s.size()), s); };
+    size_t p = scheme("https://")? 8 : scheme("http://")? 7 : 0;
+    while(p<url.size() && url[p]=='/') ++p;
+    size_t e = url.find('/', p);
+    string_view host = url.substr(p, e==string_view::npos? string_view::npos : e-p);
+    return host.empty()? url : host;
+}
+static string urlDomain(const string& url){ return string(urlDomainView(url)); }
+
+// Host key for the domain index: lowercased, without userinfo, port or a leading "www.".
+static string urlHostKey(string_view url){
+    string_view h = urlDomainView(trimView(url));
+    if(size_t at = h.rfind('@'); at!=string_view::npos) h.remove_prefix(at+1);
+    if(size_t colon = h.find(':'); colon!=string_view::npos) h = h.substr(0, colon);
+    string k(h); for(char& c: k) c = (char)tolower((unsigned char)c);
+    if(k.rfind("www.", 0)==0 && k.size()>4) k.erase(0, 4);
+    return k;
+}
+
+// Registrable domain ("eTLD+1") with a short built-in list of two-label public suffixes;
+// IP addresses and single-label hosts are returned as they are.
+static string registrableDomain(const string& host){
+    static const set<string> SUFFIX2 = {"co.uk","org.uk","ac.uk","gov.uk","me.uk","com.au","net.au","org.au","edu.au","co.nz","co.jp","ne.jp","or.jp",
+                                        "com.br","com.cn","com.mx","co.in","co.za","com.tr","com.tw","com.hk","com.sg","co.kr","github.io","gitlab.io","blogspot.com"};
+    if(host.empty() || all_of(host.begin(), host.end(), [](char c){ return isdigit((unsigned char)c) || c=='.'; })) return host;
+    size_t last = host.rfind('.'); if(last==string::npos || last==0) return host;
+    size_t second = host.rfind('.', last-1);
+    if(second==string::npos) return host;
+    if(SUFFIX2.count(host.substr(second+1))){
+        size_t third = second? host.rfind('.', second-1) : string::npos;
+        return third==string::npos? host : host.substr(third+1);
+    }
+    return host.substr(second+1);
 }
 
 // ===== Tag normalization (display) =====
@@ -290,335 +1020,6254 @@ static string normalizeTagDisplayOne(string t){
     return string(hadHash?"#":"") + t;
 }
 
-static vector<string> splitTags(const string& s){
-    vector<string> out; string cur; std::istringstream iss(s);
-    while(iss>>cur){ out.push_back(cur); }
+static vector<string> splitTags(string_view s){
+    vector<string> out; size_t i=0, n=s.size();
+    while(i<n){
+        while(i<n && isspace((unsigned char)s[i])) ++i;
+        size_t b=i; while(i<n && !isspace((unsigned char)s[i])) ++i;
+        if(i>b) out.emplace_back(s.substr(b, i-b));
+    }
     return out;
 }
 
 static string normalizeTagsForStorage(const vector<string>& raw){
-    vector<string> cleaned; cleaned.reserve(raw.size()); set<string> seen;
+    vector<string> cleaned; cleaned.reserve(raw.size());
     for(auto t: raw){
         t=trim(t); if(t.empty()) continue;
-        if(t[0] != '#') t = string("#") + t;
-        if(!seen.count(t)){ cleaned.push_back(t); seen.insert(t); }
+        if(t[0] != '#') t.insert(t.begin(), '#');
+        if(std::find(cleaned.begin(), cleaned.end(), t)==cleaned.end()) cleaned.push_back(std::move(t));
     }
-    std::ostringstream oss;
-    for(size_t i=0;i<cleaned.size();++i){ if(i) oss<<' '; oss<<cleaned[i]; }
-    return oss.str();
-}
-
-// ===== Filtering =====
-static vector<Rec> filterByDateRange(const vector<Rec>& all, sys_days a, sys_days b){
-    vector<Rec> out; for(const auto& r: all){ if(r.date>=a && r.date<=b) out.push_back(r); }
-    sort(out.begin(), out.end(), [](const Rec& x, const Rec& y){ return x.date<y.date; });
+    string out;
+    for(size_t i=0;i<cleaned.size();++i){ if(i) out += ' '; out += cleaned[i]; }
     return out;
 }
 
-// ===== Rendering =====
-static string readFileOrEmpty(const fs::path& p){
-    if(!fileExists(p)) return "";
-    std::ifstream in(p); std::ostringstream ss; ss<< in.rdbuf(); return ss.str();
-}
+// ===== JSON export / import =====
+// Streaming encoder: escapes straight into one output buffer that is handed to `sink` in
+// ~1 MiB pieces; encoding a row allocates nothing.
+class JsonWriter{
+public:
+    explicit JsonWriter(ByteSink sink): sink_(sink){ buf_.reserve(kFlushAt + 4096); }
+    ~JsonWriter(){ flush(); }
 
-struct RenderOpts{ bool groupTags=false; bool tagsOnly=false; bool includeHeader=true; bool html=false; string headerText; string rangeLabel; };
+    void raw(string_view s){ buf_.append(s.data(), s.size()); }
 
-// New format (no date): - [domain](url) — *kind* — Title — #Tag1 #Tag2
-static string recLineMarkdown(const Rec& r){
-    string dom  = urlDomain(r.url);
-    string kind = r.kind;
-    string t    = trim(r.title);
-    std::ostringstream oss;
-    oss << "- [" << dom << "](" << r.url << ") — *" << kind << "*";
-    if(!t.empty()) oss << " — " << t;
-    vector<string> tags = splitTags(r.tags);
-    if(!tags.empty()){
-        oss << " — ";
-        for(size_t i=0;i<tags.size(); ++i){
-            if(i) oss << ' ';
-            oss << normalizeTagDisplayOne(tags[i]); // keeps leading #
+    void str(string_view s){
+        static const char HEX[] = "0123456789abcdef";
+        buf_ += '"';
+        size_t run = 0;
+        for(size_t i=0;i<s.size();++i){
+            unsigned char c = (unsigned char)s[i];
+            if(c>=0x80){
+                size_t n = utf8SeqLen(s, i);
+                if(n){ i += n-1; continue; }
+                buf_.append(s.data()+run, i-run); run = i+1;
+                buf_.append(kReplacementChar); // JSON text must be valid UTF-8
+                continue;
+            }
+            if(c>=0x20 && c!='"' && c!='\\') continue;
+            buf_.append(s.data()+run, i-run); run = i+1;
+            switch(c){
+                case '"':  buf_ += "\\\""; break;
+                case '\\': buf_ += "\\\\"; break;
+                case '\n': buf_ += "\\n"; break;
+                case '\r': buf_ += "\\r"; break;
+                case '\t': buf_ += "\\t"; break;
+                case '\b': buf_ += "\\b"; break;
+                case '\f': buf_ += "\\f"; break;
+                default: buf_ += "\\u00"; buf_ += HEX[c>>4]; buf_ += HEX[c&15];
+            }
         }
+        buf_.append(s.data()+run, s.size()-run);
+        buf_ += '"';
     }
-    return oss.str();
-}
 
-static string renderGroupedByTagsMarkdown(const vector<Rec>& rows){
-    map<string, vector<const Rec*>> byTag;
-    for(const auto& r: rows){
-        for(auto &t: splitTags(r.tags)){
-            string disp = normalizeTagDisplayOne(t);
-            if(!disp.empty()) byTag[disp].push_back(&r);
+    // {"date":"…","kind":"…","url":"…","title":"…","tags":["#a","#b"]}
+    void record(const RecView& r){
+        raw("{\"date\":"); str(r.dateText);
+        raw(",\"kind\":"); str(r.kind);
+        raw(",\"url\":"); str(r.url);
+        raw(",\"title\":"); str(r.title);
+        raw(",\"tags\":[");
+        bool first = true; size_t i = 0, n = r.tags.size();
+        while(i<n){
+            while(i<n && isspace((unsigned char)r.tags[i])) ++i;
+            size_t b = i; while(i<n && !isspace((unsigned char)r.tags[i])) ++i;
+            if(i>b){ if(!first) buf_ += ','; str(r.tags.substr(b, i-b)); first = false; }
         }
+        raw("]}");
+        if(buf_.size() >= kFlushAt) flush();
     }
-    std::ostringstream out; out<<"## By Tag\n\n";
-    for(const auto& [tag, list]: byTag){
-        out<<"### "<<tag<<"\n";
-        for(const auto* pr: list){ out<< recLineMarkdown(*pr) <<"\n"; }
-        out<<"\n";
-    }
-    if(byTag.empty()) out<<"(No tags in range)\n";
-    return out.str();
-}
-
-static string mdToHtml(const string& md){
-    std::istringstream in(md);
-    std::ostringstream out;
-    out << "<!doctype html><html><meta charset=\"utf-8\"><meta name=\"viewport\" content=\"width=device-width,initial-scale=1\"><title>Digest</title><style>body{max-width:820px;margin:2rem auto;padding:0 1rem;font:16px/1.5 system-ui,Segoe UI,Roboto,Helvetica,Arial,sans-serif}code,pre{font:13px ui-monospace,Consolas,Menlo,monospace}h1,h2,h3{line-height:1.2}ul{padding-left:1.2rem}</style><body>";
-    string line; bool inList=false;
-    auto flushList=[&](){ if(inList){ out<<"</ul>"; inList=false; } };
-    auto convert=[&](string x){
-        x = std::regex_replace(
-                x,
-                std::regex(R"(\[([^\]]+)\]\(([^)]+)\))"),
-                string(R"(<a href="$2" target="_blank">$1</a>)"));
-        x = std::regex_replace(x, std::regex(R"(\*([^*]+)\*)"), string("<em>$1</em>"));
-        return x;
-    };
-    while(getline(in,line)){
-        string s = trim(line);
-        if(s.rfind("# ",0)==0){ flushList(); out<<"<h1>"<< s.substr(2) <<"</h1>"; continue; }
-        if(s.rfind("## ",0)==0){ flushList(); out<<"<h2>"<< s.substr(3) <<"</h2>"; continue; }
-        if(s.rfind("### ",0)==0){ flushList(); out<<"<h3>"<< s.substr(4) <<"</h3>"; continue; }
-        if(s.rfind("- ",0)==0){
-            if(!inList){ out<<"<ul>"; inList=true; }
-            string item = convert(s.substr(2));
-            out<<"<li>"<< item <<"</li>";
-            continue;
+
+    void flush(){ if(!buf_.empty()){ sink_(buf_); buf_.clear(); } }
+
+private:
+    static constexpr size_t kFlushAt = size_t(1) << 20;
+    ByteSink sink_;
+    string buf_;
+};
+
+// Zero-copy JSON tokenizer for one NDJSON line: strings without escapes come back as views into
+// the input; escaped ones are decoded into caller-owned scratch buffers reused across rows.
+class JsonCursor{
+public:
+    explicit JsonCursor(string_view s): s_(s){}
+    void ws(){ while(i_<s_.size() && (s_[i_]==' '||s_[i_]=='\t'||s_[i_]=='\r'||s_[i_]=='\n')) ++i_; }
+    bool eat(char c){ ws(); if(i_<s_.size() && s_[i_]==c){ ++i_; return true; } return false; }
+    bool peek(char c){ ws(); return i_<s_.size() && s_[i_]==c; }
+    bool atEnd(){ ws(); return i_>=s_.size(); }
+
+    bool str(string_view& out, string& scratch){
+        if(!eat('"')) return false;
+        size_t b = i_;
+        while(i_<s_.size() && s_[i_]!='"' && s_[i_]!='\\') ++i_;
+        if(i_>=s_.size()) return false;
+        if(s_[i_]=='"'){ out = s_.substr(b, i_-b); ++i_; return true; }
+        scratch.assign(s_.data()+b, i_-b);
+        while(i_<s_.size()){
+            char c = s_[i_++];
+            if(c=='"'){ out = scratch; return true; }
+            if(c!='\\'){ scratch += c; continue; }
+            if(i_>=s_.size()) return false;
+            char e = s_[i_++];
+            switch(e){
+                case '"': case '\\': case '/': scratch += e; break;
+                case 'n': scratch += '\n'; break; case 't': scratch += '\t'; break; case 'r': scratch += '\r'; break;
+                case 'b': scratch += '\b'; break; case 'f': scratch += '\f'; break;
+                case 'u': {
+                    // A surrogate that is not half of a valid pair becomes U+FFFD; the escape after a
+                    // lone high surrogate is then decoded on its own.
+                    uint32_t cp; if(!hex4(cp)) return false;
+                    if(cp>=0xDC00 && cp<0xE000) cp = 0xFFFD;
+                    else if(cp>=0xD800 && cp<0xDC00){
+                        size_t at = i_; uint32_t lo = 0;
+                        if(i_+1<s_.size() && s_[i_]=='\\' && s_[i_+1]=='u'){ i_+=2; if(!hex4(lo)) return false; }
+                        if(lo>=0xDC00 && lo<0xE000) cp = 0x10000 + ((cp-0xD800)<<10) + (lo-0xDC00);
+                        else { cp = 0xFFFD; i_ = at; }
+                    }
+                    utf8(cp, scratch); break;
+                }
+                default: return false;
+            }
         }
-        if(s.empty()){ flushList(); out<<"<p></p>"; continue; }
-        flushList(); out<<"<p>"<< convert(s) <<"</p>";
+        return false;
     }
-    flushList(); out << "</body></html>";
-    return out.str();
-}
 
-// ===== CLI parsing =====
-struct Args{
-    string cmd; // add,digest,clear-inbox,list,help
-    // add
-    string url; vector<string> addTags; string addTitle; optional<string> addDateISO;
-    // digest
-    bool groupTags=false, tagsOnly=false, pd=false, noHeader=false; optional<pair<int,int>> week; optional<sys_days> start, end; string outPath;
-    // clear
-    string archiveDir;
-    // list
-    optional<int> limit; optional<sys_days> since, until;
+    bool skipValue(){
+        ws(); if(i_>=s_.size()) return false;
+        char c = s_[i_];
+        if(c=='"'){ string_view v; string tmp; return str(v, tmp); }
+        if(c=='{' || c=='['){
+            char close = c=='{'? '}' : ']'; ++i_;
+            if(eat(close)) return true;
+            for(;;){
+                if(c=='{'){ string_view k; string tmp; if(!str(k, tmp) || !eat(':')) return false; }
+                if(!skipValue()) return false;
+                if(eat(close)) return true;
+                if(!eat(',')) return false;
+            }
+        }
+        size_t b = i_;
+        while(i_<s_.size() && (isalnum((unsigned char)s_[i_]) || s_[i_]=='-' || s_[i_]=='+' || s_[i_]=='.')) ++i_;
+        return i_>b;
+    }
+
+private:
+    bool hex4(uint32_t& v){
+        if(i_+4>s_.size()) return false;
+        v = 0;
+        for(int k=0;k<4;++k){ char h = s_[i_++]; v <<= 4; if(h>='0'&&h<='9') v|=uint32_t(h-'0'); else if(h>='a'&&h<='f') v|=uint32_t(h-'a'+10); else if(h>='A'&&h<='F') v|=uint32_t(h-'A'+10); else return false; }
+        return true;
+    }
+    static void utf8(uint32_t cp, string& o){
+        if(cp<0x80) o += char(cp);
+        else if(cp<0x800){ o += char(0xC0|(cp>>6)); o += char(0x80|(cp&0x3F)); }
+        else if(cp<0x10000){ o += char(0xE0|(cp>>12)); o += char(0x80|((cp>>6)&0x3F)); o += char(0x80|(cp&0x3F)); }
+        else { o += char(0xF0|(cp>>18)); o += char(0x80|((cp>>12)&0x3F)); o += char(0x80|((cp>>6)&0x3F)); o += char(0x80|(cp&0x3F)); }
+    }
+    string_view s_;
+    size_t i_ = 0;
 };
 
-static void printHelp(){
-    cerr <<
-R"HELP(
-curate 
+// Fields of one imported row; views point into the input line or into the scratch buffers.
+struct ImportRow{ string_view date, kind, url, title; string tags; string sDate, sKind, sUrl, sTitle, sTag; };
 
-A plain‑text workflow for capturing links to `inbox.tsv`, tagging them, and rolling them into weekly (or custom range) digests.  
-No databases, no runtimes — just a tiny C++20 CLI, TSV, and Markdown/HTML.
+static bool parseNdjsonRow(string_view line, ImportRow& r){
+    JsonCursor c(line);
+    r.date = r.kind = r.url = r.title = string_view(); r.tags.clear();
+    if(!c.eat('{')) return false;
+    if(c.eat('}')) return true;
+    string_view key; string keyScratch;
+    for(;;){
+        if(!c.str(key, keyScratch) || !c.eat(':')) return false;
+        bool ok;
+        if(key=="date") ok = c.str(r.date, r.sDate);
+        else if(key=="kind" || key=="type") ok = c.str(r.kind, r.sKind);
+        else if(key=="url") ok = c.str(r.url, r.sUrl);
+        else if(key=="title") ok = c.peek('"')? c.str(r.title, r.sTitle) : c.skipValue();
+        else if(key=="tags"){
+            if(c.eat('[')){
+                ok = true;
+                if(!c.eat(']')){
+                    for(;;){
+                        string_view t; if(!c.str(t, r.sTag)){ ok = false; break; }
+                        if(!r.tags.empty()) r.tags += ' ';
+                        r.tags.append(t.data(), t.size());
+                        if(c.eat(']')) break;
+                        if(!c.eat(',')){ ok = false; break; }
+                    }
+                }
+            } else if(c.peek('"')){ string_view t; ok = c.str(t, r.sTag); r.tags.assign(t.data(), t.size()); }
+            else ok = c.skipValue();
+        }
+        else ok = c.skipValue();
+        if(!ok) return false;
+        if(c.eat('}')) return c.atEnd();
+        if(!c.eat(',')) return false;
+    }
+}
 
-Copyright (c) 2025 Norman Bauer - MIT License
+// ===== Bulk import (CSV / TSV / bookmarks HTML / NDJSON) =====
+// The input is cut into chunks on record boundaries, chunks are parsed and classified in parallel,
+// and the rows are appended in input order with a single buffered write.
+enum class ImportFormat { ndjson, csv, tsv, bookmarks };
 
-USAGE:
-  curate add <url> [tags...] [--title "..."] [--date YYYY-MM-DD]
-  curate digest [-gt|--group-tags] [--tags-only] [-pd]
-                [--week YYYY-Www | --start YYYY-MM-DD --end YYYY-MM-DD]
-                [--no-header] [-o <path>|-]
-  curate clear-inbox [--archive-dir <dir>]
-  curate list [--limit N] [--since YYYY-MM-DD] [--until YYYY-MM-DD]
-  curate help
+// Column positions for CSV/TSV; -1 = absent. Default is the inbox layout.
+struct ImportColumns{ int date=0, kind=1, url=2, title=3, tags=4; };
 
-ENV:
-  CURATE_HOME  Root folder for inbox.tsv, templates/, digests/, rules.tsv (default: .)
+struct ImportChunk{ vector<Rec> rows; vector<pair<size_t,string>> rejects; size_t lines=0; }; // rejects: (line in chunk, why)
 
-NOTES:
-  • Exactly 5 TAB-separated columns are written on `add`:
-      DATE\tKIND\tURL\tTITLE\tTAGS
-  • Kind detection is configured via rules.tsv (regex\tkind).
-  • ISO week handling uses Mon..Sun and the Jan 4 rule.
-  • -pd emits a self-contained HTML page (lightweight Pandoc-like output).
-)HELP";
+// Dates as found in the wild: YYYY-MM-DD, an ISO timestamp, compact YYYYMMDD, or Unix seconds
+// (bookmark ADD_DATE) or milliseconds. An epoch outside 1990..2100 is refused rather than stored
+// as some day in 1970.
+static optional<sys_days> importDate(string_view s){
+    s = trimView(s);
+    if(s.size()>=10){
+        auto d = parseISODate(s.substr(0,10));
+        if(d && (s.size()==10 || s[10]=='T' || s[10]==' ')) return d;
+    }
+    if(s.empty() || !all_of(s.begin(), s.end(), [](char c){ return c>='0' && c<='9'; })) return nullopt;
+    if(s.size()==8) return parseISODate(string(s.substr(0,4)) + "-" + string(s.substr(4,2)) + "-" + string(s.substr(6,2)));
+    if(s.size()!=9 && s.size()!=10 && s.size()!=13) return nullopt;
+    long long secs = stoll(string(s));
+    if(s.size()==13) secs /= 1000;
+    constexpr long long kMin = 631152000, kMax = 4102444800; // 1990-01-01, 2100-01-01
+    if(secs < kMin || secs >= kMax) return nullopt;
+    return sys_days{days{secs / 86400}};
 }
 
-static optional<Args> parseCLI(int argc, char** argv){
-    if(argc<2){ printHelp(); return nullopt; }
-    Args a; a.cmd = argv[1];
-    auto need = [&](int i){ if(i>=argc){ cerr<<"Missing value for "<<argv[i-1]<<"\n"; exit(2);} };
+static string decodeHtmlEntities(string_view s){
+    string o; o.reserve(s.size());
+    for(size_t i=0;i<s.size();++i){
+        if(s[i]!='&'){ o += s[i]; continue; }
+        size_t semi = s.find(';', i);
+        if(semi==string_view::npos || semi-i>10){ o += '&'; continue; }
+        string_view ent = s.substr(i+1, semi-i-1);
+        uint32_t cp = 0;
+        if(ent=="amp") cp='&'; else if(ent=="lt") cp='<'; else if(ent=="gt") cp='>'; else if(ent=="quot") cp='"'; else if(ent=="apos") cp='\''; else if(ent=="nbsp") cp=' ';
+        else if(ent=="mdash") cp=0x2014; else if(ent=="ndash") cp=0x2013; else if(ent=="hellip") cp=0x2026; else if(ent=="copy") cp=0xA9;
+        else if(ent=="lsquo") cp=0x2018; else if(ent=="rsquo") cp=0x2019; else if(ent=="ldquo") cp=0x201C; else if(ent=="rdquo") cp=0x201D;
+        else if(ent.size()>1 && ent[0]=='#'){
+            string num(ent.substr(1));
+            try{ cp = uint32_t(num[0]=='x'||num[0]=='X'? stoul(num.substr(1), nullptr, 16) : stoul(num)); }catch(...){ cp = 0; }
+        }
+        if(!cp){ o += '&'; continue; }
+        if(cp<0x80) o += char(cp);
+        else if(cp<0x800){ o += char(0xC0|(cp>>6)); o += char(0x80|(cp&0x3F)); }
+        else if(cp<0x10000){ o += char(0xE0|(cp>>12)); o += char(0x80|((cp>>6)&0x3F)); o += char(0x80|(cp&0x3F)); }
+        else { o += char(0xF0|(cp>>18)); o += char(0x80|((cp>>12)&0x3F)); o += char(0x80|((cp>>6)&0x3F)); o += char(0x80|(cp&0x3F)); }
+        i = semi;
+    }
+    return o;
+}
 
-    if(a.cmd=="add"){
-        if(argc<3){ cerr<<"add: require <url>\n"; exit(2);} a.url = argv[2];
+// One RFC 4180 record starting at pos (quoted fields may hold separators, "" and newlines).
+// Advances pos past the record terminator.
+static void nextCsvRecord(string_view d, size_t& pos, char sep, vector<string>& fields){
+    fields.clear(); string cur; bool inQ = false, wasQuoted = false;
+    while(pos < d.size()){
+        char c = d[pos++];
+        if(inQ){
+            if(c=='"'){ if(pos<d.size() && d[pos]=='"'){ cur += '"'; ++pos; } else inQ = false; }
+            else cur += c;
+            continue;
+        }
+        if(c=='"' && cur.empty() && !wasQuoted){ inQ = wasQuoted = true; continue; }
+        if(c==sep){ fields.push_back(std::move(cur)); cur.clear(); wasQuoted = false; continue; }
+        if(c=='\n') break;
+        if(c=='\r' && pos<d.size() && d[pos]=='\n'){ ++pos; break; }
+        cur += c;
+    }
+    fields.push_back(std::move(cur));
+}
+
+static void nextTsvRecord(string_view d, size_t& pos, vector<string>& fields){
+    const void* nl = memchr(d.data()+pos, '\n', d.size()-pos);
+    size_t end = nl? size_t(static_cast<const char*>(nl) - d.data()) : d.size();
+    string_view line = d.substr(pos, end-pos); pos = end + 1;
+    if(!line.empty() && line.back()=='\r') line.remove_suffix(1);
+    fields.clear(); size_t b = 0;
+    for(size_t i=0;i<=line.size();++i) if(i==line.size() || line[i]=='\t'){ fields.emplace_back(line.substr(b, i-b)); b = i+1; }
+}
+
+// A header row names its columns (date, kind/type, url/link/href, title/name, tags/labels);
+// anything else is data in the inbox column order.
+static optional<ImportColumns> headerColumns(const vector<string>& f){
+    ImportColumns c{-1,-1,-1,-1,-1};
+    for(size_t i=0;i<f.size();++i){
+        string k = toLower(trim(f[i]));
+        if(k=="date"||k=="added"||k=="created") c.date=int(i);
+        else if(k=="kind"||k=="type") c.kind=int(i);
+        else if(k=="url"||k=="link"||k=="href") c.url=int(i);
+        else if(k=="title"||k=="name") c.title=int(i);
+        else if(k=="tags"||k=="labels") c.tags=int(i);
+    }
+    if(c.url<0) return nullopt;
+    return c;
+}
+
+// Splits d[begin..] for parallel parsing: about four chunks per core (at least 1 MiB each),
+// each starting on a record boundary. csvQuotes tracks quote parity so a newline inside a
+// quoted CSV field never starts a chunk.
+static vector<size_t> chunkStarts(string_view d, size_t begin, bool csvQuotes){
+    unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+    size_t target = std::max<size_t>(size_t(1)<<20, (d.size()-begin) / (size_t(hw)*4) + 1);
+    vector<size_t> starts{begin};
+    bool inQ = false;
+    size_t next = begin + target;
+    if(csvQuotes){
+        for(size_t i=begin;i<d.size();++i){
+            char c = d[i];
+            if(c=='"') inQ = !inQ;
+            else if(c=='\n' && !inQ && i+1>=next && i+1<d.size()){ starts.push_back(i+1); next = i+1+target; }
+        }
+    } else {
+        while(next < d.size()){
+            const void* nl = memchr(d.data()+next, '\n', d.size()-next);
+            if(!nl) break;
+            size_t s0 = size_t(static_cast<const char*>(nl) - d.data()) + 1;
+            if(s0>=d.size()) break;
+            starts.push_back(s0); next = s0 + target;
+        }
+    }
+    return starts;
+}
+
+static void importFinishRow(ImportChunk& out, size_t line, sys_days today, string_view date, string_view kind, string_view url, string_view title, string_view tags){
+    string u(trimView(url));
+    if(u.empty()){ out.rejects.push_back({line, "no url"}); return; }
+    sys_days d = today;
+    if(!trimView(date).empty()){ auto p = importDate(date); if(!p){ out.rejects.push_back({line, "bad date"}); return; } d = *p; }
+    string k(trimView(kind));
+    if(k.empty()) k = detectKind(u);
+    string t(tags); for(char& c: t) if(c==',') c = ' ';
+    out.rows.push_back(Rec{d, std::move(k), std::move(u), string(trimView(title)), normalizeTagsForStorage(splitTags(t))});
+}
+
+static ImportChunk parseImportChunk(string_view d, ImportFormat f, const ImportColumns& cols, sys_days today){
+    ImportChunk out;
+    auto col = [](const vector<string>& v, int i){ return (i>=0 && size_t(i)<v.size())? string_view(v[size_t(i)]) : string_view(); };
+    if(f==ImportFormat::csv || f==ImportFormat::tsv){
+        vector<string> fields; size_t pos = 0;
+        while(pos < d.size()){
+            size_t startLine = out.lines + 1;
+            if(f==ImportFormat::csv){
+                size_t before = pos;
+                nextCsvRecord(d, pos, ',', fields);
+                out.lines += size_t(std::count(d.begin()+long(before), d.begin()+long(std::min(pos, d.size())), '\n'));
+                if(pos>=d.size() && (pos==before || d.back()!='\n')) ++out.lines;
+            } else { nextTsvRecord(d, pos, fields); ++out.lines; }
+            if(fields.size()==1 && trimView(fields[0]).empty()) continue;
+            importFinishRow(out, startLine, today, col(fields, cols.date), col(fields, cols.kind), col(fields, cols.url), col(fields, cols.title), col(fields, cols.tags));
+        }
+        return out;
+    }
+    if(f==ImportFormat::ndjson){
+        ImportRow row; size_t pos = 0;
+        while(pos < d.size()){
+            const void* nl = memchr(d.data()+pos, '\n', d.size()-pos);
+            size_t end = nl? size_t(static_cast<const char*>(nl) - d.data()) : d.size();
+            string_view line = d.substr(pos, end-pos); pos = end + 1; ++out.lines;
+            if(trimView(line).empty()) continue;
+            if(!parseNdjsonRow(line, row)){ out.rejects.push_back({out.lines, "malformed JSON"}); continue; }
+            importFinishRow(out, out.lines, today, row.date, row.kind, row.url, row.title, row.tags);
+        }
+        return out;
+    }
+    // Netscape bookmarks: <DT><A HREF="…" ADD_DATE="…" TAGS="a,b">Title</A>
+    auto attr = [](string_view tag, string_view name) -> string {
+        string lower = toLower(string(tag));
+        size_t p = 0;
+        while((p = lower.find(toLower(string(name)), p)) != string::npos){
+            size_t q = p + name.size();
+            bool boundary = p==0 || isspace((unsigned char)lower[p-1]);
+            while(q<lower.size() && isspace((unsigned char)lower[q])) ++q;
+            if(!boundary || q>=lower.size() || lower[q]!='='){ p = q; continue; }
+            ++q; while(q<lower.size() && isspace((unsigned char)lower[q])) ++q;
+            if(q<tag.size() && (tag[q]=='"' || tag[q]=='\'')){ char qc = tag[q]; size_t e = tag.find(qc, q+1); if(e==string_view::npos) e = tag.size(); return decodeHtmlEntities(tag.substr(q+1, e-q-1)); }
+            size_t e = q; while(e<tag.size() && !isspace((unsigned char)tag[e]) && tag[e]!='>') ++e;
+            return decodeHtmlEntities(tag.substr(q, e-q));
+        }
+        return string();
+    };
+    size_t pos = 0;
+    while(pos < d.size()){
+        const void* nl = memchr(d.data()+pos, '\n', d.size()-pos);
+        size_t end = nl? size_t(static_cast<const char*>(nl) - d.data()) : d.size();
+        string_view line = d.substr(pos, end-pos); pos = end + 1; ++out.lines;
+        size_t a = 0;
+        while(a < line.size()){
+            size_t lt = line.find('<', a);
+            if(lt==string_view::npos || lt+2>=line.size()) break;
+            a = lt + 1;
+            if(!((line[lt+1]=='A' || line[lt+1]=='a') && isspace((unsigned char)line[lt+2]))) continue;
+            size_t gt = line.find('>', lt); if(gt==string_view::npos) break;
+            string_view tag = line.substr(lt+2, gt-lt-2);
+            string lowerRest = toLower(string(line.substr(gt+1)));
+            size_t close = lowerRest.find("</a>");
+            string_view text = close==string::npos? line.substr(gt+1) : line.substr(gt+1, close);
+            string href = attr(tag, "href");
+            if(href.rfind("place:",0)==0 || href.rfind("javascript:",0)==0) continue;
+            importFinishRow(out, out.lines, today, attr(tag, "add_date"), "", href, decodeHtmlEntities(text), attr(tag, "tags"));
+            a = gt + 1;
+        }
+    }
+    return out;
+}
+
+// ===== Full-text index =====
+// index/ holds an inverted index over every row of archive/*.tsv and inbox.tsv. A segment file
+// covers a run of rows: a row table (source, byte offset, length, day), a sorted term dictionary
+// and delta+varint posting lists of (row, tf). index/manifest.tsv lists the sources with a
+// size + tail-hash stamp, and the segments. Rows appended to the inbox become a new small
+// segment; any other change to the sources (a cleared inbox, a new archive) means a rebuild.
+static fs::path indexDir(){ return curateHome()/ "index"; }
+static fs::path indexManifestPath(){ return indexDir()/ "manifest.tsv"; }
+
+static void putU32(string& b, uint32_t v){ char c[4]; memcpy(c, &v, 4); b.append(c, 4); }
+static void putU64(string& b, uint64_t v){ char c[8]; memcpy(c, &v, 8); b.append(c, 8); }
+static uint32_t getU32(const char* p){ uint32_t v; memcpy(&v, p, 4); return v; }
+static uint64_t getU64(const char* p){ uint64_t v; memcpy(&v, p, 8); return v; }
+static void putVarint(string& b, uint64_t v){ while(v>=0x80){ b += char(v|0x80); v >>= 7; } b += char(v); }
+// Reads one varint from [p, end); nullopt if it runs past end or past 64 bits.
+static optional<uint64_t> getVarint(const char*& p, const char* end){
+    uint64_t v = 0;
+    for(int s = 0; p<end && s<64; s += 7){
+        unsigned char c = (unsigned char)*p++;
+        v |= uint64_t(c & 0x7F) << s;
+        if(!(c & 0x80)) return v;
+    }
+    return nullopt;
+}
+// A whole field of decimal digits, or nullopt.
+static optional<uint64_t> parseU64(string_view s){
+    uint64_t v = 0;
+    auto [end, ec] = std::from_chars(s.data(), s.data()+s.size(), v);
+    if(s.empty() || ec!=std::errc() || end!=s.data()+s.size()) return nullopt;
+    return v;
+}
+
+// Lowercased alphanumeric runs; bytes >= 0x80 count as letters so UTF-8 words stay whole.
+template<class F> static void forEachToken(string_view s, F&& fn){
+    auto word = [](char c){ return isalnum((unsigned char)c) || (unsigned char)c>=0x80; };
+    string t; size_t i = 0, n = s.size();
+    while(i<n){
+        while(i<n && !word(s[i])) ++i;
+        size_t b = i; while(i<n && word(s[i])) ++i;
+        if(i>b){ t.assign(s.substr(b, i-b)); for(char& c: t) c = (char)tolower((unsigned char)c); fn(string_view(t)); }
+    }
+}
+
+// Terms of one row: title words, host labels (minus www), URL path words, tag words, plus the
+// exact-match terms "#tag" and "kind:<kind>" used by --tag / --kind.
+template<class F> static void forEachRowTerm(const RecView& r, F&& fn){
+    forEachToken(r.title, fn);
+    string_view u = trimView(r.url);
+    if(size_t p = u.find("://"); p!=string_view::npos) u.remove_prefix(p+3);
+    size_t slash = u.find('/');
+    forEachToken(u.substr(0, slash), [&](string_view t){ if(t!="www") fn(t); });
+    if(slash!=string_view::npos){
+        string_view path = u.substr(slash);
+        path = path.substr(0, path.find_first_of("?#"));
+        forEachToken(path, fn);
+    }
+    for(const auto& tag: splitTags(r.tags)){
+        string t = toLower(tag);
+        if(t[0]!='#') t.insert(t.begin(), '#');
+        fn(string_view(t));
+        forEachToken(tag, fn);
+    }
+    fn(string_view("kind:" + toLower(string(trimView(r.kind)))));
+}
+
+// Segment layout (little-endian): 64-byte header, rows x 24 bytes, dictionary x 24 bytes,
+// term bytes, posting bytes.
+static constexpr char IDX_MAGIC[8] = {'C','U','R','I','D','X','1','\0'};
+
+class SegmentBuilder{
+public:
+    void addRow(uint32_t src, uint64_t off, uint32_t len, const RecView& r){
+        uint32_t row = rows_++;
+        putU64(rowTable_, off); putU32(rowTable_, src); putU32(rowTable_, len);
+        putU32(rowTable_, uint32_t(int32_t(r.date.time_since_epoch().count()))); putU32(rowTable_, 0);
+        ids_.clear();
+        forEachRowTerm(r, [&](string_view t){
+            auto it = termIds_.find(string(t));
+            if(it==termIds_.end()){ it = termIds_.emplace(string(t), uint32_t(terms_.size())).first; terms_.emplace_back(t); post_.emplace_back(); }
+            ids_.push_back(it->second);
+        });
+        sort(ids_.begin(), ids_.end());
+        for(size_t i=0;i<ids_.size();){
+            size_t j = i; while(j<ids_.size() && ids_[j]==ids_[i]) ++j;
+            post_[ids_[i]].push_back({row, uint32_t(j-i)});
+            i = j;
+        }
+    }
+    uint32_t rows() const { return rows_; }
+
+    bool write(const fs::path& p) const {
+        vector<uint32_t> order(terms_.size());
+        for(uint32_t i=0;i<order.size();++i) order[i] = i;
+        sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y){ return terms_[x] < terms_[y]; });
+        string dict, termBytes, postBytes;
+        for(uint32_t id: order){
+            size_t start = postBytes.size(); uint32_t prev = 0;
+            for(auto [row, tf]: post_[id]){ putVarint(postBytes, row - prev); putVarint(postBytes, tf); prev = row; }
+            putU32(dict, uint32_t(termBytes.size())); putU32(dict, uint32_t(terms_[id].size()));
+            putU64(dict, start); putU32(dict, uint32_t(postBytes.size()-start)); putU32(dict, uint32_t(post_[id].size()));
+            termBytes += terms_[id];
+        }
+        string head(IDX_MAGIC, 8);
+        uint64_t rowsOff = 64, dictOff = rowsOff + rowTable_.size(), termsOff = dictOff + dict.size(), postOff = termsOff + termBytes.size();
+        putU32(head, rows_); putU32(head, uint32_t(terms_.size()));
+        putU64(head, rowsOff); putU64(head, dictOff); putU64(head, termsOff); putU64(head, postOff);
+        putU64(head, postOff + postBytes.size());
+        head.resize(64, '\0');
+        AtomicFile o(p);
+        o.write(head); o.write(rowTable_); o.write(dict); o.write(termBytes); o.write(postBytes);
+        return o.commit();
+    }
+
+private:
+    uint32_t rows_ = 0;
+    string rowTable_;
+    unordered_map<string,uint32_t> termIds_;
+    vector<string> terms_;
+    vector<vector<pair<uint32_t,uint32_t>>> post_;
+    vector<uint32_t> ids_;
+};
+
+class IndexSegment{
+public:
+    struct RowRef{ uint64_t off; uint32_t src, len; sys_days day; };
+    struct Term{ uint64_t postOff; uint32_t postLen, df; };
+
+    explicit IndexSegment(const fs::path& p): mf_(p){
+        string_view d = mf_.view();
+        if(d.size()<64 || memcmp(d.data(), IDX_MAGIC, 8)!=0) return;
+        const char* h = d.data() + 8;
+        rows_ = getU32(h); terms_ = getU32(h+4);
+        rowsOff_ = getU64(h+8); dictOff_ = getU64(h+16); termsOff_ = getU64(h+24); postOff_ = getU64(h+32);
+        ok_ = getU64(h+40)==d.size() && rowsOff_==64 && rowsOff_ + uint64_t(rows_)*24 == dictOff_
+           && dictOff_ + uint64_t(terms_)*24 == termsOff_ && termsOff_<=postOff_ && postOff_<=d.size();
+        // Every dictionary entry must point inside the term and posting areas.
+        for(uint32_t i=0;i<terms_ && ok_;++i){
+            const char* e = d.data() + dictOff_ + uint64_t(i)*24;
+            ok_ = uint64_t(getU32(e)) + getU32(e+4) <= postOff_ - termsOff_ && getU64(e+8) <= d.size() - postOff_
+               && getU32(e+16) <= d.size() - postOff_ - getU64(e+8);
+        }
+    }
+    bool ok() const { return ok_; }
+    uint32_t rows() const { return rows_; }
+
+    RowRef row(uint32_t i) const {
+        const char* p = mf_.view().data() + rowsOff_ + uint64_t(i)*24;
+        return RowRef{getU64(p), getU32(p+8), getU32(p+12), sys_days{days{int32_t(getU32(p+16))}}};
+    }
+
+    // Binary search over the sorted dictionary.
+    optional<Term> find(string_view term) const {
+        const char* base = mf_.view().data();
+        uint32_t lo = 0, hi = terms_;
+        while(lo<hi){
+            uint32_t mid = lo + (hi-lo)/2;
+            const char* e = base + dictOff_ + uint64_t(mid)*24;
+            string_view t(base + termsOff_ + getU32(e), getU32(e+4));
+            if(t==term) return Term{getU64(e+8), getU32(e+16), getU32(e+20)};
+            if(t<term) lo = mid+1; else hi = mid;
+        }
+        return nullopt;
+    }
+
+    // Decodes a posting list into (segment-local row, tf) pairs; false if it is malformed (runs
+    // past its bytes or names a row the segment does not have).
+    bool postings(const Term& t, vector<pair<uint32_t,uint32_t>>& out) const {
+        out.clear();
+        const char* p = mf_.view().data() + postOff_ + t.postOff;
+        const char* end = p + t.postLen;
+        uint64_t row = 0;
+        for(uint32_t i=0;i<t.df;++i){
+            auto gap = getVarint(p, end), tf = getVarint(p, end);
+            if(!gap || !tf || (row += *gap) >= rows_) return false;
+            out.push_back({uint32_t(row), uint32_t(*tf)});
+        }
+        return true;
+    }
+
+private:
+    MappedFile mf_;
+    uint32_t rows_ = 0, terms_ = 0;
+    uint64_t rowsOff_ = 0, dictOff_ = 0, termsOff_ = 0, postOff_ = 0;
+    bool ok_ = false;
+};
+
+struct IndexSource{ string rel; uint64_t bytes = 0; string tail; };
+struct IndexSegmentInfo{ string file; uint64_t firstRow = 0; uint32_t rows = 0; };
+struct IndexManifest{ vector<IndexSource> sources; vector<IndexSegmentInfo> segments; uint64_t rows = 0; };
+
+static optional<IndexManifest> loadIndexManifest(){
+    ifstream in(indexManifestPath());
+    if(!in) return nullopt;
+    IndexManifest m; string line;
+    if(!getline(in, line) || line!="# curate index v1") return nullopt;
+    while(getline(in, line)){
+        auto c = splitTabs(line);
+        if(c.size()!=4) continue;
+        if(c[0]=="source"){
+            auto bytes = parseU64(c[2]);
+            if(!bytes) return nullopt;
+            m.sources.push_back({c[1], *bytes, c[3]});
+        } else if(c[0]=="segment"){
+            auto first = parseU64(c[2]), rows = parseU64(c[3]);
+            if(!first || !rows || *rows > UINT32_MAX || c[1].find('/')!=string::npos) return nullopt;
+            m.segments.push_back({c[1], *first, uint32_t(*rows)});
+            m.rows += *rows;
+        }
+    }
+    return m;
+}
+
+static bool saveIndexManifest(const IndexManifest& m){
+    AtomicFile o(indexManifestPath());
+    o.write("# curate index v1\n");
+    for(const auto& s: m.sources) o.write("source\t" + s.rel + "\t" + to_string(s.bytes) + "\t" + s.tail + "\n");
+    for(const auto& s: m.segments) o.write("segment\t" + s.file + "\t" + to_string(s.firstRow) + "\t" + to_string(s.rows) + "\n");
+    if(!o.commit()) return false;
+    // Drop segment files the manifest no longer names.
+    std::error_code ec;
+    for(const auto& e: fs::directory_iterator(indexDir(), ec)){
+        string name = e.path().filename().string();
+        if(name.rfind("seg-", 0)!=0) continue;
+        if(none_of(m.segments.begin(), m.segments.end(), [&](const IndexSegmentInfo& s){ return s.file==name; })) fs::remove(e.path(), ec);
+    }
+    return true;
+}
+
+// Index sources in row order: archive segments oldest first, then the inbox.
+static vector<fs::path> indexSourcePaths(){ auto v = archiveFiles(); for(auto& p: inboxFiles()) v.push_back(std::move(p)); return v; }
+
+// Adds the complete lines of data[from, to) to b; returns the end of the last complete line.
+static uint64_t indexRange(SegmentBuilder& b, uint32_t src, string_view data, uint64_t from){
+    size_t pos = size_t(from); RecView r;
+    while(pos < data.size()){
+        const void* nl = memchr(data.data()+pos, '\n', data.size()-pos);
+        if(!nl) break; // a partial last line waits for its newline
+        size_t end = size_t(static_cast<const char*>(nl) - data.data());
+        if(parseRecLine(data.substr(pos, end-pos), r)) b.addRow(src, pos, uint32_t(end-pos), r);
+        pos = end + 1;
+    }
+    return pos;
+}
+
+static string newSegmentName(uint64_t firstRow, uint32_t rows){ return "seg-" + to_string(firstRow) + "-" + to_string(rows) + ".idx"; }
+
+enum class IndexUpdate { current, appended, rebuilt, failed };
+
+// Brings index/ up to date with the sources. With createIfMissing=false (the add/import path) a
+// missing index stays missing. More than 8 tail segments are folded back into one.
+static IndexUpdate syncIndex(bool rebuild, bool createIfMissing){
+    auto m = loadIndexManifest();
+    if(!m && !createIfMissing) return IndexUpdate::current;
+    fs::create_directories(indexDir());
+    auto paths = indexSourcePaths();
+    auto rel = [](const fs::path& p){ return p.lexically_relative(curateHome()).generic_string(); };
+
+    // clear-inbox renames inbox.tsv into archive/, where it sorts last: if that file is exactly the
+    // indexed inbox, its rows keep their ids and only the source entry moves.
+    bool rotated = false;
+    if(m && !rebuild && paths.size()==m->sources.size()+1 && paths.size()>=2 && m->sources.back().rel==rel(paths.back())){
+        auto& old = m->sources.back();
+        MappedFile f(paths[paths.size()-2]);
+        if(f.view().size()==old.bytes && tailStamp(f.view(), old.bytes)==old.tail){
+            old.rel = rel(paths[paths.size()-2]);
+            m->sources.push_back({rel(paths.back()), 0, tailStamp(string_view(), 0)});
+            rotated = true;
+        }
+    }
+
+    if(m && !rebuild && !paths.empty() && m->sources.size()==paths.size() && !m->segments.empty()){
+        bool prefixOk = true;
+        for(size_t i=0;i<paths.size() && prefixOk;++i){
+            const auto& s = m->sources[i];
+            if(s.rel!=rel(paths[i])){ prefixOk = false; break; }
+            MappedFile f(paths[i]);
+            string_view d = f.view();
+            bool last = i+1==paths.size();
+            if(d.size()<s.bytes || (!last && d.size()!=s.bytes) || tailStamp(d, s.bytes)!=s.tail) prefixOk = false;
+        }
+        if(prefixOk){
+            MappedFile inbox(paths.back());
+            string_view d = inbox.view();
+            auto& src = m->sources.back();
+            if(d.size()==src.bytes) return !rotated? IndexUpdate::current : saveIndexManifest(*m)? IndexUpdate::appended : IndexUpdate::failed;
+            uint64_t from = src.bytes, firstRow = m->rows;
+            bool fold = m->segments.size() > 8;
+            if(fold){
+                // Tail segments hold inbox rows, so they re-index as one byte range (unless a
+                // clear-inbox moved some of them into archive/; then rebuild).
+                IndexSegment s1(indexDir()/ m->segments[1].file);
+                if(!s1.ok() || !s1.rows() || s1.row(0).src!=paths.size()-1) return syncIndex(true, true);
+                from = s1.row(0).off; firstRow = m->segments[1].firstRow;
+                m->segments.resize(1);
+            }
+            SegmentBuilder b;
+            uint64_t end = indexRange(b, uint32_t(paths.size()-1), d, from);
+            if(end==src.bytes && !fold && !rotated) return IndexUpdate::current;
+            if(b.rows()){
+                string name = newSegmentName(firstRow, b.rows());
+                if(!b.write(indexDir()/ name)) return IndexUpdate::failed;
+                m->segments.push_back({name, firstRow, b.rows()});
+            }
+            src.bytes = end; src.tail = tailStamp(d, end);
+            return saveIndexManifest(*m)? IndexUpdate::appended : IndexUpdate::failed;
+        }
+    }
+
+    IndexManifest fresh;
+    SegmentBuilder b;
+    for(size_t i=0;i<paths.size();++i){
+        MappedFile f(paths[i]);
+        string_view d = f.view();
+        uint64_t end = indexRange(b, uint32_t(i), d, 0);
+        fresh.sources.push_back({rel(paths[i]), end, tailStamp(d, end)});
+    }
+    string name = newSegmentName(0, b.rows());
+    if(!b.write(indexDir()/ name)) return IndexUpdate::failed;
+    fresh.segments.push_back({name, 0, b.rows()});
+    return saveIndexManifest(fresh)? IndexUpdate::rebuilt : IndexUpdate::failed;
+}
+
+// ===== Compressed row bitmaps =====
+// Roaring-style: row ids are split by their high 16 bits into containers; a container holds a
+// sorted array of low halves up to 4096 ids and a 65536-bit bitmap beyond that.
+class RowBitmap{
+public:
+    void add(uint32_t v){
+        uint16_t key = uint16_t(v >> 16), low = uint16_t(v);
+        if(cs_.empty() || cs_.back().key < key) cs_.push_back(Container{key});
+        Container* c = &cs_.back();
+        if(c->key != key){
+            auto it = lower_bound(cs_.begin(), cs_.end(), key, [](const Container& x, uint16_t k){ return x.key < k; });
+            if(it==cs_.end() || it->key!=key) it = cs_.insert(it, Container{key});
+            c = &*it;
+        }
+        c->add(low);
+    }
+    uint64_t cardinality() const { uint64_t n = 0; for(const auto& c: cs_) n += c.card; return n; }
+    static RowBitmap range(uint32_t n){ RowBitmap b; for(uint32_t i=0;i<n;++i) b.add(i); return b; }
+
+    RowBitmap& operator&=(const RowBitmap& o){ return combine(o, Op::And); }
+    RowBitmap& operator|=(const RowBitmap& o){ return combine(o, Op::Or); }
+    RowBitmap& andNot(const RowBitmap& o){ return combine(o, Op::AndNot); }
+
+    // Calls fn(id) in increasing order.
+    template<class F> void forEach(F&& fn) const {
+        for(const auto& c: cs_){
+            uint32_t hi = uint32_t(c.key) << 16;
+            if(c.bits.empty()){ for(uint16_t v: c.arr) fn(hi | v); continue; }
+            for(uint32_t w=0;w<1024;++w) for(uint64_t x = c.bits[w]; x; x &= x-1) fn(hi | (w<<6) | uint32_t(std::countr_zero(x)));
+        }
+    }
+
+    // u32 containers, then per container: u16 key, u16 kind (0 array, 1 bitmap), u32 card, payload.
+    void serialize(string& out) const {
+        putU32(out, uint32_t(cs_.size()));
+        for(const auto& c: cs_){
+            char h[4]; uint16_t k = c.key, t = c.bits.empty()? 0 : 1;
+            memcpy(h, &k, 2); memcpy(h+2, &t, 2); out.append(h, 4); putU32(out, c.card);
+            if(t) out.append(reinterpret_cast<const char*>(c.bits.data()), 8192);
+            else out.append(reinterpret_cast<const char*>(c.arr.data()), c.arr.size()*2);
+        }
+    }
+    static optional<RowBitmap> parse(string_view d){
+        RowBitmap b; size_t p = 4;
+        if(d.size()<4) return nullopt;
+        uint32_t n = getU32(d.data());
+        for(uint32_t i=0;i<n;++i){
+            if(p+8 > d.size()) return nullopt;
+            Container c; uint16_t t; memcpy(&c.key, d.data()+p, 2); memcpy(&t, d.data()+p+2, 2); c.card = getU32(d.data()+p+4); p += 8;
+            size_t len = t? 8192 : size_t(c.card)*2;
+            if(p+len > d.size()) return nullopt;
+            if(t){ c.bits.resize(1024); memcpy(c.bits.data(), d.data()+p, len); }
+            else { c.arr.resize(c.card); memcpy(c.arr.data(), d.data()+p, len); }
+            p += len; b.cs_.push_back(std::move(c));
+        }
+        return b;
+    }
+
+private:
+    enum class Op { And, Or, AndNot };
+    struct Container{
+        uint16_t key = 0; uint32_t card = 0;
+        vector<uint16_t> arr; vector<uint64_t> bits; // exactly one is in use
+        explicit Container(uint16_t k = 0): key(k){}
+        bool has(uint16_t v) const { return bits.empty()? binary_search(arr.begin(), arr.end(), v) : (bits[v>>6] >> (v&63)) & 1; }
+        void add(uint16_t v){
+            if(!bits.empty()){ uint64_t m = uint64_t(1) << (v&63); if(!(bits[v>>6] & m)){ bits[v>>6] |= m; ++card; } return; }
+            if(arr.empty() || arr.back() < v) arr.push_back(v);
+            else { auto it = lower_bound(arr.begin(), arr.end(), v); if(*it==v) return; arr.insert(it, v); }
+            ++card;
+            if(card > 4096) toBits();
+        }
+        void toBits(){ if(!bits.empty()) return; bits.assign(1024, 0); for(uint16_t v: arr) bits[v>>6] |= uint64_t(1) << (v&63); arr.clear(); arr.shrink_to_fit(); }
+        // Recounts a bitmap container and drops back to an array when it got sparse.
+        void normalize(){
+            if(bits.empty()){ card = uint32_t(arr.size()); return; }
+            card = 0; for(uint64_t w: bits) card += uint32_t(std::popcount(w));
+            if(card <= 4096){
+                arr.clear(); arr.reserve(card);
+                for(uint32_t w=0;w<1024;++w) for(uint64_t x = bits[w]; x; x &= x-1) arr.push_back(uint16_t((w<<6) | uint32_t(std::countr_zero(x))));
+                bits.clear(); bits.shrink_to_fit();
+            }
+        }
+    };
+
+    static void apply(Container& a, const Container& b, Op op){
+        if(op==Op::Or){
+            if(a.bits.empty() && b.bits.empty()){
+                vector<uint16_t> u; u.reserve(a.arr.size()+b.arr.size());
+                std::set_union(a.arr.begin(), a.arr.end(), b.arr.begin(), b.arr.end(), back_inserter(u));
+                a.arr.swap(u); a.card = uint32_t(a.arr.size());
+                if(a.card > 4096) a.toBits();
+                return;
+            }
+            a.toBits();
+            if(b.bits.empty()) for(uint16_t v: b.arr) a.bits[v>>6] |= uint64_t(1) << (v&63);
+            else for(size_t w=0;w<1024;++w) a.bits[w] |= b.bits[w];
+        } else if(a.bits.empty()){
+            bool keep = op==Op::And;
+            a.arr.erase(std::remove_if(a.arr.begin(), a.arr.end(), [&](uint16_t v){ return b.has(v)!=keep; }), a.arr.end());
+        } else if(b.bits.empty()){
+            if(op==Op::AndNot){ for(uint16_t v: b.arr) a.bits[v>>6] &= ~(uint64_t(1) << (v&63)); }
+            else { vector<uint16_t> r; for(uint16_t v: b.arr) if(a.has(v)) r.push_back(v); a.bits.clear(); a.arr.swap(r); }
+        } else {
+            for(size_t w=0;w<1024;++w) a.bits[w] = op==Op::And? (a.bits[w] & b.bits[w]) : (a.bits[w] & ~b.bits[w]);
+        }
+        a.normalize();
+    }
+
+    RowBitmap& combine(const RowBitmap& o, Op op){
+        vector<Container> out;
+        size_t i = 0, j = 0;
+        while(i<cs_.size() || j<o.cs_.size()){
+            if(j==o.cs_.size() || (i<cs_.size() && cs_[i].key < o.cs_[j].key)){ if(op!=Op::And) out.push_back(std::move(cs_[i])); ++i; }
+            else if(i==cs_.size() || o.cs_[j].key < cs_[i].key){ if(op==Op::Or) out.push_back(o.cs_[j]); ++j; }
+            else { apply(cs_[i], o.cs_[j], op); if(cs_[i].card) out.push_back(std::move(cs_[i])); ++i; ++j; }
+        }
+        cs_.swap(out);
+        return *this;
+    }
+
+    vector<Container> cs_; // sorted by key
+};
+
+// ===== Tag / kind / week bitmaps =====
+// inbox.bitmaps sits next to inbox.tsv: a size + tail-hash stamp, whether the rows are in date
+// order (and the last row's date, to keep that flag up to date on append), the byte offset of
+// every row, and a RowBitmap per "#tag", "kind:<kind>", "week:<YYYY-Www>", "host:<host>" and
+// "site:<registrable domain>" (the host bitmaps are the domain posting index). add/import extend
+// an existing file; rows appended otherwise are picked up on the next query, and any other
+// change to the inbox rebuilds it. Each month shard of the sharded layout has the same file next
+// to it, inbox/YYYY-MM.tsv.bitmaps.
+static fs::path bitmapsPath(){ return curateHome()/ "inbox.bitmaps"; }
+static fs::path bitmapsPathFor(const fs::path& source){
+    if(source==inboxPath()) return bitmapsPath();
+    fs::path p = source; p += ".bitmaps"; return p;
+}
+static constexpr char BMP_MAGIC[8] = {'C','U','R','B','M','P','3','\0'};
+
+struct InboxBitmaps{
+    uint64_t bytes = 0; string tail;
+    bool sorted = true; sys_days lastRowDate{}; // sorted: row dates never decrease in file order
+    vector<uint64_t> offsets; // row id -> byte offset of its line
+    map<string,RowBitmap> maps;
+
+    void addRow(uint64_t off, const RecView& r){
+        uint32_t id = uint32_t(offsets.size());
+        if(id && r.date < lastRowDate) sorted = false;
+        lastRowDate = r.date;
+        offsets.push_back(off);
+        for(const auto& t: splitTags(r.tags)){
+            string k = toLower(t);
+            if(k[0]!='#') k.insert(k.begin(), '#');
+            maps[k].add(id);
+        }
+        maps["kind:" + toLower(string(trimView(r.kind)))].add(id);
+        if(r.date!=lastDate_){ auto w = isoWeekFromDate(r.date); lastWeek_ = "week:" + fmtISOWeek(w.year, w.week); lastDate_ = r.date; }
+        maps[lastWeek_].add(id);
+        string host = urlHostKey(r.url);
+        if(host.empty()) return;
+        string site = registrableDomain(host);
+        maps["host:" + host].add(id);
+        maps["site:" + site].add(id);
+    }
+    const RowBitmap& get(const string& key) const { static const RowBitmap EMPTY; auto it = maps.find(key); return it==maps.end()? EMPTY : it->second; }
+
+private:
+    sys_days lastDate_{}; string lastWeek_;
+};
+
+static optional<InboxBitmaps> loadInboxBitmaps(const fs::path& file){
+    MappedFile f(file);
+    string_view d = f.view();
+    if(d.size()<48 || memcmp(d.data(), BMP_MAGIC, 8)!=0) return nullopt;
+    InboxBitmaps b;
+    b.bytes = getU64(d.data()+8); b.tail = string(d.substr(16, 16));
+    uint32_t rows = getU32(d.data()+32), nmaps = getU32(d.data()+36);
+    b.sorted = getU32(d.data()+40)!=0; b.lastRowDate = sys_days{days{int32_t(getU32(d.data()+44))}};
+    size_t p = 48;
+    if(p + size_t(rows)*8 > d.size()) return nullopt;
+    b.offsets.resize(rows); memcpy(b.offsets.data(), d.data()+p, size_t(rows)*8); p += size_t(rows)*8;
+    for(uint32_t i=0;i<nmaps;++i){
+        if(p+4 > d.size()) return nullopt;
+        uint32_t kl = getU32(d.data()+p); p += 4;
+        if(p+kl+4 > d.size()) return nullopt;
+        string key(d.substr(p, kl)); p += kl;
+        uint32_t bl = getU32(d.data()+p); p += 4;
+        if(p+bl > d.size()) return nullopt;
+        auto bm = RowBitmap::parse(d.substr(p, bl)); p += bl;
+        if(!bm) return nullopt;
+        b.maps.emplace(std::move(key), std::move(*bm));
+    }
+    return b;
+}
+
+static bool saveInboxBitmaps(const fs::path& file, const InboxBitmaps& b){
+    string head(BMP_MAGIC, 8);
+    putU64(head, b.bytes); head += b.tail; head.resize(32, '0');
+    putU32(head, uint32_t(b.offsets.size())); putU32(head, uint32_t(b.maps.size()));
+    putU32(head, b.sorted? 1 : 0); putU32(head, uint32_t(int32_t(b.lastRowDate.time_since_epoch().count())));
+    AtomicFile o(file);
+    o.write(head);
+    o.write(string_view(reinterpret_cast<const char*>(b.offsets.data()), b.offsets.size()*8));
+    string buf;
+    for(const auto& [k,bm]: b.maps){
+        buf.clear(); putU32(buf, uint32_t(k.size())); buf += k;
+        size_t at = buf.size(); putU32(buf, 0);
+        bm.serialize(buf);
+        uint32_t len = uint32_t(buf.size() - at - 4); memcpy(&buf[at], &len, 4);
+        o.write(buf);
+    }
+    return o.commit();
+}
+
+// Set by `curate serve`: the synced bitmaps stay in memory (keyed by bitmaps file), so requests
+// (forked from the daemon) start from them instead of reloading the files.
+static unique_ptr<map<string,InboxBitmaps>>& residentBitmaps(){ static unique_ptr<map<string,InboxBitmaps>> r; return r; }
+
+// Returns bitmaps covering every complete line of `inbox` (a mapped live inbox file), extending
+// or rebuilding its bitmaps `file` as needed.
+static InboxBitmaps syncInboxBitmaps(string_view inbox, const fs::path& file = bitmapsPath()){
+    InboxBitmaps* res = residentBitmaps()? &(*residentBitmaps())[file.string()] : nullptr;
+    optional<InboxBitmaps> b;
+    if(res && !res->tail.empty() && res->bytes<=inbox.size() && tailStamp(inbox, res->bytes)==res->tail) b = *res;
+    else b = loadInboxBitmaps(file);
+    if(!b || b->bytes > inbox.size() || tailStamp(inbox, b->bytes)!=b->tail) b = InboxBitmaps{};
+    size_t pos = size_t(b->bytes); RecView r;
+    while(pos < inbox.size()){
+        const void* nl = memchr(inbox.data()+pos, '\n', inbox.size()-pos);
+        if(!nl) break;
+        size_t end = size_t(static_cast<const char*>(nl) - inbox.data());
+        if(parseRecLine(inbox.substr(pos, end-pos), r)) b->addRow(pos, r);
+        pos = end + 1;
+    }
+    if(pos!=b->bytes){
+        b->bytes = pos; b->tail = tailStamp(inbox, pos);
+        if(!saveInboxBitmaps(file, *b)) cerr<<"warning: could not write "<< file <<"\n";
+    }
+    if(res) *res = *b;
+    // A last line still missing its newline is served from memory but not persisted.
+    if(pos < inbox.size() && parseRecLine(inbox.substr(pos), r)) b->addRow(pos, r);
+    return std::move(*b);
+}
+
+// ===== Filter expressions (--where) =====
+// kind in (video,pdf) and domain ~ "github" and tag:#AI and date >= 2025-09-01
+//
+//   expr := and ('or' and)* ; and := unary ('and' unary)* ; unary := 'not' unary | '(' expr ')' | pred
+//   pred := field op value | field 'in' '(' value, ... ')' | field:value
+//   field: date kind domain url title tag     op: = != < <= > >= ~ (contains) !~
+//
+// The expression is parsed once and compiled into one short-circuit program per top-level
+// conjunct. Rows are filtered in batches through a selection vector, conjunct by conjunct, in
+// order of cost and selectivity (estimated on a sample of the inbox), so cheap date/kind tests
+// shrink the batch before the URL parsing and substring searches run.
+enum class WField { date, kind, domain, url, title, tag };
+enum class WOp { eq, ne, lt, le, gt, ge, contains, notContains, in };
+
+struct WPred{
+    WField field; WOp op; vector<string> values; sys_days date{};
+    int cost() const {
+        switch(field){
+            case WField::date: return 1;
+            case WField::kind: return 2;
+            case WField::tag: return 4;
+            case WField::title: case WField::url: return op==WOp::contains || op==WOp::notContains? 6 : 3;
+            case WField::domain: return 8;
+        }
+        return 8;
+    }
+};
+
+struct WNode{ enum Kind { And, Or, Not, Pred } kind; vector<WNode> kids; size_t pred = 0; };
+
+// Acc-based bytecode: Pred sets acc, Not flips it, JumpIfFalse/JumpIfTrue short-circuit.
+struct WInstr{ enum Code { Pred, Not, JumpIfFalse, JumpIfTrue } code; size_t arg = 0; };
+
+static const char* wFieldName(WField f){
+    static const char* N[] = {"date","kind","domain","url","title","tag"};
+    return N[int(f)];
+}
+static const char* wOpName(WOp o){
+    static const char* N[] = {"=","!=","<","<=",">",">=","~","!~","in"};
+    return N[int(o)];
+}
+
+static bool icontains(string_view hay, string_view lowerNeedle){
+    if(lowerNeedle.empty()) return true;
+    auto it = std::search(hay.begin(), hay.end(), lowerNeedle.begin(), lowerNeedle.end(),
+                          [](char a, char b){ return tolower((unsigned char)a)==b; });
+    return it!=hay.end();
+}
+static bool iequals(string_view a, string_view lowerB){
+    return a.size()==lowerB.size() && std::equal(a.begin(), a.end(), lowerB.begin(), [](char x, char y){ return tolower((unsigned char)x)==y; });
+}
+
+static bool evalPred(const WPred& p, const RecView& r){
+    auto text = [&](string_view v) -> bool {
+        switch(p.op){
+            case WOp::eq: return iequals(v, p.values[0]);
+            case WOp::ne: return !iequals(v, p.values[0]);
+            case WOp::in: return any_of(p.values.begin(), p.values.end(), [&](const string& x){ return iequals(v, x); });
+            case WOp::contains: return icontains(v, p.values[0]);
+            case WOp::notContains: return !icontains(v, p.values[0]);
+            default: { string l(v); for(char& c: l) c = (char)tolower((unsigned char)c);
+                       int c = l.compare(p.values[0]);
+                       return p.op==WOp::lt? c<0 : p.op==WOp::le? c<=0 : p.op==WOp::gt? c>0 : c>=0; }
+        }
+    };
+    switch(p.field){
+        case WField::date:
+            switch(p.op){
+                case WOp::eq: return r.date==p.date;   case WOp::ne: return r.date!=p.date;
+                case WOp::lt: return r.date<p.date;    case WOp::le: return r.date<=p.date;
+                case WOp::gt: return r.date>p.date;    case WOp::ge: return r.date>=p.date;
+                default: { string d = fmtDate(r.date); return text(d); }
+            }
+        case WField::kind: return text(trimView(r.kind));
+        case WField::url: return text(trimView(r.url));
+        case WField::title: return text(trimView(r.title));
+        case WField::domain: return text(urlDomainView(trimView(r.url)));
+        case WField::tag: {
+            // Any tag matching; "#" on either side is optional. != and !~ mean "no tag matches".
+            bool negate = p.op==WOp::ne || p.op==WOp::notContains;
+            WOp op = negate? (p.op==WOp::ne? WOp::eq : WOp::contains) : p.op;
+            bool hit = false; size_t i = 0, n = r.tags.size();
+            while(i<n && !hit){
+                while(i<n && isspace((unsigned char)r.tags[i])) ++i;
+                size_t b = i; while(i<n && !isspace((unsigned char)r.tags[i])) ++i;
+                if(i==b) break;
+                string_view t = r.tags.substr(b, i-b);
+                if(!t.empty() && t[0]=='#') t.remove_prefix(1);
+                hit = op==WOp::contains? icontains(t, p.values[0])
+                    : op==WOp::in? any_of(p.values.begin(), p.values.end(), [&](const string& x){ return iequals(t, x); })
+                    : iequals(t, p.values[0]);
+            }
+            return hit!=negate;
+        }
+    }
+    return false;
+}
+
+class WhereFilter{
+public:
+    static constexpr size_t BATCH = 1024;
+
+    // Throws runtime_error("...") with a column on a syntax error.
+    explicit WhereFilter(const string& src): src_(src){
+        lex();
+        WNode root = parseOr();
+        if(pos_<toks_.size()) fail("unexpected '" + toks_[pos_].text + "'", toks_[pos_].col);
+        auto addConj = [&](WNode n){ Conj c; c.node = std::move(n); conj_.push_back(std::move(c)); };
+        if(root.kind==WNode::And) for(auto& k: root.kids) addConj(std::move(k));
+        else addConj(std::move(root));
+        for(auto& c: conj_){ orderByCost(c.node); emit(c.node, c.code); c.cost = nodeCost(c.node); }
+    }
+
+    // Estimates each conjunct's selectivity on `sample` and runs the cheapest-per-row-removed first.
+    void plan(const vector<RecView>& sample){
+        sampleSize_ = sample.size();
+        for(auto& c: conj_){
+            size_t hit = 0; for(const auto& r: sample) hit += run(c.code, r);
+            c.sel = sample.empty()? 0.5 : double(hit) / double(sample.size());
+        }
+        std::stable_sort(conj_.begin(), conj_.end(), [](const Conj& x, const Conj& y){
+            return (x.sel - 1.0) / x.cost < (y.sel - 1.0) / y.cost;
+        });
+        size_t all = 0; for(const auto& r: sample) all += test(r);
+        combinedSel_ = sample.empty()? 0.5 : double(all) / double(sample.size());
+    }
+
+    bool test(const RecView& r) const { for(const auto& c: conj_) if(!run(c.code, r)) return false; return true; }
+
+    // Narrows `sel` (indexes into rows) conjunct by conjunct.
+    void filter(const vector<RecView>& rows, vector<uint32_t>& sel) const {
+        for(const auto& c: conj_){
+            size_t w = 0;
+            for(uint32_t i: sel) if(run(c.code, rows[i])) sel[w++] = i;
+            sel.resize(w);
+            if(sel.empty()) return;
+        }
+    }
+
+    void explain(ostream& o) const {
+        o<<"where: "<< src_ <<"\n";
+        o<<"plan: "<< conj_.size() <<" conjunct(s), rows filtered in batches of "<< BATCH <<", in this order\n";
+        for(size_t i=0;i<conj_.size();++i){
+            const auto& c = conj_[i];
+            o<<"  "<< (i+1) <<". "<< show(c.node) <<"\n";
+            o<<"     cost "<< c.cost <<", selectivity "<< std::fixed << std::setprecision(3) << c.sel <<"\n";
+            for(size_t k=0;k<c.code.size();++k){
+                const auto& in = c.code[k];
+                o<<"       "<< setw(2) << k <<"  ";
+                if(in.code==WInstr::Pred) o<<"PRED   "<< showPred(preds_[in.arg]);
+                else if(in.code==WInstr::Not) o<<"NOT";
+                else o<< (in.code==WInstr::JumpIfFalse? "JFALSE " : "JTRUE  ") << in.arg;
+                o<<"\n";
+            }
+        }
+        o<<"estimated selectivity: "<< std::fixed << std::setprecision(3) << combinedSel_ <<" (sample of "<< sampleSize_ <<" rows)\n";
+    }
+
+private:
+    struct Tok{ string text; bool quoted; size_t col; };
+    struct Conj{ WNode node; vector<WInstr> code; int cost = 0; double sel = 0.5; };
+
+    [[noreturn]] void fail(const string& why, size_t col) const { throw runtime_error(why + " at column " + to_string(col+1)); }
+
+    void lex(){
+        size_t i = 0, n = src_.size();
+        while(i<n){
+            char c = src_[i];
+            if(isspace((unsigned char)c)){ ++i; continue; }
+            if(c=='(' || c==')' || c==','){ toks_.push_back({string(1,c), false, i}); ++i; continue; }
+            if(c=='"' || c=='\''){
+                size_t b = i++; string s;
+                while(i<n && src_[i]!=c){ if(src_[i]=='\\' && i+1<n) ++i; s += src_[i++]; }
+                if(i>=n) fail("unterminated string", b);
+                ++i; toks_.push_back({s, true, b}); continue;
+            }
+            if(strchr("=!<>~&|", c)){
+                size_t b = i; string op(1, c); ++i;
+                if(i<n && (src_[i]=='=' || src_[i]=='~' || (c=='&' && src_[i]=='&') || (c=='|' && src_[i]=='|'))) op += src_[i++];
+                toks_.push_back({op, false, b}); continue;
+            }
+            size_t b = i;
+            while(i<n && !isspace((unsigned char)src_[i]) && !strchr("(),=!<>~&|\"'", src_[i])) ++i;
+            toks_.push_back({src_.substr(b, i-b), false, b});
+        }
+    }
+
+    bool atWord(const char* w) const { return pos_<toks_.size() && !toks_[pos_].quoted && toLower(toks_[pos_].text)==w; }
+    bool atSym(const char* s) const { return pos_<toks_.size() && !toks_[pos_].quoted && toks_[pos_].text==s; }
+    size_t col() const { return pos_<toks_.size()? toks_[pos_].col : src_.size(); }
+
+    WNode parseOr(){
+        WNode l = parseAnd();
+        if(!(atWord("or") || atSym("||"))) return l;
+        WNode n{WNode::Or, {std::move(l)}};
+        while(atWord("or") || atSym("||")){ ++pos_; n.kids.push_back(parseAnd()); }
+        return n;
+    }
+    WNode parseAnd(){
+        WNode l = parseUnary();
+        if(!(atWord("and") || atSym("&&"))) return l;
+        WNode n{WNode::And, {std::move(l)}};
+        while(atWord("and") || atSym("&&")){ ++pos_; n.kids.push_back(parseUnary()); }
+        return n;
+    }
+    WNode parseUnary(){
+        if(atWord("not") || atSym("!")){ ++pos_; return WNode{WNode::Not, {parseUnary()}}; }
+        if(atSym("(")){
+            ++pos_; WNode n = parseOr();
+            if(!atSym(")")) fail("expected ')'", col());
+            ++pos_; return n;
+        }
+        return parsePred();
+    }
+
+    WNode parsePred(){
+        if(pos_>=toks_.size()) fail("expected a condition", col());
+        Tok t = toks_[pos_++];
+        string fieldText = toLower(t.text), shorthand;
+        bool hasShorthand = false;
+        if(size_t c = t.text.find(':'); !t.quoted && c!=string::npos){ fieldText = toLower(t.text.substr(0, c)); shorthand = t.text.substr(c+1); hasShorthand = true; }
+        static const map<string,WField> FIELDS = {{"date",WField::date},{"kind",WField::kind},{"type",WField::kind},{"domain",WField::domain},
+                                                  {"host",WField::domain},{"url",WField::url},{"title",WField::title},{"tag",WField::tag},{"tags",WField::tag}};
+        auto f = FIELDS.find(fieldText);
+        if(t.quoted || f==FIELDS.end()) fail("unknown field '" + t.text + "'", t.col);
+        WPred p{f->second, WOp::eq, {}};
+        if(hasShorthand){
+            if(shorthand.empty()) fail("missing value after ':'", t.col);
+            p.values.push_back(shorthand);
+        } else if(atWord("in")){
+            ++pos_; p.op = WOp::in;
+            if(!atSym("(")) fail("expected '(' after in", col());
+            ++pos_;
+            while(true){
+                if(pos_>=toks_.size() || (!toks_[pos_].quoted && (toks_[pos_].text==")" || toks_[pos_].text==","))) fail("expected a value", col());
+                p.values.push_back(toks_[pos_++].text);
+                if(atSym(",")){ ++pos_; continue; }
+                if(atSym(")")){ ++pos_; break; }
+                fail("expected ',' or ')'", col());
+            }
+        } else {
+            static const map<string,WOp> OPS = {{"=",WOp::eq},{"==",WOp::eq},{"!=",WOp::ne},{"<",WOp::lt},{"<=",WOp::le},{">",WOp::gt},{">=",WOp::ge},{"~",WOp::contains},{"!~",WOp::notContains}};
+            if(pos_>=toks_.size()) fail("expected an operator", col());
+            auto o = OPS.find(toks_[pos_].text);
+            if(toks_[pos_].quoted || o==OPS.end()) fail("expected an operator after " + fieldText, col());
+            p.op = o->second; ++pos_;
+            if(pos_>=toks_.size()) fail("expected a value", col());
+            p.values.push_back(toks_[pos_++].text);
+        }
+        for(auto& v: p.values){
+            v = toLower(v);
+            if(p.field==WField::tag && !v.empty() && v[0]=='#') v.erase(0, 1);
+        }
+        if(p.field==WField::date && p.op!=WOp::contains && p.op!=WOp::notContains){
+            if(p.op==WOp::in) fail("date does not support in", t.col);
+            auto d = parseISODate(p.values[0]);
+            if(!d) fail("expected YYYY-MM-DD after date", t.col);
+            p.date = *d;
+        }
+        if(p.field==WField::tag && (p.op==WOp::lt || p.op==WOp::le || p.op==WOp::gt || p.op==WOp::ge)) fail("tag supports =, !=, ~, !~ and in", t.col);
+        preds_.push_back(std::move(p));
+        WNode n{WNode::Pred, {}}; n.pred = preds_.size()-1;
+        return n;
+    }
+
+    int nodeCost(const WNode& n) const {
+        if(n.kind==WNode::Pred) return preds_[n.pred].cost();
+        int c = 0; for(const auto& k: n.kids) c += nodeCost(k);
+        return c;
+    }
+    void orderByCost(WNode& n) const {
+        for(auto& k: n.kids) orderByCost(k);
+        if(n.kind==WNode::And || n.kind==WNode::Or)
+            std::stable_sort(n.kids.begin(), n.kids.end(), [&](const WNode& x, const WNode& y){ return nodeCost(x) < nodeCost(y); });
+    }
+    void emit(const WNode& n, vector<WInstr>& code) const {
+        switch(n.kind){
+            case WNode::Pred: code.push_back({WInstr::Pred, n.pred}); return;
+            case WNode::Not: emit(n.kids[0], code); code.push_back({WInstr::Not, 0}); return;
+            default: {
+                vector<size_t> jumps;
+                for(size_t i=0;i<n.kids.size();++i){
+                    emit(n.kids[i], code);
+                    if(i+1<n.kids.size()){ jumps.push_back(code.size()); code.push_back({n.kind==WNode::And? WInstr::JumpIfFalse : WInstr::JumpIfTrue, 0}); }
+                }
+                for(size_t j: jumps) code[j].arg = code.size();
+            }
+        }
+    }
+    bool run(const vector<WInstr>& code, const RecView& r) const {
+        bool acc = false;
+        for(size_t pc=0; pc<code.size(); ){
+            const WInstr& in = code[pc];
+            switch(in.code){
+                case WInstr::Pred: acc = evalPred(preds_[in.arg], r); ++pc; break;
+                case WInstr::Not: acc = !acc; ++pc; break;
+                case WInstr::JumpIfFalse: pc = acc? pc+1 : in.arg; break;
+                case WInstr::JumpIfTrue: pc = acc? in.arg : pc+1; break;
+            }
+        }
+        return acc;
+    }
+
+    string showPred(const WPred& p) const {
+        string s = string(wFieldName(p.field)) + " " + wOpName(p.op) + " ";
+        if(p.op==WOp::in){ s += "("; for(size_t i=0;i<p.values.size();++i){ if(i) s += ","; s += p.values[i]; } return s + ")"; }
+        return s + (p.field==WField::date && p.op!=WOp::contains && p.op!=WOp::notContains? p.values[0] : "\"" + p.values[0] + "\"");
+    }
+    string show(const WNode& n) const {
+        if(n.kind==WNode::Pred) return showPred(preds_[n.pred]);
+        if(n.kind==WNode::Not) return "not " + show(n.kids[0]);
+        string s = "(";
+        for(size_t i=0;i<n.kids.size();++i){ if(i) s += n.kind==WNode::And? " and " : " or "; s += show(n.kids[i]); }
+        return s + ")";
+    }
+
+    string src_;
+    vector<Tok> toks_; size_t pos_ = 0;
+    vector<WPred> preds_;
+    vector<Conj> conj_;
+    size_t sampleSize_ = 0; double combinedSel_ = 0.5;
+};
+
+// Up to n rows spread evenly over `data` (each probe snaps to the next line start).
+static vector<RecView> sampleRows(string_view data, size_t n){
+    vector<RecView> out; RecView r;
+    if(data.empty()) return out;
+    size_t step = std::max<size_t>(1, data.size() / n), last = string_view::npos;
+    for(size_t probe=0; probe<data.size() && out.size()<n; probe += step){
+        size_t pos = probe;
+        if(pos){ const void* nl = memchr(data.data()+pos-1, '\n', data.size()-pos+1); if(!nl) break; pos = size_t(static_cast<const char*>(nl) - data.data()) + 1; }
+        if(pos>=data.size() || pos==last) continue;
+        last = pos;
+        const void* nl = memchr(data.data()+pos, '\n', data.size()-pos);
+        size_t end = nl? size_t(static_cast<const char*>(nl) - data.data()) : data.size();
+        if(parseRecLine(data.substr(pos, end-pos), r)) out.push_back(r);
+    }
+    return out;
+}
+
+// Compiles --where against a sample of the inbox; exits with status 2 on a syntax error.
+static unique_ptr<WhereFilter> compileWhere(const string& expr){
+    if(expr.empty()) return nullptr;
+    unique_ptr<WhereFilter> w;
+    try{ w = make_unique<WhereFilter>(expr); }
+    catch(const runtime_error& e){ cerr<<"--where: "<< e.what() <<"\n"; exit(2); }
+    auto files = inboxFiles();
+    MappedFile inbox(files.empty()? inboxPath() : files.back());
+    w->plan(sampleRows(inbox.view(), 4096));
+    return w;
+}
+
+// Like forEachRecView, but rows pass through `w` a batch at a time; fn sees survivors in order.
+template<class F> static void forEachMatching(string_view data, const WhereFilter* w, F&& fn){
+    if(!w){ forEachRecView(data, fn); return; }
+    vector<RecView> batch; batch.reserve(WhereFilter::BATCH);
+    vector<uint32_t> sel;
+    auto drain = [&]{
+        sel.resize(batch.size());
+        for(uint32_t i=0;i<sel.size();++i) sel[i] = i;
+        w->filter(batch, sel);
+        for(uint32_t i: sel) fn(batch[i]);
+        batch.clear();
+    };
+    forEachRecView(data, [&](const RecView& r){ batch.push_back(r); if(batch.size()==WhereFilter::BATCH) drain(); });
+    if(!batch.empty()) drain();
+}
+
+// ===== Per-week aggregates =====
+// aggregates.bin holds materialized per-ISO-week counters for the inbox: total rows and counts per
+// kind, per tag and per domain (names interned once, counters keyed by id). It carries the same
+// size + tail-hash stamp as inbox.bitmaps plus an FNV-1a checksum of the whole file. add/import
+// fold the appended rows in (O(tags) per row); anything else is repaired by a rebuild. With the
+// sharded layout each month shard has its own, inbox/YYYY-MM.tsv.aggregates.
+struct SvHash{ using is_transparent = void; size_t operator()(string_view s) const { return std::hash<string_view>{}(s); } };
+using CountTable = unordered_map<string, uint64_t, SvHash, std::equal_to<>>;
+
+static fs::path aggregatesPath(){ return curateHome()/ "aggregates.bin"; }
+static fs::path aggregatesPathFor(const fs::path& source){
+    if(source==inboxPath()) return aggregatesPath();
+    fs::path p = source; p += ".aggregates"; return p;
+}
+static constexpr char AGG_MAGIC[8] = {'C','U','R','A','G','G','1','\0'};
+
+struct WeekAggregate{ uint64_t total = 0; unordered_map<uint32_t,uint64_t> kind, tag, domain; };
+
+struct InboxAggregates{
+    uint64_t bytes = 0; string tail;
+    vector<string> names;
+    unordered_map<string,uint32_t,SvHash,std::equal_to<>> ids;
+    map<int,WeekAggregate> weeks; // year*100 + week
+
+    uint32_t id(string_view name){
+        auto it = ids.find(name);
+        if(it!=ids.end()) return it->second;
+        names.emplace_back(name); ids.emplace(string(name), uint32_t(names.size()-1));
+        return uint32_t(names.size()-1);
+    }
+
+    void addRow(const RecView& r){
+        if(r.date!=lastDate_){ auto w = isoWeekFromDate(r.date); lastWeek_ = w.year*100 + w.week; lastDate_ = r.date; }
+        WeekAggregate& w = weeks[lastWeek_];
+        ++w.total;
+        string_view k = trimView(r.kind);
+        ++w.kind[id(k.empty()? "(none)" : k)];
+        string host = urlHostKey(r.url);
+        ++w.domain[id(host.empty()? "(none)" : host)];
+        bool any = false; size_t p = 0, n = r.tags.size(); string t;
+        while(p<n){
+            while(p<n && isspace((unsigned char)r.tags[p])) ++p;
+            size_t b = p; while(p<n && !isspace((unsigned char)r.tags[p])) ++p;
+            if(p==b) break;
+            t.clear(); if(r.tags[b]!='#') t += '#';
+            for(size_t c=b;c<p;++c) t += (char)tolower((unsigned char)r.tags[c]);
+            ++w.tag[id(t)]; any = true;
+        }
+        if(!any) ++w.tag[id("(none)")];
+    }
+
+private:
+    sys_days lastDate_{}; int lastWeek_ = 0;
+};
+
+static string serializeAggregates(const InboxAggregates& g){
+    string b(AGG_MAGIC, 8);
+    putU64(b, g.bytes); b += g.tail; b.resize(32, '0');
+    putU32(b, uint32_t(g.names.size()));
+    for(const auto& n: g.names){ putU32(b, uint32_t(n.size())); b += n; }
+    putU32(b, uint32_t(g.weeks.size()));
+    for(const auto& [wk, w]: g.weeks){
+        putU32(b, uint32_t(wk)); putU64(b, w.total);
+        for(const auto* m: {&w.kind, &w.tag, &w.domain}){
+            putU32(b, uint32_t(m->size()));
+            for(const auto& [id, n]: *m){ putU32(b, id); putU64(b, n); }
+        }
+    }
+    putU64(b, Fnv64().add(b).h);
+    return b;
+}
+
+// nullopt when the file is missing, truncated or fails its checksum.
+static optional<InboxAggregates> loadAggregates(const fs::path& file = aggregatesPath()){
+    MappedFile f(file);
+    string_view d = f.view();
+    if(d.size()<48 || memcmp(d.data(), AGG_MAGIC, 8)!=0) return nullopt;
+    if(Fnv64().add(d.substr(0, d.size()-8)).h != getU64(d.data()+d.size()-8)) return nullopt;
+    d.remove_suffix(8);
+    InboxAggregates g; size_t p = 32;
+    auto need = [&](size_t n){ return p+n <= d.size(); };
+    g.bytes = getU64(d.data()+8); g.tail = string(d.substr(16, 16));
+    if(!need(4)) return nullopt;
+    uint32_t nn = getU32(d.data()+p); p += 4;
+    for(uint32_t i=0;i<nn;++i){
+        if(!need(4)) return nullopt;
+        uint32_t len = getU32(d.data()+p); p += 4;
+        if(!need(len)) return nullopt;
+        g.id(d.substr(p, len)); p += len;
+    }
+    if(!need(4)) return nullopt;
+    uint32_t nw = getU32(d.data()+p); p += 4;
+    for(uint32_t i=0;i<nw;++i){
+        if(!need(12)) return nullopt;
+        WeekAggregate& w = g.weeks[int(getU32(d.data()+p))]; w.total = getU64(d.data()+p+4); p += 12;
+        for(auto* m: {&w.kind, &w.tag, &w.domain}){
+            if(!need(4)) return nullopt;
+            uint32_t n = getU32(d.data()+p); p += 4;
+            if(!need(size_t(n)*12)) return nullopt;
+            for(uint32_t k=0;k<n;++k){ uint32_t id = getU32(d.data()+p); if(id>=nn) return nullopt; (*m)[id] = getU64(d.data()+p+4); p += 12; }
+        }
+    }
+    return g;
+}
+
+// Brings the aggregates `file` up to date with `inbox` (a mapped live inbox file): folds in
+// appended rows, or rebuilds when the file is missing, corrupt or stamped for different contents.
+static optional<InboxAggregates> syncAggregates(string_view inbox, bool rebuild, const fs::path& file = aggregatesPath()){
+    optional<InboxAggregates> g;
+    if(!rebuild) g = loadAggregates(file);
+    bool changed = false;
+    if(!g || g->bytes > inbox.size() || tailStamp(inbox, g->bytes)!=g->tail){ g = InboxAggregates{}; changed = true; }
+    size_t pos = size_t(g->bytes); RecView r;
+    while(pos < inbox.size()){
+        const void* nl = memchr(inbox.data()+pos, '\n', inbox.size()-pos);
+        if(!nl) break; // a partial last line waits for its newline
+        size_t end = size_t(static_cast<const char*>(nl) - inbox.data());
+        if(parseRecLine(inbox.substr(pos, end-pos), r)) g->addRow(r);
+        pos = end + 1; changed = true;
+    }
+    if(changed){
+        g->bytes = pos; g->tail = tailStamp(inbox, pos);
+        AtomicFile o(file);
+        o.write(serializeAggregates(*g));
+        if(!o.commit()){ cerr<<"warning: could not write "<< file <<"\n"; }
+    }
+    if(pos < inbox.size()) return nullopt; // rows not covered: callers fall back to a scan
+    return g;
+}
+
+// ===== Approximate sketches (stats --approx) =====
+// Every source file gets a sidecar <file>.sketch holding, per ISO week, HyperLogLogs of the
+// distinct URLs and domains, and for tags and domains a Space-Saving summary (which items are
+// heavy) plus a Count-Min sketch (how heavy). They merge, so a year-scale question combines ~52
+// small sketches per file instead of scanning rows. Archives never change, so their sketches are
+// built once; the inbox's is extended with appended rows like inbox.bitmaps. A week of a few
+// hundred rows touches few registers and counters, so both are stored sparse (index deltas and
+// varints) whenever that is smaller than the dense form; a sketch stays well below its rows' size.
+static bool readVarint(string_view d, size_t& p, uint64_t& v){
+    v = 0;
+    for(int s = 0; s < 64; s += 7){
+        if(p >= d.size()) return false;
+        unsigned char b = (unsigned char)d[p++];
+        v |= uint64_t(b & 0x7F) << s;
+        if(!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+static uint64_t mix64(uint64_t x){ // splitmix64 finalizer: FNV-1a alone is too weak for HLL buckets
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ull; x ^= x >> 27; x *= 0x94d049bb133111ebull; return x ^ (x >> 31);
+}
+
+class HyperLogLog{
+public:
+    static constexpr int P = 12;
+    static constexpr size_t M = size_t(1) << P; // 4096 registers: ~1.6% standard error
+
+    HyperLogLog(): reg_(M, 0){}
+    void add(string_view s){
+        uint64_t h = mix64(Fnv64().add(s).h);
+        size_t idx = size_t(h >> (64-P));
+        uint8_t rho = uint8_t(std::countl_zero((h << P) | (uint64_t(1) << (P-1))) + 1);
+        if(rho > reg_[idx]) reg_[idx] = rho;
+    }
+    void merge(const HyperLogLog& o){ for(size_t i=0;i<M;++i) reg_[i] = std::max(reg_[i], o.reg_[i]); }
+    double estimate() const {
+        double sum = 0; size_t zeros = 0;
+        for(uint8_t r: reg_){ sum += std::ldexp(1.0, -int(r)); zeros += r==0; }
+        double m = double(M), e = 0.7213 / (1.0 + 1.079/m) * m * m / sum;
+        if(e <= 2.5*m && zeros) e = m * std::log(m / double(zeros)); // linear counting for small sets
+        return e;
+    }
+    static double relativeError(){ return 1.04 / std::sqrt(double(M)); }
+
+    // 0 + M register bytes, or 1 + count + (index delta, register) pairs for the non-zero ones.
+    void serialize(string& b) const {
+        string sp(1, '\1'); size_t nz = 0, prev = 0;
+        for(size_t i=0;i<M;++i) if(reg_[i]) ++nz;
+        putVarint(sp, nz);
+        for(size_t i=0;i<M && sp.size() < M;++i) if(reg_[i]){ putVarint(sp, i - prev); sp += char(reg_[i]); prev = i; }
+        if(sp.size() < M){ b += sp; return; }
+        b += '\0'; b.append(reinterpret_cast<const char*>(reg_.data()), M);
+    }
+    bool load(string_view d, size_t& p){
+        if(p >= d.size()) return false;
+        char kind = d[p++];
+        if(kind==0){
+            if(p + M > d.size()) return false;
+            memcpy(reg_.data(), d.data()+p, M); p += M;
+            return true;
+        }
+        uint64_t nz, idx = 0, delta;
+        if(kind!=1 || !readVarint(d, p, nz) || nz > M) return false;
+        for(uint64_t k=0;k<nz;++k){
+            if(!readVarint(d, p, delta) || p >= d.size()) return false;
+            idx += delta;
+            if(idx >= M) return false;
+            reg_[size_t(idx)] = uint8_t(d[p++]);
+        }
+        return true;
+    }
+
+private:
+    vector<uint8_t> reg_;
+};
+
+// Space-Saving with K counters: each kept count overestimates the true one by at most its err,
+// and any item with more than n/K of the rows is guaranteed to be kept.
+class SpaceSaving{
+public:
+    static constexpr size_t K = 64;
+    struct Counter{ uint64_t count = 0, err = 0; };
+
+    void add(string_view key){
+        ++total_;
+        if(auto it = c_.find(key); it!=c_.end()){ ++it->second.count; return; }
+        if(c_.size() < K){ c_.emplace(string(key), Counter{1, 0}); return; }
+        auto mn = std::min_element(c_.begin(), c_.end(), [](const auto& x, const auto& y){ return x.second.count < y.second.count; });
+        Counter c{mn->second.count + 1, mn->second.count};
+        c_.erase(mn);
+        c_.emplace(string(key), c);
+    }
+
+    // [low, high] for the true count of `key` in this summary's rows; a key that was not kept can
+    // have had at most the smallest kept count (0 while the summary is not full).
+    pair<uint64_t,uint64_t> bounds(string_view key) const {
+        if(auto it = c_.find(key); it!=c_.end()) return {it->second.count - it->second.err, it->second.count};
+        if(c_.size() < K) return {0, 0};
+        uint64_t mn = UINT64_MAX;
+        for(const auto& [k,c]: c_) mn = std::min(mn, c.count);
+        return {0, mn};
+    }
+    template<class F> void forEachKey(F&& f) const { for(const auto& [k,c]: c_) f(string_view(k)); }
+    uint64_t total() const { return total_; }
+
+    void serialize(string& b) const {
+        putVarint(b, total_); putVarint(b, c_.size());
+        for(const auto& [k,c]: c_){ putVarint(b, k.size()); b += k; putVarint(b, c.count); putVarint(b, c.err); }
+    }
+    bool load(string_view d, size_t& p){
+        uint64_t n, len, count, err;
+        if(!readVarint(d, p, total_) || !readVarint(d, p, n) || n > K) return false;
+        for(uint64_t i=0;i<n;++i){
+            if(!readVarint(d, p, len) || len > d.size()-p) return false;
+            string k(d.substr(p, size_t(len))); p += size_t(len);
+            if(!readVarint(d, p, count) || !readVarint(d, p, err)) return false;
+            c_.emplace(std::move(k), Counter{count, err});
+        }
+        return true;
+    }
+
+private:
+    unordered_map<string,Counter,SvHash,std::equal_to<>> c_;
+    uint64_t total_ = 0;
+};
+
+// Count-Min with D rows of W counters: estimate() never undercounts, and overcounts by more than
+// e/W of the rows with probability at most e^-D. Sketches of the same shape merge by addition.
+class CountMin{
+public:
+    static constexpr size_t W = 1024, D = 4;
+
+    CountMin(): c_(W*D, 0){}
+    void add(string_view key){ uint64_t h = Fnv64().add(key).h; for(size_t i=0;i<D;++i) ++c_[i*W + slot(h, i)]; }
+    uint64_t estimate(string_view key) const {
+        uint64_t h = Fnv64().add(key).h, e = UINT64_MAX;
+        for(size_t i=0;i<D;++i) e = std::min<uint64_t>(e, c_[i*W + slot(h, i)]);
+        return e;
+    }
+    void merge(const CountMin& o){ for(size_t i=0;i<c_.size();++i) c_[i] += o.c_[i]; }
+    static double epsilon(){ return std::exp(1.0) / double(W); }
+
+    // Counters as varints: 0 + all of them, or 1 + count + (index delta, counter) for the non-zero ones.
+    void serialize(string& b) const {
+        string sp(1, '\1'); size_t nz = 0, prev = 0;
+        for(uint32_t v: c_) if(v) ++nz;
+        putVarint(sp, nz);
+        for(size_t i=0;i<c_.size();++i) if(c_[i]){ putVarint(sp, i - prev); putVarint(sp, c_[i]); prev = i; }
+        string dn(1, '\0');
+        for(uint32_t v: c_) putVarint(dn, v);
+        b += sp.size() < dn.size()? sp : dn;
+    }
+    bool load(string_view d, size_t& p){
+        if(p >= d.size()) return false;
+        char kind = d[p++];
+        uint64_t v;
+        if(kind==0){
+            for(auto& x: c_){ if(!readVarint(d, p, v) || v > UINT32_MAX) return false; x = uint32_t(v); }
+            return true;
+        }
+        uint64_t nz, idx = 0;
+        if(kind!=1 || !readVarint(d, p, nz) || nz > c_.size()) return false;
+        for(uint64_t k=0;k<nz;++k){
+            if(!readVarint(d, p, v)) return false;
+            idx += v;
+            if(idx >= c_.size() || !readVarint(d, p, v) || v > UINT32_MAX) return false;
+            c_[size_t(idx)] = uint32_t(v);
+        }
+        return true;
+    }
+
+private:
+    static size_t slot(uint64_t h, size_t i){ return size_t(mix64(h + 0x9e3779b97f4a7c15ull*(i+1)) % W); }
+    vector<uint32_t> c_;
+};
+
+struct WeekSketch{ uint64_t rows = 0; HyperLogLog urls, domains; SpaceSaving tags, hosts; CountMin tagCounts, hostCounts; };
+
+struct SourceSketch{
+    uint64_t bytes = 0; string tail;
+    map<int,WeekSketch> weeks; // year*100 + week
+
+    void addRow(const RecView& r){
+        if(r.date!=lastDate_){ auto w = isoWeekFromDate(r.date); lastWeek_ = w.year*100 + w.week; lastDate_ = r.date; }
+        WeekSketch& w = weeks[lastWeek_];
+        ++w.rows;
+        w.urls.add(trimView(r.url));
+        string host = urlHostKey(r.url);
+        if(!host.empty()){ w.domains.add(host); w.hosts.add(host); w.hostCounts.add(host); }
+        size_t p = 0, n = r.tags.size(); string t;
+        while(p<n){
+            while(p<n && isspace((unsigned char)r.tags[p])) ++p;
+            size_t b = p; while(p<n && !isspace((unsigned char)r.tags[p])) ++p;
+            if(p==b) break;
+            t.clear(); if(r.tags[b]!='#') t += '#';
+            for(size_t c=b;c<p;++c) t += (char)tolower((unsigned char)r.tags[c]);
+            w.tags.add(t); w.tagCounts.add(t);
+        }
+    }
+
+private:
+    sys_days lastDate_{}; int lastWeek_ = 0;
+};
+
+static constexpr char SKT_MAGIC[8] = {'C','U','R','S','K','T','2','\0'};
+static fs::path sketchPath(const fs::path& source){ fs::path p = source; p += ".sketch"; return p; }
+
+static optional<SourceSketch> loadSketch(const fs::path& p){
+    MappedFile f(p);
+    string_view d = f.view();
+    if(d.size()<44 || memcmp(d.data(), SKT_MAGIC, 8)!=0) return nullopt;
+    if(Fnv64().add(d.substr(0, d.size()-8)).h != getU64(d.data()+d.size()-8)) return nullopt;
+    d.remove_suffix(8);
+    SourceSketch s; s.bytes = getU64(d.data()+8); s.tail = string(d.substr(16, 16));
+    uint32_t nw = getU32(d.data()+32); size_t p2 = 36;
+    for(uint32_t i=0;i<nw;++i){
+        if(p2 + 12 > d.size()) return nullopt;
+        WeekSketch& w = s.weeks[int(getU32(d.data()+p2))]; w.rows = getU64(d.data()+p2+4); p2 += 12;
+        if(!w.urls.load(d, p2) || !w.domains.load(d, p2)) return nullopt;
+        if(!w.tags.load(d, p2) || !w.hosts.load(d, p2) || !w.tagCounts.load(d, p2) || !w.hostCounts.load(d, p2)) return nullopt;
+    }
+    if(p2!=d.size()) return nullopt;
+    return s;
+}
+
+static bool saveSketch(const fs::path& p, const SourceSketch& s){
+    string b(SKT_MAGIC, 8);
+    putU64(b, s.bytes); b += s.tail; b.resize(32, '0');
+    putU32(b, uint32_t(s.weeks.size()));
+    for(const auto& [wk, w]: s.weeks){
+        putU32(b, uint32_t(wk)); putU64(b, w.rows);
+        w.urls.serialize(b); w.domains.serialize(b);
+        w.tags.serialize(b); w.hosts.serialize(b); w.tagCounts.serialize(b); w.hostCounts.serialize(b);
+    }
+    putU64(b, Fnv64().add(b).h);
+    AtomicFile o(p);
+    o.write(b);
+    return o.commit();
+}
+
+// The sketch for `source`, extended with appended rows or rebuilt when stale.
+static SourceSketch syncSketch(const fs::path& source){
+    MappedFile f(source);
+    string_view d = f.view();
+    auto s = loadSketch(sketchPath(source));
+    bool changed = false;
+    if(!s || s->bytes > d.size() || tailStamp(d, s->bytes)!=s->tail){ s = SourceSketch{}; changed = true; }
+    size_t pos = size_t(s->bytes); RecView r;
+    while(pos < d.size()){
+        const void* nl = memchr(d.data()+pos, '\n', d.size()-pos);
+        if(!nl) break;
+        size_t end = size_t(static_cast<const char*>(nl) - d.data());
+        if(parseRecLine(d.substr(pos, end-pos), r)) s->addRow(r);
+        pos = end + 1; changed = true;
+    }
+    if(changed){
+        s->bytes = pos; s->tail = tailStamp(d, pos);
+        if(!saveSketch(sketchPath(source), *s)) cerr<<"warning: could not write "<< sketchPath(source) <<"\n";
+    }
+    if(pos < d.size() && parseRecLine(d.substr(pos), r)) s->addRow(r);
+    return std::move(*s);
+}
+
+// Keeps an existing full-text index and each live inbox file's existing bitmaps, aggregates and
+// sketch in step after rows were appended; none of them is created here.
+static void refreshIndexesAfterAppend(){
+    if(syncIndex(false, false)==IndexUpdate::failed) cerr<<"warning: could not update "<< indexDir() <<" (run `curate index --rebuild`)\n";
+    for(const auto& p: inboxFiles()){
+        if(fileExists(sketchPath(p))) syncSketch(p);
+        bool bitmaps = fileExists(bitmapsPathFor(p)), aggregates = fileExists(aggregatesPathFor(p));
+        if(!bitmaps && !aggregates) continue;
+        MappedFile inbox(p);
+        if(bitmaps) syncInboxBitmaps(inbox.view(), bitmapsPathFor(p));
+        if(aggregates) syncAggregates(inbox.view(), false, aggregatesPathFor(p));
+    }
+}
+
+// ===== Filtering =====
+static void sortByDate(vector<Rec>& rows){
+    stable_sort(rows.begin(), rows.end(), [](const Rec& x, const Rec& y){ return x.date<y.date; });
+}
+
+// `sorted`: `all` is known to be in date order (see InboxBitmaps::sorted), so the range is found
+// by binary search and nothing needs sorting.
+static vector<Rec> filterByDateRange(const vector<Rec>& all, sys_days a, sys_days b, bool sorted = false){
+    if(sorted){
+        auto lo = std::lower_bound(all.begin(), all.end(), a, [](const Rec& r, sys_days d){ return r.date < d; });
+        auto hi = std::upper_bound(lo, all.end(), b, [](sys_days d, const Rec& r){ return d < r.date; });
+        return vector<Rec>(lo, hi);
+    }
+    vector<Rec> out; for(const auto& r: all){ if(r.date>=a && r.date<=b) out.push_back(r); }
+    sortByDate(out);
+    return out;
+}
+
+// ===== Rendering =====
+static string readFileOrEmpty(const fs::path& p){
+    if(!fileExists(p)) return "";
+    std::ifstream in(p); std::ostringstream ss; ss<< in.rdbuf(); return ss.str();
+}
+
+struct RenderOpts{ bool groupTags=false; bool tagsOnly=false; bool includeHeader=true; bool html=false; string headerText; string rangeLabel; size_t pageSize=0; };
+
+// New format (no date): - [domain](url) — *kind* — Title — #Tag1 #Tag2
+static string recLineMarkdown(const Rec& r){
+    string dom  = urlDomain(r.url);
+    string kind = r.kind;
+    string t    = trim(r.title);
+    std::ostringstream oss;
+    oss << "- [" << dom << "](" << r.url << ") — *" << kind << "*";
+    if(!t.empty()) oss << " — " << t;
+    vector<string> tags = splitTags(r.tags);
+    if(!tags.empty()){
+        oss << " — ";
+        for(size_t i=0;i<tags.size(); ++i){
+            if(i) oss << ' ';
+            oss << normalizeTagDisplayOne(tags[i]); // keeps leading #
+        }
+    }
+    return oss.str();
+}
+
+// Streaming digest output: Markdown text goes in (in any chunking), bytes come out through `out`.
+// With html=true each completed Markdown line is converted as it arrives, so no stage holds
+// the whole document.
+
+class DigestWriter{
+public:
+    // document=false emits a bare HTML fragment (no <html>/<body> wrapper), e.g. for feed entry content.
+    DigestWriter(ByteSink out, bool html, bool document=true): out_(std::move(out)), html_(html), document_(document){
+        if(html_ && document_) out_("<!doctype html><html><meta charset=\"utf-8\"><meta name=\"viewport\" content=\"width=device-width,initial-scale=1\"><title>Digest</title><style>body{max-width:820px;margin:2rem auto;padding:0 1rem;font:16px/1.5 system-ui,Segoe UI,Roboto,Helvetica,Arial,sans-serif}code,pre{font:13px ui-monospace,Consolas,Menlo,monospace}h1,h2,h3{line-height:1.2}ul{padding-left:1.2rem}</style><body>");
+    }
+
+    void md(string_view s){
+        if(!html_){ out_(s); return; }
+        size_t nl;
+        while((nl = s.find('\n')) != string_view::npos){
+            pending_.append(s.data(), nl); htmlLine(pending_); pending_.clear();
+            s.remove_prefix(nl+1);
+        }
+        pending_.append(s.data(), s.size());
+    }
+
+    // Pre-built HTML (navigation, index tables); only meaningful in html mode.
+    void raw(string_view html){
+        if(!pending_.empty()){ htmlLine(pending_); pending_.clear(); }
+        flushList(); out_(html);
+    }
+
+    void finish(){
+        if(!html_) return;
+        if(!pending_.empty()){ htmlLine(pending_); pending_.clear(); }
+        flushList(); if(document_) out_("</body></html>");
+    }
+
+private:
+    void flushList(){ if(inList_){ out_("</ul>"); inList_=false; } }
+
+    static string convert(string x){
+        static const std::regex LINK(R"(\[([^\]]+)\]\(([^)]+)\))");
+        static const std::regex EM(R"(\*([^*]+)\*)");
+        x = std::regex_replace(x, LINK, string(R"(<a href="$2" target="_blank">$1</a>)"));
+        x = std::regex_replace(x, EM, string("<em>$1</em>"));
+        return x;
+    }
+
+    void tagged(const char* open, const string& body, const char* close){ out_(open); out_(body); out_(close); }
+
+    void htmlLine(const string& line){
+        string s = trim(line);
+        if(s.rfind("# ",0)==0){ flushList(); tagged("<h1>", s.substr(2), "</h1>"); return; }
+        if(s.rfind("## ",0)==0){ flushList(); tagged("<h2>", s.substr(3), "</h2>"); return; }
+        if(s.rfind("### ",0)==0){ flushList(); tagged("<h3>", s.substr(4), "</h3>"); return; }
+        if(s.rfind("- ",0)==0){
+            if(!inList_){ out_("<ul>"); inList_=true; }
+            tagged("<li>", convert(s.substr(2)), "</li>");
+            return;
+        }
+        if(s.empty()){ flushList(); out_("<p></p>"); return; }
+        flushList(); tagged("<p>", convert(s), "</p>");
+    }
+
+    ByteSink out_;
+    bool html_, document_;
+    bool inList_ = false;
+    string pending_;
+};
+
+static void renderGroupedByTagsMarkdown(const vector<Rec>& rows, DigestWriter& out){
+    map<string, vector<const Rec*>> byTag;
+    for(const auto& r: rows){
+        for(auto &t: splitTags(r.tags)){
+            string disp = normalizeTagDisplayOne(t);
+            if(!disp.empty()) byTag[disp].push_back(&r);
+        }
+    }
+    out.md("## By Tag\n\n");
+    for(const auto& [tag, list]: byTag){
+        out.md("### "); out.md(tag); out.md("\n");
+        for(const auto* pr: list){ out.md(recLineMarkdown(*pr)); out.md("\n"); }
+        out.md("\n");
+    }
+    if(byTag.empty()) out.md("(No tags in range)\n");
+}
+
+// ===== Digest manifest =====
+// digests/.manifest.tsv maps each digest file name to the hash of everything that shaped it:
+// its input rows, the header template, the render options and CURATE_VERSION.
+static fs::path digestManifestPath(){ return digestsDir()/ ".manifest.tsv"; }
+
+static map<string,string> loadDigestManifest(){
+    map<string,string> m;
+    ifstream in(digestManifestPath());
+    string line;
+    while(getline(in,line)){
+        if(line.empty() || line[0]=='#') continue;
+        auto cols = splitTabs(line);
+        if(cols.size()>=2) m[cols[0]] = cols[1];
+    }
+    return m;
+}
+
+static bool saveDigestManifest(const map<string,string>& m){
+    AtomicFile o(digestManifestPath());
+    o.write("# digest\tinput-hash\n");
+    for(const auto& [k,v]: m){ o.write(k); o.write("\t"); o.write(v); o.write("\n"); }
+    return o.commit();
+}
+
+static string digestInputHash(const vector<Rec>& rows, const RenderOpts& ro){
+    Fnv64 f;
+    f.field(CURATE_VERSION);
+    f.field(ro.groupTags?"g":"-").field(ro.tagsOnly?"t":"-").field(ro.includeHeader?"h":"-").field(ro.html?"html":"md");
+    f.field(ro.rangeLabel);
+    if(ro.pageSize) f.field("pages:" + to_string(ro.pageSize));
+    if(ro.includeHeader) f.field(ro.headerText);
+    for(const auto& r: rows) f.field(fmtDate(r.date)).field(r.kind).field(r.url).field(r.title).field(r.tags);
+    return hex64(f.h);
+}
+
+static void renderDigest(const vector<Rec>& rows, const RenderOpts& ro, DigestWriter& out){
+    if(ro.includeHeader && !ro.headerText.empty()){
+        out.md(ro.headerText);
+        if(ro.headerText.back()!='\n') out.md("\n");
+        out.md("\n");
+    }
+    if(!ro.tagsOnly){
+        out.md("# All Items "); out.md(ro.rangeLabel); out.md("\n\n");
+        for(const auto& r: rows){ out.md(recLineMarkdown(r)); out.md("\n"); }
+        out.md("\n");
+    }
+    if(ro.groupTags || ro.tagsOnly){ renderGroupedByTagsMarkdown(rows, out); }
+    out.finish();
+}
+
+// ===== Paginated HTML =====
+// --page-size N: <base>.html becomes a small index (header + page list) and the items go to
+// <base>-p001.html, <base>-p002.html, ... with prev/next links. Each page streams to its own
+// file as it is rendered.
+static fs::path digestPagePath(const fs::path& indexPath, size_t page, size_t pages){
+    int width = std::max<int>(3, int(to_string(pages).size()));
+    std::ostringstream oss; oss << indexPath.stem().string() << "-p" << setw(width) << setfill('0') << page << indexPath.extension().string();
+    return indexPath.parent_path() / oss.str();
+}
+
+static void removeStalePages(const fs::path& indexPath, size_t pages){
+    // Pages left over from an earlier run that had more of them.
+    std::error_code ec;
+    string prefix = indexPath.stem().string() + "-p", ext = indexPath.extension().string();
+    fs::path dir = indexPath.parent_path().empty()? fs::path(".") : indexPath.parent_path();
+    for(const auto& e: fs::directory_iterator(dir, ec)){
+        string n = e.path().filename().string();
+        if(n.size() <= prefix.size()+ext.size() || n.compare(0, prefix.size(), prefix)!=0 || e.path().extension()!=ext) continue;
+        string num = n.substr(prefix.size(), n.size()-prefix.size()-ext.size());
+        if(num.empty() || !all_of(num.begin(), num.end(), [](char c){ return isdigit((unsigned char)c); })) continue;
+        if(stoull(num) > pages) fs::remove(e.path(), ec);
+    }
+}
+
+static bool writePagedDigest(const fs::path& indexPath, const vector<Rec>& rows, const RenderOpts& ro, bool& unchanged){
+    size_t ps = ro.pageSize, pages = std::max<size_t>(1, (rows.size() + ps - 1) / ps);
+    unchanged = true;
+    auto commit = [&](AtomicFile& f, const fs::path& p){
+        if(!f.commit()){ cerr<<"Failed to write "<< p <<": "<< f.error() <<"\n"; return false; }
+        unchanged = unchanged && f.unchanged();
+        return true;
+    };
+
+    for(size_t p=1; p<=pages; ++p){
+        size_t lo = (p-1)*ps, hi = std::min(rows.size(), p*ps);
+        vector<Rec> slice(rows.begin()+long(lo), rows.begin()+long(hi));
+        fs::path path = digestPagePath(indexPath, p, pages);
+        AtomicFile f(path);
+        DigestWriter w([&](string_view s){ f.write(s); }, true);
+        std::ostringstream nav;
+        nav << "<nav>";
+        if(p>1) nav << "<a href=\"" << digestPagePath(indexPath, p-1, pages).filename().string() << "\">&larr; Prev</a> · ";
+        nav << "<a href=\"" << indexPath.filename().string() << "\">Index</a>";
+        if(p<pages) nav << " · <a href=\"" << digestPagePath(indexPath, p+1, pages).filename().string() << "\">Next &rarr;</a>";
+        nav << "</nav>";
+        w.raw(nav.str());
+        string heading = ro.rangeLabel + " — page " + to_string(p) + " of " + to_string(pages);
+        if(!ro.tagsOnly){
+            w.md("# All Items "); w.md(heading); w.md("\n\n");
+            for(const auto& r: slice){ w.md(recLineMarkdown(r)); w.md("\n"); }
+            w.md("\n");
+        } else {
+            w.md("# "); w.md(heading); w.md("\n\n");
+        }
+        if(ro.groupTags || ro.tagsOnly) renderGroupedByTagsMarkdown(slice, w);
+        w.raw(nav.str());
+        w.finish();
+        if(!commit(f, path)) return false;
+    }
+
+    AtomicFile f(indexPath);
+    DigestWriter w([&](string_view s){ f.write(s); }, true);
+    if(ro.includeHeader && !ro.headerText.empty()){
+        w.md(ro.headerText);
+        if(ro.headerText.back()!='\n') w.md("\n");
+        w.md("\n");
+    }
+    w.md("# "); w.md(ro.rangeLabel); w.md("\n\n");
+    w.md(to_string(rows.size()) + " items on " + to_string(pages) + (pages==1? " page" : " pages") + "\n");
+    std::ostringstream idx; idx << "<ol>";
+    for(size_t p=1; p<=pages; ++p){
+        size_t lo = (p-1)*ps, hi = std::min(rows.size(), p*ps);
+        idx << "<li><a href=\"" << digestPagePath(indexPath, p, pages).filename().string() << "\">Page " << p << "</a>";
+        if(hi>lo) idx << " — " << fmtDate(rows[lo].date) << " to " << fmtDate(rows[hi-1].date) << " (" << (hi-lo) << ((hi-lo)==1? " item)" : " items)");
+        idx << "</li>";
+    }
+    idx << "</ol>";
+    w.raw(idx.str());
+    w.finish();
+    if(!commit(f, indexPath)) return false;
+    removeStalePages(indexPath, pages);
+    return true;
+}
+
+// ===== Atom / RSS feeds =====
+// A feed is assembled from per-week entry fragments cached in digests/.feed/ and tracked in the
+// digest manifest: only weeks whose rows changed are re-rendered, the rest are copied byte-for-byte.
+enum class FeedFormat { atom, rss };
+
+static void xmlEscapeTo(const ByteSink& out, string_view s){
+    size_t run = 0;
+    for(size_t i=0;i<s.size();++i){
+        unsigned char c = (unsigned char)s[i];
+        string_view rep;
+        if(c>=0x80){
+            size_t n = utf8SeqLen(s, i);
+            if(n){ i += n-1; continue; }
+            rep = kReplacementChar; // one bad byte would make the whole feed not well-formed
+        }
+        else switch(c){
+            case '&': rep="&amp;"; break; case '<': rep="&lt;"; break; case '>': rep="&gt;"; break;
+            case '"': rep="&quot;"; break; case '\'': rep="&apos;"; break;
+            default: if(c<0x20 && c!='\t' && c!='\n' && c!='\r') rep=" "; // not allowed in XML 1.0
+        }
+        if(rep.empty()) continue;
+        if(i>run) out(s.substr(run, i-run));
+        out(rep); run = i+1;
+    }
+    if(run<s.size()) out(s.substr(run));
+}
+
+static string xmlEscape(string_view s){ string o; xmlEscapeTo([&](string_view x){ o.append(x.data(), x.size()); }, s); return o; }
+
+static string fmtRfc3339(sys_days d){ return fmtDate(d) + "T00:00:00Z"; }
+
+static string fmtRfc822(sys_days d){
+    using namespace std::chrono;
+    static const char* WD[] = {"Sun","Mon","Tue","Wed","Thu","Fri","Sat"};
+    static const char* MO[] = {"Jan","Feb","Mar","Apr","May","Jun","Jul","Aug","Sep","Oct","Nov","Dec"};
+    year_month_day ymd(d); weekday wd{d};
+    char buf[64]; snprintf(buf, sizeof(buf), "%s, %02u %s %d 00:00:00 +0000", WD[wd.c_encoding()], unsigned(ymd.day()), MO[unsigned(ymd.month())-1], int(ymd.year()));
+    return buf;
+}
+
+static string itemTitle(const Rec& r){ string t = trim(r.title); return t.empty()? urlDomain(r.url) : t; }
+
+struct FeedOpts{ FeedFormat format = FeedFormat::atom; bool perPeriod=false; string siteUrl; string label; };
+
+static const char* feedExt(FeedFormat f){ return f==FeedFormat::atom? ".atom" : ".rss"; }
+
+static void renderFeedEntry(const ByteSink& out, const FeedOpts& fo, const string& title, const string& link, const string& id, sys_days updated, const vector<string>& tags, const function<void(const ByteSink&)>& htmlBody){
+    auto esc = [&](string_view s){ xmlEscapeTo(out, s); };
+    if(fo.format==FeedFormat::atom){
+        out("  <entry>\n    <title>"); esc(title); out("</title>\n");
+        if(!link.empty()){ out("    <link href=\""); esc(link); out("\"/>\n"); }
+        out("    <id>"); esc(id); out("</id>\n    <updated>"); out(fmtRfc3339(updated)); out("</updated>\n");
+        for(const auto& t: tags){ out("    <category term=\""); esc(t); out("\"/>\n"); }
+        out("    <content type=\"html\">"); htmlBody(esc); out("</content>\n  </entry>\n");
+    } else {
+        out("  <item>\n    <title>"); esc(title); out("</title>\n");
+        if(!link.empty()){ out("    <link>"); esc(link); out("</link>\n"); }
+        out("    <guid isPermaLink=\"false\">"); esc(id); out("</guid>\n    <pubDate>"); out(fmtRfc822(updated)); out("</pubDate>\n");
+        for(const auto& t: tags){ out("    <category>"); esc(t); out("</category>\n"); }
+        out("    <description>"); htmlBody(esc); out("</description>\n  </item>\n");
+    }
+}
+
+// Entries for one week, newest first.
+static void renderFeedFragment(const ByteSink& out, const vector<Rec>& rows, const string& weekLabel, const FeedOpts& fo){
+    if(rows.empty()) return;
+    if(fo.perPeriod){
+        string link = fo.siteUrl.empty()? string() : fo.siteUrl + "/" + defaultDigestPath(weekLabel, true).filename().string();
+        set<string> tagSet; for(const auto& r: rows) for(auto& t: splitTags(r.tags)) tagSet.insert(normalizeTagDisplayOne(t));
+        string title = "Digest " + weekLabel + " (" + to_string(rows.size()) + (rows.size()==1? " item)" : " items)");
+        renderFeedEntry(out, fo, title, link, "urn:curate:period:" + weekLabel, rows.back().date, vector<string>(tagSet.begin(), tagSet.end()),
+            [&](const ByteSink& esc){
+                DigestWriter w(esc, true, false);
+                for(const auto& r: rows){ w.md(recLineMarkdown(r)); w.md("\n"); }
+                w.finish();
+            });
+        return;
+    }
+    for(auto it = rows.rbegin(); it != rows.rend(); ++it){
+        const Rec& r = *it;
+        vector<string> tags; for(auto& t: splitTags(r.tags)) tags.push_back(normalizeTagDisplayOne(t));
+        string id = "urn:curate:item:" + hex64(Fnv64().field(fmtDate(r.date)).field(r.url).h);
+        renderFeedEntry(out, fo, itemTitle(r), r.url, id, r.date, tags, [&](const ByteSink& esc){
+            DigestWriter w(esc, true, false);
+            w.md(recLineMarkdown(r)); w.md("\n");
+            w.finish();
+        });
+    }
+}
+
+static void renderFeedHead(const ByteSink& out, const FeedOpts& fo, sys_days updated){
+    string title = "Digest " + fo.label;
+    string site = fo.siteUrl.empty()? string("https://github.com/simulacra10/penless-curation") : fo.siteUrl;
+    out("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
+    if(fo.format==FeedFormat::atom){
+        out("<feed xmlns=\"http://www.w3.org/2005/Atom\">\n  <title>"); out(xmlEscape(title)); out("</title>\n");
+        out("  <link href=\""); out(xmlEscape(site)); out("\"/>\n");
+        out("  <id>urn:curate:feed:"); out(xmlEscape(fo.label)); out(fo.perPeriod? ":periods" : ""); out("</id>\n");
+        out("  <updated>"); out(fmtRfc3339(updated)); out("</updated>\n");
+        out("  <author><name>Penless Curation</name></author>\n  <generator>curate "); out(CURATE_VERSION); out("</generator>\n");
+    } else {
+        out("<rss version=\"2.0\">\n<channel>\n  <title>"); out(xmlEscape(title)); out("</title>\n");
+        out("  <link>"); out(xmlEscape(site)); out("</link>\n");
+        out("  <description>"); out(xmlEscape(title)); out("</description>\n");
+        out("  <lastBuildDate>"); out(fmtRfc822(updated)); out("</lastBuildDate>\n  <generator>curate "); out(CURATE_VERSION); out("</generator>\n");
+    }
+}
+
+static void renderFeedTail(const ByteSink& out, const FeedOpts& fo){ out(fo.format==FeedFormat::atom? "</feed>\n" : "</channel>\n</rss>\n"); }
+
+static bool copyFileTo(const fs::path& p, const ByteSink& out){
+    int fd = fdOpenRead(p); if(fd<0) return false;
+    char buf[64*1024]; long n;
+    while((n = fdRead(fd, buf, sizeof(buf))) > 0) out(string_view(buf, size_t(n)));
+    fdClose(fd);
+    return n==0;
+}
+
+// Renders straight into an AtomicFile; sets `unchanged` when the bytes on disk already matched.
+static bool writeDigestFile(const fs::path& outPath, const vector<Rec>& rows, const RenderOpts& ro, bool& unchanged){
+    if(ro.pageSize) return writePagedDigest(outPath, rows, ro, unchanged);
+    AtomicFile f(outPath);
+    DigestWriter w([&](string_view s){ f.write(s); }, ro.html);
+    renderDigest(rows, ro, w);
+    if(!f.commit()){ cerr<<"Failed to write "<< outPath <<": "<< f.error() <<"\n"; return false; }
+    unchanged = f.unchanged();
+    return true;
+}
+
+// ===== Aggregation (stats) =====
+// Group-by counts over the inbox (and archives): every file is cut into line-aligned chunks,
+// each chunk is counted into its own hash table on the pool, and the partial tables are merged
+// once at the end, so the scan scales with the number of cores.
+enum class StatDim { kind, domain, tag, week, month };
+
+static const char* statDimName(StatDim d){
+    static const char* N[] = {"kind","domain","tag","week","month"};
+    return N[int(d)];
+}
+
+static optional<vector<StatDim>> parseStatDims(const string& s){
+    vector<StatDim> dims; size_t b = 0;
+    while(b<=s.size()){
+        size_t e = s.find(',', b); if(e==string::npos) e = s.size();
+        string d = toLower(trim(s.substr(b, e-b)));
+        if(d=="kind") dims.push_back(StatDim::kind);
+        else if(d=="domain") dims.push_back(StatDim::domain);
+        else if(d=="tag") dims.push_back(StatDim::tag);
+        else if(d=="week") dims.push_back(StatDim::week);
+        else if(d=="month") dims.push_back(StatDim::month);
+        else return nullopt;
+        b = e + 1;
+    }
+    if(dims.empty()) return nullopt;
+    return dims;
+}
+
+// Counts one chunk. Keys join the dimension values with TABs; a row with several tags counts
+// once per tag, and a missing value is "(none)".
+class StatCounter{
+public:
+    explicit StatCounter(const vector<StatDim>& dims): dims_(dims){}
+
+    void add(const RecView& r){
+        key_.clear();
+        addFrom(0, r);
+    }
+    CountTable& table(){ return t_; }
+
+private:
+    void addFrom(size_t i, const RecView& r){
+        if(i==dims_.size()){
+            auto it = t_.find(string_view(key_));
+            if(it==t_.end()) t_.emplace(key_, 1); else ++it->second;
+            return;
+        }
+        size_t mark = key_.size();
+        if(i) key_ += '\t';
+        switch(dims_[i]){
+            case StatDim::kind: { string_view k = trimView(r.kind); key_ += k.empty()? "(none)" : k; break; }
+            case StatDim::domain: { string h = urlHostKey(r.url); key_ += h.empty()? "(none)" : h; break; }
+            case StatDim::month: key_ += r.dateText.substr(0, 7); break;
+            case StatDim::week:
+                if(r.date!=weekDate_){ auto w = isoWeekFromDate(r.date); week_ = fmtISOWeek(w.year, w.week); weekDate_ = r.date; }
+                key_ += week_; break;
+            case StatDim::tag: {
+                bool any = false; size_t p = 0, n = r.tags.size(), at = key_.size();
+                while(p<n){
+                    while(p<n && isspace((unsigned char)r.tags[p])) ++p;
+                    size_t b = p; while(p<n && !isspace((unsigned char)r.tags[p])) ++p;
+                    if(p==b) break;
+                    key_.resize(at);
+                    if(r.tags[b]!='#') key_ += '#';
+                    for(size_t c=b;c<p;++c) key_ += (char)tolower((unsigned char)r.tags[c]);
+                    addFrom(i+1, r); any = true;
+                }
+                key_.resize(at);
+                if(!any){ key_ += "(none)"; addFrom(i+1, r); }
+                key_.resize(mark);
+                return;
+            }
+        }
+        addFrom(i+1, r);
+        key_.resize(mark);
+    }
+
+    const vector<StatDim>& dims_;
+    CountTable t_;
+    string key_, week_;
+    sys_days weekDate_{};
+};
+
+// ===== HTTP client (titles fill, check-links) =====
+// A small event-driven HTTP/1.1 client: one non-blocking socket per request in flight, driven by
+// epoll (poll elsewhere), with a global cap on requests in flight, a per-host cap for politeness
+// and an optional global rate limit. A finished keep-alive connection is parked and reused for
+// the next request to the same host; `titleOnly` requests stop reading once </title> has arrived.
+// `rangeFallback` HEAD requests that fail are retried once as `GET` with `Range: bytes=0-0`,
+// reading only the response head (some servers reject HEAD). There is no TLS: https:// URLs
+// are fetched only through a proxy that accepts absolute-form requests (--proxy / CURATE_HTTP_PROXY),
+// which is also how a local stand-in server answers for arbitrary hosts in tests/http_fetch.py.
+struct HttpUrl{ string scheme, host, target; int port = 80; };
+
+static optional<HttpUrl> parseHttpUrl(string_view url){
+    url = trimView(url);
+    size_t sep = url.find("://");
+    if(sep==string_view::npos) return nullopt;
+    HttpUrl u; u.scheme = toLower(string(url.substr(0, sep)));
+    if(u.scheme!="http" && u.scheme!="https") return nullopt;
+    u.port = u.scheme=="https"? 443 : 80;
+    string_view rest = url.substr(sep+3);
+    size_t slash = rest.find_first_of("/?#");
+    string_view auth = rest.substr(0, slash);
+    if(size_t at = auth.rfind('@'); at!=string_view::npos) auth.remove_prefix(at+1);
+    size_t colon = auth.rfind(':');
+    if(colon!=string_view::npos && auth.find(']', colon)==string_view::npos){
+        int p = atoi(string(auth.substr(colon+1)).c_str());
+        if(p<=0 || p>65535) return nullopt;
+        u.port = p; auth = auth.substr(0, colon);
+    }
+    if(auth.size()>=2 && auth.front()=='[' && auth.back()==']') auth = auth.substr(1, auth.size()-2);
+    if(auth.empty()) return nullopt;
+    u.host = toLower(string(auth));
+    string_view t = slash==string_view::npos? string_view() : rest.substr(slash);
+    if(size_t h = t.find('#'); h!=string_view::npos) t = t.substr(0, h);
+    u.target = t.empty() || t[0]!='/'? "/" + string(t) : string(t);
+    return u;
+}
+
+static string httpUrlString(const HttpUrl& u){
+    bool v6 = u.host.find(':')!=string::npos;
+    string s = u.scheme + "://" + (v6? "[" + u.host + "]" : u.host);
+    if(u.port != (u.scheme=="https"? 443 : 80)) s += ":" + to_string(u.port);
+    return s + u.target;
+}
+
+// Cache key for a URL: scheme and host lowercased, default port and fragment dropped.
+static string canonicalUrl(string_view url){
+    auto u = parseHttpUrl(url);
+    return u? httpUrlString(*u) : string(trimView(url));
+}
+
+// Location header → absolute URL.
+static string resolveLocation(const HttpUrl& base, string_view loc){
+    loc = trimView(loc);
+    if(loc.find("://")!=string_view::npos) return string(loc);
+    HttpUrl u = base;
+    if(loc.substr(0, 2)=="//") return u.scheme + ":" + string(loc);
+    if(!loc.empty() && loc[0]=='/') u.target = string(loc);
+    else { string dir = u.target.substr(0, u.target.find('?')); dir = dir.substr(0, dir.rfind('/')+1); u.target = dir + string(loc); }
+    return httpUrlString(u);
+}
+
+// Readiness notification: epoll on Linux, poll elsewhere.
+class Poller{
+public:
+    struct Ready{ int fd; bool in, out, err; };
+#ifdef __linux__
+    Poller(): ep_(::epoll_create1(EPOLL_CLOEXEC)){}
+    ~Poller(){ if(ep_>=0) ::close(ep_); }
+    void watch(int fd, bool wantWrite){
+        epoll_event ev{}; ev.events = wantWrite? EPOLLOUT : EPOLLIN; ev.data.fd = fd;
+        if(::epoll_ctl(ep_, EPOLL_CTL_MOD, fd, &ev)!=0) ::epoll_ctl(ep_, EPOLL_CTL_ADD, fd, &ev);
+    }
+    void forget(int fd){ ::epoll_ctl(ep_, EPOLL_CTL_DEL, fd, nullptr); }
+    vector<Ready> wait(int timeoutMs){
+        epoll_event ev[256];
+        int n = ::epoll_wait(ep_, ev, 256, timeoutMs);
+        vector<Ready> r;
+        for(int i=0;i<n;++i) r.push_back({ev[i].data.fd, (ev[i].events & EPOLLIN)!=0, (ev[i].events & EPOLLOUT)!=0, (ev[i].events & (EPOLLERR|EPOLLHUP))!=0});
+        return r;
+    }
+private:
+    int ep_;
+#else
+    void watch(int fd, bool wantWrite){ fds_[fd] = wantWrite? POLLOUT : POLLIN; }
+    void forget(int fd){ fds_.erase(fd); }
+    vector<Ready> wait(int timeoutMs){
+        vector<pollfd> p;
+        for(auto [fd, ev]: fds_) p.push_back({fd, short(ev), 0});
+        vector<Ready> r;
+        if(::poll(p.data(), nfds_t(p.size()), timeoutMs)<=0) return r;
+        for(const auto& x: p) if(x.revents) r.push_back({x.fd, (x.revents & POLLIN)!=0, (x.revents & POLLOUT)!=0, (x.revents & (POLLERR|POLLHUP))!=0});
+        return r;
+    }
+private:
+    map<int,int> fds_;
+#endif
+};
+
+// Incremental response parser: feed() consumes bytes as they arrive. Interim 1xx responses
+// (100 Continue, 103 Early Hints) are skipped; the final response follows on the same connection.
+struct HttpResponseParser{
+    bool head = false;
+    int status = 0;
+    string location, contentType, body;
+    bool headersDone = false, complete = false, keepAlive = true, failed = false;
+
+    void feed(string& in){
+        while(!headersDone){
+            size_t he = in.find("\r\n\r\n");
+            if(he==string::npos){ if(in.size() > 64*1024) failed = true; return; }
+            parseHead(string_view(in).substr(0, he));
+            in.erase(0, he+4);
+            if(failed) return;
+            if(status/100==1 && status!=101){ bool h = head; *this = HttpResponseParser{}; head = h; }
+        }
+        if(mode_==Mode::none){ complete = true; return; }
+        if(mode_==Mode::length){
+            size_t n = std::min(remaining_, in.size());
+            body.append(in, 0, n); in.erase(0, n); remaining_ -= n;
+            complete = remaining_==0;
+            return;
+        }
+        if(mode_==Mode::close){ body += in; in.clear(); return; }
+        while(!complete){ // chunked
+            if(chunkState_==0){
+                size_t le = in.find("\r\n"); if(le==string::npos) return;
+                remaining_ = size_t(strtoull(in.substr(0, le).c_str(), nullptr, 16));
+                in.erase(0, le+2);
+                chunkState_ = remaining_? 1 : 3;
+            } else if(chunkState_==1){
+                size_t n = std::min(remaining_, in.size());
+                body.append(in, 0, n); in.erase(0, n); remaining_ -= n;
+                if(remaining_) return;
+                chunkState_ = 2;
+            } else if(chunkState_==2){
+                if(in.size()<2) return;
+                in.erase(0, 2); chunkState_ = 0;
+            } else {
+                size_t le = in.find("\r\n"); if(le==string::npos) return;
+                bool last = le==0; in.erase(0, le+2);
+                if(last) complete = true; // end of trailers
+            }
+        }
+    }
+    // The peer closed the connection: a body delimited by close is now complete.
+    void eof(){ if(headersDone && mode_==Mode::close){ complete = true; keepAlive = false; } }
+
+private:
+    enum class Mode{ none, length, chunked, close } mode_ = Mode::close;
+    size_t remaining_ = 0; int chunkState_ = 0;
+
+    void parseHead(string_view h){
+        headersDone = true;
+        size_t le = h.find("\r\n");
+        string_view line = h.substr(0, le);
+        if(line.substr(0, 5)!="HTTP/" || line.size()<12){ failed = true; return; }
+        status = atoi(string(line.substr(9, 3)).c_str());
+        keepAlive = line.substr(0, 8)!="HTTP/1.0";
+        long length = -1; bool chunked = false;
+        while(le!=string_view::npos){
+            size_t b = le+2; le = h.find("\r\n", b);
+            string_view f = h.substr(b, le==string_view::npos? string_view::npos : le-b);
+            size_t c = f.find(':'); if(c==string_view::npos) continue;
+            string name = toLower(string(f.substr(0, c)));
+            string value = trim(string(f.substr(c+1)));
+            if(name=="location") location = value;
+            else if(name=="content-type") contentType = toLower(value);
+            else if(name=="content-length") length = atol(value.c_str());
+            else if(name=="transfer-encoding") chunked = toLower(value).find("chunked")!=string::npos;
+            else if(name=="connection") keepAlive = toLower(value)!="close" && (keepAlive || toLower(value)=="keep-alive");
+        }
+        if(head || status==101 || status==204 || status==304) mode_ = Mode::none;
+        else if(chunked) mode_ = Mode::chunked;
+        else if(length>=0){ mode_ = length? Mode::length : Mode::none; remaining_ = size_t(length); }
+        else { mode_ = Mode::close; keepAlive = false; }
+    }
+};
+
+// The text of the first <title>...</title>, entity-decoded and with whitespace collapsed.
+static optional<string> extractTitle(string_view html){
+    auto ifind = [&](string_view needle, size_t from){ return ifindAscii(html, needle, from); };
+    size_t open = ifind("<title", 0);
+    if(open==string_view::npos) return nullopt;
+    size_t gt = html.find('>', open);
+    if(gt==string_view::npos) return nullopt;
+    size_t close = ifind("</title", gt);
+    if(close==string_view::npos) return nullopt;
+    string t = decodeHtmlEntities(html.substr(gt+1, close-gt-1)), o;
+    for(char c: t){
+        if(isspace((unsigned char)c)){ if(!o.empty() && o.back()!=' ') o += ' '; }
+        else o += c;
+    }
+    while(!o.empty() && o.back()==' ') o.pop_back();
+    return o;
+}
+
+class HttpFetcher{
+public:
+    struct Options{ size_t concurrency = 16, perHost = 2; int timeoutMs = 10000; int maxRedirects = 5; string proxy; double rate = 0; /* requests/s, 0 = unlimited */ };
+    struct Job{ string url; bool head = false, titleOnly = false, rangeFallback = false, keepBody = false; };
+    struct Result{ int status = 0; string finalUrl, title, error, contentType, body; int redirects = 0; double ms = 0; };
+    // Called as each job finishes (before run() returns), e.g. to consume and free a kept body.
+    using OnResult = function<void(size_t job, Result&)>;
+    static constexpr size_t kMaxBody = size_t(8) << 20; // keepBody stops reading past this
+
+    explicit HttpFetcher(Options o): opt_(std::move(o)){}
+
+#ifdef _WIN32
+    vector<Result> run(const vector<Job>& jobs, const OnResult& onResult = nullptr){
+        vector<Result> r(jobs.size());
+        for(size_t i=0;i<r.size();++i){ r[i].error = "not supported on Windows"; if(onResult) onResult(i, r[i]); }
+        return r;
+    }
+#else
+    vector<Result> run(const vector<Job>& jobs, const OnResult& onResult = nullptr){
+        jobs_ = &jobs; onResult_ = onResult;
+        results_.assign(jobs.size(), Result{});
+        for(size_t i=0;i<jobs.size();++i) enqueue(i, jobs[i].url, 0, Clock::time_point{});
+        resolveHosts();
+        pump();
+        auto msUntil = [](Clock::time_point t, Clock::time_point now){ return int(std::max<long>(0, long(std::chrono::duration_cast<std::chrono::milliseconds>(t - now).count()))); };
+        while(active_ || queued_){
+            auto now = Clock::now();
+            int wait = 1000;
+            for(const auto& [fd, c]: conns_) wait = std::min(wait, msUntil(c.deadline, now));
+            if(queued_ && opt_.rate>0) wait = std::min(wait, msUntil(nextStart_, now) + 1);
+            for(const auto& r: poller_.wait(wait)) onReady(r);
+            now = Clock::now();
+            vector<int> expired;
+            for(const auto& [fd, c]: conns_) if(c.deadline <= now) expired.push_back(fd);
+            for(int fd: expired) fail(fd, "timeout", false);
+            pump();
+        }
+        for(auto& [k, h]: hosts_) closeIdle(h);
+        return std::move(results_);
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    // `start` is set when the first request of the job goes out, so queueing is not latency.
+    struct Task{ size_t job; HttpUrl url; int redirects; Clock::time_point start; bool retried = false, get = false; };
+    struct Host{ string name; int port; vector<sockaddr_storage> addrs; vector<socklen_t> lens; string error; bool resolved = false; std::deque<Task> pending; size_t active = 0; vector<int> idle; };
+    struct Conn{ string host; Task task; string out, in; size_t sent = 0, addr = 0, titleScan = 0; bool connecting = true, reused = false, gotBytes = false; HttpResponseParser resp; Clock::time_point deadline; };
+
+    // Hosts are keyed by origin (the politeness unit) even when connections go to a proxy.
+    static string hostKey(const HttpUrl& u){ return u.host + ":" + to_string(u.port); }
+
+    void enqueue(size_t job, const string& url, int redirects, Clock::time_point start){
+        auto u = parseHttpUrl(url);
+        if(!u){ reject(job, "not an http(s) URL"); return; }
+        if(u->scheme=="https" && opt_.proxy.empty()){ reject(job, "https needs --proxy (no TLS support)"); return; }
+        string k = hostKey(*u);
+        auto [it, fresh] = hosts_.try_emplace(k);
+        if(fresh){
+            if(opt_.proxy.empty()){ it->second.name = u->host; it->second.port = u->port; }
+            else {
+                auto p = parseHttpUrl(opt_.proxy.find("://")==string::npos? "http://" + opt_.proxy : opt_.proxy);
+                if(p){ it->second.name = p->host; it->second.port = p->port; } else it->second.error = "invalid proxy";
+            }
+            order_.push_back(k);
+        }
+        it->second.pending.push_back(Task{job, *u, redirects, start});
+        ++queued_;
+    }
+
+    // Resolves every host up front (getaddrinfo blocks, so on the pool rather than in the loop).
+    void resolveHosts(){
+        vector<Host*> todo;
+        for(auto& [k, h]: hosts_) if(!h.resolved) todo.push_back(&h);
+        parallelFor(todo.size(), [&](size_t i){ resolve(*todo[i]); });
+    }
+
+    static void resolve(Host& h){
+        h.resolved = true;
+        if(!h.error.empty()) return;
+        // AI_ADDRCONFIG skips families this machine has no address for (AAAA on IPv4-only hosts);
+        // a machine with nothing but loopback gets no answers with it, so ask again without.
+        addrinfo hints{}; hints.ai_family = AF_UNSPEC; hints.ai_socktype = SOCK_STREAM; hints.ai_flags = AI_ADDRCONFIG;
+        addrinfo* res = nullptr;
+        int rc = ::getaddrinfo(h.name.c_str(), to_string(h.port).c_str(), &hints, &res);
+        if(rc==EAI_NONAME || rc==EAI_ADDRFAMILY){ hints.ai_flags = 0; rc = ::getaddrinfo(h.name.c_str(), to_string(h.port).c_str(), &hints, &res); }
+        if(rc!=0){ h.error = rc==EAI_NONAME? "dns: no such host" : string("dns: ") + gai_strerror(rc); return; }
+        for(addrinfo* a = res; a; a = a->ai_next){
+            sockaddr_storage s{}; memcpy(&s, a->ai_addr, a->ai_addrlen);
+            h.addrs.push_back(s); h.lens.push_back(socklen_t(a->ai_addrlen));
+        }
+        ::freeaddrinfo(res);
+        if(h.addrs.empty()) h.error = "dns: no address";
+    }
+
+    // Starts pending tasks round-robin over hosts within the global and per-host caps and the
+    // rate limit, on a parked connection to the host when there is one.
+    void pump(){
+        bool progress = true;
+        while(progress && active_ < opt_.concurrency){
+            progress = false;
+            for(const auto& k: order_){
+                Host& h = hosts_[k];
+                if(h.pending.empty()){ closeIdle(h); continue; }
+                if(h.active >= opt_.perHost) continue;
+                if(!h.resolved) resolve(h);
+                if(h.error.empty() && !takeRateSlot()) return;
+                Task t = std::move(h.pending.front()); h.pending.pop_front(); --queued_;
+                if(!h.error.empty()){ finish(t, 0, h.error); progress = true; continue; }
+                int fd = -1;
+                while(fd<0 && !h.idle.empty()){
+                    fd = h.idle.back(); h.idle.pop_back();
+                    if(!idleAlive(fd)){ ::close(fd); fd = -1; }
+                }
+                start(k, std::move(t), fd);
+                progress = true;
+                if(active_ >= opt_.concurrency) break;
+            }
+        }
+    }
+
+    // Global rate limit: request starts are spaced at least 1/rate apart, with no burst.
+    bool takeRateSlot(){
+        if(opt_.rate<=0) return true;
+        auto now = Clock::now();
+        if(now < nextStart_) return false;
+        auto gap = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / opt_.rate));
+        nextStart_ = std::max(nextStart_, now) + gap;
+        return true;
+    }
+
+    // A parked connection is reusable only while nothing has happened on it: a server that closed
+    // it (or sent anything unasked) makes it readable or reports a hangup.
+    static bool idleAlive(int fd){
+        pollfd p{fd, POLLIN, 0};
+#ifdef POLLRDHUP
+        p.events |= POLLRDHUP;
+#endif
+        return ::poll(&p, 1, 0)==0;
+    }
+
+    void closeIdle(Host& h){
+        for(int fd: h.idle) ::close(fd);
+        h.idle.clear();
+    }
+
+    // Non-blocking connect to one resolved address; -1 with `err` set when it fails outright.
+    static int connectTo(const sockaddr_storage& sa, socklen_t len, string& err){
+        int fd = ::socket(sa.ss_family, SOCK_STREAM, 0);
+        if(fd<0){ err = strerror(errno); return -1; }
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+        if(::connect(fd, reinterpret_cast<const sockaddr*>(&sa), len)!=0 && errno!=EINPROGRESS){ err = strerror(errno); ::close(fd); return -1; }
+        return fd;
+    }
+
+    // A new connection tries the host's addresses in resolver order from `addr` on.
+    void start(const string& k, Task t, int reuseFd, size_t addr = 0){
+        Host& h = hosts_[k];
+        int fd = reuseFd;
+        if(fd<0){
+            string err;
+            for(;; ++addr){
+                if(addr >= h.addrs.size()){ finish(t, 0, err); return; }
+                if((fd = connectTo(h.addrs[addr], h.lens[addr], err)) >= 0) break;
+            }
+        }
+        Conn c; c.host = k; c.addr = addr; c.reused = reuseFd>=0; c.connecting = reuseFd<0;
+        c.deadline = Clock::now() + std::chrono::milliseconds(opt_.timeoutMs);
+        if(t.start==Clock::time_point{}) t.start = Clock::now();
+        const Job& j = (*jobs_)[t.job];
+        bool head = j.head && !t.get;
+        c.resp.head = head;
+        string target = opt_.proxy.empty()? t.url.target : httpUrlString(t.url);
+        bool v6 = t.url.host.find(':')!=string::npos;
+        string host = (v6? "[" + t.url.host + "]" : t.url.host) + (t.url.port!=(t.url.scheme=="https"? 443 : 80)? ":" + to_string(t.url.port) : string());
+        c.out = string(head? "HEAD " : "GET ") + target + " HTTP/1.1\r\nHost: " + host + "\r\nUser-Agent: curate/" + CURATE_VERSION
+              + "\r\nAccept: text/html,*/*;q=0.5\r\nAccept-Encoding: identity\r\n" + (t.get? "Range: bytes=0-0\r\n" : "") + "Connection: keep-alive\r\n\r\n";
+        c.task = std::move(t);
+        ++h.active; ++active_;
+        conns_[fd] = std::move(c);
+        if(reuseFd>=0) send(fd); else poller_.watch(fd, true);
+    }
+
+    void onReady(const Poller::Ready& r){
+        auto it = conns_.find(r.fd);
+        if(it==conns_.end()) return;
+        Conn& c = it->second;
+        if(c.connecting){
+            int err = 0; socklen_t len = sizeof(err);
+            ::getsockopt(r.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if(err){ fail(r.fd, strerror(err), false); return; }
+            c.connecting = false;
+        }
+        if(c.sent < c.out.size()){ send(r.fd); return; }
+        char buf[1<<16];
+        for(;;){
+            ssize_t n = ::recv(r.fd, buf, sizeof(buf), 0);
+            if(n<0){ if(errno==EINTR) continue; if(errno==EAGAIN || errno==EWOULDBLOCK) break; fail(r.fd, strerror(errno), true); return; }
+            if(n==0){
+                c.resp.eof();
+                if(!c.resp.complete){ fail(r.fd, c.gotBytes? "connection closed mid-response" : "connection closed", true); return; }
+                c.resp.keepAlive = false; // closed despite keep-alive: never park it
+                break;
+            }
+            c.gotBytes = true;
+            c.in.append(buf, size_t(n));
+            c.resp.feed(c.in);
+            if(c.resp.failed){ fail(r.fd, "malformed response", false); return; }
+            if(c.task.get && c.resp.headersDone){ done(r.fd, c.resp.complete && c.resp.keepAlive && c.in.empty()); return; }
+            if(c.resp.complete) break;
+            if((*jobs_)[c.task.job].titleOnly && c.resp.headersDone && c.resp.status/100==2 && titleDone(c.resp.body, c.titleScan)){ done(r.fd, false); return; }
+            if(c.resp.body.size() > kMaxBody){ done(r.fd, false); return; }
+        }
+        if(c.resp.complete) done(r.fd, c.resp.keepAlive && c.in.empty());
+    }
+
+    // Looks for "</title" only in bytes added since the last call; `scan` keeps where to resume,
+    // backed up far enough to catch a tag split across reads.
+    static bool titleDone(const string& body, size_t& scan){
+        if(body.size() > 256*1024) return true;
+        if(scan > body.size()) scan = 0;
+        for(size_t i = body.find('<', scan); i!=string::npos; i = body.find('<', i+1))
+            if(body.size()-i >= 7 && iequalsAscii(string_view(body).substr(i, 7), "</title")) return true;
+        scan = body.size() > 6? body.size() - 6 : 0;
+        return false;
+    }
+
+    void send(int fd){
+        Conn& c = conns_[fd];
+        while(c.sent < c.out.size()){
+#ifdef MSG_NOSIGNAL
+            ssize_t n = ::send(fd, c.out.data()+c.sent, c.out.size()-c.sent, MSG_NOSIGNAL);
+#else
+            ssize_t n = ::send(fd, c.out.data()+c.sent, c.out.size()-c.sent, 0);
+#endif
+            if(n<0){ if(errno==EINTR) continue; if(errno==EAGAIN || errno==EWOULDBLOCK) break; fail(fd, strerror(errno), true); return; }
+            c.sent += size_t(n);
+        }
+        poller_.watch(fd, c.sent < c.out.size());
+    }
+
+    // Releases `fd` and its slot; parks it for pump() only when `reuse` and the host has more work.
+    void release(int fd, bool reuse){
+        Conn& c = conns_[fd];
+        Host& h = hosts_[c.host];
+        --h.active; --active_;
+        conns_.erase(fd);
+        poller_.forget(fd);
+        if(reuse && !h.pending.empty()) h.idle.push_back(fd);
+        else ::close(fd);
+    }
+
+    void done(int fd, bool reuse){
+        Conn& c = conns_[fd];
+        Task t = std::move(c.task);
+        int status = c.resp.status;
+        string location = c.resp.location, contentType = c.resp.contentType, body = std::move(c.resp.body);
+        release(fd, reuse);
+        const Job& j = (*jobs_)[t.job];
+        if(j.head && j.rangeFallback && !t.get && status>=400){
+            t.get = true;
+            hosts_[hostKey(t.url)].pending.push_back(std::move(t)); ++queued_;
+            return;
+        }
+        if(status/100==3 && !location.empty() && t.redirects < opt_.maxRedirects){
+            results_[t.job].redirects = t.redirects + 1;
+            enqueue(t.job, resolveLocation(t.url, location), t.redirects + 1, t.start);
+            resolveHosts();
+            return;
+        }
+        Result& r = results_[t.job];
+        if(j.titleOnly && status/100==2) if(auto ti = extractTitle(body)) r.title = *ti;
+        r.contentType = std::move(contentType);
+        if(j.keepBody && status/100==2) r.body = std::move(body);
+        finish(t, status, "");
+    }
+
+    // A connect that fails or times out moves on to the host's next address; a reused keep-alive
+    // connection the server already closed gets one fresh attempt.
+    void fail(int fd, const string& why, bool retryable){
+        Conn& c = conns_[fd];
+        Task t = std::move(c.task);
+        bool retry = retryable && c.reused && !c.gotBytes && !t.retried;
+        string k = c.host;
+        size_t next = c.connecting? c.addr + 1 : 0;
+        release(fd, false);
+        if(next && next < hosts_[k].addrs.size()){ start(k, std::move(t), -1, next); return; }
+        if(retry){ t.retried = true; hosts_[k].pending.push_front(std::move(t)); ++queued_; return; }
+        finish(t, 0, why);
+    }
+
+    void reject(size_t job, const string& why){
+        results_[job].error = why;
+        if(onResult_) onResult_(job, results_[job]);
+    }
+
+    void finish(const Task& t, int status, const string& error){
+        Result& r = results_[t.job];
+        r.status = status; r.error = error; r.finalUrl = httpUrlString(t.url);
+        r.ms = t.start==Clock::time_point{}? 0 : std::chrono::duration<double, std::milli>(Clock::now() - t.start).count();
+        if(onResult_) onResult_(t.job, r);
+    }
+
+    Options opt_;
+    const vector<Job>* jobs_ = nullptr;
+    OnResult onResult_;
+    vector<Result> results_;
+    unordered_map<string,Host> hosts_;
+    vector<string> order_;
+    unordered_map<int,Conn> conns_;
+    size_t active_ = 0, queued_ = 0;
+    Clock::time_point nextStart_{};
+    Poller poller_;
+#endif
+};
+
+// ===== Title cache =====
+// titles.tsv: canonical URL, fetch date, HTTP status (0 = no response), title. Successful titles
+// are reused forever; failures are retried once they are a week old.
+static fs::path titleCachePath(){ return curateHome()/ "titles.tsv"; }
+
+struct CachedTitle{ sys_days fetched; int status = 0; string title; };
+
+static unordered_map<string,CachedTitle> loadTitleCache(){
+    unordered_map<string,CachedTitle> m;
+    MappedFile f(titleCachePath());
+    string_view d = f.view();
+    size_t pos = 0;
+    while(pos < d.size()){
+        size_t end = d.find('\n', pos); if(end==string_view::npos) end = d.size();
+        auto c = splitTabs(string(d.substr(pos, end-pos)));
+        pos = end + 1;
+        if(c.size()<3 || c[0].empty() || c[0][0]=='#') continue;
+        auto date = parseISODate(c[1]);
+        if(!date) continue;
+        m[c[0]] = CachedTitle{*date, atoi(c[2].c_str()), c.size()>3? c[3] : string()};
+    }
+    return m;
+}
+
+static bool saveTitleCache(const unordered_map<string,CachedTitle>& m){
+    vector<const pair<const string,CachedTitle>*> rows;
+    for(const auto& e: m) rows.push_back(&e);
+    sort(rows.begin(), rows.end(), [](auto* x, auto* y){ return x->first < y->first; });
+    AtomicFile o(titleCachePath());
+    o.write("# url\tfetched\tstatus\ttitle\n");
+    for(auto* e: rows){ o.write(e->first); o.write("\t"); o.write(fmtDate(e->second.fetched)); o.write("\t"); o.write(to_string(e->second.status)); o.write("\t"); o.write(e->second.title); o.write("\n"); }
+    return o.commit();
+}
+
+// ===== Link status =====
+// linkstatus.tsv: canonical URL, check date, HTTP status (0 = no response), latency in ms, final
+// URL when redirected, error. Written by check-links; digest --dead-links reads it.
+static fs::path linkStatusPath(){ return curateHome()/ "linkstatus.tsv"; }
+
+struct LinkStatus{ sys_days checked; int status = 0; long ms = 0; string target, error; };
+
+// Only answers that say the page is gone count; timeouts, 5xx and blocked requests may be transient.
+static bool linkDead(const LinkStatus& s){ return s.status==404 || s.status==410 || s.error=="dns: no such host"; }
+
+static unordered_map<string,LinkStatus> loadLinkStatus(){
+    unordered_map<string,LinkStatus> m;
+    MappedFile f(linkStatusPath());
+    string_view d = f.view();
+    size_t pos = 0;
+    while(pos < d.size()){
+        size_t end = d.find('\n', pos); if(end==string_view::npos) end = d.size();
+        auto c = splitTabs(string(d.substr(pos, end-pos)));
+        pos = end + 1;
+        if(c.size()<3 || c[0].empty() || c[0][0]=='#') continue;
+        auto date = parseISODate(c[1]);
+        if(!date) continue;
+        c.resize(6);
+        m[c[0]] = LinkStatus{*date, atoi(c[2].c_str()), atol(c[3].c_str()), c[4], c[5]};
+    }
+    return m;
+}
+
+static bool saveLinkStatus(const unordered_map<string,LinkStatus>& m){
+    vector<const pair<const string,LinkStatus>*> rows;
+    for(const auto& e: m) rows.push_back(&e);
+    sort(rows.begin(), rows.end(), [](auto* x, auto* y){ return x->first < y->first; });
+    AtomicFile o(linkStatusPath());
+    o.write("# url\tchecked\tstatus\tms\ttarget\terror\n");
+    for(auto* e: rows){
+        const LinkStatus& s = e->second;
+        o.write(e->first); o.write("\t"); o.write(fmtDate(s.checked)); o.write("\t"); o.write(to_string(s.status)); o.write("\t");
+        o.write(to_string(s.ms)); o.write("\t"); o.write(s.target); o.write("\t"); o.write(s.error); o.write("\n");
+    }
+    return o.commit();
+}
+
+// digest --dead-links drop|mark: rows linkstatus.tsv records as dead are left out, or flagged in the title.
+static void applyDeadLinks(vector<Rec>& rows, const string& mode){
+    if(mode.empty()) return;
+    auto st = loadLinkStatus();
+    if(st.empty()) return;
+    auto dead = [&](const Rec& r){ auto it = st.find(canonicalUrl(r.url)); return it!=st.end() && linkDead(it->second); };
+    if(mode=="drop"){ std::erase_if(rows, dead); return; }
+    for(auto& r: rows) if(dead(r)) r.title = trim(r.title).empty()? "[dead link]" : "[dead link] " + r.title;
+}
+
+// ===== Snapshot store =====
+// snapshots/ keeps the readable text of fetched pages, content-addressed by SHA-256:
+//   chunks.pack  chunk bytes back to back (append-only)
+//   chunks.idx   one 44-byte record per chunk: SHA-256, offset (u64), length (u32)
+//   index.tsv    canonical URL → fetch date, HTTP status, snapshot id, text bytes, title
+// Text is cut into content-defined chunks, so boilerplate repeated across pages (and unchanged
+// parts of a re-fetched page) is stored once. A snapshot's recipe, the concatenated hashes of its
+// chunks, is stored as a chunk too; the recipe's hash is the snapshot id.
+struct Sha256{
+    Sha256& add(string_view s){
+        len_ += s.size();
+        for(unsigned char c: s){ buf_[n_++] = c; if(n_==64){ block(); n_ = 0; } }
+        return *this;
+    }
+    array<uint8_t,32> digest(){
+        uint64_t bits = len_ * 8;
+        buf_[n_++] = 0x80;
+        if(n_>56){ while(n_<64) buf_[n_++] = 0; block(); n_ = 0; }
+        while(n_<56) buf_[n_++] = 0;
+        for(int i=7;i>=0;--i) buf_[n_++] = uint8_t(bits >> (8*i));
+        block();
+        array<uint8_t,32> out;
+        for(size_t i=0;i<8;++i) for(size_t b=0;b<4;++b) out[4*i+b] = uint8_t(h_[i] >> (24 - 8*b));
+        return out;
+    }
+
+private:
+    void block(){
+        static constexpr uint32_t K[64] = {
+            0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+            0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+            0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+            0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+            0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+            0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+            0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+            0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2};
+        uint32_t w[64];
+        for(size_t i=0;i<16;++i) w[i] = uint32_t(buf_[4*i])<<24 | uint32_t(buf_[4*i+1])<<16 | uint32_t(buf_[4*i+2])<<8 | buf_[4*i+3];
+        for(size_t i=16;i<64;++i){
+            uint32_t s0 = std::rotr(w[i-15], 7) ^ std::rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+            uint32_t s1 = std::rotr(w[i-2], 17) ^ std::rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+            w[i] = w[i-16] + s0 + w[i-7] + s1;
+        }
+        uint32_t a=h_[0], b=h_[1], c=h_[2], d=h_[3], e=h_[4], f=h_[5], g=h_[6], h=h_[7];
+        for(size_t i=0;i<64;++i){
+            uint32_t t1 = h + (std::rotr(e, 6) ^ std::rotr(e, 11) ^ std::rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+        }
+        h_[0]+=a; h_[1]+=b; h_[2]+=c; h_[3]+=d; h_[4]+=e; h_[5]+=f; h_[6]+=g; h_[7]+=h;
+    }
+
+    uint32_t h_[8] = {0x6a09e667,0xbb67ae85,0x3c6ef372,0xa54ff53a,0x510e527f,0x9b05688c,0x1f83d9ab,0x5be0cd19};
+    uint8_t buf_[64];
+    size_t n_ = 0;
+    uint64_t len_ = 0;
+};
+
+// Main readable text of an HTML page: the <main>, else <article>, else <body> element, minus
+// scripts, styles and page furniture (nav, header, footer, aside, forms). Block elements end a
+// line; entities are decoded and whitespace collapsed.
+static string extractReadableText(string_view html){
+    auto isName = [](char c){ return isalnum((unsigned char)c)!=0; };
+    size_t from = 0, to = html.size();
+    for(string_view tag: {"main", "article", "body"}){
+        string open = "<" + string(tag), close = "</" + string(tag);
+        size_t o = ifindAscii(html, open);
+        while(o!=string_view::npos && o+open.size()<html.size() && isName(html[o+open.size()])) o = ifindAscii(html, open, o+1);
+        if(o==string_view::npos) continue;
+        size_t gt = html.find('>', o);
+        if(gt==string_view::npos) continue;
+        size_t c = string_view::npos;
+        for(size_t x = ifindAscii(html, close, gt); x!=string_view::npos; x = ifindAscii(html, close, x+1)) c = x;
+        from = gt + 1; to = c==string_view::npos? html.size() : c;
+        break;
+    }
+
+    static const unordered_set<string> furniture = {"nav","header","footer","aside","form","noscript","svg","template","button","select","dialog","figure"};
+    static const unordered_set<string> rawText = {"script","style","textarea","title"};
+    static const unordered_set<string> blocks = {"p","div","br","li","ul","ol","dl","dt","dd","h1","h2","h3","h4","h5","h6","tr","td","th",
+                                                  "table","section","article","main","blockquote","pre","hr","figcaption"};
+    string out, text, prefix;
+    int skip = 0;
+    auto endLine = [&]{
+        string t = decodeHtmlEntities(text), line;
+        text.clear();
+        for(char c: t){
+            if(isspace((unsigned char)c)){ if(!line.empty() && line.back()!=' ') line += ' '; }
+            else line += c;
+        }
+        while(!line.empty() && line.back()==' ') line.pop_back();
+        if(!line.empty()){ out += prefix; out += line; out += '\n'; }
+        prefix.clear();
+    };
+    size_t i = from;
+    while(i < to){
+        if(html[i]!='<'){
+            size_t lt = std::min(html.find('<', i), to);
+            if(!skip) text.append(html.substr(i, lt-i)); else text += ' ';
+            i = lt;
+            continue;
+        }
+        if(html.substr(i, 4)=="<!--"){ size_t e = html.find("-->", i+4); i = e==string_view::npos? to : e+3; continue; }
+        size_t gt = html.find('>', i);
+        if(gt==string_view::npos || gt>=to) break;
+        string_view tag = html.substr(i+1, gt-i-1);
+        i = gt + 1;
+        bool closing = !tag.empty() && tag[0]=='/';
+        if(closing) tag.remove_prefix(1);
+        size_t ne = 0; while(ne<tag.size() && isName(tag[ne])) ++ne;
+        string name = toLower(string(tag.substr(0, ne)));
+        if(!closing && rawText.count(name)){
+            size_t e = ifindAscii(html, "</" + name, i);
+            i = e==string_view::npos? to : e;
+            continue;
+        }
+        if(furniture.count(name)){
+            if(closing) skip = std::max(0, skip-1); else if(tag.empty() || tag.back()!='/') ++skip;
+            continue;
+        }
+        if(!skip && blocks.count(name)){
+            endLine();
+            if(name=="li" && !closing) prefix = "- ";
+        }
+    }
+    endLine();
+    return out;
+}
+
+// Content-defined chunk ends (gear rolling hash over a 64-byte window, ~640 B average, 128 B to
+// 8 KiB): an edit moves only the cuts next to it, so shared passages still yield identical chunks.
+// Small chunks suit page text, where shared boilerplate comes in runs of a few KiB.
+static vector<size_t> chunkEnds(string_view d){
+    static const array<uint64_t,256> gear = []{ array<uint64_t,256> g{}; for(size_t i=0;i<256;++i) g[i] = mix64(i + 0x5eed); return g; }();
+    constexpr size_t MIN = 128, MAX = 8192;
+    constexpr uint64_t MASK = 0x1ffull << 55; // 9 bits → one cut per ~512 B past MIN
+    vector<size_t> ends;
+    for(size_t start = 0; start < d.size(); ){
+        size_t end = std::min(d.size(), start + MAX), cut = end;
+        uint64_t h = 0;
+        for(size_t i = start; i < end; ++i){
+            h = (h << 1) + gear[(unsigned char)d[i]];
+            if(i+1 - start >= MIN && (h & MASK)==0){ cut = i + 1; break; }
+        }
+        ends.push_back(cut);
+        start = cut;
+    }
+    return ends;
+}
+
+static string hexBytes(const uint8_t* p, size_t n){
+    static const char* digits = "0123456789abcdef";
+    string s; s.reserve(n*2);
+    for(size_t i=0;i<n;++i){ s += digits[p[i]>>4]; s += digits[p[i]&15]; }
+    return s;
+}
+
+static fs::path snapshotsDir(){ return curateHome()/ "snapshots"; }
+
+class SnapshotStore{
+public:
+    struct Stats{ size_t chunks = 0, newChunks = 0; uint64_t bytes = 0, newBytes = 0; };
+
+    SnapshotStore(): dir_(snapshotsDir()){
+        std::error_code ec;
+        packSize_ = fs::exists(packPath(), ec)? uint64_t(fs::file_size(packPath(), ec)) : 0;
+        MappedFile idx(idxPath());
+        string_view d = idx.view();
+        for(size_t at = 0; at + kRec <= d.size(); at += kRec){
+            Loc l{getU64(d.data()+at+32), getU32(d.data()+at+40)};
+            if(l.off + l.len <= packSize_) idx_[string(d.substr(at, 32))] = l; // else: pack write did not land
+        }
+    }
+
+    // Stores `text` (new chunks are buffered until flush()) and returns its snapshot id.
+    string put(string_view text){
+        string recipe;
+        size_t start = 0;
+        for(size_t end: chunkEnds(text)){
+            string_view c = text.substr(start, end-start);
+            auto h = Sha256().add(c).digest();
+            recipe.append(reinterpret_cast<const char*>(h.data()), h.size());
+            add(h, c);
+            stats.chunks++; stats.bytes += c.size();
+            start = end;
+        }
+        auto id = Sha256().add(recipe).digest();
+        add(id, recipe);
+        return hexBytes(id.data(), id.size());
+    }
+
+    // The text of snapshot `id`; nullopt if it is unknown or a chunk fails its hash check.
+    optional<string> get(const string& id){
+        if(!pack_) pack_ = make_unique<MappedFile>(packPath());
+        auto chunk = [&](string_view key) -> optional<string_view> {
+            auto it = idx_.find(string(key));
+            if(it==idx_.end() || it->second.off + it->second.len > pack_->view().size()) return nullopt;
+            string_view c = pack_->view().substr(size_t(it->second.off), it->second.len);
+            auto h = Sha256().add(c).digest();
+            if(memcmp(h.data(), key.data(), 32)!=0) return nullopt;
+            return c;
+        };
+        string key = unhex(id);
+        if(key.size()!=32) return nullopt;
+        auto recipe = chunk(key);
+        if(!recipe || recipe->size()%32) return nullopt;
+        string out;
+        for(size_t at=0; at<recipe->size(); at+=32){
+            auto c = chunk(recipe->substr(at, 32));
+            if(!c) return nullopt;
+            out.append(*c);
+        }
+        return out;
+    }
+
+    // Appends buffered chunks to the pack, then their records to the index (pack first, so a
+    // crash in between leaves only unreferenced bytes).
+    bool flush(string& err){
+        if(pending_.empty()) return true;
+        std::error_code ec; fs::create_directories(dir_, ec);
+        uint64_t now = fs::exists(packPath(), ec)? uint64_t(fs::file_size(packPath(), ec)) : 0;
+        if(now!=packSize_){ err = "snapshots/ changed during the run; run `curate snapshot` again"; return false; }
+        for(auto [p, data]: {pair<fs::path,string*>{packPath(), &pending_}, {idxPath(), &pendingIdx_}}){
+            int fd = fdOpenAppend(p);
+            if(fd<0){ err = "cannot open " + p.string() + ": " + strerror(errno); return false; }
+            bool ok = fdWriteAll(fd, data->data(), data->size()) && (fsyncPolicy()==FsyncPolicy::never || fdSync(fd));
+            fdClose(fd);
+            if(!ok){ err = "write failed: " + p.string(); return false; }
+        }
+        packSize_ += pending_.size();
+        pending_.clear(); pendingIdx_.clear();
+        return true;
+    }
+
+    Stats stats;
+
+private:
+    struct Loc{ uint64_t off; uint32_t len; };
+    static constexpr size_t kRec = 44;
+
+    fs::path packPath() const { return dir_/ "chunks.pack"; }
+    fs::path idxPath() const { return dir_/ "chunks.idx"; }
+
+    static string unhex(const string& s){
+        string out;
+        for(size_t i=0; i+1<s.size(); i+=2){
+            auto nib = [](char c){ return c>='0'&&c<='9'? c-'0' : c>='a'&&c<='f'? c-'a'+10 : c>='A'&&c<='F'? c-'A'+10 : -1; };
+            int hi = nib(s[i]), lo = nib(s[i+1]);
+            if(hi<0 || lo<0) return {};
+            out += char(hi*16 + lo);
+        }
+        return s.size()%2? string() : out;
+    }
+
+    void add(const array<uint8_t,32>& h, string_view data){
+        string key(reinterpret_cast<const char*>(h.data()), h.size());
+        if(idx_.count(key)) return;
+        Loc l{packSize_ + pending_.size(), uint32_t(data.size())};
+        idx_.emplace(key, l);
+        pending_.append(data);
+        pendingIdx_ += key; putU64(pendingIdx_, l.off); putU32(pendingIdx_, l.len);
+        stats.newChunks++; stats.newBytes += data.size();
+    }
+
+    fs::path dir_;
+    unordered_map<string,Loc> idx_;
+    uint64_t packSize_ = 0;
+    string pending_, pendingIdx_;
+    unique_ptr<MappedFile> pack_;
+};
+
+// snapshots/index.tsv rows; an empty id records a failed fetch (retried after a week).
+struct SnapshotEntry{ sys_days fetched; int status = 0; string id; uint64_t bytes = 0; string title; };
+
+static fs::path snapshotIndexPath(){ return snapshotsDir()/ "index.tsv"; }
+
+static unordered_map<string,SnapshotEntry> loadSnapshotIndex(){
+    unordered_map<string,SnapshotEntry> m;
+    MappedFile f(snapshotIndexPath());
+    string_view d = f.view();
+    size_t pos = 0;
+    while(pos < d.size()){
+        size_t end = d.find('\n', pos); if(end==string_view::npos) end = d.size();
+        auto c = splitTabs(string(d.substr(pos, end-pos)));
+        pos = end + 1;
+        if(c.size()<3 || c[0].empty() || c[0][0]=='#') continue;
+        auto date = parseISODate(c[1]);
+        if(!date) continue;
+        c.resize(6);
+        m[c[0]] = SnapshotEntry{*date, atoi(c[2].c_str()), c[3], uint64_t(atoll(c[4].c_str())), c[5]};
+    }
+    return m;
+}
+
+static bool saveSnapshotIndex(const unordered_map<string,SnapshotEntry>& m){
+    vector<const pair<const string,SnapshotEntry>*> rows;
+    for(const auto& e: m) rows.push_back(&e);
+    sort(rows.begin(), rows.end(), [](auto* x, auto* y){ return x->first < y->first; });
+    AtomicFile o(snapshotIndexPath());
+    o.write("# url\tfetched\tstatus\tid\tbytes\ttitle\n");
+    for(auto* e: rows){
+        const SnapshotEntry& s = e->second;
+        o.write(e->first); o.write("\t"); o.write(fmtDate(s.fetched)); o.write("\t"); o.write(to_string(s.status)); o.write("\t");
+        o.write(s.id); o.write("\t"); o.write(to_string(s.bytes)); o.write("\t"); o.write(s.title); o.write("\n");
+    }
+    return o.commit();
+}
+
+// ===== CLI parsing =====
+struct Args{
+    string cmd; // add,digest,clear-inbox,list,help
+    // add
+    string url; vector<string> addTags; string addTitle; optional<string> addDateISO;
+    // digest
+    bool groupTags=false, tagsOnly=false, pd=false, noHeader=false; optional<pair<int,int>> week; optional<sys_days> start, end; string outPath;
+    bool allWeeks=false, incremental=false; optional<pair<pair<int,int>,pair<int,int>>> weeks; size_t pageSize=0;
+    string format; bool feedPerPeriod=false; string feedUrl; optional<size_t> feedLimit; // format: md|html|atom|rss; feedLimit unset = 50 newest, 0 = all
+    string deadLinks; // drop|mark
+    // clear (also: week)
+    string archiveDir; optional<sys_days> clearBefore;
+    // list
+    optional<int> limit; optional<sys_days> since, until; optional<size_t> tail; bool reverse=false;
+    // export / import (also: format, since, until, outPath)
+    bool includeArchive=false, skipExisting=false; string inPath;
+    // search / index (also: limit, since, until)
+    vector<string> terms, tagFilter; string kindFilter; bool rebuild=false;
+    // list / digest row filters (also: tagFilter, kindFilter)
+    vector<string> anyTagFilter, notTagFilter;
+    // list / digest / export
+    string where; bool explain=false;
+    // list --domain, domains (also: limit)
+    string domain; bool subdomains=false, bySite=false;
+    // stats (also: since, until, includeArchive, where, format)
+    vector<StatDim> statBy; optional<size_t> top; bool approx=false;
+    // http
+    int port=8080; string bind="127.0.0.1", token;
+    // titles fill (also: since, until)
+    size_t concurrency=16, perHost=2; int timeoutMs=10000; string proxy; bool verbose=false;
+    // check-links (also: since, until, includeArchive, concurrency, perHost, timeoutMs, proxy, verbose)
+    double rate=10; int maxAgeDays=7;
+    // snapshot (also: since, until, includeArchive, concurrency, perHost, timeoutMs, proxy, verbose)
+    bool refresh=false; string showKey;
+    // sort (also: includeArchive)
+    size_t sortMemoryMB=256;
+    // migrate
+    string layout;
+    // sync
+    string syncHome; bool dryRun=false;
+    // digest / list / stats: extra homes to read from (see federatedHomes)
+    vector<string> homes;
+};
+
+static void printHelp(){
+    cerr <<
+R"HELP(
+curate 
+
+A plain‑text workflow for capturing links to `inbox.tsv`, tagging them, and rolling them into weekly (or custom range) digests.  
+No databases, no runtimes — just a tiny C++20 CLI, TSV, and Markdown/HTML.
+
+Copyright (c) 2025 Norman Bauer - MIT License
+
+USAGE:
+  curate add <url> [tags...] [--title "..."] [--date YYYY-MM-DD]
+  curate digest [-gt|--group-tags] [--tags-only] [-pd]
+                [--week YYYY-Www | --start YYYY-MM-DD --end YYYY-MM-DD
+                 | --all-weeks | --weeks YYYY-Www..YYYY-Www]
+                [--incremental] [--page-size N] [--no-header] [-o <path>|-]
+                [--format md|html|atom|rss [--feed-per-period] [--feed-url URL] [--feed-limit N|all]]
+                [--tag T]... [--any-tag T]... [--not-tag T]... [--kind K]
+                [--where EXPR [--explain]] [--dead-links mark|drop] [--home DIR]...
+  curate clear-inbox [--archive-dir <dir>] [--week YYYY-Www | --before YYYY-MM-DD | --older-than Nd]
+  curate sort [--include-archive] [--memory MB]
+  curate migrate --layout sharded|single
+  curate sync <other-home> [--dry-run]
+  curate list [--limit N] [--since YYYY-MM-DD] [--until YYYY-MM-DD]
+              [--tag T]... [--any-tag T]... [--not-tag T]... [--kind K]
+              [--where EXPR [--explain]]
+              [--domain HOST [--subdomains]] [--tail N] [--reverse] [--home DIR]...
+  curate export [--format json|ndjson] [--since YYYY-MM-DD] [--until YYYY-MM-DD]
+                [--include-archive] [-o <path>|-]
+                [--where EXPR [--explain]]
+  curate import <file|-> [--format csv|tsv|bookmarks-html|ndjson] [--skip-existing]
+  curate search <terms...> [--kind K] [--tag T]... [--since YYYY-MM-DD] [--until YYYY-MM-DD] [--limit N]
+  curate index [--rebuild]
+  curate domains [--by-site] [--limit N]
+  curate stats --by kind|domain|tag|week|month[,...] [--top N] [--format tsv|json]
+               [--since YYYY-MM-DD] [--until YYYY-MM-DD] [--include-archive] [--where EXPR]
+               [--approx] [--home DIR]...
+  curate aggregates [--rebuild]
+  curate serve
+  curate http [--port N] [--bind ADDR] [--token T]
+  curate titles fill [--since YYYY-MM-DD] [--until YYYY-MM-DD] [--concurrency N] [--per-host N]
+                     [--timeout SECS] [--proxy URL] [-v]
+  curate check-links [--since YYYY-MM-DD] [--until YYYY-MM-DD] [--include-archive] [--max-age DAYS]
+                     [--concurrency N] [--per-host N] [--rate N] [--timeout SECS] [--proxy URL] [-v]
+  curate snapshot [--since YYYY-MM-DD] [--until YYYY-MM-DD] [--include-archive] [--refresh]
+                  [--concurrency N] [--per-host N] [--timeout SECS] [--proxy URL] [-v]
+  curate snapshot show <url|id>
+  curate help
+
+ENV:
+  CURATE_HOME  Root folder for inbox.tsv, templates/, digests/, rules.tsv (default: .);
+               several homes separated by ':' are read together by digest/list/stats
+  CURATE_FSYNC never | file | full — durability of atomic rewrites (default: file)
+  CURATE_SOCKET  Socket of `curate serve` (default: $CURATE_HOME/.curate.sock)
+  CURATE_NO_DAEMON=1  Run add/list/digest/stats locally even when serve is up
+  CURATE_HTTP_PROXY  HTTP proxy for `titles fill`, `check-links` and `snapshot` (required for https URLs)
+
+NOTES:
+  • Exactly 5 TAB-separated columns are written on `add`:
+      DATE\tKIND\tURL\tTITLE\tTAGS
+  • Kind detection is configured via rules.tsv (regex\tkind).
+  • ISO week handling uses Mon..Sun and the Jan 4 rule.
+  • -pd emits a self-contained HTML page (lightweight Pandoc-like output).
+  • clear-inbox --week / --before / --older-than Nd (or Nw) archives only the
+    matching rows: one streaming pass splits the inbox into a new archive
+    segment and a new inbox, swapped in under the inbox lock.
+  • --all-weeks / --weeks scan the inbox once and write one digest per ISO week
+    to digests/<YYYY-Www>.{md,html}, rendering weeks in parallel.
+  • --page-size N (with -pd) splits the items into <base>-p001.html, ... with
+    prev/next links; <base>.html becomes a small index of the pages.
+  • --format atom|rss writes a feed (one entry per item, or per ISO week with
+    --feed-per-period) to digests/<range>.{atom,rss} (digests/feed.* for
+    --all-weeks). Entries are cached per week under digests/.feed/, so adding
+    this week's items re-renders only this week; cached weeks the feed no
+    longer includes are removed. The feed keeps the 50 newest entries;
+    --feed-limit N changes that, --feed-limit all (or 0) keeps every entry.
+  • Digests are written to a temp file and renamed into place; identical output
+    leaves the existing file (and its mtime) untouched.
+  • --incremental re-renders only digests whose inputs (rows, header, options,
+    curate version) changed since the last write, per digests/.manifest.tsv.
+  • import reads CSV/TSV (a header row naming url, date, kind, title, tags
+    maps columns; otherwise DATE,KIND,URL,TITLE,TAGS), browser bookmark exports
+    and NDJSON; the input is parsed in parallel chunks and appended at once.
+  • search ANDs its terms over an inverted index in index/ (title words, host,
+    URL path words, tags) and ranks by term frequency and recency. The index is
+    built on first use, extended on add/import, and rebuilt when archive/ or a
+    cleared inbox no longer matches it (or with `curate index --rebuild`).
+  • --tag (all of), --any-tag (any of), --not-tag (none of) and --kind on list
+    and digest are resolved with compressed bitmaps kept in inbox.bitmaps
+    (per tag, kind and ISO week); only matching rows are read from the inbox.
+  • --where takes an expression over date, kind, domain, url, title and tag,
+    e.g. 'kind in (video,pdf) and domain ~ "github" and tag:#AI and
+    date >= 2025-09-01' (ops: = != < <= > >= ~ !~ in; and/or/not; parens).
+    It is compiled once; --explain prints the plan and estimated selectivity.
+  • list --domain HOST and `curate domains` answer from the host → rows
+    bitmaps in inbox.bitmaps (keyed by full host and registrable domain).
+  • list streams rows and stops once --limit is met; --reverse lists newest
+    first and --tail N prints the last N, both reading back from the end of
+    the inbox. With --since/--until rows are ordered by date.
+  • stats counts rows per group (several --by dimensions give one row per
+    combination) with a parallel hash aggregation over the inbox and, with
+    --include-archive, archive/*.tsv. Queries by week and/or one of kind, tag,
+    domain over whole weeks read the inbox part from aggregates.bin (or
+    each month shard's aggregates) instead.
+  • stats --approx (--by week|tag|domain) merges per-week sketches kept in
+    <file>.sketch next to the inbox and each archive: HyperLogLog distinct
+    URL/domain counts (±3.2% at 95%) per week, and Space-Saving + Count-Min
+    heavy hitters with low/high bounds. The range widens to whole ISO weeks.
+  • serve keeps the parsed inbox, inbox.bitmaps and rules.tsv in memory and
+    answers add/list/digest/stats over a Unix socket; the CLI uses it when
+    the socket is up. External edits are picked up via inotify (appended
+    rows are parsed incrementally). Requests run side by side, each in a
+    child forked from the daemon. digest reads the resident rows and list
+    --tag/--kind/--domain the resident bitmaps; unfiltered list and stats
+    read the mapped files as they would locally and gain only the skipped
+    start-up.
+  • http (default 127.0.0.1:8080) renders /week/YYYY-Www, /range/A..B and
+    /tag/NAME on demand from the inbox held in memory, with an LRU page cache
+    cleared on inbox changes and ETag/If-None-Match; POST /add (url, title,
+    tags, date, token) captures a link. Without --token a random token is
+    printed at startup. Requests with a foreign Host are refused, as are
+    requests from another Origin without the token; a non-loopback --bind
+    needs --token and the token on every request.
+  • titles fill fetches the pages of rows with an empty title (default 16
+    connections, 2 per host, keep-alive, redirects followed) and writes the
+    <title> back into the inbox. Results are cached in titles.tsv; failures
+    are retried after 7 days. https needs --proxy (no TLS in curate).
+  • check-links sends HEAD (a `Range: bytes=0-0` GET if HEAD fails) for each
+    distinct URL, at most --rate requests/s (default 10) and --per-host at a
+    time, and records status, latency and redirect target in linkstatus.tsv.
+    URLs checked within --max-age days (default 7) are skipped. Dead (404,
+    410, unknown host) and failing URLs are printed; digest --dead-links
+    mark|drop flags or omits the dead ones.
+  • snapshot fetches each page not yet stored and keeps its readable text
+    (<main>/<article>/<body> minus scripts, navigation, headers and footers)
+    in snapshots/, split into content-defined chunks addressed by SHA-256 so
+    text shared between pages is stored once. snapshots/index.tsv maps URLs
+    to snapshot ids; `snapshot show <url|id>` prints a stored text.
+  • sort orders inbox.tsv (and archive/*.tsv with --include-archive) by date,
+    keeping capture order within a day. Files already in order are left
+    alone; larger ones are sorted in runs of --memory MB (default 256) and
+    merged from temp files. Ranged digests on a sorted inbox binary-search
+    the rows instead of scanning and sorting them.
+  • migrate --layout sharded splits inbox.tsv into inbox/YYYY-MM.tsv (one
+    file per month of row dates) and records `layout sharded` in config.tsv;
+    --layout single merges the shards back. With shards, adds go to their
+    month, ranged reads open only the months in range and clear-inbox moves
+    whole months by renaming them. Each shard keeps its own bitmaps,
+    aggregates and sketch (inbox/YYYY-MM.tsv.bitmaps and so on), and serve
+    keeps every shard parsed in memory.
+  • digest, list and stats read every home in CURATE_HOME (':'-separated)
+    plus each --home DIR concurrently and k-way merge their rows by date.
+    An item (canonical URL) found in several homes is kept once, with the
+    union of its tags; output goes to the first home.
+  • sync <other-home> makes both homes hold the union of their rows (one
+    per date and canonical URL), appending each side's missing rows to the
+    other's inbox. Per-week row hashes kept in sync.bin are compared first,
+    so only rows of weeks that differ are read; --dry-run only reports.
+)HELP";
+}
+
+static optional<Args> parseCLI(int argc, char** argv){
+    if(argc<2){ printHelp(); return nullopt; }
+    Args a; a.cmd = argv[1];
+    auto need = [&](int i){ if(i>=argc){ cerr<<"Missing value for "<<argv[i-1]<<"\n"; exit(2);} };
+
+    if(a.cmd=="add"){
+        if(argc<3){ cerr<<"add: require <url>\n"; exit(2);} a.url = argv[2];
         for(int i=3;i<argc;++i){
             string t=argv[i];
             if(t=="--title"){ need(++i); a.addTitle = argv[i]; continue; }
             if(t=="--date"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --date"<<"\n"; exit(2);} a.addDateISO=fmtDate(*p); continue; }
             a.addTags.push_back(t);
         }
-        return a;
+        return a;
+    }
+    if(a.cmd=="digest"){
+        for(int i=2;i<argc;++i){
+            string t=argv[i];
+            if(t=="--home"){ need(++i); a.homes.push_back(argv[i]); continue; }
+            if(t=="-gt"||t=="--group-tags"){ a.groupTags=true; continue; }
+            if(t=="--tags-only"){ a.tagsOnly=true; continue; }
+            if(t=="-pd"){ a.pd=true; continue; }
+            if(t=="--no-header"){ a.noHeader=true; continue; }
+            if(t=="--week"){ need(++i); auto w=parseISOWeekStr(argv[i]); if(!w){ cerr<<"Invalid --week (use YYYY-Www)\n"; exit(2);} a.week=w; continue; }
+            if(t=="--start"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --start"<<"\n"; exit(2);} a.start=*p; continue; }
+            if(t=="--end"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --end"<<"\n"; exit(2);} a.end=*p; continue; }
+            if(t=="--all-weeks"){ a.allWeeks=true; continue; }
+            if(t=="--incremental"){ a.incremental=true; continue; }
+            if(t=="--page-size"){ need(++i); long n = atol(argv[i]); if(n<=0){ cerr<<"Invalid --page-size (use a positive count)\n"; exit(2);} a.pageSize=size_t(n); continue; }
+            if(t=="--weeks"){ need(++i); auto w=parseISOWeekRangeStr(argv[i]); if(!w){ cerr<<"Invalid --weeks (use YYYY-Www..YYYY-Www)\n"; exit(2);} a.weeks=w; continue; }
+            if(t=="--format"){ need(++i); a.format=argv[i]; if(a.format!="md" && a.format!="html" && a.format!="atom" && a.format!="rss"){ cerr<<"Invalid --format (use md|html|atom|rss)\n"; exit(2);} continue; }
+            if(t=="--feed-per-period"){ a.feedPerPeriod=true; continue; }
+            if(t=="--feed-url"){ need(++i); a.feedUrl=argv[i]; continue; }
+            if(t=="--feed-limit"){
+                need(++i); string v=argv[i]; char* e=nullptr; long n = v=="all"? 0 : strtol(v.c_str(), &e, 10);
+                if(v!="all" && (v.empty() || *e || n<0)){ cerr<<"Invalid --feed-limit (use a count, or all)\n"; exit(2);}
+                a.feedLimit=size_t(n); continue;
+            }
+            if(t=="--dead-links"){ need(++i); a.deadLinks=argv[i]; if(a.deadLinks!="mark" && a.deadLinks!="drop"){ cerr<<"Invalid --dead-links (use mark|drop)\n"; exit(2);} continue; }
+            if(t=="-o"){ need(++i); a.outPath=argv[i]; continue; }
+            if(t=="--where"){ need(++i); a.where=argv[i]; continue; }
+            if(t=="--explain"){ a.explain=true; continue; }
+            if(t=="--tag"){ need(++i); a.tagFilter.push_back(argv[i]); continue; }
+            if(t=="--any-tag"){ need(++i); a.anyTagFilter.push_back(argv[i]); continue; }
+            if(t=="--not-tag"){ need(++i); a.notTagFilter.push_back(argv[i]); continue; }
+            if(t=="--kind"){ need(++i); a.kindFilter=argv[i]; continue; }
+            cerr<<"Unknown option: "<<t<<"\n"; exit(2);
+        }
+        if(a.format=="html") a.pd = true;
+        if(a.format=="md" && a.pd){ cerr<<"-pd conflicts with --format md\n"; exit(2); }
+        bool feed = a.format=="atom" || a.format=="rss";
+        if(feed && (a.pd || a.pageSize || a.groupTags || a.tagsOnly)){ cerr<<"--format "<<a.format<<" cannot be combined with -pd, --page-size, -gt or --tags-only\n"; exit(2); }
+        if(!feed && (a.feedPerPeriod || !a.feedUrl.empty() || a.feedLimit)){ cerr<<"--feed-per-period/--feed-url/--feed-limit need --format atom|rss\n"; exit(2); }
+        if(a.allWeeks || a.weeks){
+            if(a.allWeeks && a.weeks){ cerr<<"--all-weeks and --weeks are mutually exclusive\n"; exit(2); }
+            if(a.week || a.start || a.end){ cerr<<"--all-weeks/--weeks cannot be combined with --week/--start/--end\n"; exit(2); }
+            if(!feed && !a.outPath.empty()){ cerr<<"--all-weeks/--weeks write to digests/; -o is not supported\n"; exit(2); }
+        }
+        if(a.pageSize && !a.pd){ cerr<<"--page-size applies to HTML output; add -pd\n"; exit(2); }
+        if(a.pageSize && a.outPath=="-"){ cerr<<"--page-size writes several files; it cannot go to stdout\n"; exit(2); }
+        if(a.incremental && !a.outPath.empty() && !feed){ cerr<<"--incremental only applies to the default digests/ paths\n"; exit(2); }
+        return a;
+    }
+    if(a.cmd=="clear-inbox"){
+        int periods = 0;
+        for(int i=2;i<argc;++i){
+            string t=argv[i];
+            if(t=="--archive-dir"){ need(++i); a.archiveDir=argv[i]; continue; }
+            if(t=="--week"){ need(++i); auto w=parseISOWeekStr(argv[i]); if(!w){ cerr<<"Invalid --week (use YYYY-Www)\n"; exit(2);} a.week=w; ++periods; continue; }
+            if(t=="--before"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --before"<<"\n"; exit(2);} a.clearBefore=*p; ++periods; continue; }
+            if(t=="--older-than"){
+                need(++i); string v=argv[i]; char* e=nullptr; errno=0; long n=strtol(v.c_str(), &e, 10);
+                string unit = e? string(e) : string();
+                // digits first (no sign or blanks), then an explicit unit: "d" alone or "-0" is not a period
+                if(v.empty() || !isdigit((unsigned char)v[0]) || e==v.c_str() || errno==ERANGE || (unit!="d" && unit!="w")){ cerr<<"Invalid --older-than (use Nd or Nw, e.g. 30d)\n"; exit(2); }
+                // bounded before multiplying: the cutoff must land between year 0 and yesterday
+                sys_days today = *parseISODate(todayISO());
+                long span = (today - sys_days{std::chrono::year{0}/1/1}).count();
+                if(n > (unit=="w"? span/7 : span)){ cerr<<"Invalid --older-than (reaches back past year 0)\n"; exit(2); }
+                a.clearBefore = today - days{unit=="w"? n*7 : n};
+                if(a.clearBefore >= today){ cerr<<"Invalid --older-than (must be at least 1d)\n"; exit(2); }
+                ++periods; continue;
+            }
+            cerr<<"Unknown option: "<<t<<"\n"; exit(2);
+        }
+        if(periods>1){ cerr<<"--week, --before and --older-than are mutually exclusive\n"; exit(2); }
+        return a;
+    }
+    if(a.cmd=="sort"){
+        for(int i=2;i<argc;++i){
+            string t=argv[i];
+            if(t=="--include-archive"){ a.includeArchive=true; continue; }
+            if(t=="--memory"){
+                need(++i); char* e=nullptr; long n=strtol(argv[i], &e, 10);
+                if(!e || *e || n<1){ cerr<<"Invalid --memory (MB, at least 1)\n"; exit(2); }
+                a.sortMemoryMB=size_t(n); continue;
+            }
+            cerr<<"Unknown option: "<<t<<"\n"; exit(2);
+        }
+        return a;
+    }
+    if(a.cmd=="migrate"){
+        for(int i=2;i<argc;++i){
+            string t=argv[i];
+            if(t=="--layout"){ need(++i); a.layout=argv[i]; continue; }
+            cerr<<"Unknown option: "<<t<<"\n"; exit(2);
+        }
+        if(a.layout!="sharded" && a.layout!="single"){ cerr<<"migrate needs --layout sharded|single\n"; exit(2); }
+        return a;
+    }
+    if(a.cmd=="sync"){
+        for(int i=2;i<argc;++i){
+            string t=argv[i];
+            if(t=="--dry-run"){ a.dryRun=true; continue; }
+            if(!t.empty() && t[0]!='-' && a.syncHome.empty()){ a.syncHome=t; continue; }
+            cerr<<"Unknown option: "<<t<<"\n"; exit(2);
+        }
+        if(a.syncHome.empty()){ cerr<<"sync: require <other-home>\n"; exit(2); }
+        return a;
+    }
+    if(a.cmd=="list"){
+        for(int i=2;i<argc;++i){
+            string t=argv[i];
+            if(t=="--home"){ need(++i); a.homes.push_back(argv[i]); continue; }
+            if(t=="--limit"){ need(++i); a.limit=stoi(argv[i]); continue; }
+            if(t=="--since"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --since"<<"\n"; exit(2);} a.since=*p; continue; }
+            if(t=="--until"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --until"<<"\n"; exit(2);} a.until=*p; continue; }
+            if(t=="--where"){ need(++i); a.where=argv[i]; continue; }
+            if(t=="--explain"){ a.explain=true; continue; }
+            if(t=="--tag"){ need(++i); a.tagFilter.push_back(argv[i]); continue; }
+            if(t=="--any-tag"){ need(++i); a.anyTagFilter.push_back(argv[i]); continue; }
+            if(t=="--not-tag"){ need(++i); a.notTagFilter.push_back(argv[i]); continue; }
+            if(t=="--kind"){ need(++i); a.kindFilter=argv[i]; continue; }
+            if(t=="--domain"){ need(++i); a.domain=argv[i]; continue; }
+            if(t=="--subdomains"){ a.subdomains=true; continue; }
+            if(t=="--tail"){ need(++i); long n=atol(argv[i]); if(n<=0){ cerr<<"Invalid --tail (use a positive count)\n"; exit(2);} a.tail=size_t(n); continue; }
+            if(t=="--reverse"){ a.reverse=true; continue; }
+            cerr<<"Unknown option: "<<t<<"\n"; exit(2);
+        }
+        if(a.subdomains && a.domain.empty()){ cerr<<"--subdomains needs --domain\n"; exit(2); }
+        return a;
+    }
+    if(a.cmd=="stats"){
+        a.format = "tsv";
+        for(int i=2;i<argc;++i){
+            string t=argv[i];
+            if(t=="--home"){ need(++i); a.homes.push_back(argv[i]); continue; }
+            if(t=="--by"){ need(++i); auto d=parseStatDims(argv[i]); if(!d){ cerr<<"Invalid --by (use kind|domain|tag|week|month, comma-separated)\n"; exit(2);} a.statBy=*d; continue; }
+            if(t=="--top"){ need(++i); long n=atol(argv[i]); if(n<=0){ cerr<<"Invalid --top (use a positive count)\n"; exit(2);} a.top=size_t(n); continue; }
+            if(t=="--since"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --since"<<"\n"; exit(2);} a.since=*p; continue; }
+            if(t=="--until"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --until"<<"\n"; exit(2);} a.until=*p; continue; }
+            if(t=="--include-archive"){ a.includeArchive=true; continue; }
+            if(t=="--where"){ need(++i); a.where=argv[i]; continue; }
+            if(t=="--format"){ need(++i); a.format=argv[i]; if(a.format!="tsv" && a.format!="json"){ cerr<<"Invalid --format (use tsv|json)\n"; exit(2);} continue; }
+            if(t=="--approx"){ a.approx=true; continue; }
+            cerr<<"Unknown option: "<<t<<"\n"; exit(2);
+        }
+        if(a.statBy.empty()){ cerr<<"stats: require --by kind|domain|tag|week|month\n"; exit(2); }
+        if(a.approx && (a.statBy.size()!=1 || a.statBy[0]==StatDim::kind || a.statBy[0]==StatDim::month)){ cerr<<"stats --approx: use --by week|tag|domain\n"; exit(2); }
+        if(a.approx && !a.where.empty()){ cerr<<"stats --approx cannot be combined with --where\n"; exit(2); }
+        return a;
+    }
+    if(a.cmd=="domains"){
+        for(int i=2;i<argc;++i){
+            string t=argv[i];
+            if(t=="--limit"){ need(++i); a.limit=stoi(argv[i]); continue; }
+            if(t=="--by-site"){ a.bySite=true; continue; }
+            cerr<<"Unknown option: "<<t<<"\n"; exit(2);
+        }
+        return a;
+    }
+    if(a.cmd=="export"){
+        a.format = "json";
+        for(int i=2;i<argc;++i){
+            string t=argv[i];
+            if(t=="--format"){ need(++i); a.format=argv[i]; if(a.format!="json" && a.format!="ndjson"){ cerr<<"Invalid --format (use json|ndjson)\n"; exit(2);} continue; }
+            if(t=="--since"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --since"<<"\n"; exit(2);} a.since=*p; continue; }
+            if(t=="--until"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --until"<<"\n"; exit(2);} a.until=*p; continue; }
+            if(t=="--include-archive"){ a.includeArchive=true; continue; }
+            if(t=="--where"){ need(++i); a.where=argv[i]; continue; }
+            if(t=="--explain"){ a.explain=true; continue; }
+            if(t=="-o"){ need(++i); a.outPath=argv[i]; continue; }
+            cerr<<"Unknown option: "<<t<<"\n"; exit(2);
+        }
+        return a;
+    }
+    if(a.cmd=="import"){
+        for(int i=2;i<argc;++i){
+            string t=argv[i];
+            if(t=="--format"){ need(++i); a.format=argv[i]; continue; }
+            if(t=="--skip-existing"){ a.skipExisting=true; continue; }
+            if(a.inPath.empty() && (t=="-" || t[0]!='-')){ a.inPath=t; continue; }
+            cerr<<"Unknown option: "<<t<<"\n"; exit(2);
+        }
+        if(a.inPath.empty()){ cerr<<"import: require <file> (or - for stdin)\n"; exit(2); }
+        if(a.format.empty()){
+            string ext = toLower(fs::path(a.inPath).extension().string());
+            if(ext==".ndjson" || ext==".jsonl") a.format = "ndjson";
+            else if(ext==".csv") a.format = "csv";
+            else if(ext==".tsv") a.format = "tsv";
+            else if(ext==".html" || ext==".htm") a.format = "bookmarks-html";
+            else { cerr<<"import: cannot infer the format of "<<a.inPath<<"; pass --format\n"; exit(2); }
+        }
+        if(a.format!="ndjson" && a.format!="csv" && a.format!="tsv" && a.format!="bookmarks-html"){ cerr<<"Invalid --format (use csv|tsv|bookmarks-html|ndjson)\n"; exit(2); }
+        return a;
+    }
+    if(a.cmd=="search"){
+        for(int i=2;i<argc;++i){
+            string t=argv[i];
+            if(t=="--kind"){ need(++i); a.kindFilter=argv[i]; continue; }
+            if(t=="--tag"){ need(++i); a.tagFilter.push_back(argv[i]); continue; }
+            if(t=="--limit"){ need(++i); a.limit=stoi(argv[i]); continue; }
+            if(t=="--since"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --since"<<"\n"; exit(2);} a.since=*p; continue; }
+            if(t=="--until"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --until"<<"\n"; exit(2);} a.until=*p; continue; }
+            if(t.size()>1 && t[0]=='-'){ cerr<<"Unknown option: "<<t<<"\n"; exit(2); }
+            a.terms.push_back(t);
+        }
+        return a;
+    }
+    if(a.cmd=="aggregates"){
+        for(int i=2;i<argc;++i){ string t=argv[i]; if(t=="--rebuild"){ a.rebuild=true; continue; } cerr<<"Unknown option: "<<t<<"\n"; exit(2); }
+        return a;
+    }
+    if(a.cmd=="titles"){
+        if(argc<3 || string(argv[2])!="fill"){ cerr<<"titles: use `curate titles fill`\n"; exit(2); }
+        for(int i=3;i<argc;++i){
+            string t=argv[i];
+            if(t=="--since"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --since"<<"\n"; exit(2);} a.since=*p; continue; }
+            if(t=="--until"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --until"<<"\n"; exit(2);} a.until=*p; continue; }
+            if(t=="--concurrency"){ need(++i); long n=atol(argv[i]); if(n<=0){ cerr<<"Invalid --concurrency (use a positive count)\n"; exit(2);} a.concurrency=size_t(n); continue; }
+            if(t=="--per-host"){ need(++i); long n=atol(argv[i]); if(n<=0){ cerr<<"Invalid --per-host (use a positive count)\n"; exit(2);} a.perHost=size_t(n); continue; }
+            if(t=="--timeout"){ need(++i); double s=atof(argv[i]); if(s<=0){ cerr<<"Invalid --timeout (use seconds > 0)\n"; exit(2);} a.timeoutMs=int(s*1000); continue; }
+            if(t=="--proxy"){ need(++i); a.proxy=argv[i]; continue; }
+            if(t=="-v"||t=="--verbose"){ a.verbose=true; continue; }
+            cerr<<"Unknown option: "<<t<<"\n"; exit(2);
+        }
+        return a;
+    }
+    if(a.cmd=="check-links"){
+        for(int i=2;i<argc;++i){
+            string t=argv[i];
+            if(t=="--since"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --since"<<"\n"; exit(2);} a.since=*p; continue; }
+            if(t=="--until"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --until"<<"\n"; exit(2);} a.until=*p; continue; }
+            if(t=="--include-archive"){ a.includeArchive=true; continue; }
+            if(t=="--concurrency"){ need(++i); long n=atol(argv[i]); if(n<=0){ cerr<<"Invalid --concurrency (use a positive count)\n"; exit(2);} a.concurrency=size_t(n); continue; }
+            if(t=="--per-host"){ need(++i); long n=atol(argv[i]); if(n<=0){ cerr<<"Invalid --per-host (use a positive count)\n"; exit(2);} a.perHost=size_t(n); continue; }
+            if(t=="--rate"){ need(++i); char* e=nullptr; double r=strtod(argv[i], &e); if(*e || r<0){ cerr<<"Invalid --rate (use requests per second, 0 = unlimited)\n"; exit(2);} a.rate=r; continue; }
+            if(t=="--timeout"){ need(++i); double s=atof(argv[i]); if(s<=0){ cerr<<"Invalid --timeout (use seconds > 0)\n"; exit(2);} a.timeoutMs=int(s*1000); continue; }
+            if(t=="--max-age"){ need(++i); char* e=nullptr; long n=strtol(argv[i], &e, 10); if(*e || n<0){ cerr<<"Invalid --max-age (use days >= 0)\n"; exit(2);} a.maxAgeDays=int(n); continue; }
+            if(t=="--proxy"){ need(++i); a.proxy=argv[i]; continue; }
+            if(t=="-v"||t=="--verbose"){ a.verbose=true; continue; }
+            cerr<<"Unknown option: "<<t<<"\n"; exit(2);
+        }
+        return a;
+    }
+    if(a.cmd=="snapshot"){
+        if(argc>2 && string(argv[2])=="show"){
+            if(argc!=4){ cerr<<"snapshot show: require <url|id>\n"; exit(2); }
+            a.showKey = argv[3];
+            return a;
+        }
+        for(int i=2;i<argc;++i){
+            string t=argv[i];
+            if(t=="--since"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --since"<<"\n"; exit(2);} a.since=*p; continue; }
+            if(t=="--until"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --until"<<"\n"; exit(2);} a.until=*p; continue; }
+            if(t=="--include-archive"){ a.includeArchive=true; continue; }
+            if(t=="--refresh"){ a.refresh=true; continue; }
+            if(t=="--concurrency"){ need(++i); long n=atol(argv[i]); if(n<=0){ cerr<<"Invalid --concurrency (use a positive count)\n"; exit(2);} a.concurrency=size_t(n); continue; }
+            if(t=="--per-host"){ need(++i); long n=atol(argv[i]); if(n<=0){ cerr<<"Invalid --per-host (use a positive count)\n"; exit(2);} a.perHost=size_t(n); continue; }
+            if(t=="--timeout"){ need(++i); double s=atof(argv[i]); if(s<=0){ cerr<<"Invalid --timeout (use seconds > 0)\n"; exit(2);} a.timeoutMs=int(s*1000); continue; }
+            if(t=="--proxy"){ need(++i); a.proxy=argv[i]; continue; }
+            if(t=="-v"||t=="--verbose"){ a.verbose=true; continue; }
+            cerr<<"Unknown option: "<<t<<"\n"; exit(2);
+        }
+        return a;
+    }
+    if(a.cmd=="http"){
+        for(int i=2;i<argc;++i){
+            string t=argv[i];
+            if(t=="--port"){ need(++i); long n=atol(argv[i]); if(n<1 || n>65535){ cerr<<"Invalid --port (use 1-65535)\n"; exit(2);} a.port=int(n); continue; }
+            if(t=="--bind"){ need(++i); a.bind=argv[i]; continue; }
+            if(t=="--token"){ need(++i); a.token=argv[i]; continue; }
+            cerr<<"Unknown option: "<<t<<"\n"; exit(2);
+        }
+        if(a.bind.rfind("127.", 0)!=0 && a.token.empty()){ cerr<<"--bind "<< a.bind <<" is not loopback; it needs --token T\n"; exit(2); }
+        return a;
+    }
+    if(a.cmd=="serve"){
+        for(int i=2;i<argc;++i){ cerr<<"Unknown option: "<<argv[i]<<"\n"; exit(2); }
+        return a;
+    }
+    if(a.cmd=="index"){
+        for(int i=2;i<argc;++i){ string t=argv[i]; if(t=="--rebuild"){ a.rebuild=true; continue; } cerr<<"Unknown option: "<<t<<"\n"; exit(2); }
+        return a;
+    }
+    if(a.cmd=="help"||a.cmd=="-h"||a.cmd=="--help"){ printHelp(); exit(0); }
+    cerr<<"Unknown command: "<<a.cmd<<"\n"; printHelp(); return nullopt;
+}
+
+// ===== Commands =====
+static int cmd_add(const Args& a){
+    Rec r;
+    r.date  = a.addDateISO? *parseISODate(*a.addDateISO) : *parseISODate(todayISO());
+    r.url   = a.url;
+    r.kind  = detectKind(a.url);
+    r.title = a.addTitle;
+    r.tags  = normalizeTagsForStorage(a.addTags);
+    if(!appendInbox(r)){ cerr<<"Failed to append to "<< inboxPath() <<"\n"; return 1; }
+    refreshIndexesAfterAppend();
+    cout<<"Added: "<< fmtDate(r.date) <<"\t"<< r.kind <<"\t"<< r.url <<"\t"<< r.title <<"\t"<< r.tags <<"\n";
+    return 0;
+}
+
+// --tag (all of), --any-tag (at least one), --not-tag (none of), --kind, and the ISO weeks
+// overlapping [lo, hi] are combined as bitmaps; only the surviving rows are decoded.
+static bool rowFilterActive(const Args& a){ return !a.tagFilter.empty() || !a.anyTagFilter.empty() || !a.notTagFilter.empty() || !a.kindFilter.empty() || !a.domain.empty(); }
+
+// --domain H: rows whose host is H (a leading "www." is ignored either way). With --subdomains
+// also every host ending in ".H"; when H is a registrable domain that is one "site:" bitmap.
+static RowBitmap domainRows(const InboxBitmaps& b, const string& domain, bool subdomains){
+    string h = urlHostKey(domain);
+    if(!subdomains) return b.get("host:" + h);
+    if(registrableDomain(h)==h) return b.get("site:" + h);
+    RowBitmap u;
+    for(auto it = b.maps.lower_bound("host:"); it!=b.maps.end() && it->first.rfind("host:", 0)==0; ++it){
+        string_view k = string_view(it->first).substr(5);
+        if(k==h || (k.size()>h.size() && k.substr(k.size()-h.size())==h && k[k.size()-h.size()-1]=='.')) u |= it->second;
+    }
+    return u;
+}
+
+// Rows (ids into b.offsets) passing the tag/kind/domain filters, narrowed to the ISO weeks that
+// overlap [lo, hi]; dates themselves are checked by the caller.
+static RowBitmap selectRows(const Args& a, const InboxBitmaps& b, sys_days lo, sys_days hi){
+    auto tagKey = [](string t){ t = toLower(trim(t)); if(!t.empty() && t[0]!='#') t.insert(t.begin(), '#'); return t; };
+    auto anyOf = [&](const vector<string>& keys){ RowBitmap u; for(const auto& k: keys) u |= b.get(k); return u; };
+
+    optional<RowBitmap> sel;
+    auto narrow = [&](const RowBitmap& x){ if(sel) *sel &= x; else sel = x; };
+    for(const auto& t: a.tagFilter) narrow(b.get(tagKey(t)));
+    if(!a.anyTagFilter.empty()){ vector<string> k; for(const auto& t: a.anyTagFilter) k.push_back(tagKey(t)); narrow(anyOf(k)); }
+    if(!a.kindFilter.empty()) narrow(b.get("kind:" + toLower(a.kindFilter)));
+    if(!a.domain.empty()) narrow(domainRows(b, a.domain, a.subdomains));
+    if(lo!=sys_days::min() || hi!=sys_days::max()){
+        vector<string> weeks;
+        for(auto it = b.maps.lower_bound("week:"); it!=b.maps.end() && it->first.rfind("week:", 0)==0; ++it){
+            auto w = parseISOWeekStr(it->first.substr(5));
+            if(!w) continue;
+            auto wb = weekBounds(w->first, w->second);
+            if(wb.sunday>=lo && wb.monday<=hi) weeks.push_back(it->first);
+        }
+        narrow(anyOf(weeks));
+    }
+    if(!sel) sel = RowBitmap::range(uint32_t(b.offsets.size()));
+    if(!a.notTagFilter.empty()){ vector<string> k; for(const auto& t: a.notTagFilter) k.push_back(tagKey(t)); sel->andNot(anyOf(k)); }
+    return std::move(*sel);
+}
+
+// Row ids [first, last) dated within [lo, hi], found by binary search over the row offsets of a
+// date-ordered inbox (b.sorted).
+static pair<uint32_t,uint32_t> sortedRowRange(string_view d, const InboxBitmaps& b, sys_days lo, sys_days hi){
+    auto dateOf = [&](uint32_t id){
+        size_t off = size_t(b.offsets[id]);
+        size_t tab = d.find('\t', off);
+        auto p = parseISODate(string(trimView(d.substr(off, (tab==string_view::npos? d.size() : tab) - off))));
+        return p? *p : sys_days::min();
+    };
+    auto bound = [&](auto before){
+        uint32_t l = 0, r = uint32_t(b.offsets.size());
+        while(l < r){ uint32_t m = l + (r-l)/2; if(before(dateOf(m))) l = m + 1; else r = m; }
+        return l;
+    };
+    return {bound([&](sys_days x){ return x < lo; }), bound([&](sys_days x){ return x <= hi; })};
+}
+
+// `sortedOut` (optional) is set when the rows come back in date order because the inbox is.
+static vector<Rec> loadInboxFiltered(const Args& a, sys_days lo = sys_days::min(), sys_days hi = sys_days::max(), bool* sortedOut = nullptr){
+    auto where = compileWhere(a.where);
+    bool ranged = lo!=sys_days::min() || hi!=sys_days::max();
+    if(sortedOut) *sortedOut = false;
+    bool sharded = shardedInbox();
+    if(!rowFilterActive(a) && !ranged && !sharded){
+        if(!where) return loadInbox();
+        MappedFile inbox(inboxPath());
+        vector<Rec> out;
+        forEachMatching(inbox.view(), where.get(), [&](const RecView& r){ out.push_back(toRec(r)); });
+        return out;
+    }
+    // Shards are months, so only those overlapping the range are opened; rows are in date order
+    // when every shard is.
+    vector<Rec> out; vector<uint32_t> keep;
+    bool sorted = true;
+    for(const auto& path: inboxFiles(lo, hi)){
+        MappedFile inbox(path);
+        string_view d = inbox.view();
+        InboxBitmaps b = syncInboxBitmaps(d, bitmapsPathFor(path));
+        // A date-ordered inbox reads only the rows in range; otherwise the week bitmaps narrow it.
+        uint32_t first = 0, last = uint32_t(b.offsets.size());
+        if(b.sorted && ranged) std::tie(first, last) = sortedRowRange(d, b, lo, hi);
+        sorted = sorted && b.sorted;
+
+        vector<RecView> views; RecView r;
+        auto visit = [&](uint32_t id){
+            if(id < first || id >= last) return;
+            size_t off = size_t(b.offsets[id]);
+            const void* nl = memchr(d.data()+off, '\n', d.size()-off);
+            size_t end = nl? size_t(static_cast<const char*>(nl) - d.data()) : d.size();
+            if(parseRecLine(d.substr(off, end-off), r)) views.push_back(r);
+        };
+        if(rowFilterActive(a) || !b.sorted) selectRows(a, b, lo, hi).forEach(visit);
+        else for(uint32_t id = first; id < last; ++id) visit(id);
+        for(size_t at=0; at<views.size(); at += WhereFilter::BATCH){
+            size_t n = std::min(WhereFilter::BATCH, views.size()-at);
+            keep.resize(n); for(uint32_t i=0;i<n;++i) keep[i] = uint32_t(at+i);
+            if(where) where->filter(views, keep);
+            for(uint32_t i: keep) out.push_back(toRec(views[i]));
+        }
+    }
+    if(sortedOut) *sortedOut = sorted;
+    return out;
+}
+
+static pair<sys_days,sys_days> computeRange(const Args& a, string& labelOut){
+    if(a.start && a.end){ labelOut = fmtDate(*a.start) + string(" to ") + fmtDate(*a.end); return {*a.start,*a.end}; }
+    if(a.week){ auto wb = weekBounds(a.week->first, a.week->second); labelOut = fmtISOWeek(wb.year, wb.week); return {wb.monday, wb.sunday}; }
+    auto now = std::chrono::floor<days>(std::chrono::system_clock::now()); auto w = isoWeekFromDate(now); labelOut = fmtISOWeek(w.year, w.week); return {w.monday, w.sunday};
+}
+
+// ===== Federated homes =====
+// digest, list and stats can read several homes at once: every home listed in CURATE_HOME
+// (':'-separated, ';' on Windows) plus each --home DIR. The first is the primary home (digests,
+// templates and rules come from it). Each home's rows in range are loaded concurrently (a thread
+// resolves paths against its own home) and put in date order; a k-way heap merge on (date, home)
+// then streams them once, keeping the first copy of each canonical URL and folding the tags of
+// copies from other homes into it.
+static vector<fs::path> federatedHomes(const Args& a){
+    vector<fs::path> homes;
+    auto addHome = [&](const fs::path& h){
+        std::error_code ec;
+        for(const auto& o: homes) if(o==h || fs::equivalent(o, h, ec)) return;
+        homes.push_back(h);
+    };
+    string env = getenvOr("CURATE_HOME", string("."));
+    for(size_t b = 0; b <= env.size(); ){
+        size_t e = std::min(env.size(), env.find(kHomeSep, b));
+        if(e>b) addHome(env.substr(b, e-b));
+        b = e + 1;
+    }
+    if(homes.empty()) homes.push_back(".");
+    for(const auto& h: a.homes) addHome(h);
+    return homes;
+}
+
+static bool federated(const Args& a){ return federatedHomes(a).size() > 1; }
+
+// Adds the tags of `more` that `into` lacks (compared case-insensitively, with or without '#').
+static void unionTags(string& into, string_view more){
+    auto key = [](string_view t){ string k = toLower(string(t)); if(k[0]!='#') k.insert(k.begin(), '#'); return k; };
+    unordered_set<string> have;
+    for(const auto& t: splitTags(into)) have.insert(key(t));
+    for(const auto& t: splitTags(more)){
+        if(!have.insert(key(t)).second) continue;
+        if(!into.empty()) into += ' ';
+        into += t;
+    }
+}
+
+struct FederationStats{ size_t homes = 0, rows = 0, duplicates = 0; };
+
+static vector<Rec> loadFederated(const Args& a, sys_days lo, sys_days hi, FederationStats* st = nullptr){
+    auto homes = federatedHomes(a);
+    compileWhere(a.where); // report a syntax error once, before the readers start
+    vector<vector<Rec>> per(homes.size());
+    parallelFor(homes.size(), [&](size_t i){
+        fs::path saved = threadHome(); threadHome() = homes[i];
+        bool sorted = false;
+        auto rows = loadInboxFiltered(a, lo, hi, &sorted);
+        if(a.includeArchive){
+            auto where = compileWhere(a.where);
+            for(const auto& p: archiveFiles()){
+                MappedFile f(p);
+                forEachMatching(f.view(), where.get(), [&](const RecView& r){ if(r.date>=lo && r.date<=hi) rows.push_back(toRec(r)); });
+            }
+            sorted = false;
+        }
+        per[i] = filterByDateRange(rows, lo, hi, sorted);
+        threadHome() = saved;
+    });
+
+    using Head = pair<sys_days,size_t>; // (date, home): ties go to the earlier home
+    vector<Head> heap; vector<size_t> next(homes.size(), 0);
+    auto later = [](const Head& x, const Head& y){ return x > y; };
+    for(size_t i=0;i<per.size();++i) if(!per[i].empty()) heap.push_back({per[i][0].date, i});
+    make_heap(heap.begin(), heap.end(), later);
+    vector<Rec> out;
+    unordered_map<string,pair<size_t,size_t>> byUrl; // canonical URL → (first kept row, its home)
+    size_t dups = 0;
+    while(!heap.empty()){
+        pop_heap(heap.begin(), heap.end(), later);
+        size_t i = heap.back().second;
+        Rec& r = per[i][next[i]++];
+        if(next[i] < per[i].size()){ heap.back().first = per[i][next[i]].date; push_heap(heap.begin(), heap.end(), later); }
+        else heap.pop_back();
+        string key = canonicalUrl(r.url);
+        if(!key.empty()){
+            // Repeats within one home are that home's business; only copies from other homes merge.
+            auto [it, fresh] = byUrl.emplace(std::move(key), pair{out.size(), i});
+            if(!fresh && it->second.second!=i){ unionTags(out[it->second.first].tags, r.tags); ++dups; continue; }
+        }
+        out.push_back(std::move(r));
+    }
+    if(st){ st->homes = homes.size(); st->rows = out.size(); st->duplicates = dups; }
+    return out;
+}
+
+// The rows digest renders: from this home, or merged from every federated home (date-ordered).
+static vector<Rec> loadDigestRows(const Args& a, sys_days lo = sys_days::min(), sys_days hi = sys_days::max(), bool* sortedOut = nullptr){
+    if(!federated(a)) return loadInboxFiltered(a, lo, hi, sortedOut);
+    if(sortedOut) *sortedOut = true;
+    return loadFederated(a, lo, hi);
+}
+
+static RenderOpts renderOptsFromArgs(const Args& a, const string& label){
+    RenderOpts ro; 
+    ro.groupTags     = a.groupTags; 
+    ro.tagsOnly      = a.tagsOnly; 
+    ro.includeHeader = !a.noHeader; 
+    ro.html          = a.pd; 
+    ro.headerText    = readFileOrEmpty(headerPath()); 
+    ro.rangeLabel    = label;
+    ro.pageSize      = a.pageSize;
+    return ro;
+}
+
+// --all-weeks / --weeks: one inbox scan, rows bucketed by ISO week, weeks rendered on the pool.
+static int cmd_digest_weeks(const Args& a){
+    auto all = loadDigestRows(a);
+    applyDeadLinks(all, a.deadLinks);
+    sys_days lo, hi;
+    if(a.weeks){
+        lo = weekBounds(a.weeks->first.first, a.weeks->first.second).monday;
+        hi = weekBounds(a.weeks->second.first, a.weeks->second.second).sunday;
+    } else {
+        if(all.empty()){ cout<<"Inbox is empty; no digests written\n"; return 0; }
+        auto [mn,mx] = std::minmax_element(all.begin(), all.end(), [](const Rec& x, const Rec& y){ return x.date<y.date; });
+        lo = isoWeekFromDate(mn->date).monday; hi = isoWeekFromDate(mx->date).sunday;
+    }
+
+    WeekLookup wl(lo, hi);
+    vector<vector<Rec>> buckets(wl.weeks.size());
+    for(auto& r: all){ int w = wl.indexOf(r.date); if(w>=0) buckets[size_t(w)].push_back(std::move(r)); }
+
+    // --weeks renders every week in range (empty ones too, as --week would); --all-weeks only weeks with rows.
+    vector<size_t> todo;
+    for(size_t i=0;i<buckets.size();++i) if(a.weeks || !buckets[i].empty()) todo.push_back(i);
+
+    RenderOpts base = renderOptsFromArgs(a, "");
+    const auto manifest = loadDigestManifest();
+    vector<string> newHash(todo.size()); // empty = skipped or failed
+    std::atomic<int> failures{0}, unchanged{0}, identical{0};
+    parallelFor(todo.size(), [&](size_t k){
+        size_t i = todo[k];
+        auto& rows = buckets[i]; sortByDate(rows);
+        RenderOpts ro = base; ro.rangeLabel = fmtISOWeek(wl.weeks[i].year, wl.weeks[i].week);
+        fs::path outPath = defaultDigestPath(ro.rangeLabel, a.pd);
+        string h = digestInputHash(rows, ro);
+        if(a.incremental){
+            auto it = manifest.find(outPath.filename().string());
+            if(it!=manifest.end() && it->second==h && fileExists(outPath)){ ++unchanged; return; }
+        }
+        bool same = false;
+        if(!writeDigestFile(outPath, rows, ro, same)){ ++failures; return; }
+        if(same) ++identical;
+        newHash[k] = h;
+    });
+
+    auto updated = manifest; size_t written = 0;
+    for(size_t k=0;k<todo.size();++k){
+        if(newHash[k].empty()) continue;
+        const auto& w = wl.weeks[todo[k]];
+        updated[defaultDigestPath(fmtISOWeek(w.year, w.week), a.pd).filename().string()] = newHash[k];
+        ++written;
+    }
+    if(written && !saveDigestManifest(updated)) cerr<<"Warning: failed to update "<< digestManifestPath() <<"\n";
+    cout<<"Wrote "<< written <<" weekly digests to "<< digestsDir();
+    if(a.incremental) cout<<" ("<< unchanged.load() <<" unchanged)";
+    if(identical) cout<<"; "<< identical.load() <<" already identical on disk";
+    cout<<"\n";
+    return failures? 2 : 0;
+}
+
+// --format atom|rss: rows are bucketed by ISO week; each week's entries are a cached fragment
+// under digests/.feed/, re-rendered only when its hash in the manifest changes. Only the newest
+// entries are kept (items, or weeks with --feed-per-period; 50 unless --feed-limit); fragments of the same flavour for
+// weeks left out of the feed are deleted with their manifest entries.
+static int cmd_digest_feed(const Args& a){
+    auto all = loadDigestRows(a);
+    applyDeadLinks(all, a.deadLinks);
+    FeedOpts fo; fo.format = a.format=="rss"? FeedFormat::rss : FeedFormat::atom; fo.perPeriod = a.feedPerPeriod; fo.siteUrl = a.feedUrl;
+    while(!fo.siteUrl.empty() && fo.siteUrl.back()=='/') fo.siteUrl.pop_back();
+
+    sys_days lo, hi;
+    if(a.weeks){
+        lo = weekBounds(a.weeks->first.first, a.weeks->first.second).monday;
+        hi = weekBounds(a.weeks->second.first, a.weeks->second.second).sunday;
+        fo.label = fmtISOWeek(a.weeks->first.first, a.weeks->first.second) + ".." + fmtISOWeek(a.weeks->second.first, a.weeks->second.second);
+    } else if(a.allWeeks){
+        fo.label = "feed";
+        if(all.empty()){ lo = hi = *parseISODate(todayISO()); }
+        else {
+            auto [mn,mx] = std::minmax_element(all.begin(), all.end(), [](const Rec& x, const Rec& y){ return x.date<y.date; });
+            lo = mn->date; hi = mx->date;
+        }
+    } else {
+        auto r = computeRange(a, fo.label); lo = r.first; hi = r.second;
+    }
+
+    WeekLookup wl(lo, hi);
+    vector<vector<Rec>> buckets(wl.weeks.size());
+    for(auto& r: all){ if(r.date<lo || r.date>hi) continue; int w = wl.indexOf(r.date); if(w>=0) buckets[size_t(w)].push_back(std::move(r)); }
+
+    fs::path fragDir = digestsDir() / ".feed";
+    string suffix = string(feedExt(fo.format)) + (fo.perPeriod? "-period" : "");
+    auto fragKey = [&](size_t i){ return ".feed/" + fmtISOWeek(wl.weeks[i].year, wl.weeks[i].week) + suffix; };
+    auto fragPath = [&](size_t i){ return fragDir / (fmtISOWeek(wl.weeks[i].year, wl.weeks[i].week) + suffix); };
+
+    const auto manifest = loadDigestManifest();
+    vector<string> newHash(buckets.size());
+    std::atomic<int> failures{0};
+    sys_days newest = lo;
+    for(auto& b: buckets){ sortByDate(b); if(!b.empty()) newest = std::max(newest, b.back().date); }
+    if(size_t limit = a.feedLimit.value_or(50)){
+        size_t left = limit;
+        for(size_t k=buckets.size(); k-- > 0; ){
+            auto& b = buckets[k];
+            if(b.empty()) continue;
+            if(!left){ b.clear(); continue; }
+            if(fo.perPeriod){ --left; continue; }
+            if(b.size() > left) b.erase(b.begin(), b.end() - ptrdiff_t(left)); // newest rows are last
+            left -= b.size();
+        }
+    }
+
+    parallelFor(buckets.size(), [&](size_t i){
+        if(buckets[i].empty()) return;
+        string label = fmtISOWeek(wl.weeks[i].year, wl.weeks[i].week);
+        Fnv64 f; f.field(CURATE_VERSION).field(suffix).field(fo.siteUrl).field(label);
+        for(const auto& r: buckets[i]) f.field(fmtDate(r.date)).field(r.kind).field(r.url).field(r.title).field(r.tags);
+        string h = hex64(f.h);
+        auto it = manifest.find(fragKey(i));
+        if(it!=manifest.end() && it->second==h && fileExists(fragPath(i))) return;
+        AtomicFile out(fragPath(i));
+        renderFeedFragment([&](string_view s){ out.write(s); }, buckets[i], label, fo);
+        if(!out.commit()){ cerr<<"Failed to write "<< fragPath(i) <<": "<< out.error() <<"\n"; ++failures; return; }
+        newHash[i] = h;
+    });
+    if(failures) return 2;
+
+    auto updated = manifest; size_t rendered = 0, weeks = 0;
+    set<string> kept;
+    for(size_t i=0;i<buckets.size();++i){
+        if(!buckets[i].empty()){ ++weeks; kept.insert(fragKey(i)); }
+        if(!newHash[i].empty()){ updated[fragKey(i)] = newHash[i]; ++rendered; }
+    }
+    // A fragment is ".feed/YYYY-Www" + suffix; those of other formats or flavours are left alone.
+    auto ours = [&](const string& key){
+        return key.size()==6 + 8 + suffix.size() && key.compare(0, 6, ".feed/")==0 && key.compare(14, string::npos, suffix)==0
+            && parseISOWeekStr(key.substr(6, 8));
+    };
+    size_t pruned = 0;
+    for(auto it = updated.begin(); it!=updated.end(); ){
+        if(ours(it->first) && !kept.count(it->first)){ it = updated.erase(it); ++pruned; } else ++it;
+    }
+    std::error_code ec;
+    for(const auto& e: fs::directory_iterator(fragDir, ec)){
+        string key = ".feed/" + e.path().filename().string();
+        if(ours(key) && !kept.count(key)){ std::error_code rm; fs::remove(e.path(), rm); if(!manifest.count(key)) ++pruned; }
+    }
+    if((rendered || pruned) && !saveDigestManifest(updated)) cerr<<"Warning: failed to update "<< digestManifestPath() <<"\n";
+
+    auto assemble = [&](const ByteSink& out){
+        renderFeedHead(out, fo, newest);
+        for(size_t k=buckets.size(); k-- > 0; ){
+            if(buckets[k].empty()) continue;
+            if(!copyFileTo(fragPath(k), out)) return false;
+        }
+        renderFeedTail(out, fo);
+        return true;
+    };
+
+    if(a.outPath=="-"){
+        if(!assemble([](string_view s){ cout.write(s.data(), std::streamsize(s.size())); })){ cerr<<"Failed to read feed fragments\n"; return 2; }
+        return 0;
+    }
+    fs::path outPath = a.outPath.empty()? digestsDir() / (safeBaseFromRangeLabel(fo.label) + feedExt(fo.format)) : fs::path(a.outPath);
+    AtomicFile out(outPath);
+    if(!assemble([&](string_view s){ out.write(s); }) || !out.commit()){ cerr<<"Failed to write "<< outPath <<"\n"; return 2; }
+    cout<<"Wrote "<< outPath <<" ("<< weeks <<" weeks, "<< rendered <<" re-rendered";
+    if(pruned) cout<<", "<< pruned <<" stale cached week"<< (pruned==1? "" : "s") <<" removed";
+    cout<<")\n";
+    return 0;
+}
+
+static int cmd_digest(const Args& a){
+    if(a.format=="atom" || a.format=="rss") return cmd_digest_feed(a);
+    if(a.allWeeks || a.weeks) return cmd_digest_weeks(a);
+    string label; auto [A,B] = computeRange(a,label);
+    bool sorted = false; auto all = loadDigestRows(a,A,B,&sorted);
+    auto rows = filterByDateRange(all,A,B,sorted);
+    applyDeadLinks(rows, a.deadLinks);
+
+    RenderOpts ro = renderOptsFromArgs(a, label);
+
+    // Default-path digests are tracked in the manifest so --incremental can skip unchanged ones.
+    bool tracked = a.outPath.empty();
+    string hash = tracked? digestInputHash(rows, ro) : string();
+    if(a.incremental){
+        fs::path outPath = defaultDigestPath(ro.rangeLabel, a.pd);
+        auto m = loadDigestManifest(); auto it = m.find(outPath.filename().string());
+        if(it!=m.end() && it->second==hash && fileExists(outPath)){ cout<<"Up to date: "<< outPath <<"\n"; return 0; }
+    }
+
+    // Output target:
+    // - If -o "-" => stdout
+    // - If -o not set => digests/<range>.{md,html}
+    // - Else => user-specified path
+    if(a.outPath == "-"){
+        DigestWriter w([](string_view s){ cout.write(s.data(), std::streamsize(s.size())); }, a.pd);
+        renderDigest(rows, ro, w);
+        return 0;
+    }
+
+    fs::path outPath = a.outPath.empty()
+        ? defaultDigestPath(ro.rangeLabel, a.pd)
+        : fs::path(a.outPath);
+
+    bool same = false;
+    if(!writeDigestFile(outPath, rows, ro, same)) return 2;
+
+    if(tracked){
+        auto m = loadDigestManifest(); m[outPath.filename().string()] = hash;
+        if(!saveDigestManifest(m)) cerr<<"Warning: failed to update "<< digestManifestPath() <<"\n";
+    }
+    return 0;
+}
+
+// clear-inbox --week/--before/--older-than: one streaming pass over `src` in fixed-size blocks
+// sends each row either to a new archive segment `dest` or to the new `src` (an AtomicFile), so
+// memory stays flat for any inbox size. The archive segment is renamed into place first, then the
+// new inbox: a crash in between leaves rows in both places, never in neither. The caller holds
+// the inbox lock.
+static bool partitionInboxFile(const fs::path& src, const fs::path& dest, sys_days lo, sys_days hi, size_t& moved, size_t& kept){
+    LineReader in(src);
+    if(!in.ok()){ cerr<<"Cannot read "<< src <<"\n"; return false; }
+    fs::path tmp = dest; tmp += ".tmp-" + to_string(processId());
+    int arc = -1;
+    string arcBuf;
+    size_t movedHere = 0;
+    bool ok = true;
+    AtomicFile inbox(src);
+    auto flushArchive = [&]{
+        if(arcBuf.empty() || !ok) return;
+        if(arc<0 && (arc = fdCreateExcl(tmp))<0){ ok = false; return; }
+        if(!fdWriteAll(arc, arcBuf.data(), arcBuf.size())) ok = false;
+        arcBuf.clear();
+    };
+    auto route = [&](string_view line, bool nl){
+        RecView r;
+        if(parseRecLine(line, r) && r.date>=lo && r.date<=hi){
+            arcBuf.append(line); arcBuf += '\n'; ++movedHere;
+            if(arcBuf.size() >= (size_t(1) << 20)) flushArchive();
+        } else {
+            inbox.write(line); if(nl) inbox.write("\n");
+            if(!trimView(line).empty()) ++kept;
+        }
+    };
+    string_view line; bool nl;
+    while(ok && in.next(line, &nl)) route(line, nl);
+    flushArchive();
+
+    auto cleanup = [&]{ if(arc>=0) fdClose(arc); std::error_code ec; fs::remove(tmp, ec); };
+    if(!ok){ cerr<<"Archive failed: cannot write "<< tmp <<"\n"; cleanup(); return false; }
+    if(!movedHere){ cleanup(); return true; }
+    bool synced = fsyncPolicy()==FsyncPolicy::never || fdSync(arc);
+    fdClose(arc); arc = -1;
+    std::error_code ec;
+    if(synced) fs::rename(tmp, dest, ec);
+    if(!synced || ec){ cerr<<"Archive failed: "<< (ec? ec.message() : string("fsync failed")) <<"\n"; cleanup(); return false; }
+    moved += movedHere;
+    if(!inbox.commit()){ cerr<<"Archived to "<< dest <<" but failed to rewrite "<< src <<": "<< inbox.error() <<" (rows are in both)\n"; return false; }
+    return true;
+}
+
+// With the sharded layout a month entirely inside the period is archived by renaming its shard
+// (and its sketch; its bitmaps and aggregates are dropped); only the months at the edges of the
+// period are streamed, and a shard they leave empty is removed with its sidecars.
+static int cmd_clear_inbox_partial(const Args& a, const fs::path& dest){
+    sys_days lo = sys_days::min(), hi = sys_days::max();
+    string label, none;   // "(2026-W01)" in the summary; "No rows in 2026-W01" when nothing matched
+    if(a.week){ auto wb = weekBounds(a.week->first, a.week->second); lo = wb.monday; hi = wb.sunday; label = fmtISOWeek(wb.year, wb.week); none = "No rows in " + label; }
+    else if(a.clearBefore){ hi = *a.clearBefore - days{1}; label = "before " + fmtDate(*a.clearBefore); none = "No rows dated " + label; }
+    else { label = "all rows"; none = "No rows"; }
+
+    InboxLock lock;
+    size_t moved = 0, kept = 0;
+    if(!shardedInbox()){
+        if(!partitionInboxFile(inboxPath(), dest, lo, hi, moved, kept)) return 2;
+        if(!moved){ cout<< none <<"; inbox unchanged\n"; return 0; }
+        cout<<"Archived "<< moved <<" rows ("<< label <<") to "<< dest <<"; "<< kept <<" rows remain in inbox.tsv\n";
+        return 0;
+    }
+    size_t shards = 0;
+    for(const auto& src: inboxFiles(lo, hi)){
+        auto month = *shardMonth(src);
+        fs::path to = dest.parent_path()/ (dest.stem().string() + "-" + src.stem().string() + ".tsv");
+        for(int n=2; fileExists(to); ++n) to = dest.parent_path()/ (dest.stem().string() + "-" + src.stem().string() + "_" + to_string(n) + ".tsv");
+        size_t before = moved;
+        if(month.first>=lo && month.second<=hi){
+            { MappedFile f(src); forEachRecView(f.view(), [&](const RecView&){ ++moved; }); }
+            std::error_code ec;
+            fs::rename(src, to, ec);
+            if(ec){ cerr<<"Archive failed: "<< ec.message() <<"\n"; return 2; }
+            if(fileExists(sketchPath(src))) fs::rename(sketchPath(src), sketchPath(to), ec);
+            fs::remove(bitmapsPathFor(src), ec); fs::remove(aggregatesPathFor(src), ec);
+        } else {
+            if(!partitionInboxFile(src, to, lo, hi, moved, kept)) return 2;
+            std::error_code ec;
+            if(fs::file_size(src, ec)==0){
+                fs::remove(src, ec);
+                fs::remove(sketchPath(src), ec); fs::remove(bitmapsPathFor(src), ec); fs::remove(aggregatesPathFor(src), ec);
+            }
+        }
+        if(moved>before) ++shards;
+    }
+    if(!moved){ cout<< none <<"; inbox unchanged\n"; return 0; }
+    cout<<"Archived "<< moved <<" rows ("<< label <<") from "<< shards <<" month shard"<< (shards==1? "" : "s") <<" to "<< dest.parent_path()/ (dest.stem().string() + "-<month>.tsv") <<"\n";
+    return 0;
+}
+
+static int cmd_clear_inbox(const Args& a){
+    fs::create_directories(curateHome());
+    bool sharded = shardedInbox();
+    if(!sharded && !fileExists(inboxPath())){
+        ofstream o(inboxPath());
+        cout << "Initialized new inbox.tsv" << '\n';
+        return 0;
+    }
+    fs::path arch = a.archiveDir.empty()? archiveDir() : fs::path(a.archiveDir);
+    fs::create_directories(arch);
+
+    auto now = std::chrono::system_clock::now();
+    time_t t = std::chrono::system_clock::to_time_t(now);
+    std::tm tm{}; portable_localtime(&t,&tm);
+    char buf[32]; strftime(buf,sizeof(buf),"%Y%m%d-%H%M%S", &tm);
+    fs::path dest = arch / (string("inbox-") + buf + ".tsv");
+    for(int n=2; fileExists(dest); ++n) dest = arch / (string("inbox-") + buf + "_" + to_string(n) + ".tsv"); // sorts after the first
+    if(a.week || a.clearBefore || sharded) return cmd_clear_inbox_partial(a, dest);
+
+    InboxLock lock;
+    std::error_code ec;
+    fs::rename(inboxPath(), dest, ec);
+    if(ec){
+        ec.clear();
+        fs::copy_file(inboxPath(), dest, fs::copy_options::overwrite_existing, ec);
+        if(ec){
+            cerr << "Archive failed: " << ec.message() << '\n';
+            return 2;
+        }
+        ofstream o(inboxPath(), ios::trunc);
+    } else {
+        ofstream o(inboxPath(), ios::trunc);
+    }
+    cout << "Archived to " << dest << " and cleared inbox.tsv" << '\n';
+    return 0;
+}
+
+// ===== Sort =====
+// `curate sort` puts inbox.tsv (and with --include-archive each archive segment) in date order,
+// stably, so rows of one day keep their capture order. A first streaming pass counts natural runs;
+// a file that is already one run is left alone. Otherwise rows are cut into runs of at most
+// --memory bytes, each sorted in memory and spilled to $CURATE_HOME/.sort-tmp-<pid>/, then merged
+// k ways (at most kSortFanIn runs at a time, over several passes if needed) into an AtomicFile.
+// Blank lines are dropped; rows with an unreadable date sort first.
+static constexpr size_t kSortFanIn = 64;
+
+struct SortStats{ size_t rows = 0, naturalRuns = 0, spilled = 0, passes = 0; bool sorted = false; };
+
+static sys_days sortKey(string_view line){ RecView r; return parseRecLine(line, r)? r.date : sys_days::min(); }
+
+// Buffered, newline-terminated lines to a fresh file.
+class RunWriter{
+public:
+    explicit RunWriter(const fs::path& p): fd_(fdCreateExcl(p)){ ok_ = fd_>=0; }
+    RunWriter(const RunWriter&) = delete;
+    RunWriter& operator=(const RunWriter&) = delete;
+    ~RunWriter(){ close(); }
+    void line(string_view l){ buf_.append(l); buf_ += '\n'; if(buf_.size() >= (size_t(1) << 20)) flush(); }
+    bool close(){
+        flush();
+        if(fd_>=0){ fdClose(fd_); fd_ = -1; }
+        return ok_;
+    }
+
+private:
+    void flush(){
+        if(ok_ && !buf_.empty() && !fdWriteAll(fd_, buf_.data(), buf_.size())) ok_ = false;
+        buf_.clear();
+    }
+    int fd_;
+    bool ok_;
+    string buf_;
+};
+
+// Merges date-ordered run files into `out`; ties go to the earlier run, which keeps the sort stable.
+static void mergeRuns(const vector<fs::path>& runs, size_t block, const function<void(string_view)>& out){
+    vector<unique_ptr<LineReader>> in;
+    vector<string_view> cur(runs.size());
+    vector<pair<sys_days,size_t>> heap; // min-heap on (date, run)
+    auto later = [](const auto& x, const auto& y){ return x > y; };
+    for(size_t i=0;i<runs.size();++i){
+        in.push_back(make_unique<LineReader>(runs[i], block));
+        if(in[i]->next(cur[i])) heap.push_back({sortKey(cur[i]), i});
+    }
+    make_heap(heap.begin(), heap.end(), later);
+    while(!heap.empty()){
+        pop_heap(heap.begin(), heap.end(), later);
+        size_t i = heap.back().second;
+        out(cur[i]);
+        if(in[i]->next(cur[i])){ heap.back().first = sortKey(cur[i]); push_heap(heap.begin(), heap.end(), later); }
+        else heap.pop_back();
+    }
+}
+
+static bool sortFile(const fs::path& path, size_t budget, const fs::path& tmpDir, SortStats& st, string& err){
+    {
+        LineReader in(path);
+        if(!in.ok()){ err = "cannot read " + path.string(); return false; }
+        string_view line; sys_days prev = sys_days::min();
+        while(in.next(line)){
+            if(trimView(line).empty()) continue;
+            sys_days d = sortKey(line);
+            if(st.rows==0 || d < prev) ++st.naturalRuns;
+            prev = d; ++st.rows;
+        }
+    }
+    if(st.naturalRuns<=1){ st.sorted = true; return true; }
+
+    // Run formation: lines are packed into one arena and sorted through a small index.
+    struct Item{ sys_days date; size_t off; uint32_t len; };
+    string arena; vector<Item> items;
+    vector<fs::path> runs;
+    std::error_code ec;
+    auto sortItems = [&]{
+        auto byDate = [](const Item& x, const Item& y){ return x.date < y.date; };
+        if(!is_sorted(items.begin(), items.end(), byDate)) stable_sort(items.begin(), items.end(), byDate);
+    };
+    auto spill = [&]{
+        sortItems();
+        if(runs.empty()) fs::create_directories(tmpDir, ec);
+        runs.push_back(tmpDir / ("run-" + to_string(runs.size()) + ".tsv"));
+        RunWriter w(runs.back());
+        for(const auto& it: items) w.line(string_view(arena).substr(it.off, it.len));
+        arena.clear(); items.clear();
+        if(!w.close()){ err = "cannot write " + runs.back().string(); return false; }
+        return true;
+    };
+    {
+        LineReader in(path);
+        string_view line;
+        while(in.next(line)){
+            if(trimView(line).empty()) continue;
+            items.push_back({sortKey(line), arena.size(), uint32_t(line.size())});
+            arena.append(line);
+            if(arena.size() + items.size()*sizeof(Item) >= budget && !spill()) return false;
+        }
+    }
+    st.spilled = runs.size();
+
+    AtomicFile out(path);
+    if(runs.empty()){
+        sortItems(); // everything fit: one in-memory sort straight to the target
+        for(const auto& it: items){ out.write(string_view(arena).substr(it.off, it.len)); out.write("\n"); }
+    } else {
+        if(!items.empty() && !spill()) return false;
+        string().swap(arena); vector<Item>().swap(items);
+        st.spilled = runs.size();
+        size_t block = std::clamp(budget / (kSortFanIn + 1), size_t(64) << 10, size_t(1) << 20);
+        for(size_t gen = 0; runs.size() > kSortFanIn; ++gen){
+            vector<fs::path> next;
+            for(size_t g=0; g<runs.size(); g+=kSortFanIn){
+                vector<fs::path> group(runs.begin()+g, runs.begin()+std::min(runs.size(), g+kSortFanIn));
+                next.push_back(tmpDir / ("merge-" + to_string(gen) + "-" + to_string(next.size()) + ".tsv"));
+                RunWriter w(next.back());
+                mergeRuns(group, block, [&](string_view l){ w.line(l); });
+                if(!w.close()){ err = "cannot write " + next.back().string(); return false; }
+                for(const auto& r: group) fs::remove(r, ec);
+            }
+            runs = std::move(next);
+            ++st.passes;
+        }
+        mergeRuns(runs, block, [&](string_view l){ out.write(l); out.write("\n"); });
+        ++st.passes;
+        for(const auto& r: runs) fs::remove(r, ec);
+    }
+    if(!out.commit()){ err = out.error(); return false; }
+    return true;
+}
+
+static int cmd_sort(const Args& a){
+    auto live = inboxFiles();
+    if(!shardedInbox() && !fileExists(inboxPath())){ cerr<<"No inbox.tsv in "<< curateHome() <<"\n"; return 1; }
+    vector<fs::path> files;
+    if(a.includeArchive) files = archiveFiles();
+    files.insert(files.end(), live.begin(), live.end());
+    size_t budget = a.sortMemoryMB << 20;
+    fs::path tmpDir = curateHome()/ (".sort-tmp-" + to_string(processId()));
+    int rc = 0; bool rewrote = false;
+    for(const auto& f: files){
+        bool isInbox = std::find(live.begin(), live.end(), f)!=live.end();
+        optional<InboxLock> lock;
+        if(isInbox) lock.emplace(); // appends wait until the sorted inbox is in place
+        auto t0 = std::chrono::steady_clock::now();
+        SortStats st; string err;
+        bool ok = sortFile(f, budget, tmpDir, st, err);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        string name = f.lexically_relative(curateHome()).generic_string();
+        if(!ok){ cerr<<"Sort failed for "<< name <<": "<< err <<"\n"; rc = 2; continue; }
+        if(st.sorted){ cout<<name<<": already sorted ("<< st.rows <<" rows)\n"; continue; }
+        // The row offsets in the file's bitmaps no longer match; the next ranged read rebuilds them.
+        std::error_code ec;
+        if(isInbox) fs::remove(bitmapsPathFor(f), ec);
+        rewrote = true;
+        cout<<name<<": sorted "<< st.rows <<" rows ("<< st.naturalRuns <<" natural runs";
+        if(st.spilled) cout<<", "<< st.spilled <<" spilled runs, "<< st.passes <<" merge pass"<< (st.passes==1? "" : "es");
+        cout<<") in "<< fixed << setprecision(0) << ms <<" ms\n";
+    }
+    std::error_code ec; fs::remove_all(tmpDir, ec);
+    // The search index addresses rows by file offset, so it is rebuilt by the next `search`.
+    if(rewrote && fileExists(indexManifestPath())){ fs::remove_all(indexDir(), ec); cout<<"Search index dropped; the next search rebuilds it\n"; }
+    return rc;
+}
+
+// ===== Layout migration =====
+// `migrate --layout sharded` splits inbox.tsv into month shards in one streaming pass: rows are
+// buffered per month and appended to shards staged in inbox.migrate-<pid>/, which becomes inbox/
+// before config.tsv switches the layout and inbox.tsv is removed. A row with an unreadable date
+// goes with the row before it. `--layout single` concatenates the shards back, oldest month first.
+// Files derived from the old layout (inbox.bitmaps, aggregates.bin, sketches of the live inbox,
+// the search index) are dropped; each is rebuilt when next needed.
+static int cmd_migrate(const Args& a){
+    bool sharded = shardedInbox();
+    if(a.layout==(sharded? "sharded" : "single")){ cout<<"Already using the "<< a.layout <<" layout\n"; return 0; }
+    InboxLock lock;
+    auto t0 = std::chrono::steady_clock::now();
+    std::error_code ec;
+    size_t rows = 0, files = 0;
+    vector<fs::path> derived = {bitmapsPath(), aggregatesPath(), sketchPath(inboxPath())};
+
+    if(a.layout=="sharded"){
+        if(fs::exists(shardsDir()) && !fs::is_empty(shardsDir(), ec)){ cerr<<shardsDir()<<" exists and is not empty\n"; return 2; }
+        fs::path stage = curateHome()/ ("inbox.migrate-" + to_string(processId()));
+        fs::remove_all(stage, ec); fs::create_directories(stage, ec);
+        constexpr size_t kShardBuf = size_t(256) << 10, kTotalBuf = size_t(64) << 20;
+        map<string,string> bufs; // month → rows not yet written
+        size_t buffered = 0; bool ok = true;
+        auto flush = [&](const string& month, string& b){
+            if(b.empty()) return;
+            int fd = fdOpenAppend(stage/ (month + ".tsv"));
+            ok = ok && fd>=0 && fdWriteAll(fd, b.data(), b.size());
+            if(fd>=0) fdClose(fd);
+            buffered -= b.size(); b.clear();
+        };
+        LineReader in(inboxPath());
+        string month, undated; // undated: unreadable rows before the first dated one
+        string_view line; RecView r;
+        while(ok && in.next(line)){
+            if(trimView(line).empty()) continue;
+            if(parseRecLine(line, r)){ month = string(r.dateText.substr(0, 7)); ++rows; }
+            if(month.empty()){ undated.append(line); undated += '\n'; continue; }
+            string& b = bufs[month];
+            if(!undated.empty()){ b += undated; buffered += undated.size(); undated.clear(); }
+            b.append(line); b += '\n'; buffered += line.size() + 1;
+            if(b.size() >= kShardBuf) flush(month, b);
+            if(buffered >= kTotalBuf) for(auto& [m, mb]: bufs) flush(m, mb);
+        }
+        if(!undated.empty()){ string m = fmtDate(*parseISODate(todayISO())).substr(0, 7); bufs[m] += undated; buffered += undated.size(); }
+        for(auto& [m, mb]: bufs) flush(m, mb);
+        files = bufs.size();
+        if(ok && fsyncPolicy()!=FsyncPolicy::never){
+            for(const auto& [m, mb]: bufs){ int fd = fdOpenAppend(stage/ (m + ".tsv")); ok = ok && fd>=0 && fdSync(fd); if(fd>=0) fdClose(fd); }
+        }
+        if(ok){ fs::remove(shardsDir(), ec); ec.clear(); fs::rename(stage, shardsDir(), ec); }
+        auto cfg = loadConfig(); cfg["layout"] = "sharded";
+        if(!ok || ec || !saveConfig(cfg)){
+            cerr<<"Migration failed"<< (ec? ": " + ec.message() : string()) <<"; inbox.tsv is unchanged\n";
+            fs::remove_all(stage, ec);
+            return 2;
+        }
+        fs::remove(inboxPath(), ec);
+    } else {
+        auto shards = inboxFiles();
+        {
+            AtomicFile out(inboxPath());
+            for(const auto& p: shards){
+                LineReader in(p); string_view line;
+                while(in.next(line)){
+                    if(trimView(line).empty()) continue;
+                    out.write(line); out.write("\n");
+                    RecView r; if(parseRecLine(line, r)) ++rows;
+                }
+                derived.push_back(sketchPath(p));
+            }
+            if(!out.commit()){ cerr<<"Migration failed: "<< out.error() <<"; shards are unchanged\n"; return 2; }
+        }
+        auto cfg = loadConfig(); cfg["layout"] = "single";
+        if(!saveConfig(cfg)){ cerr<<"Migration failed: cannot write "<< configPath() <<"\n"; return 2; }
+        files = shards.size();
+        fs::remove_all(shardsDir(), ec);
+    }
+    for(const auto& p: derived) fs::remove(p, ec);
+    fs::remove_all(indexDir(), ec);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    if(a.layout=="sharded") cout<<"Split "<< rows <<" rows into "<< files <<" month shards under "<< shardsDir();
+    else cout<<"Merged "<< files <<" month shards ("<< rows <<" rows) into "<< inboxPath();
+    cout<<" in "<< fixed << setprecision(0) << ms <<" ms\n";
+    return 0;
+}
+
+// ===== Sync between homes =====
+// `curate sync OTHER` leaves this home and OTHER holding the union of their rows, where a row is
+// its date plus canonical URL. Each home keeps sync.bin: per source file (archive segments and
+// live inbox files) and ISO week, the row count and the sum of row-key hashes. Sums ignore row
+// order and file boundaries, so the per-week totals are the leaves of a hash tree that does not
+// depend on layout or archiving history; a year hashes its weeks and the root hashes the years.
+// Appended rows extend a file's entry and a renamed file (clear-inbox, migrate) keeps it, so
+// bringing sync.bin up to date costs the new rows only. The two trees are compared top down,
+// only rows of weeks whose hashes differ are read, and each side's missing rows are appended to
+// the other's live inbox. Rows both homes hold keep each home's own title and tags.
+// A week holding the same key twice sums it twice; once sync has read such a week it records the
+// week's distinct totals next to the raw ones, and the tree uses them while the raw totals match.
+struct WeekHash{ uint64_t rows = 0, sum = 0; bool operator==(const WeekHash&) const = default; };
+struct SyncSource{ string rel; uint64_t bytes = 0; string tail; map<int,WeekHash> weeks; };
+struct WeekDistinct{ WeekHash raw, distinct; };
+struct SyncState{ vector<SyncSource> sources; map<int,WeekDistinct> distinct; };
+struct WeekTree{ map<int,WeekHash> raw, weeks; map<int,uint64_t> years; uint64_t root = 0; };
+
+static constexpr char SYNC_MAGIC[8] = {'C','U','R','S','Y','N','2','\0'};
+static fs::path syncStatePath(){ return curateHome()/ "sync.bin"; }
+
+static string syncRowKey(string_view date, string_view url){ string k(date); k += '\t'; k += canonicalUrl(url); return k; }
+static uint64_t syncKeyHash(const string& key){ return mix64(Fnv64().add(key).h); }
+static int weekKey(sys_days d){ auto w = isoWeekFromDate(d); return w.year*100 + w.week; }
+
+// Folds the complete lines of data[from, end) into s; returns the end of the last one.
+static uint64_t addSyncRows(SyncSource& s, string_view data, uint64_t from){
+    size_t pos = size_t(from); RecView r;
+    sys_days lastDate{}; int lastWeek = 0;
+    while(pos < data.size()){
+        const void* nl = memchr(data.data()+pos, '\n', data.size()-pos);
+        if(!nl) break; // a partial last line waits for its newline
+        size_t end = size_t(static_cast<const char*>(nl) - data.data());
+        if(parseRecLine(data.substr(pos, end-pos), r)){
+            if(!lastWeek || r.date!=lastDate){ lastDate = r.date; lastWeek = weekKey(r.date); }
+            WeekHash& h = s.weeks[lastWeek];
+            ++h.rows; h.sum += syncKeyHash(syncRowKey(r.dateText, r.url));
+        }
+        pos = end + 1;
+    }
+    return pos;
+}
+
+static string serializeSyncState(const SyncState& st){
+    string b(SYNC_MAGIC, 8);
+    putU32(b, uint32_t(st.sources.size()));
+    for(const auto& s: st.sources){
+        putU32(b, uint32_t(s.rel.size())); b += s.rel;
+        putU64(b, s.bytes); b += s.tail; b.resize(b.size() + 16 - std::min<size_t>(16, s.tail.size()), '0');
+        putU32(b, uint32_t(s.weeks.size()));
+        for(const auto& [wk, h]: s.weeks){ putU32(b, uint32_t(wk)); putU64(b, h.rows); putU64(b, h.sum); }
+    }
+    putU32(b, uint32_t(st.distinct.size()));
+    for(const auto& [wk, d]: st.distinct){
+        putU32(b, uint32_t(wk)); putU64(b, d.raw.rows); putU64(b, d.raw.sum); putU64(b, d.distinct.rows); putU64(b, d.distinct.sum);
+    }
+    putU64(b, Fnv64().add(b).h);
+    return b;
+}
+
+// Empty when the file is missing, truncated or fails its checksum.
+static SyncState loadSyncState(){
+    MappedFile f(syncStatePath());
+    string_view d = f.view();
+    if(d.size()<20 || memcmp(d.data(), SYNC_MAGIC, 8)!=0) return {};
+    if(Fnv64().add(d.substr(0, d.size()-8)).h != getU64(d.data()+d.size()-8)) return {};
+    d.remove_suffix(8);
+    size_t p = 8;
+    auto need = [&](size_t n){ return p+n <= d.size(); };
+    uint32_t n = getU32(d.data()+p); p += 4;
+    SyncState st; st.sources.resize(n);
+    for(auto& s: st.sources){
+        if(!need(4)) return {};
+        uint32_t len = getU32(d.data()+p); p += 4;
+        if(!need(size_t(len) + 28)) return {};
+        s.rel = string(d.substr(p, len)); p += len;
+        s.bytes = getU64(d.data()+p); s.tail = string(d.substr(p+8, 16)); p += 24;
+        uint32_t nw = getU32(d.data()+p); p += 4;
+        if(!need(size_t(nw)*20)) return {};
+        for(uint32_t i=0;i<nw;++i, p += 20) s.weeks[int(getU32(d.data()+p))] = {getU64(d.data()+p+4), getU64(d.data()+p+12)};
+    }
+    if(!need(4)) return {};
+    uint32_t nd = getU32(d.data()+p); p += 4;
+    if(!need(size_t(nd)*36)) return {};
+    for(uint32_t i=0;i<nd;++i, p += 36){
+        const char* e = d.data()+p;
+        st.distinct[int(getU32(e))] = {{getU64(e+4), getU64(e+12)}, {getU64(e+20), getU64(e+28)}};
+    }
+    return st;
+}
+
+static bool saveSyncState(const SyncState& st){
+    AtomicFile o(syncStatePath());
+    o.write(serializeSyncState(st));
+    if(o.commit()) return true;
+    cerr<<"warning: could not write "<< syncStatePath() <<"\n";
+    return false;
+}
+
+static WeekTree weekTree(const SyncState& st);
+
+// Brings sync.bin up to date with the current home's archive segments and live inbox files.
+static SyncState syncWeekHashes(){
+    auto state = loadSyncState();
+    auto& old = state.sources;
+    auto paths = archiveFiles(); for(auto& p: inboxFiles()) paths.push_back(std::move(p));
+    auto rel = [](const fs::path& p){ return p.lexically_relative(curateHome()).generic_string(); };
+    vector<bool> used(old.size(), false);
+    vector<SyncSource> out;
+    bool changed = old.size()!=paths.size();
+    for(const auto& p: paths){
+        MappedFile f(p);
+        string_view d = f.view();
+        string name = rel(p);
+        // Same file grown by appends, or the same bytes under a new name.
+        size_t hit = old.size();
+        for(size_t i=0;i<old.size() && hit==old.size();++i){
+            if(!used[i] && old[i].rel==name && old[i].bytes<=d.size() && tailStamp(d, old[i].bytes)==old[i].tail) hit = i;
+        }
+        if(hit==old.size()){
+            string whole = tailStamp(d, d.size());
+            for(size_t i=0;i<old.size() && hit==old.size();++i){
+                if(!used[i] && old[i].bytes==d.size() && old[i].tail==whole) hit = i;
+            }
+        }
+        SyncSource s;
+        if(hit<old.size()){ used[hit] = true; s = std::move(old[hit]); }
+        if(hit==old.size() || s.rel!=name){ s.rel = name; changed = true; }
+        uint64_t end = addSyncRows(s, d, s.bytes);
+        if(end!=s.bytes || hit==old.size()){ s.bytes = end; s.tail = tailStamp(d, end); changed = true; }
+        out.push_back(std::move(s));
+    }
+    state.sources = std::move(out);
+    // Distinct totals recorded for a week that has changed since no longer apply.
+    auto raw = weekTree(state).raw;
+    erase_if(state.distinct, [&](const auto& d){ auto it = raw.find(d.first); bool stale = it==raw.end() || !(it->second==d.second.raw); changed |= stale; return stale; });
+    if(changed) saveSyncState(state);
+    return state;
+}
+
+static WeekTree weekTree(const SyncState& st){
+    WeekTree t;
+    for(const auto& s: st.sources) for(const auto& [wk, h]: s.weeks){ auto& w = t.raw[wk]; w.rows += h.rows; w.sum += h.sum; }
+    t.weeks = t.raw;
+    for(const auto& [wk, d]: st.distinct){ auto it = t.weeks.find(wk); if(it!=t.weeks.end() && it->second==d.raw) it->second = d.distinct; }
+    map<int,Fnv64> years;
+    for(const auto& [wk, h]: t.weeks){ string b; putU32(b, uint32_t(wk)); putU64(b, h.rows); putU64(b, h.sum); years[wk/100].add(b); }
+    Fnv64 root;
+    for(const auto& [y, f]: years){ t.years[y] = f.h; string b; putU32(b, uint32_t(y)); putU64(b, f.h); root.add(b); }
+    t.root = root.h;
+    return t;
+}
+
+// Weeks whose hashes differ, descending only into years whose hashes differ.
+static vector<int> differingWeeks(const WeekTree& x, const WeekTree& y){
+    vector<int> out;
+    if(x.root==y.root) return out;
+    set<int> years;
+    for(const auto& [yr, h]: x.years){ auto it = y.years.find(yr); if(it==y.years.end() || it->second!=h) years.insert(yr); }
+    for(const auto& [yr, h]: y.years) if(!x.years.count(yr)) years.insert(yr);
+    for(int yr: years){
+        set<int> weeks;
+        for(const auto* t: {&x, &y}){
+            for(auto it = t->weeks.lower_bound(yr*100); it!=t->weeks.end() && it->first < (yr+1)*100; ++it) weeks.insert(it->first);
+        }
+        for(int wk: weeks){
+            auto a = x.weeks.find(wk), b = y.weeks.find(wk);
+            if(a==x.weeks.end() || b==y.weeks.end() || a->second.rows!=b->second.rows || a->second.sum!=b->second.sum) out.push_back(wk);
+        }
+    }
+    return out;
+}
+
+// The current home's rows in `weeks` (ascending), bucketed by week. Archive segments holding any
+// of them are scanned once; the live inbox is read a run of consecutive weeks at a time, through
+// its bitmaps or month shards.
+static map<int,vector<Rec>> rowsOfWeeks(const SyncState& st, const vector<int>& weeks){
+    const auto& sources = st.sources;
+    map<int,vector<Rec>> out;
+    set<int> wanted(weeks.begin(), weeks.end());
+    sys_days lastDate{}; int lastWeek = 0;
+    auto bucket = [&](const RecView& r){
+        if(!lastWeek || r.date!=lastDate){ lastDate = r.date; lastWeek = weekKey(r.date); }
+        if(wanted.count(lastWeek)) out[lastWeek].push_back(toRec(r));
+    };
+    for(const auto& p: archiveFiles()){
+        string name = p.lexically_relative(curateHome()).generic_string();
+        auto s = find_if(sources.begin(), sources.end(), [&](const SyncSource& x){ return x.rel==name; });
+        if(s==sources.end() || none_of(s->weeks.begin(), s->weeks.end(), [&](const auto& w){ return wanted.count(w.first)>0; })) continue;
+        MappedFile f(p);
+        forEachRecView(f.view(), bucket);
+    }
+    auto bounds = [](int wk){ return weekBounds(wk/100, wk%100); };
+    Args none;
+    for(size_t i=0;i<weeks.size(); ){
+        size_t j = i + 1;
+        while(j<weeks.size() && bounds(weeks[j]).monday == bounds(weeks[j-1]).sunday + days(1)) ++j;
+        for(auto& r: loadInboxFiltered(none, bounds(weeks[i]).monday, bounds(weeks[j-1]).sunday)){
+            int wk = weekKey(r.date);
+            if(wanted.count(wk)) out[wk].push_back(std::move(r));
+        }
+        i = j;
+    }
+    return out;
+}
+
+static int cmd_sync(const Args& a){
+    auto t0 = std::chrono::steady_clock::now();
+    std::error_code ec;
+    fs::path other = a.syncHome;
+    if(!fs::is_directory(other, ec)){ cerr<<other<<" is not a directory\n"; return 2; }
+    if(fs::equivalent(curateHome(), other, ec)){ cerr<<other<<" is this home\n"; return 2; }
+    const fs::path homes[2] = {curateHome(), other};
+    auto inHome = [&](size_t i, auto&& fn){ fs::path saved = threadHome(); threadHome() = homes[i]; fn(); threadHome() = saved; };
+
+    SyncState sources[2]; WeekTree trees[2];
+    parallelFor(2, [&](size_t i){ inHome(i, [&]{ sources[i] = syncWeekHashes(); trees[i] = weekTree(sources[i]); }); });
+    auto diff = differingWeeks(trees[0], trees[1]);
+    size_t weeks = 0;
+    { set<int> all; for(const auto& t: trees) for(const auto& [wk, h]: t.weeks) all.insert(wk); weeks = all.size(); }
+    if(diff.empty()){ cout<<"Already in sync with "<< other <<" ("<< weeks <<" weeks, root "<< hex64(trees[0].root) <<")\n"; return 0; }
+
+    map<int,vector<Rec>> rows[2];
+    parallelFor(2, [&](size_t i){ inHome(i, [&]{ rows[i] = rowsOfWeeks(sources[i], diff); }); });
+    vector<Rec> missing[2]; // missing[i]: rows home i lacks
+    map<int,WeekHash> merged; // distinct totals of each differing week once both sides hold the union
+    size_t read = 0;
+    for(int wk: diff){
+        vector<string> keys[2]; unordered_set<string> have[2];
+        for(size_t i=0;i<2;++i){
+            for(const auto& r: rows[i][wk]) keys[i].push_back(syncRowKey(fmtDate(r.date), r.url));
+            have[i].insert(keys[i].begin(), keys[i].end());
+            read += keys[i].size();
+        }
+        for(size_t i=0;i<2;++i){
+            auto& from = rows[1-i][wk];
+            for(size_t k=0;k<from.size();++k) if(have[i].insert(keys[1-i][k]).second) missing[i].push_back(std::move(from[k]));
+        }
+        auto& m = merged[wk];
+        for(const auto& k: have[0]){ ++m.rows; m.sum += syncKeyHash(k); }
+    }
+
+    const char* verb = a.dryRun? "Would add " : "Added ";
+    if(!a.dryRun){
+        bool ok = true;
+        for(size_t i=0;i<2;++i){
+            if(missing[i].empty()) continue;
+            inHome(i, [&]{
+                InboxAppender app;
+                for(const auto& r: missing[i]) app.add(r);
+                if(!app.close()){ cerr<<"Could not append to the inbox in "<< homes[i] <<"\n"; ok = false; return; }
+                refreshIndexesAfterAppend();
+            });
+        }
+        if(!ok) return 1;
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    cout<<"Compared "<< weeks <<" weeks with "<< other <<": "<< diff.size() <<" differ ("<< read <<" rows read)\n";
+    cout<< verb << missing[0].size() <<" rows here and "<< missing[1].size() <<" rows to "<< other
+        <<" in "<< fixed << setprecision(0) << ms <<" ms\n";
+    if(!a.dryRun){
+        // Both homes now hold each differing week's union; record its distinct totals so a row one
+        // home repeats does not keep the week apart.
+        parallelFor(2, [&](size_t i){ inHome(i, [&]{
+            sources[i] = syncWeekHashes();
+            auto raw = weekTree(sources[i]).raw;
+            for(const auto& [wk, m]: merged) if(raw.count(wk)) sources[i].distinct[wk] = {raw[wk], m};
+            saveSyncState(sources[i]);
+            trees[i] = weekTree(sources[i]);
+        }); });
+        size_t left = differingWeeks(trees[0], trees[1]).size();
+        if(left) cout<< left <<" weeks still differ: a home changed during the sync\n";
+    }
+    return 0;
+}
+
+// Streams rows straight from the mapped inbox. Without a date range, rows come in file order and
+// the scan stops once --limit rows are out; --reverse and --tail N walk back from EOF, so the
+// latest captures cost the same whatever the inbox size. A range lists by date, which needs every
+// row in it, but only the --limit earliest (or --tail/--reverse latest) are kept, in a bounded heap.
+// With the sharded layout "file order" is shard (month) order, then capture order within a month.
+// Across federated homes rows always come merged in date order: --limit N prints the first N,
+// --tail N the last N and --reverse the newest first.
+static int cmd_list_federated(const Args& a){
+    auto rows = loadFederated(a, a.since.value_or(sys_days::min()), a.until.value_or(sys_days::max()));
+    size_t want = a.limit? size_t(std::max(0, *a.limit)) : SIZE_MAX;
+    if(a.tail) want = std::min(want, *a.tail);
+    size_t n = std::min(want, rows.size()), first = a.tail && !a.reverse? rows.size()-n : 0;
+    for(size_t i=0;i<n;++i){
+        const Rec& r = rows[a.reverse? rows.size()-1-i : first+i];
+        cout<< fmtDate(r.date) <<"\t"<< r.kind <<"\t"<< r.url <<"\t"<< r.title <<"\t"<< r.tags <<"\n";
+    }
+    return 0;
+}
+
+static int cmd_list(const Args& a){
+    if(federated(a)) return cmd_list_federated(a);
+    sys_days lo = a.since.value_or(sys_days::min()), hi = a.until.value_or(sys_days::max());
+    bool ranged = a.since || a.until, latest = a.reverse || a.tail;
+    size_t want = a.limit? size_t(std::max(0, *a.limit)) : SIZE_MAX;
+    if(a.tail) want = std::min(want, *a.tail);
+    if(want==0) return 0;
+    auto where = compileWhere(a.where);
+    auto paths = inboxFiles(lo, hi);
+    vector<unique_ptr<MappedFile>> files; // kept mapped: printed rows are views into them
+    for(const auto& p: paths) files.push_back(make_unique<MappedFile>(p));
+
+    // Calls fn for each matching row of file i (from the end when `backward`) until it returns false.
+    auto scanFile = [&](size_t i, bool backward, auto&& fn){
+        string_view d = files[i]->view();
+        bool stopped = false;
+        auto visit = [&](const RecView& r){ bool go = r.date<lo || r.date>hi || (where && !where->test(r)) || fn(r); stopped = !go; return go; };
+        if(!rowFilterActive(a)){
+            if(backward) forEachRecViewBackward(d, visit); else forEachRecView(d, visit);
+            return !stopped;
+        }
+        vector<size_t> offs;
+        {
+            InboxBitmaps b = syncInboxBitmaps(d, bitmapsPathFor(paths[i]));
+            selectRows(a, b, lo, hi).forEach([&](uint32_t id){ offs.push_back(size_t(b.offsets[id])); });
+        }
+        if(backward) std::reverse(offs.begin(), offs.end());
+        RecView r;
+        for(size_t off: offs){
+            const void* nl = memchr(d.data()+off, '\n', d.size()-off);
+            size_t end = nl? size_t(static_cast<const char*>(nl) - d.data()) : d.size();
+            if(parseRecLine(d.substr(off, end-off), r) && !visit(r)) return false;
+        }
+        return true;
+    };
+    auto scan = [&](bool backward, auto&& fn){
+        for(size_t i=0;i<files.size();++i){
+            if(!scanFile(backward? files.size()-1-i : i, backward, fn)) return;
+        }
+    };
+    auto print = [](const RecView& r){ cout<< fmtDate(r.date) <<"\t"<< r.kind <<"\t"<< r.url <<"\t"<< r.title <<"\t"<< r.tags <<"\n"; };
+
+    vector<RecView> rows;
+    if(!ranged){
+        scan(latest, [&](const RecView& r){
+            if(a.tail && !a.reverse) rows.push_back(r); else print(r);
+            return --want > 0;
+        });
+        for(auto it = rows.rbegin(); it!=rows.rend(); ++it) print(*it);
+        return 0;
+    }
+
+    // Order is (date, position in file); `latest` keeps the largest keys, otherwise the smallest.
+    struct Item{ sys_days date; size_t seq; RecView r; };
+    auto before = [](const Item& x, const Item& y){ return x.date!=y.date? x.date<y.date : x.seq<y.seq; };
+    auto heapCmp = [&](const Item& x, const Item& y){ return latest? before(y, x) : before(x, y); };
+    vector<Item> heap;
+    size_t seq = 0;
+    scan(false, [&](const RecView& r){
+        Item it{r.date, seq++, r};
+        if(heap.size() < want){ heap.push_back(it); if(want!=SIZE_MAX) std::push_heap(heap.begin(), heap.end(), heapCmp); }
+        else if(heapCmp(it, heap.front())){ std::pop_heap(heap.begin(), heap.end(), heapCmp); heap.back() = it; std::push_heap(heap.begin(), heap.end(), heapCmp); }
+        return true;
+    });
+    std::sort(heap.begin(), heap.end(), before);
+    if(a.reverse) std::reverse(heap.begin(), heap.end());
+    for(const auto& it: heap) print(it.r);
+    return 0;
+}
+
+// titles fill: fetches titles for rows whose TITLE is empty (cache first), then rewrites the
+// inbox once, changing only those TITLE columns.
+static int cmd_titles(const Args& a){
+    sys_days lo = a.since.value_or(sys_days::min()), hi = a.until.value_or(sys_days::max());
+    auto needsTitle = [&](const RecView& r){ return trimView(r.title).empty() && !trimView(r.url).empty() && r.date>=lo && r.date<=hi; };
+    auto cache = loadTitleCache();
+    sys_days today = *parseISODate(todayISO());
+
+    vector<string> urls; // canonical, to fetch
+    size_t empty = 0;
+    unordered_set<string> seen;
+    for(const auto& path: inboxFiles(lo, hi)){
+        MappedFile inbox(path);
+        forEachRecView(inbox.view(), [&](const RecView& r){
+            if(!needsTitle(r)) return;
+            ++empty;
+            string k = canonicalUrl(r.url);
+            if(!seen.insert(k).second) return;
+            auto it = cache.find(k);
+            if(it!=cache.end() && (!it->second.title.empty() || today - it->second.fetched < days{7})) return;
+            urls.push_back(k);
+        });
+    }
+    if(!empty){ cout<<"No rows with an empty title\n"; return 0; }
+
+    size_t fetchedTitles = 0, failed = 0;
+    if(!urls.empty()){
+#ifndef _WIN32
+        ::signal(SIGPIPE, SIG_IGN);
+#endif
+        HttpFetcher::Options o;
+        o.concurrency = a.concurrency; o.perHost = a.perHost; o.timeoutMs = a.timeoutMs;
+        o.proxy = a.proxy.empty()? getenvOr("CURATE_HTTP_PROXY", "") : a.proxy;
+        vector<HttpFetcher::Job> jobs;
+        for(const auto& u: urls){ HttpFetcher::Job j; j.url = u; j.titleOnly = true; jobs.push_back(j); }
+        auto res = HttpFetcher(o).run(jobs);
+        for(size_t i=0;i<urls.size();++i){
+            cache[urls[i]] = CachedTitle{today, res[i].status, res[i].title};
+            if(!res[i].title.empty()) ++fetchedTitles;
+            else { ++failed; if(a.verbose) cerr<< urls[i] <<": "<< (res[i].error.empty()? "HTTP " + to_string(res[i].status) + (res[i].status/100==2? ", no <title>" : "") : res[i].error) <<"\n"; }
+        }
+        if(!saveTitleCache(cache)) cerr<<"warning: could not write "<< titleCachePath() <<"\n";
+    }
+
+    // Re-read the inbox under the lock so rows appended while fetching are kept.
+    size_t filled = 0;
+    for(InboxLock lock; const auto& path: inboxFiles(lo, hi)){
+        MappedFile inbox(path);
+        string_view d = inbox.view();
+        AtomicFile out(path);
+        size_t pos = 0, before = filled; RecView r; string line;
+        while(pos < d.size()){
+            size_t end = d.find('\n', pos);
+            bool nl = end!=string_view::npos; if(!nl) end = d.size();
+            string_view raw = d.substr(pos, end-pos);
+            pos = end + 1;
+            const CachedTitle* t = nullptr;
+            if(parseRecLine(raw, r) && needsTitle(r)){ auto it = cache.find(canonicalUrl(r.url)); if(it!=cache.end() && !it->second.title.empty()) t = &it->second; }
+            if(!t){ out.write(raw); if(nl) out.write("\n"); continue; }
+            vector<string> f = splitTabs(string(raw));
+            if(f.size()<2) f.push_back("link"); // what parseRecLine assumed for a missing KIND
+            if(f.size()<5) f.resize(5);
+            f[3] = t->title;
+            line.clear();
+            for(size_t i=0;i<f.size();++i){ if(i) line += '\t'; line += f[i]; }
+            out.write(line); if(nl) out.write("\n");
+            ++filled;
+        }
+        if(filled>before && !out.commit()){ cerr<<"Failed to rewrite "<< path <<": "<< out.error() <<"\n"; return 1; }
+    }
+    if(filled) refreshIndexesAfterAppend();
+    cout<<"Filled "<< filled <<" of "<< empty <<" empty titles; fetched "<< urls.size() <<" URLs ("<< fetchedTitles <<" titles, "<< failed <<" without)\n";
+    return 0;
+}
+
+// Checks every distinct URL in range (HEAD, falling back to a ranged GET) unless linkstatus.tsv
+// has a result younger than --max-age days, then prints the dead and failing ones.
+static int cmd_check_links(const Args& a){
+    vector<fs::path> files;
+    if(a.includeArchive) files = archiveFiles();
+    sys_days lo = a.since.value_or(sys_days::min()), hi = a.until.value_or(sys_days::max());
+    for(auto& p: inboxFiles(lo, hi)) files.push_back(std::move(p));
+    string proxy = a.proxy.empty()? getenvOr("CURATE_HTTP_PROXY", "") : a.proxy;
+    auto status = loadLinkStatus();
+    sys_days today = *parseISODate(todayISO());
+
+    vector<string> urls; // canonical, to check
+    size_t total = 0, recent = 0, noProxy = 0;
+    unordered_set<string> seen;
+    for(const auto& p: files){
+        MappedFile mf(p);
+        forEachRecView(mf.view(), [&](const RecView& r){
+            if(r.date<lo || r.date>hi) return;
+            auto u = parseHttpUrl(r.url);
+            if(!u) return;
+            string k = httpUrlString(*u);
+            if(!seen.insert(k).second) return;
+            ++total;
+            auto it = status.find(k);
+            if(it!=status.end() && today - it->second.checked < days{a.maxAgeDays}){ ++recent; return; }
+            if(u->scheme=="https" && proxy.empty()){ ++noProxy; return; }
+            urls.push_back(k);
+        });
+    }
+
+    size_t ok = 0, redirected = 0, dead = 0, failing = 0;
+    if(!urls.empty()){
+#ifndef _WIN32
+        ::signal(SIGPIPE, SIG_IGN);
+#endif
+        HttpFetcher::Options o;
+        o.concurrency = a.concurrency; o.perHost = a.perHost; o.timeoutMs = a.timeoutMs; o.proxy = proxy; o.rate = a.rate;
+        vector<HttpFetcher::Job> jobs;
+        for(const auto& u: urls){ HttpFetcher::Job j; j.url = u; j.head = true; j.rangeFallback = true; jobs.push_back(j); }
+        auto res = HttpFetcher(o).run(jobs);
+        for(size_t i=0;i<urls.size();++i){
+            const auto& r = res[i];
+            LinkStatus s{today, r.status, long(std::lround(r.ms)), r.redirects && r.finalUrl!=urls[i]? r.finalUrl : string(), r.error};
+            status[urls[i]] = s;
+            string note = !s.error.empty()? s.error : s.target;
+            if(linkDead(s)){ ++dead; cout<<"dead\t"<< s.status <<"\t"<< urls[i] <<"\t"<< note <<"\n"; }
+            else if(s.status==0 || s.status>=400){ ++failing; cout<<"error\t"<< s.status <<"\t"<< urls[i] <<"\t"<< note <<"\n"; }
+            else {
+                (s.target.empty()? ok : redirected)++;
+                if(a.verbose) cout<<(s.target.empty()? "ok" : "moved")<<"\t"<< s.status <<"\t"<< urls[i] <<"\t"<< note <<"\n";
+            }
+        }
+        if(!saveLinkStatus(status)){ cerr<<"Failed to write "<< linkStatusPath() <<"\n"; return 1; }
+    }
+    cerr<<"Checked "<< urls.size() <<" of "<< total <<" URLs: "<< ok <<" ok, "<< redirected <<" redirected, "<< dead <<" dead, "<< failing <<" failing";
+    if(recent) cerr<<"; "<< recent <<" checked in the last "<< a.maxAgeDays <<" days";
+    if(noProxy) cerr<<"; "<< noProxy <<" https skipped (needs --proxy)";
+    cerr<<"\n";
+    return 0;
+}
+
+static string fmtBytes(double b){
+    const char* unit[] = {"B", "KiB", "MiB", "GiB"};
+    int u = 0; while(b >= 1024 && u < 3){ b /= 1024; ++u; }
+    std::ostringstream o; o<< std::fixed << setprecision(u? 1 : 0) << b <<" "<< unit[u];
+    return o.str();
+}
+
+// snapshot show: prints the stored text for a URL (via index.tsv) or a snapshot id.
+static int cmd_snapshot_show(const Args& a){
+    auto index = loadSnapshotIndex();
+    string id = a.showKey;
+    if(id.find("://")!=string::npos){
+        auto it = index.find(canonicalUrl(id));
+        if(it==index.end() || it->second.id.empty()){ cerr<<"No snapshot of "<< a.showKey <<"\n"; return 1; }
+        id = it->second.id;
+    }
+    SnapshotStore store;
+    auto text = store.get(id);
+    if(!text){ cerr<<"Snapshot "<< id <<" is missing or damaged\n"; return 1; }
+    cout<< *text;
+    return 0;
+}
+
+// snapshot: fetches every distinct URL in range without a snapshot (--refresh: all of them),
+// stores the readable text of HTML and plain-text pages and updates snapshots/index.tsv.
+static int cmd_snapshot(const Args& a){
+    if(!a.showKey.empty()) return cmd_snapshot_show(a);
+    vector<fs::path> files;
+    if(a.includeArchive) files = archiveFiles();
+    sys_days lo = a.since.value_or(sys_days::min()), hi = a.until.value_or(sys_days::max());
+    for(auto& p: inboxFiles(lo, hi)) files.push_back(std::move(p));
+    string proxy = a.proxy.empty()? getenvOr("CURATE_HTTP_PROXY", "") : a.proxy;
+    auto index = loadSnapshotIndex();
+    sys_days today = *parseISODate(todayISO());
+
+    vector<string> urls; // canonical, to fetch
+    size_t total = 0, have = 0, recentFail = 0, noProxy = 0;
+    unordered_set<string> seen;
+    for(const auto& p: files){
+        MappedFile mf(p);
+        forEachRecView(mf.view(), [&](const RecView& r){
+            if(r.date<lo || r.date>hi) return;
+            auto u = parseHttpUrl(r.url);
+            if(!u) return;
+            string k = httpUrlString(*u);
+            if(!seen.insert(k).second) return;
+            ++total;
+            auto it = index.find(k);
+            if(!a.refresh && it!=index.end()){
+                if(!it->second.id.empty()){ ++have; return; }
+                if(today - it->second.fetched < days{7}){ ++recentFail; return; }
+            }
+            if(u->scheme=="https" && proxy.empty()){ ++noProxy; return; }
+            urls.push_back(k);
+        });
+    }
+
+    SnapshotStore store;
+    size_t stored = 0, failed = 0;
+    uint64_t fetchedBytes = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    if(!urls.empty()){
+#ifndef _WIN32
+        ::signal(SIGPIPE, SIG_IGN);
+#endif
+        HttpFetcher::Options o;
+        o.concurrency = a.concurrency; o.perHost = a.perHost; o.timeoutMs = a.timeoutMs; o.proxy = proxy;
+        vector<HttpFetcher::Job> jobs;
+        for(const auto& u: urls){ HttpFetcher::Job j; j.url = u; j.keepBody = true; jobs.push_back(j); }
+        // Bodies are turned into snapshots as they arrive and freed, so memory stays flat.
+        HttpFetcher(o).run(jobs, [&](size_t i, HttpFetcher::Result& r){
+            fetchedBytes += r.body.size();
+            SnapshotEntry e{today, r.status, "", 0, ""};
+            string why = r.error;
+            bool html = r.contentType.empty() || r.contentType.find("html")!=string::npos;
+            if(why.empty() && r.status/100!=2) why = "HTTP " + to_string(r.status);
+            else if(why.empty() && !html && r.contentType.rfind("text/plain", 0)!=0) why = "not a page (" + r.contentType + ")";
+            if(why.empty()){
+                string text = html? extractReadableText(r.body) : r.body;
+                if(text.empty()) why = "no readable text";
+                else {
+                    e.id = store.put(text); e.bytes = text.size();
+                    if(html) if(auto t = extractTitle(r.body)) e.title = *t;
+                    ++stored;
+                }
+            }
+            if(!why.empty()){ ++failed; if(a.verbose) cerr<< urls[i] <<": "<< why <<"\n"; }
+            // A failed --refresh keeps the snapshot already stored rather than forgetting it.
+            auto it = index.find(urls[i]);
+            if(e.id.empty() && it!=index.end() && !it->second.id.empty()){ string().swap(r.body); return; }
+            index[urls[i]] = std::move(e);
+            string().swap(r.body);
+        });
+        string err;
+        if(!store.flush(err)){ cerr<<"Failed to write snapshots: "<< err <<"\n"; return 1; }
+        if(!saveSnapshotIndex(index)){ cerr<<"Failed to write "<< snapshotIndexPath() <<"\n"; return 1; }
+    }
+    double secs = std::max(1e-3, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+    const auto& st = store.stats;
+    cout<<"Snapshotted "<< stored <<" of "<< urls.size() <<" pages ("<< failed <<" failed); "<< have <<" of "<< total <<" URLs already stored";
+    if(recentFail) cout<<"; "<< recentFail <<" failed in the last 7 days";
+    if(noProxy) cout<<"; "<< noProxy <<" https skipped (needs --proxy)";
+    cout<<"\n";
+    if(!urls.empty()){
+        cout<<"Fetched "<< fmtBytes(double(fetchedBytes)) <<" in "<< std::fixed << setprecision(1) << secs <<" s ("<< fmtBytes(double(fetchedBytes)/secs) <<"/s, "
+            << setprecision(1) << double(urls.size())/secs <<" pages/s)\n";
+        cout<<"Text "<< fmtBytes(double(st.bytes)) <<" in "<< st.chunks <<" chunks; stored "<< fmtBytes(double(st.newBytes)) <<" new in "<< st.newChunks <<" chunks";
+        if(st.bytes) cout<<" (dedupe saved "<< setprecision(0) << 100.0 * (1.0 - double(std::min(st.newBytes, st.bytes)) / double(st.bytes)) <<"%)";
+        cout<<"\n";
+    }
+    return 0;
+}
+
+static int cmd_index(const Args& a){
+    auto r = syncIndex(a.rebuild, true);
+    if(r==IndexUpdate::failed){ cerr<<"Failed to write "<< indexDir() <<"\n"; return 1; }
+    auto m = loadIndexManifest();
+    const char* what = r==IndexUpdate::rebuilt? "Rebuilt" : r==IndexUpdate::appended? "Updated" : "Index is current:";
+    cout<< what <<" "<< (m? m->rows : 0) <<" rows in "<< (m? m->segments.size() : 0) <<" segment(s) under "<< indexDir() <<"\n";
+    return 0;
+}
+
+// Every query term must match (AND). Score = sum of (1 + ln tf) * idf over the free-text terms,
+// scaled by a recency boost that halves at 30 days; --tag/--kind are exact terms that filter only.
+static int cmd_search(const Args& a, bool rebuild = false){
+    if(syncIndex(rebuild, true)==IndexUpdate::failed){ cerr<<"Failed to update "<< indexDir() <<"\n"; return 1; }
+    auto m = loadIndexManifest();
+    if(!m){ cerr<<"Cannot read "<< indexManifestPath() <<"\n"; return 1; }
+    // A damaged segment is rebuilt once, like a stale one.
+    auto corrupt = [&](const string& file){
+        if(!rebuild) return cmd_search(a, true);
+        cerr<<"Corrupt index segment "<< file <<" after a rebuild\n"; return 1;
+    };
+
+    vector<pair<string,bool>> terms; // (term, scored)
+    auto addTerm = [&](string_view t, bool scored){ if(none_of(terms.begin(), terms.end(), [&](const auto& x){ return x.first==t; })) terms.push_back({string(t), scored}); };
+    for(const auto& q: a.terms) forEachToken(q, [&](string_view t){ addTerm(t, true); });
+    for(const auto& t: a.tagFilter){ string s = toLower(trim(t)); if(!s.empty() && s[0]!='#') s.insert(s.begin(), '#'); addTerm(s, false); }
+    if(!a.kindFilter.empty()) addTerm("kind:" + toLower(a.kindFilter), false);
+    if(terms.empty()){ cerr<<"search: require <terms>\n"; return 2; }
+
+    vector<unique_ptr<IndexSegment>> segs;
+    for(const auto& s: m->segments){
+        segs.push_back(make_unique<IndexSegment>(indexDir()/ s.file));
+        if(!segs.back()->ok()) return corrupt(s.file);
     }
-    if(a.cmd=="digest"){
-        for(int i=2;i<argc;++i){
-            string t=argv[i];
-            if(t=="-gt"||t=="--group-tags"){ a.groupTags=true; continue; }
-            if(t=="--tags-only"){ a.tagsOnly=true; continue; }
-            if(t=="-pd"){ a.pd=true; continue; }
-            if(t=="--no-header"){ a.noHeader=true; continue; }
-            if(t=="--week"){ need(++i); auto w=parseISOWeekStr(argv[i]); if(!w){ cerr<<"Invalid --week (use YYYY-Www)\n"; exit(2);} a.week=w; continue; }
-            if(t=="--start"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --start"<<"\n"; exit(2);} a.start=*p; continue; }
-            if(t=="--end"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --end"<<"\n"; exit(2);} a.end=*p; continue; }
-            if(t=="-o"){ need(++i); a.outPath=argv[i]; continue; }
-            cerr<<"Unknown option: "<<t<<"\n"; exit(2);
+    vector<double> idf(terms.size());
+    for(size_t t=0;t<terms.size();++t){
+        uint64_t df = 0;
+        for(const auto& s: segs) if(auto x = s->find(terms[t].first)) df += x->df;
+        if(!df) return 0;
+        idf[t] = std::log(1.0 + double(m->rows) / double(df));
+    }
+
+    sys_days lo = a.since.value_or(sys_days::min()), hi = a.until.value_or(sys_days::max());
+    sys_days today = *parseISODate(todayISO());
+    struct Hit{ double score; size_t seg; uint32_t row; sys_days day; };
+    vector<Hit> hits;
+    vector<pair<uint32_t,uint32_t>> cur, next;
+    for(size_t si=0;si<segs.size();++si){
+        const auto& seg = *segs[si];
+        vector<pair<IndexSegment::Term,size_t>> found; // rarest first
+        bool all = true;
+        for(size_t t=0;t<terms.size() && all;++t){ auto x = seg.find(terms[t].first); if(x) found.push_back({*x, t}); else all = false; }
+        if(!all) continue;
+        sort(found.begin(), found.end(), [](const auto& x, const auto& y){ return x.first.df < y.first.df; });
+        if(!seg.postings(found[0].first, cur)) return corrupt(m->segments[si].file);
+        vector<double> score(cur.size());
+        auto weigh = [&](size_t t, uint32_t tf){ return terms[t].second? (1.0 + std::log(double(tf))) * idf[t] : 0.0; };
+        for(size_t i=0;i<cur.size();++i) score[i] = weigh(found[0].second, cur[i].second);
+        for(size_t k=1;k<found.size() && !cur.empty();++k){
+            if(!seg.postings(found[k].first, next)) return corrupt(m->segments[si].file);
+            size_t w = 0, j = 0;
+            for(size_t i=0;i<cur.size();++i){
+                while(j<next.size() && next[j].first<cur[i].first) ++j;
+                if(j==next.size()) break;
+                if(next[j].first==cur[i].first){ cur[w] = cur[i]; score[w] = score[i] + weigh(found[k].second, next[j].second); ++w; }
+            }
+            cur.resize(w); score.resize(w);
+        }
+        for(size_t i=0;i<cur.size();++i){
+            sys_days day = seg.row(cur[i].first).day;
+            if(day<lo || day>hi) continue;
+            double age = std::max(0.0, double((today - day).count()));
+            hits.push_back({score[i] * (1.0 + 30.0 / (30.0 + age)), si, cur[i].first, day});
         }
-        return a;
     }
-    if(a.cmd=="clear-inbox"){
-        for(int i=2;i<argc;++i){ string t=argv[i]; if(t=="--archive-dir"){ need(++i); a.archiveDir=argv[i]; continue; } cerr<<"Unknown option: "<<t<<"\n"; exit(2); }
-        return a;
+
+    size_t limit = a.limit? size_t(std::max(0, *a.limit)) : 20;
+    auto better = [](const Hit& x, const Hit& y){ return x.score!=y.score? x.score>y.score : x.day>y.day; };
+    if(hits.size()>limit){ std::partial_sort(hits.begin(), hits.begin()+long(limit), hits.end(), better); hits.resize(limit); }
+    else sort(hits.begin(), hits.end(), better);
+
+    vector<unique_ptr<MappedFile>> sources(m->sources.size());
+    for(const auto& h: hits){
+        auto ref = segs[h.seg]->row(h.row);
+        if(ref.src>=sources.size()) continue;
+        if(!sources[ref.src]) sources[ref.src] = make_unique<MappedFile>(curateHome()/ m->sources[ref.src].rel);
+        string_view d = sources[ref.src]->view();
+        RecView r;
+        if(ref.off + ref.len > d.size() || !parseRecLine(d.substr(size_t(ref.off), ref.len), r)) continue;
+        cout<< fmtDate(r.date) <<"\t"<< r.kind <<"\t"<< r.url <<"\t"<< r.title <<"\t"<< r.tags <<"\n";
     }
-    if(a.cmd=="list"){
-        for(int i=2;i<argc;++i){
-            string t=argv[i];
-            if(t=="--limit"){ need(++i); a.limit=stoi(argv[i]); continue; }
-            if(t=="--since"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --since"<<"\n"; exit(2);} a.since=*p; continue; }
-            if(t=="--until"){ need(++i); auto p=parseISODate(argv[i]); if(!p){ cerr<<"Invalid --until"<<"\n"; exit(2);} a.until=*p; continue; }
-            cerr<<"Unknown option: "<<t<<"\n"; exit(2);
+    return 0;
+}
+
+// Hosts (or registrable domains with --by-site) by row count, straight from inbox.bitmaps (or
+// each shard's bitmaps).
+static int cmd_domains(const Args& a){
+    string prefix = a.bySite? "site:" : "host:";
+    map<string,uint64_t> counts;
+    for(const auto& path: inboxFiles()){
+        MappedFile inbox(path);
+        InboxBitmaps b = syncInboxBitmaps(inbox.view(), bitmapsPathFor(path));
+        for(auto it = b.maps.lower_bound(prefix); it!=b.maps.end() && it->first.rfind(prefix, 0)==0; ++it)
+            counts[it->first.substr(prefix.size())] += it->second.cardinality();
+    }
+    vector<pair<uint64_t,string_view>> hosts;
+    for(const auto& [h,n]: counts) hosts.push_back({n, h});
+    sort(hosts.begin(), hosts.end(), [](const auto& x, const auto& y){ return x.first!=y.first? x.first>y.first : x.second<y.second; });
+    if(a.limit && *a.limit>=0 && size_t(*a.limit)<hosts.size()) hosts.resize(size_t(*a.limit));
+    for(const auto& [n,h]: hosts) cout<< n <<"\t"<< h <<"\n";
+    return 0;
+}
+
+// The aggregates (aggregates.bin, or each shard's) answer the inbox part of a query when it groups by week and/or one of kind,
+// tag, domain, has no --where, and its range is made of whole ISO weeks.
+static bool aggregatesFit(const Args& a){
+    if(!a.where.empty() || a.statBy.size()>2) return false;
+    int weekDims = 0, other = 0;
+    for(auto d: a.statBy){ if(d==StatDim::week) ++weekDims; else if(d==StatDim::month) return false; else ++other; }
+    if(weekDims>1 || other>1) return false;
+    using std::chrono::weekday; using std::chrono::Monday; using std::chrono::Sunday;
+    if(a.since && weekday{*a.since}!=Monday) return false;
+    if(a.until && weekday{*a.until}!=Sunday) return false;
+    return true;
+}
+
+static void addAggregateCounts(CountTable& total, const InboxAggregates& g, const vector<StatDim>& dims, sys_days lo, sys_days hi){
+    string key;
+    for(const auto& [wk, w]: g.weeks){
+        auto wb = weekBounds(wk/100, wk%100);
+        if(wb.monday<lo || wb.sunday>hi) continue;
+        string week = fmtISOWeek(wk/100, wk%100);
+        auto bump = [&](const string& k, uint64_t n){ auto it = total.find(string_view(k)); if(it==total.end()) total.emplace(k, n); else it->second += n; };
+        const unordered_map<uint32_t,uint64_t>* m = nullptr;
+        for(auto d: dims) if(d!=StatDim::week) m = d==StatDim::kind? &w.kind : d==StatDim::tag? &w.tag : &w.domain;
+        if(!m){ bump(week, w.total); continue; }
+        for(const auto& [id, n]: *m){
+            if(dims.size()==1) key = g.names[id];
+            else key = dims[0]==StatDim::week? week + "\t" + g.names[id] : g.names[id] + "\t" + week;
+            bump(key, n);
         }
-        return a;
     }
-    if(a.cmd=="help"||a.cmd=="-h"||a.cmd=="--help"){ printHelp(); exit(0); }
-    cerr<<"Unknown command: "<<a.cmd<<"\n"; printHelp(); return nullopt;
 }
 
-// ===== Commands =====
-static int cmd_add(const Args& a){
-    Rec r;
-    r.date  = a.addDateISO? *parseISODate(*a.addDateISO) : *parseISODate(todayISO());
-    r.url   = a.url;
-    r.kind  = detectKind(a.url);
-    r.title = a.addTitle;
-    r.tags  = normalizeTagsForStorage(a.addTags);
-    if(!appendInbox(r)){ cerr<<"Failed to append to "<< inboxPath() <<"\n"; return 1; }
-    cout<<"Added: "<< fmtDate(r.date) <<"\t"<< r.kind <<"\t"<< r.url <<"\t"<< r.title <<"\t"<< r.tags <<"\n";
+// stats --approx: answers from the per-week sketches of every file instead of reading rows; the
+// range widens to whole ISO weeks. Distinct counts carry a 95% bound (two standard errors). For
+// heavy hitters, candidates are the items kept by any week's Space-Saving summary (which includes
+// every item above 1/K of the rows); low/high sum the per-week guarantees and count is the merged
+// Count-Min estimate clamped into them.
+static int cmd_stats_approx(const Args& a){
+    sys_days lo = a.since.value_or(sys_days::min()), hi = a.until.value_or(sys_days::max());
+    vector<fs::path> files;
+    if(a.includeArchive) files = archiveFiles();
+    for(auto& p: inboxFiles(lo, hi)) files.push_back(std::move(p));
+    vector<SourceSketch> sketches(files.size());
+    parallelFor(files.size(), [&](size_t i){ sketches[i] = syncSketch(files[i]); });
+
+    struct Merged{ uint64_t rows = 0; HyperLogLog urls, domains; };
+    map<int,Merged> weeks;
+    vector<const WeekSketch*> parts;
+    Merged all;
+    for(const auto& s: sketches) for(const auto& [wk, w]: s.weeks){
+        auto wb = weekBounds(wk/100, wk%100);
+        if(wb.sunday<lo || wb.monday>hi) continue;
+        parts.push_back(&w);
+        for(Merged* m: {&weeks[wk], &all}){ m->rows += w.rows; m->urls.merge(w.urls); m->domains.merge(w.domains); }
+    }
+
+    double rel = 2 * HyperLogLog::relativeError();
+    auto est = [](const HyperLogLog& h){ return uint64_t(std::llround(h.estimate())); };
+    auto bound = [&](const HyperLogLog& h){ return uint64_t(std::ceil(h.estimate() * rel)); };
+    bool json = a.format=="json";
+    JsonWriter jw([](string_view s){ fwrite(s.data(), 1, s.size(), stdout); });
+    if(json) jw.raw("[");
+    size_t n = 0;
+    auto openRow = [&]{ jw.raw(n++? ",\n {" : "\n {"); };
+
+    if(a.statBy[0]==StatDim::week){
+        if(!json) cout<<"week\trows\turls\turls_err\tdomains\tdomains_err\n";
+        for(const auto& [wk, w]: weeks){
+            string week = fmtISOWeek(wk/100, wk%100);
+            if(!json){ cout<< week <<"\t"<< w.rows <<"\t"<< est(w.urls) <<"\t"<< bound(w.urls) <<"\t"<< est(w.domains) <<"\t"<< bound(w.domains) <<"\n"; continue; }
+            openRow();
+            jw.str("week"); jw.raw(":"); jw.str(week);
+            jw.raw(",\"rows\":"+to_string(w.rows)+",\"urls\":"+to_string(est(w.urls))+",\"urls_err\":"+to_string(bound(w.urls))
+                  +",\"domains\":"+to_string(est(w.domains))+",\"domains_err\":"+to_string(bound(w.domains))+"}");
+        }
+    } else {
+        bool tags = a.statBy[0]==StatDim::tag;
+        CountMin cm;
+        unordered_set<string_view> candidates;
+        for(const WeekSketch* w: parts){
+            cm.merge(tags? w->tagCounts : w->hostCounts);
+            (tags? w->tags : w->hosts).forEachKey([&](string_view k){ candidates.insert(k); });
+        }
+        struct Hit{ string_view key; uint64_t count, low, high; };
+        vector<Hit> hits;
+        for(string_view k: candidates){
+            Hit h{k, 0, 0, 0};
+            for(const WeekSketch* w: parts){ auto [l, u] = (tags? w->tags : w->hosts).bounds(k); h.low += l; h.high += u; }
+            h.count = std::clamp(cm.estimate(k), h.low, h.high);
+            hits.push_back(h);
+        }
+        auto byCount = [](const Hit& x, const Hit& y){ return x.count!=y.count? x.count>y.count : x.key<y.key; };
+        size_t keep = std::min(hits.size(), a.top.value_or(SpaceSaving::K));
+        std::partial_sort(hits.begin(), hits.begin()+long(keep), hits.end(), byCount);
+        hits.resize(keep);
+        const char* dim = statDimName(a.statBy[0]);
+        if(!json) cout<< dim <<"\tcount\tlow\thigh\n";
+        for(const Hit& h: hits){
+            if(!json){ cout<< h.key <<"\t"<< h.count <<"\t"<< h.low <<"\t"<< h.high <<"\n"; continue; }
+            openRow();
+            jw.str(dim); jw.raw(":"); jw.str(h.key);
+            jw.raw(",\"count\":"+to_string(h.count)+",\"low\":"+to_string(h.low)+",\"high\":"+to_string(h.high)+"}");
+        }
+    }
+    if(json){ jw.raw(n? "\n]\n" : "]\n"); jw.flush(); fflush(stdout); }
+    cerr<< all.rows <<" rows in "<< weeks.size() <<" weeks; ~"<< est(all.urls) <<" distinct urls (±"<< bound(all.urls)
+        <<"), ~"<< est(all.domains) <<" distinct domains (±"<< bound(all.domains) <<") at 95%\n";
     return 0;
 }
 
-static pair<sys_days,sys_days> computeRange(const Args& a, string& labelOut){
-    if(a.start && a.end){ labelOut = fmtDate(*a.start) + string(" to ") + fmtDate(*a.end); return {*a.start,*a.end}; }
-    if(a.week){ auto wb = weekBounds(a.week->first, a.week->second); labelOut = fmtISOWeek(wb.year, wb.week); return {wb.monday, wb.sunday}; }
-    auto now = std::chrono::floor<days>(std::chrono::system_clock::now()); auto w = isoWeekFromDate(now); labelOut = fmtISOWeek(w.year, w.week); return {w.monday, w.sunday};
+// Rows are sorted by count (descending) unless the first dimension is week/month without --top,
+// which reads better in time order.
+static int printStats(const Args& a, CountTable& total);
+
+// Federated stats count the merged rows, so an item kept in several homes counts once.
+static int cmd_stats_federated(const Args& a){
+    if(a.approx){ cerr<<"--approx reads one home's sketches; drop it to count across homes\n"; return 2; }
+    FederationStats st;
+    auto rows = loadFederated(a, a.since.value_or(sys_days::min()), a.until.value_or(sys_days::max()), &st);
+    StatCounter c(a.statBy);
+    for(const auto& r: rows){ string d = fmtDate(r.date); c.add(RecView{r.date, d, r.kind, r.url, r.title, r.tags}); }
+    cerr<< st.rows <<" rows from "<< st.homes <<" homes ("<< st.duplicates <<" duplicate URLs merged)\n";
+    return printStats(a, c.table());
 }
 
-static int cmd_digest(const Args& a){
-    auto all = loadInbox(); string label; auto [A,B] = computeRange(a,label); auto rows = filterByDateRange(all,A,B);
+static int cmd_stats(const Args& a){
+    if(federated(a)) return cmd_stats_federated(a);
+    if(a.approx) return cmd_stats_approx(a);
+    sys_days lo = a.since.value_or(sys_days::min()), hi = a.until.value_or(sys_days::max());
+    // Each live inbox file whose aggregates cover it is answered from them; the rest are scanned.
+    vector<InboxAggregates> aggs;
+    vector<fs::path> files;
+    if(a.includeArchive) files = archiveFiles();
+    bool useAggregates = aggregatesFit(a);
+    for(auto& p: inboxFiles(lo, hi)){
+        if(useAggregates){
+            MappedFile inbox(p);
+            if(auto g = syncAggregates(inbox.view(), false, aggregatesPathFor(p))){ aggs.push_back(std::move(*g)); continue; }
+        }
+        files.push_back(std::move(p));
+    }
+    auto where = compileWhere(a.where);
 
-    RenderOpts ro; 
-    ro.groupTags     = a.groupTags; 
-    ro.tagsOnly      = a.tagsOnly; 
-    ro.includeHeader = !a.noHeader; 
-    ro.html          = a.pd; 
-    ro.headerText    = readFileOrEmpty(headerPath()); 
-    ro.rangeLabel    = label;
+    vector<unique_ptr<MappedFile>> maps;
+    vector<string_view> chunks;
+    for(const auto& p: files){
+        maps.push_back(make_unique<MappedFile>(p));
+        string_view d = maps.back()->view();
+        if(d.empty()) continue;
+        auto starts = chunkStarts(d, 0, false);
+        for(size_t i=0;i<starts.size();++i) chunks.push_back(d.substr(starts[i], (i+1<starts.size()? starts[i+1] : d.size()) - starts[i]));
+    }
+
+    vector<CountTable> partial(chunks.size());
+    parallelFor(chunks.size(), [&](size_t i){
+        StatCounter c(a.statBy);
+        forEachMatching(chunks[i], where.get(), [&](const RecView& r){ if(r.date>=lo && r.date<=hi) c.add(r); });
+        partial[i] = std::move(c.table());
+    });
+
+    CountTable total;
+    for(auto& t: partial){
+        if(total.empty()){ total = std::move(t); continue; }
+        for(auto& [k,n]: t){ auto it = total.find(string_view(k)); if(it==total.end()) total.emplace(k, n); else it->second += n; }
+        CountTable().swap(t);
+    }
+    for(const auto& g: aggs) addAggregateCounts(total, g, a.statBy, lo, hi);
+    return printStats(a, total);
+}
+
+static int printStats(const Args& a, CountTable& total){
+    vector<pair<string_view,uint64_t>> rows(total.begin(), total.end());
+    bool timeOrder = !a.top && (a.statBy[0]==StatDim::week || a.statBy[0]==StatDim::month);
+    auto byCount = [](const auto& x, const auto& y){ return x.second!=y.second? x.second>y.second : x.first<y.first; };
+    if(timeOrder) sort(rows.begin(), rows.end(), [](const auto& x, const auto& y){ return x.first<y.first; });
+    else if(a.top && *a.top<rows.size()){ std::partial_sort(rows.begin(), rows.begin()+long(*a.top), rows.end(), byCount); rows.resize(*a.top); }
+    else sort(rows.begin(), rows.end(), byCount);
 
-    // Build Markdown
-    string md = [&]{
-        std::ostringstream out;
-        if(ro.includeHeader && !ro.headerText.empty()){
-            out<< ro.headerText;
-            if(ro.headerText.back()!='\n') out<<'\n';
-            out<<'\n';
+    if(a.format=="json"){
+        JsonWriter jw([](string_view s){ fwrite(s.data(), 1, s.size(), stdout); });
+        jw.raw("[");
+        for(size_t i=0;i<rows.size();++i){
+            jw.raw(i? ",\n {" : "\n {");
+            size_t b = 0;
+            for(size_t d=0; d<a.statBy.size(); ++d){
+                size_t e = rows[i].first.find('\t', b); if(e==string_view::npos) e = rows[i].first.size();
+                jw.str(statDimName(a.statBy[d])); jw.raw(":"); jw.str(rows[i].first.substr(b, e-b)); jw.raw(",");
+                b = e + 1;
+            }
+            jw.raw("\"count\":"); jw.raw(to_string(rows[i].second)); jw.raw("}");
         }
-        if(!ro.tagsOnly){
-            out<< "# All Items " << ro.rangeLabel << "\n\n";
-            for(const auto& r: rows){ out<< recLineMarkdown(r) <<"\n"; }
-            out<< "\n";
+        jw.raw(rows.empty()? "]\n" : "\n]\n");
+        jw.flush(); fflush(stdout);
+        return 0;
+    }
+    for(auto d: a.statBy) cout<< statDimName(d) <<"\t";
+    cout<<"count\n";
+    for(const auto& [k,n]: rows) cout<< k <<"\t"<< n <<"\n";
+    return 0;
+}
+
+// Verifies (or builds) the aggregates of every live inbox file: aggregates.bin, or one per shard.
+static int cmd_aggregates(const Args& a){
+    auto files = inboxFiles();
+    uint64_t rows = 0; set<int> weeks; bool valid = true;
+    for(const auto& p: files){
+        fs::path file = aggregatesPathFor(p);
+        string name = file.lexically_relative(curateHome()).generic_string();
+        MappedFile inbox(p);
+        bool ok = !a.rebuild && loadAggregates(file).has_value();
+        if(!ok && !a.rebuild && fileExists(file)) cerr<< name <<" failed validation; rebuilding\n";
+        valid = valid && ok;
+        auto g = syncAggregates(inbox.view(), a.rebuild, file);
+        if(!g){ cerr<< name <<" does not cover "<< p.filename().string() <<" (is the last line unterminated?)\n"; return 1; }
+        for(const auto& [wk, w]: g->weeks){ rows += w.total; weeks.insert(wk); }
+        if(!shardedInbox()){
+            cout<< (valid? "Verified " : "Built ") << file <<": "<< rows <<" rows in "<< g->weeks.size() <<" weeks, "<< g->names.size() <<" names\n";
+            return 0;
         }
-        if(ro.groupTags || ro.tagsOnly){ out<< renderGroupedByTagsMarkdown(rows); }
-        return out.str();
-    }();
+    }
+    cout<< (valid? "Verified" : "Built") <<" aggregates of "<< files.size() <<" month shards under "<< shardsDir() <<": "<< rows <<" rows in "<< weeks.size() <<" weeks\n";
+    return 0;
+}
 
-    // Output target:
-    // - If -o "-" => stdout
-    // - If -o not set => digests/<range>.{md,html}
-    // - Else => user-specified path
-    if(a.outPath == "-"){
-        if(a.pd) cout << mdToHtml(md);
-        else     cout << md;
-        return 0;
+// --explain: print the compiled --where plan instead of running the command.
+static int cmd_explain(const Args& a){
+    if(a.where.empty()){ cerr<<"--explain needs --where\n"; return 2; }
+    compileWhere(a.where)->explain(cout);
+    return 0;
+}
+
+static int cmd_export(const Args& a){
+    vector<fs::path> files;
+    if(a.includeArchive) files = archiveFiles();
+    sys_days lo = a.since.value_or(sys_days::min()), hi = a.until.value_or(sys_days::max());
+    for(auto& p: inboxFiles(lo, hi)) files.push_back(std::move(p));
+    bool nd = a.format=="ndjson";
+    auto where = compileWhere(a.where);
+
+    unique_ptr<AtomicFile> file;
+    ByteSink sink = [](string_view s){ fwrite(s.data(), 1, s.size(), stdout); };
+    if(!a.outPath.empty() && a.outPath!="-"){
+        file = make_unique<AtomicFile>(a.outPath);
+        sink = [&](string_view s){ file->write(s); };
     }
 
-    fs::path outPath = a.outPath.empty()
-        ? defaultDigestPath(ro.rangeLabel, a.pd)
-        : fs::path(a.outPath);
+    size_t n = 0;
+    {
+        JsonWriter jw(sink);
+        if(!nd) jw.raw("[\n");
+        for(const auto& p: files){
+            MappedFile mf(p);
+            forEachMatching(mf.view(), where.get(), [&](const RecView& r){
+                if(r.date<lo || r.date>hi) return;
+                if(!nd && n) jw.raw(",\n");
+                jw.record(r);
+                if(nd) jw.raw("\n");
+                ++n;
+            });
+        }
+        if(!nd) jw.raw(n? "\n]\n" : "]\n");
+    }
+    if(file){
+        if(!file->commit()){ cerr<<"Failed to write "<< a.outPath <<": "<< file->error() <<"\n"; return 2; }
+        cerr<<"Exported "<< n <<" rows to "<< a.outPath <<"\n";
+    } else fflush(stdout);
+    return 0;
+}
+
+static int cmd_import(const Args& a){
+    string stdinData; unique_ptr<MappedFile> mf; string_view data;
+    if(a.inPath=="-"){ std::ostringstream ss; ss<< cin.rdbuf(); stdinData = ss.str(); data = stdinData; }
+    else {
+        mf = make_unique<MappedFile>(a.inPath);
+        if(!mf->ok()){ cerr<<"Cannot read "<< a.inPath <<"\n"; return 2; }
+        data = mf->view();
+    }
+    if(data.size()>=3 && memcmp(data.data(), "\xEF\xBB\xBF", 3)==0) data.remove_prefix(3); // UTF-8 BOM
 
-    fs::create_directories(outPath.parent_path());
-    ofstream o(outPath);
-    if(!o){
-        cerr<<"Failed to write "<< outPath <<"\n";
-        return 2;
+    ImportFormat f = a.format=="csv"? ImportFormat::csv : a.format=="tsv"? ImportFormat::tsv
+                   : a.format=="bookmarks-html"? ImportFormat::bookmarks : ImportFormat::ndjson;
+
+    // A CSV/TSV header row is consumed here, before the input is chunked.
+    ImportColumns cols; size_t begin = 0, headerLines = 0;
+    if(f==ImportFormat::csv || f==ImportFormat::tsv){
+        vector<string> first; size_t pos = 0;
+        if(f==ImportFormat::csv) nextCsvRecord(data, pos, ',', first); else nextTsvRecord(data, pos, first);
+        if(auto h = headerColumns(first)){ cols = *h; begin = std::min(pos, data.size()); headerLines = size_t(std::count(data.begin(), data.begin()+long(begin), '\n')); }
     }
 
-    if(a.pd) o << mdToHtml(md);
-    else     o << md;
+    detectKind(""); // compile rules.tsv once, before the workers start
+    sys_days today = *parseISODate(todayISO());
+    vector<size_t> starts = chunkStarts(data, begin, f==ImportFormat::csv);
+    vector<ImportChunk> chunks(starts.size());
+    parallelFor(starts.size(), [&](size_t i){
+        size_t e = i+1<starts.size()? starts[i+1] : data.size();
+        chunks[i] = parseImportChunk(data.substr(starts[i], e-starts[i]), f, cols, today);
+    });
+
+    std::unordered_set<string> seen;
+    if(a.skipExisting){
+        for(const auto& path: inboxFiles()){
+            MappedFile inbox(path);
+            forEachRecView(inbox.view(), [&](const RecView& r){ seen.emplace(trimView(r.url)); });
+        }
+    }
 
+    InboxAppender out({}, SIZE_MAX);
+    size_t rejected = 0, duplicates = 0, lineBase = headerLines;
+    for(auto& c: chunks){
+        for(auto& [line, why]: c.rejects){ if(++rejected <= 5) cerr<<a.inPath<<":"<<(lineBase+line)<<": skipped ("<<why<<")\n"; }
+        for(auto& r: c.rows){
+            if(a.skipExisting && !seen.insert(r.url).second){ ++duplicates; continue; }
+            out.add(r);
+        }
+        lineBase += c.lines;
+        c.rows.clear(); c.rows.shrink_to_fit();
+    }
+    if(!out.close()){ cerr<<"Failed to append to "<< inboxPath() <<"\n"; return 1; }
+    refreshIndexesAfterAppend();
+    cout<<"Imported "<< out.rows() <<" rows from "<< a.inPath;
+    if(rejected) cout<<" ("<< rejected <<" skipped)";
+    if(duplicates) cout<<" ("<< duplicates <<" already present)";
+    cout<<"\n";
     return 0;
 }
 
-static int cmd_clear_inbox(const Args& a){
-    fs::create_directories(curateHome());
-    if(!fileExists(inboxPath())){
-        ofstream o(inboxPath());
-        cout << "Initialized new inbox.tsv" << '\n';
-        return 0;
+// ===== Resident daemon (serve) =====
+// `curate serve` listens on $CURATE_HOME/.curate.sock (or $CURATE_SOCKET) and keeps the parsed
+// inbox, inbox.bitmaps and compiled rules.tsv in memory (every shard and its bitmaps with the
+// sharded layout). inotify on $CURATE_HOME and inbox/ marks them stale when an inbox file,
+// rules.tsv or config.tsv changes; the inbox is then brought up to date by parsing only
+// the appended tail (a rewrite starts over). Each request runs in a child forked from that warm
+// state, so it skips process start-up, rule compilation and inbox parsing; the daemon relays the
+// output of all running children from one poll loop, woken by SIGCHLD through a self-pipe when a
+// child exits, and keeps accepting meanwhile. digest starts from the resident rows and filtered
+// list from the resident bitmaps; unfiltered list and stats stream the mapped files (or read
+// aggregates.bin) exactly as they do locally.
+//
+// Protocol: every message is a frame, u32 little-endian length followed by that many bytes.
+//   request:  "curate1\0" cwd "\0" arg "\0" arg ...      (arguments after the program name)
+//   response: 'o' + stdout bytes | 'e' + stderr bytes    (any number, in order)
+//             'x' + u32 exit status                      (last frame)
+// The CLI forwards add/list/digest/stats when the socket accepts a connection and runs the
+// command itself otherwise (CURATE_NO_DAEMON=1 forces that).
+static const char SERVE_MAGIC[] = "curate1";
+
+static fs::path serveSocketPath(){
+    string s = getenvOr("CURATE_SOCKET", "");
+    return s.empty()? curateHome()/ ".curate.sock" : fs::path(s);
+}
+
+static int runCommand(int argc, char** argv);
+
+#ifndef _WIN32
+static bool writeFrame(int fd, string_view payload){
+    string b; putU32(b, uint32_t(payload.size())); b += payload;
+    return fdWriteAll(fd, b.data(), b.size());
+}
+
+static bool writeFrame(int fd, char type, string_view data){
+    string b; putU32(b, uint32_t(data.size()+1)); b += type; b += data;
+    return fdWriteAll(fd, b.data(), b.size());
+}
+
+static optional<string> readFrame(int fd, size_t maxBytes){
+    char h[4];
+    if(fdReadFull(fd, h, 4)!=4) return nullopt;
+    uint32_t n = getU32(h);
+    if(n > maxBytes) return nullopt;
+    string b(n, '\0');
+    if(fdReadFull(fd, b.data(), n)!=n) return nullopt;
+    return b;
+}
+
+static int unixSocket(const fs::path& p, sockaddr_un& addr){
+    string s = p.string();
+    if(s.size() >= sizeof(addr.sun_path)) return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, s.data(), s.size());
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd>=0) ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+static int connectUnix(const fs::path& p){
+    sockaddr_un addr;
+    int fd = unixSocket(p, addr);
+    if(fd<0) return -1;
+    if(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))!=0){ ::close(fd); return -1; }
+    return fd;
+}
+#endif
+
+// The client half: nullopt means "no daemon, run locally". Once the daemon has answered, its
+// exit status is final even if the connection drops later.
+static optional<int> runViaDaemon(int argc, char** argv){
+#ifdef _WIN32
+    (void)argc; (void)argv;
+    return nullopt;
+#else
+    if(argc<2 || getenvOr("CURATE_NO_DAEMON", "")=="1") return nullopt;
+    string cmd = argv[1];
+    if(cmd!="add" && cmd!="list" && cmd!="digest" && cmd!="stats") return nullopt;
+    // Federated reads (several homes) run locally: the daemon serves one home.
+    if(getenvOr("CURATE_HOME", "").find(kHomeSep)!=string::npos) return nullopt;
+    for(int i=2;i<argc;++i) if(string_view(argv[i])=="--home") return nullopt;
+    int fd = connectUnix(serveSocketPath());
+    if(fd<0) return nullopt;
+    ::signal(SIGPIPE, SIG_IGN);
+    std::error_code ec;
+    string req(SERVE_MAGIC, sizeof(SERVE_MAGIC)); req += fs::current_path(ec).string(); req += '\0';
+    for(int i=1;i<argc;++i){ req += argv[i]; req += '\0'; }
+    if(!writeFrame(fd, req)){ ::close(fd); return nullopt; }
+    bool answered = false;
+    while(auto f = readFrame(fd, size_t(1)<<30)){
+        if(f->empty()) continue;
+        answered = true;
+        string_view d = string_view(*f).substr(1);
+        if((*f)[0]=='o') fwrite(d.data(), 1, d.size(), stdout);
+        else if((*f)[0]=='e'){ fflush(stdout); fwrite(d.data(), 1, d.size(), stderr); }
+        else if((*f)[0]=='x' && d.size()==4){ ::close(fd); fflush(stdout); return int(getU32(d.data())); }
     }
-    fs::path arch = a.archiveDir.empty()? (curateHome()/ "archive") : fs::path(a.archiveDir);
-    fs::create_directories(arch);
+    ::close(fd);
+    if(!answered) return nullopt;
+    cerr<<"curate serve: connection closed before the command finished\n";
+    return 1;
+#endif
+}
 
-    auto now = std::chrono::system_clock::now();
-    time_t t = std::chrono::system_clock::to_time_t(now);
-    std::tm tm{}; portable_localtime(&t,&tm);
-    char buf[32]; strftime(buf,sizeof(buf),"%Y%m%d-%H%M%S", &tm);
-    fs::path dest = arch / (string("inbox-") + buf + ".tsv");
+#ifndef _WIN32
+static volatile sig_atomic_t serveStop = 0;
+// Self-pipe written by the SIGCHLD handler, so the poll loop wakes as soon as a child can be reaped.
+static int serveChildPipe[2] = {-1, -1};
+
+// A request whose command runs in a child forked from the daemon. The serve loop relays the
+// child's stdout/stderr to the client as frames and sends the 'x' frame once it is reaped, so a
+// slow command never holds up other clients. Frames waiting for a slow reader queue in `pending`;
+// past kServePending the child's pipes are left unread until the client catches up.
+struct ServeJob{ pid_t pid = -1; int cfd = -1, out = -1, err = -1; string pending; bool clientGone = false, reaped = false; };
+constexpr size_t kServePending = size_t(1) << 20;
+
+static void appendFrame(string& b, char type, string_view data){
+    putU32(b, uint32_t(data.size()+1)); b += type; b += data;
+}
+
+// Reads the request on `cfd` and forks its command; nullopt when it was answered on the spot
+// (malformed, or no child could be started). Inherited descriptors the child does not need are closed.
+static optional<ServeJob> startServeRequest(int cfd, int listenFd, int watchFd, const vector<ServeJob>& running){
+    timeval tv{5, 0}; // the client sends its request right after connecting
+    ::setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    auto req = readFrame(cfd, size_t(1)<<20);
+    vector<string> parts;
+    if(req){ size_t b = 0; while(b < req->size()){ size_t e = req->find('\0', b); if(e==string::npos) e = req->size(); parts.emplace_back(req->substr(b, e-b)); b = e + 1; } }
+    auto answer = [&](string_view msg, uint32_t status){
+        writeFrame(cfd, 'e', msg);
+        string x; putU32(x, status); writeFrame(cfd, 'x', x);
+        return nullopt;
+    };
+    if(parts.size()<3 || parts[0]!=SERVE_MAGIC) return answer("curate serve: malformed request (client and daemon versions differ?)\n", 2);
+    int out[2], err[2];
+    if(::pipe(out)!=0) return answer("curate serve: "s + strerror(errno) + "\n", 1);
+    if(::pipe(err)!=0){ ::close(out[0]); ::close(out[1]); return answer("curate serve: "s + strerror(errno) + "\n", 1); }
+    fflush(stdout); fflush(stderr);
+    pid_t pid = ::fork();
+    if(pid==0){
+        ::close(cfd); ::close(listenFd); if(watchFd>=0) ::close(watchFd);
+        for(const auto& j: running){ ::close(j.cfd); if(j.out>=0) ::close(j.out); if(j.err>=0) ::close(j.err); }
+        ::dup2(out[1], 1); ::dup2(err[1], 2);
+        ::close(out[0]); ::close(out[1]); ::close(err[0]); ::close(err[1]);
+        ::signal(SIGPIPE, SIG_DFL); ::signal(SIGINT, SIG_DFL); ::signal(SIGTERM, SIG_DFL); ::signal(SIGCHLD, SIG_DFL);
+        ::close(serveChildPipe[0]); ::close(serveChildPipe[1]);
+        if(::chdir(parts[1].c_str())!=0){ cerr<<"curate serve: cannot enter "<< parts[1] <<"\n"; _exit(1); }
+        vector<char*> argv; argv.push_back(const_cast<char*>("curate"));
+        for(size_t i=2;i<parts.size();++i) argv.push_back(parts[i].data());
+        argv.push_back(nullptr);
+        int rc = runCommand(int(argv.size()-1), argv.data());
+        cout.flush(); fflush(stdout); fflush(stderr);
+        _exit(rc);
+    }
+    ::close(out[1]); ::close(err[1]);
+    if(pid<0){ ::close(out[0]); ::close(err[0]); return answer("curate serve: fork failed\n", 1); }
+    for(int fd: {out[0], err[0]}) ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    ::fcntl(cfd, F_SETFL, ::fcntl(cfd, F_GETFL) | O_NONBLOCK);
+    ServeJob j; j.pid = pid; j.cfd = cfd; j.out = out[0]; j.err = err[0];
+    return j;
+}
+
+// One step of a running request after poll(): `outRev`/`errRev`/`cliRev` are the revents of its
+// stdout pipe, stderr pipe and client socket. Returns true once the job is finished and closed.
+static bool stepServeJob(ServeJob& j, short outRev, short errRev, short cliRev){
+    char buf[1<<16];
+    int* pipes[2] = {&j.out, &j.err};
+    short rev[2] = {outRev, errRev};
+    for(int i=0;i<2;++i){
+        if(*pipes[i]<0 || !(rev[i] & (POLLIN|POLLHUP|POLLERR))) continue;
+        long n = fdRead(*pipes[i], buf, sizeof(buf));
+        if(n<=0){ ::close(*pipes[i]); *pipes[i] = -1; continue; }
+        if(!j.clientGone) appendFrame(j.pending, i? 'e' : 'o', string_view(buf, size_t(n)));
+    }
+    if(j.out<0 && j.err<0 && !j.reaped){
+        int ws = 0;
+        pid_t r = ::waitpid(j.pid, &ws, WNOHANG);
+        if(r==j.pid || (r<0 && errno==ECHILD)){
+            j.reaped = true;
+            uint32_t status = r<0? 1 : WIFEXITED(ws)? WEXITSTATUS(ws) : 128 + (WIFSIGNALED(ws)? WTERMSIG(ws) : 0);
+            string x; putU32(x, status);
+            if(!j.clientGone) appendFrame(j.pending, 'x', x);
+        }
+    }
+    if(cliRev & (POLLERR|POLLHUP)) j.clientGone = true;
+    while(!j.clientGone && !j.pending.empty()){
+        ssize_t n = ::write(j.cfd, j.pending.data(), j.pending.size());
+        if(n<0 && errno==EINTR) continue;
+        if(n<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) break;
+        if(n<=0){ j.clientGone = true; break; } // the client went away; the child's output is dropped
+        j.pending.erase(0, size_t(n));
+    }
+    if(j.clientGone) j.pending.clear();
+    if(!j.reaped || !j.pending.empty()) return false;
+    ::close(j.cfd);
+    return true;
+}
+#endif
 
+static int cmd_serve(const Args&){
+#ifdef _WIN32
+    cerr<<"curate serve needs Unix domain sockets and is not available on Windows\n";
+    return 1;
+#else
+    // Requests run with another working directory, so pin the home to an absolute path first.
     std::error_code ec;
-    fs::rename(inboxPath(), dest, ec);
-    if(ec){
-        ec.clear();
-        fs::copy_file(inboxPath(), dest, fs::copy_options::overwrite_existing, ec);
-        if(ec){
-            cerr << "Archive failed: " << ec.message() << '\n';
-            return 2;
+    fs::path home = fs::absolute(curateHome(), ec);
+    ::setenv("CURATE_HOME", home.string().c_str(), 1);
+    fs::path sock = serveSocketPath();
+    if(int probe = connectUnix(sock); probe>=0){ ::close(probe); cerr<<"curate serve is already running on "<< sock <<"\n"; return 1; }
+    fs::remove(sock, ec);
+
+    sockaddr_un addr;
+    int lfd = unixSocket(sock, addr);
+    if(lfd<0){ cerr<<"Cannot create socket "<< sock <<" (path too long?)\n"; return 1; }
+    mode_t old = ::umask(077);
+    bool bound = ::bind(lfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))==0;
+    ::umask(old);
+    if(!bound || ::listen(lfd, 64)!=0){ cerr<<"Cannot listen on "<< sock <<": "<< strerror(errno) <<"\n"; ::close(lfd); return 1; }
+
+    struct sigaction sa{};
+    sa.sa_handler = [](int){ serveStop = 1; };
+    ::sigaction(SIGINT, &sa, nullptr); ::sigaction(SIGTERM, &sa, nullptr);
+    ::signal(SIGPIPE, SIG_IGN);
+    if(::pipe(serveChildPipe)!=0){ cerr<<"Cannot create pipe: "<< strerror(errno) <<"\n"; ::close(lfd); fs::remove(sock, ec); return 1; }
+    for(int fd: serveChildPipe){ ::fcntl(fd, F_SETFD, FD_CLOEXEC); ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK); }
+    struct sigaction sc{};
+    sc.sa_handler = [](int){ int e = errno; char c = 0; if(::write(serveChildPipe[1], &c, 1)<0){} errno = e; };
+    sc.sa_flags = SA_NOCLDSTOP | SA_RESTART;
+    ::sigaction(SIGCHLD, &sc, nullptr);
+
+    // The home is watched for inbox.tsv, rules.tsv and config.tsv; inbox/ (once it exists) for shards.
+    int wfd = -1;
+#ifdef __linux__
+    int shardsWd = -1;
+    constexpr uint32_t watchMask = IN_CLOSE_WRITE|IN_MODIFY|IN_MOVED_TO|IN_CREATE|IN_DELETE|IN_MOVED_FROM;
+    wfd = ::inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if(wfd>=0 && ::inotify_add_watch(wfd, home.c_str(), watchMask)<0){ ::close(wfd); wfd = -1; }
+    if(wfd>=0) shardsWd = ::inotify_add_watch(wfd, shardsDir().c_str(), watchMask);
+#endif
+    bool inboxStale = true, rulesStale = false, layoutStale = false;
+    set<fs::path> replaced;
+    residentInbox() = make_unique<map<string,ResidentInbox>>();
+    residentBitmaps() = make_unique<map<string,InboxBitmaps>>();
+    auto refresh = [&]{
+        if(rulesStale){ kindRules() = loadRules(); rulesStale = false; }
+        else kindRules();
+        if(wfd<0) layoutStale = true;
+        if(layoutStale){ forgetLayout(); layoutStale = false; }
+        if(!inboxStale) return;
+        // A rewritten file (sort, clear-inbox, migrate) can end with the same bytes as before; start it over.
+        for(const auto& p: replaced){ residentInbox()->erase(p.string()); residentBitmaps()->erase(bitmapsPathFor(p).string()); }
+        replaced.clear();
+        loadInbox();
+        for(const auto& p: inboxFiles()) if(fileExists(bitmapsPathFor(p))){ MappedFile inbox(p); syncInboxBitmaps(inbox.view(), bitmapsPathFor(p)); }
+        inboxStale = wfd<0; // without inotify, re-check (cheaply, by stamp) before every request
+    };
+    refresh();
+    size_t residentRows = 0;
+    for(const auto& [path, r]: *residentInbox()) residentRows += r.rows.size();
+    cout<<"Serving "<< home <<" on "<< sock <<" ("<< residentRows <<" rows resident)\n" << std::flush;
+
+    // After SIGINT/SIGTERM no new request is accepted; those already running are relayed to the end.
+    vector<ServeJob> jobs;
+    while(lfd>=0 || !jobs.empty()){
+        if(serveStop && lfd>=0){ ::close(lfd); lfd = -1; fs::remove(sock, ec); } // new clients run locally
+        vector<pollfd> p = {{lfd, POLLIN, 0}, {wfd, POLLIN, 0}, {serveChildPipe[0], POLLIN, 0}};
+        for(const auto& j: jobs){
+            bool room = j.pending.size() < kServePending;
+            p.push_back({room? j.out : -1, POLLIN, 0});
+            p.push_back({room? j.err : -1, POLLIN, 0});
+            p.push_back({j.cfd, short(j.pending.empty()? 0 : POLLOUT), 0});
         }
-        ofstream o(inboxPath(), ios::trunc);
-    } else {
-        ofstream o(inboxPath(), ios::trunc);
+        if(::poll(p.data(), nfds_t(p.size()), -1)<0){ if(errno==EINTR) continue; break; }
+        if(p[2].revents & POLLIN){ char b[64]; while(::read(serveChildPipe[0], b, sizeof(b)) > 0){} } // jobs below try waitpid again
+#ifdef __linux__
+        if(wfd>=0 && (p[1].revents & POLLIN)){
+            alignas(inotify_event) char buf[8192]; long n;
+            while((n = ::read(wfd, buf, sizeof(buf))) > 0){
+                for(long i=0; i<n; ){
+                    auto* ev = reinterpret_cast<const inotify_event*>(buf+i);
+                    string_view name = ev->len? string_view(ev->name) : string_view();
+                    bool created = (ev->mask & (IN_MOVED_TO|IN_CREATE))!=0;
+                    if(ev->wd==shardsWd){
+                        if(shardMonth(fs::path(name))){ inboxStale = true; if(created) replaced.insert(shardsDir()/ string(name)); }
+                        if(ev->mask & IN_IGNORED) shardsWd = -1; // inbox/ was removed
+                    }
+                    else if(name=="inbox.tsv"){ inboxStale = true; if(created) replaced.insert(inboxPath()); }
+                    else if(name=="rules.tsv") rulesStale = true;
+                    else if(name=="config.tsv"){ layoutStale = inboxStale = true; }
+                    else if(name=="inbox" && created && shardsWd<0){
+                        shardsWd = ::inotify_add_watch(wfd, shardsDir().c_str(), watchMask);
+                        inboxStale = true;
+                    }
+                    i += long(sizeof(inotify_event) + ev->len);
+                }
+            }
+        }
+#endif
+        size_t live = 0;
+        for(size_t i=0;i<jobs.size();++i){
+            const pollfd* q = &p[3 + 3*i];
+            if(stepServeJob(jobs[i], q[0].revents, q[1].revents, q[2].revents)) continue;
+            if(live!=i) jobs[live] = std::move(jobs[i]);
+            ++live;
+        }
+        jobs.resize(live);
+        if(lfd<0 || !(p[0].revents & POLLIN)) continue;
+        int cfd = ::accept(lfd, nullptr, nullptr);
+        if(cfd<0) continue;
+        ::fcntl(cfd, F_SETFD, FD_CLOEXEC);
+        refresh();
+        if(auto j = startServeRequest(cfd, lfd, wfd, jobs)) jobs.push_back(std::move(*j));
+        else ::close(cfd);
     }
-    cout << "Archived to " << dest << " and cleared inbox.tsv" << '\n';
+    if(lfd>=0){ ::close(lfd); fs::remove(sock, ec); }
+    if(wfd>=0) ::close(wfd);
+    ::signal(SIGCHLD, SIG_DFL);
+    for(int& fd: serveChildPipe){ ::close(fd); fd = -1; }
+    cout<<"Stopped\n";
     return 0;
+#endif
 }
 
-static int cmd_list(const Args& a){
-    auto all = loadInbox(); vector<Rec> rows = all;
-    if(a.since || a.until){
-        sys_days lo = a.since.value_or(sys_days::min());
-        sys_days hi = a.until.value_or(sys_days::max());
-        rows = filterByDateRange(all, lo, hi);
+// ===== Local HTTP preview (http) =====
+// `curate http` serves digests rendered on demand from the parsed inbox kept in memory:
+//   GET  /                               index of ISO weeks with item counts
+//   GET  /week/YYYY-Www                  that week's digest (as `digest --week ... -pd`)
+//   GET  /range/YYYY-MM-DD..YYYY-MM-DD   any date range
+//   GET  /tag/NAME                       every item carrying #NAME
+//   POST /add                            url=...&title=...&tags=...&date=... (form-encoded)
+// Query ?gt=1 groups by tag, ?tags-only=1 prints only the tag groups. Rendered pages sit in an
+// LRU cache keyed by path and query; a change to inbox.tsv or templates/header.md empties it.
+// Responses carry an ETag (hash of the body) and If-None-Match is answered with 304.
+// Any page in a browser can reach a loopback port, so requests are screened: Host must name this
+// server (which defeats DNS rebinding), a request from another Origin needs the token, and so does
+// POST /add (a random token is made when --token is not given). The token travels as token=... in
+// the query or form body, or as an X-Curate-Token header; only replies to requests that carried it
+// get the CORS header a bookmarklet needs to read them. Off loopback every request needs it.
+static string urlDecode(string_view s){
+    string o; o.reserve(s.size());
+    auto hex = [](char c){ return isdigit((unsigned char)c)? c-'0' : (tolower((unsigned char)c)>='a' && tolower((unsigned char)c)<='f')? tolower((unsigned char)c)-'a'+10 : -1; };
+    for(size_t i=0;i<s.size();++i){
+        if(s[i]=='+') o += ' ';
+        else if(s[i]=='%' && i+2<s.size() && hex(s[i+1])>=0 && hex(s[i+2])>=0){ o += char(hex(s[i+1])*16 + hex(s[i+2])); i += 2; }
+        else o += s[i];
     }
-    if(a.limit && *a.limit < (int)rows.size()) rows.resize(*a.limit);
-    for(const auto& r: rows){
-        cout<< fmtDate(r.date) <<"\t"<< r.kind <<"\t"<< r.url <<"\t"<< r.title <<"\t"<< r.tags <<"\n";
+    return o;
+}
+
+// a=1&b=two → {a:1, b:two}; later keys win.
+static map<string,string> parseFormParams(string_view s){
+    map<string,string> m;
+    while(!s.empty()){
+        size_t amp = s.find('&');
+        string_view kv = s.substr(0, amp);
+        size_t eq = kv.find('=');
+        if(!kv.empty()) m[urlDecode(kv.substr(0, eq))] = eq==string_view::npos? string() : urlDecode(kv.substr(eq+1));
+        if(amp==string_view::npos) break;
+        s.remove_prefix(amp+1);
+    }
+    return m;
+}
+
+// Most recently used first; put() evicts from the back beyond `capacity` pages.
+class PageCache{
+public:
+    struct Page{ string etag, body; };
+    explicit PageCache(size_t capacity): cap_(capacity){}
+
+    const Page* get(const string& key){
+        auto it = idx_.find(key);
+        if(it==idx_.end()) return nullptr;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return &it->second->second;
+    }
+    const Page& put(const string& key, Page p){
+        if(auto it = idx_.find(key); it!=idx_.end()){ lru_.erase(it->second); idx_.erase(it); }
+        lru_.emplace_front(key, std::move(p));
+        idx_[key] = lru_.begin();
+        while(lru_.size() > cap_){ idx_.erase(lru_.back().first); lru_.pop_back(); }
+        return lru_.front().second;
+    }
+    void clear(){ lru_.clear(); idx_.clear(); }
+
+private:
+    size_t cap_;
+    std::list<pair<string,Page>> lru_;
+    unordered_map<string, std::list<pair<string,Page>>::iterator> idx_;
+};
+
+struct HttpRequest{ string method, path, query, body; map<string,string> headers; bool keepAlive = true; };
+
+// Parses one request from the front of `buf`: 1 = complete (consumed from buf), 0 = need more
+// bytes, -1 = malformed or too large.
+static int parseHttpRequest(string& buf, HttpRequest& req){
+    size_t he = buf.find("\r\n\r\n");
+    if(he==string::npos) return buf.size() > 16*1024? -1 : 0;
+    string_view head(buf.data(), he);
+    size_t le = head.find("\r\n");
+    string_view line = head.substr(0, le);
+    size_t s1 = line.find(' '), s2 = line.rfind(' ');
+    if(s1==string_view::npos || s2<=s1) return -1;
+    req = HttpRequest{};
+    req.method = string(line.substr(0, s1));
+    string_view target = line.substr(s1+1, s2-s1-1);
+    size_t q = target.find('?');
+    req.path = urlDecode(target.substr(0, q));
+    if(q!=string_view::npos) req.query = string(target.substr(q+1));
+    req.keepAlive = line.substr(s2+1)!="HTTP/1.0";
+    while(le!=string_view::npos){
+        size_t b = le + 2; le = head.find("\r\n", b);
+        string_view h = head.substr(b, le==string_view::npos? string_view::npos : le-b);
+        size_t colon = h.find(':');
+        if(colon==string_view::npos) continue;
+        req.headers[toLower(string(h.substr(0, colon)))] = trim(string(h.substr(colon+1)));
+    }
+    if(auto it = req.headers.find("connection"); it!=req.headers.end()) req.keepAlive = toLower(it->second)!="close" && (req.keepAlive || toLower(it->second)=="keep-alive");
+    size_t len = 0;
+    if(auto it = req.headers.find("content-length"); it!=req.headers.end()) len = size_t(atol(it->second.c_str()));
+    if(len > (1u<<20)) return -1;
+    if(buf.size() < he + 4 + len) return 0;
+    req.body = buf.substr(he+4, len);
+    buf.erase(0, he + 4 + len);
+    return 1;
+}
+
+// withBody=false (HEAD) sends the headers of `body` without it.
+static string httpResponse(int status, const char* reason, string_view type, string_view body, const string& etag, bool keepAlive, bool withBody = true){
+    string r = "HTTP/1.1 " + to_string(status) + " " + reason + "\r\n";
+    if(!type.empty()){ r += "Content-Type: "; r += type; r += "\r\n"; }
+    if(!etag.empty()) r += "ETag: " + etag + "\r\nCache-Control: no-cache\r\n";
+    r += "Content-Length: " + to_string(body.size()) + "\r\n";
+    r += keepAlive? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    r += "\r\n";
+    if(withBody) r += body;
+    return r;
+}
+
+class HttpPreview{
+public:
+    HttpPreview(string token, string bind, int port): token_(std::move(token)), bind_(std::move(bind)), port_(port), cache_(64){}
+
+    string handle(const HttpRequest& req){
+        auto deny = [&](const char* msg){ return httpResponse(403, "Forbidden", "text/plain; charset=utf-8", msg, "", req.keepAlive); };
+        if(!hostAllowed(req)) return deny("unexpected Host\n");
+        bool authed = presentedToken(req)==token_;
+        bool loopback = bind_.rfind("127.", 0)==0;
+        if(!authed && (!loopback || req.path=="/add" || foreignOrigin(req))) return deny("bad or missing token\n");
+        string r = route(req);
+        if(authed) r.insert(r.find("\r\n")+2, "Access-Control-Allow-Origin: *\r\n"); // lets a bookmarklet read the reply
+        return r;
+    }
+
+private:
+    // Host must be the bound address (or localhost for loopback) with the bound port.
+    bool hostAllowed(const HttpRequest& req) const {
+        auto it = req.headers.find("host");
+        if(it==req.headers.end()) return false;
+        string h = toLower(it->second), port = "80";
+        size_t colon = h.rfind(':');
+        if(colon!=string::npos && h.find(']', colon)==string::npos){ port = h.substr(colon+1); h.erase(colon); }
+        if(port!=to_string(port_)) return false;
+        if(bind_=="0.0.0.0") return true; // any name may reach it; the token guards every request
+        return h==bind_ || (bind_.rfind("127.", 0)==0 && (h=="localhost" || h=="127.0.0.1"));
+    }
+
+    static bool foreignOrigin(const HttpRequest& req){
+        auto o = req.headers.find("origin"), h = req.headers.find("host");
+        return o!=req.headers.end() && (h==req.headers.end() || toLower(o->second)!="http://" + toLower(h->second));
+    }
+
+    static string presentedToken(const HttpRequest& req){
+        if(auto it = req.headers.find("x-curate-token"); it!=req.headers.end()) return it->second;
+        auto q = parseFormParams(req.query);
+        if(auto it = q.find("token"); it!=q.end()) return it->second;
+        if(req.method=="POST"){ auto b = parseFormParams(req.body); if(auto it = b.find("token"); it!=b.end()) return it->second; }
+        return string("\n"); // matches no token
+    }
+
+    string route(const HttpRequest& req){
+        refresh();
+        if(req.path=="/add"){
+            if(req.method!="POST") return httpResponse(405, "Method Not Allowed", "text/plain; charset=utf-8", "use POST\n", "", req.keepAlive);
+            return add(req);
+        }
+        if(req.method!="GET" && req.method!="HEAD") return httpResponse(405, "Method Not Allowed", "text/plain; charset=utf-8", "use GET\n", "", req.keepAlive);
+        string key = req.path + "?" + req.query;
+        const PageCache::Page* page = cache_.get(key);
+        if(!page){
+            auto body = render(req.path, parseFormParams(req.query));
+            if(!body) return httpResponse(404, "Not Found", "text/plain; charset=utf-8", "no such page (try /, /week/YYYY-Www, /range/A..B, /tag/NAME)\n", "", req.keepAlive);
+            page = &cache_.put(key, PageCache::Page{"\"" + hex64(Fnv64().add(*body).h) + "\"", std::move(*body)});
+        }
+        bool head = req.method=="HEAD";
+        if(auto it = req.headers.find("if-none-match"); it!=req.headers.end() && it->second==page->etag)
+            return httpResponse(304, "Not Modified", "", "", page->etag, req.keepAlive);
+        return httpResponse(200, "OK", "text/html; charset=utf-8", page->body, page->etag, req.keepAlive, !head);
+    }
+
+    // Syncs the resident inbox; any change to it (or to the header template) drops the cache.
+    void refresh(){
+        std::error_code ec;
+        auto hdr = fs::last_write_time(headerPath(), ec);
+        string hdrGen = to_string(ec? 0 : hdr.time_since_epoch().count());
+        auto cfg = fs::last_write_time(configPath(), ec);
+        string cfgGen = ec? string() : to_string(cfg.time_since_epoch().count());
+        if(cfgGen!=cfgGen_){ forgetLayout(); cfgGen_ = cfgGen; } // `migrate` may have switched layouts
+        if(shardedInbox()){
+            // Every shard's stamp goes into the generation; a change re-parses only the shards that grew or were rewritten.
+            string gen = hdrGen;
+            for(const auto& p: inboxFiles()){ MappedFile f(p); gen += ":" + p.filename().string() + ":" + to_string(f.view().size()) + ":" + tailStamp(f.view(), f.view().size()); }
+            if(gen==gen_) return;
+            gen_ = gen;
+            cache_.clear();
+            inbox_ = ResidentInbox{}; inbox_.rows = loadInbox();
+            partial_.clear();
+            headerText_ = readFileOrEmpty(headerPath());
+            return;
+        }
+        MappedFile f(inboxPath());
+        string_view d = f.view();
+        string gen = to_string(d.size()) + ":" + tailStamp(d, d.size()) + ":" + hdrGen;
+        if(gen==gen_) return;
+        gen_ = gen;
+        cache_.clear();
+        syncResidentInbox(inbox_, d);
+        partial_.clear();
+        forEachRecView(d.substr(size_t(inbox_.bytes)), [&](const RecView& r){ partial_.push_back(toRec(r)); });
+        headerText_ = readFileOrEmpty(headerPath());
+    }
+
+    template<class F> void forEachRow(F&& fn) const { for(const auto& r: inbox_.rows) fn(r); for(const auto& r: partial_) fn(r); }
+
+    optional<string> render(const string& path, const map<string,string>& q){
+        RenderOpts ro; ro.html = true; ro.headerText = headerText_;
+        auto flag = [&](const char* k){ auto it = q.find(k); return it!=q.end() && it->second!="0"; };
+        ro.groupTags = flag("gt"); ro.tagsOnly = flag("tags-only");
+        vector<Rec> rows;
+        if(path=="/" || path.empty()) return index();
+        if(path.rfind("/week/", 0)==0){
+            auto w = parseISOWeekStr(path.substr(6));
+            if(!w) return nullopt;
+            auto wb = weekBounds(w->first, w->second);
+            ro.rangeLabel = fmtISOWeek(wb.year, wb.week);
+            forEachRow([&](const Rec& r){ if(r.date>=wb.monday && r.date<=wb.sunday) rows.push_back(r); });
+        } else if(path.rfind("/range/", 0)==0){
+            string spec = path.substr(7);
+            size_t dots = spec.find("..");
+            if(dots==string::npos) return nullopt;
+            auto lo = parseISODate(spec.substr(0, dots)), hi = parseISODate(spec.substr(dots+2));
+            if(!lo || !hi) return nullopt;
+            ro.rangeLabel = fmtDate(*lo) + " to " + fmtDate(*hi);
+            forEachRow([&](const Rec& r){ if(r.date>=*lo && r.date<=*hi) rows.push_back(r); });
+        } else if(path.rfind("/tag/", 0)==0){
+            string t = toLower(trim(path.substr(5)));
+            if(!t.empty() && t[0]=='#') t.erase(0, 1);
+            if(t.empty()) return nullopt;
+            ro.rangeLabel = "#" + t;
+            forEachRow([&](const Rec& r){
+                for(const auto& x: splitTags(r.tags)){ string_view v = x; if(!v.empty() && v[0]=='#') v.remove_prefix(1); if(iequalsAscii(v, t)){ rows.push_back(r); break; } }
+            });
+        } else return nullopt;
+        std::stable_sort(rows.begin(), rows.end(), [](const Rec& x, const Rec& y){ return x.date<y.date; });
+        string out;
+        DigestWriter w([&](string_view s){ out.append(s.data(), s.size()); }, true);
+        renderDigest(rows, ro, w);
+        return out;
+    }
+
+    string index(){
+        map<int,size_t> weeks;
+        sys_days lastDate{}; int lastWeek = 0;
+        forEachRow([&](const Rec& r){
+            if(r.date!=lastDate){ auto w = isoWeekFromDate(r.date); lastWeek = w.year*100 + w.week; lastDate = r.date; }
+            ++weeks[lastWeek];
+        });
+        string out;
+        DigestWriter w([&](string_view s){ out.append(s.data(), s.size()); }, true);
+        w.raw("<h1>Weeks</h1><ul>");
+        for(auto it = weeks.rbegin(); it!=weeks.rend(); ++it){
+            string wk = fmtISOWeek(it->first/100, it->first%100);
+            w.raw("<li><a href=\"/week/" + wk + "\">" + wk + "</a> — " + to_string(it->second) + "</li>");
+        }
+        w.raw("</ul>");
+        w.finish();
+        return out;
+    }
+
+    string add(const HttpRequest& req){
+        auto p = parseFormParams(req.body);
+        for(const auto& [k,v]: parseFormParams(req.query)) p.emplace(k, v);
+        auto text = [&](int status, const char* reason, const string& msg){
+            return httpResponse(status, reason, "text/plain; charset=utf-8", msg, "", req.keepAlive);
+        };
+        string url = trim(p["url"]);
+        if(url.empty()) return text(400, "Bad Request", "missing url\n");
+        Rec r;
+        optional<sys_days> d = p["date"].empty()? parseISODate(todayISO()) : parseISODate(p["date"]);
+        if(!d) return text(400, "Bad Request", "invalid date (use YYYY-MM-DD)\n");
+        r.date = *d; r.url = url; r.kind = detectKind(url); r.title = trim(p["title"]);
+        string tags = p["tags"]; std::replace(tags.begin(), tags.end(), ',', ' ');
+        r.tags = normalizeTagsForStorage(splitTags(tags));
+        if(!appendInbox(r)) return text(500, "Internal Server Error", "failed to append to inbox.tsv\n");
+        refreshIndexesAfterAppend();
+        return text(201, "Created", "Added: " + fmtDate(r.date) + "\t" + r.kind + "\t" + r.url + "\t" + r.title + "\t" + r.tags + "\n");
+    }
+
+    string token_, bind_;
+    int port_;
+    string gen_, headerText_;
+    ResidentInbox inbox_;
+    string cfgGen_;
+    vector<Rec> partial_;
+    PageCache cache_;
+};
+
+static int cmd_http(const Args& a){
+#ifdef _WIN32
+    (void)a;
+    cerr<<"curate http is not available on Windows\n";
+    return 1;
+#else
+    int lfd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if(lfd<0){ cerr<<"Cannot create socket: "<< strerror(errno) <<"\n"; return 1; }
+    ::fcntl(lfd, F_SETFD, FD_CLOEXEC);
+    int one = 1; ::setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{}; addr.sin_family = AF_INET; addr.sin_port = htons(uint16_t(a.port));
+    if(::inet_pton(AF_INET, a.bind.c_str(), &addr.sin_addr)!=1){ cerr<<"Invalid --bind address "<< a.bind <<"\n"; ::close(lfd); return 2; }
+    if(::bind(lfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))!=0 || ::listen(lfd, 64)!=0){
+        cerr<<"Cannot listen on "<< a.bind <<":"<< a.port <<": "<< strerror(errno) <<"\n"; ::close(lfd); return 1;
+    }
+    struct sigaction sa{};
+    sa.sa_handler = [](int){ serveStop = 1; };
+    ::sigaction(SIGINT, &sa, nullptr); ::sigaction(SIGTERM, &sa, nullptr);
+    ::signal(SIGPIPE, SIG_IGN);
+
+    string token = a.token;
+    if(token.empty()){
+        std::random_device rd;
+        for(int i=0;i<2;++i) token += hex64((uint64_t(rd()) << 32) | rd());
+    }
+    residentInbox() = make_unique<map<string,ResidentInbox>>(); // shards stay parsed between refreshes
+    HttpPreview app(token, a.bind, a.port);
+    string base = "http://" + a.bind + ":" + to_string(a.port);
+    cout<<"Serving "<< fs::absolute(curateHome()) <<" at "<< base <<"/\n";
+    if(a.token.empty()) cout<<"Token for POST /add: "<< token <<" (pass --token T to keep one across restarts)\n";
+    cout<<"Bookmarklet: javascript:fetch('"<< base <<"/add',{method:'POST',body:new URLSearchParams({url:location.href,title:document.title,token:'"<< token <<"'})})\n" << std::flush;
+
+    struct Conn{ int fd; string in; };
+    vector<Conn> conns;
+    while(!serveStop){
+        vector<pollfd> p{{lfd, POLLIN, 0}};
+        for(const auto& c: conns) p.push_back({c.fd, POLLIN, 0});
+        if(::poll(p.data(), nfds_t(p.size()), -1)<0){ if(errno==EINTR) continue; break; }
+        vector<Conn> keep;
+        for(size_t i=0;i<conns.size();++i){
+            Conn& c = conns[i];
+            bool open = true;
+            if(p[i+1].revents & (POLLIN|POLLHUP|POLLERR)){
+                char buf[1<<16];
+                long n = fdRead(c.fd, buf, sizeof(buf));
+                if(n<=0) open = false;
+                else c.in.append(buf, size_t(n));
+                HttpRequest req; int st;
+                while(open && (st = parseHttpRequest(c.in, req))!=0){
+                    if(st<0){ string r = httpResponse(400, "Bad Request", "text/plain", "bad request\n", "", false); fdWriteAll(c.fd, r.data(), r.size()); open = false; break; }
+                    string r = app.handle(req);
+                    if(!fdWriteAll(c.fd, r.data(), r.size()) || !req.keepAlive) open = false;
+                }
+            }
+            if(open) keep.push_back(std::move(c)); else ::close(c.fd);
+        }
+        conns = std::move(keep);
+        if(p[0].revents & POLLIN){
+            int cfd = ::accept(lfd, nullptr, nullptr);
+            if(cfd>=0){
+                ::fcntl(cfd, F_SETFD, FD_CLOEXEC);
+                if(conns.size() >= 256){ ::close(conns.front().fd); conns.erase(conns.begin()); }
+                conns.push_back({cfd, string()});
+            }
+        }
     }
+    for(const auto& c: conns) ::close(c.fd);
+    ::close(lfd);
+    cout<<"Stopped\n";
     return 0;
+#endif
 }
 
-int main(int argc, char** argv){
+static int runCommand(int argc, char** argv){
     auto args = parseCLI(argc, argv);
     if(!args) return 2;
     fs::create_directories(curateHome());
     fs::create_directories(templatesDir());
     fs::create_directories(digestsDir());
-    if(!fileExists(inboxPath())){ ofstream o(inboxPath()); } // first-run convenience
+    if(!fileExists(inboxPath()) && !shardedInbox()){ ofstream o(inboxPath()); } // first-run convenience
     // ensure rules.tsv exists with defaults if missing
     ensureDefaultRulesFile();
 
     if(args->cmd=="add") return cmd_add(*args);
+    if(args->explain) return cmd_explain(*args);
     if(args->cmd=="digest") return cmd_digest(*args);
     if(args->cmd=="clear-inbox") return cmd_clear_inbox(*args);
+    if(args->cmd=="sort") return cmd_sort(*args);
+    if(args->cmd=="migrate") return cmd_migrate(*args);
+    if(args->cmd=="sync") return cmd_sync(*args);
     if(args->cmd=="list") return cmd_list(*args);
+    if(args->cmd=="export") return cmd_export(*args);
+    if(args->cmd=="import") return cmd_import(*args);
+    if(args->cmd=="search") return cmd_search(*args);
+    if(args->cmd=="index") return cmd_index(*args);
+    if(args->cmd=="domains") return cmd_domains(*args);
+    if(args->cmd=="stats") return cmd_stats(*args);
+    if(args->cmd=="aggregates") return cmd_aggregates(*args);
+    if(args->cmd=="titles") return cmd_titles(*args);
+    if(args->cmd=="check-links") return cmd_check_links(*args);
+    if(args->cmd=="snapshot") return cmd_snapshot(*args);
+    if(args->cmd=="serve") return cmd_serve(*args);
+    if(args->cmd=="http") return cmd_http(*args);
     printHelp();
     return 2;
 }
+
+int main(int argc, char** argv){
+    if(auto rc = runViaDaemon(argc, argv)) return *rc;
+    return runCommand(argc, argv);
+}
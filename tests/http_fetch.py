@@ -0,0 +1,433 @@
+#!/usr/bin/env python3
+"""Runs the HTTP commands of curate against a local stand-in server.
+
+    python3 tests/http_fetch.py [path/to/curate]     (default ./curate)
+
+The stand-in speaks plain HTTP/1.1 on 127.0.0.1 and answers for any host: curate is pointed
+at it with --proxy, so rows can name several hosts (a.test, b.test, ...) while every request
+lands here in absolute form. Each test gets a fresh CURATE_HOME.
+"""
+import os
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+import unittest
+
+CURATE = os.path.abspath(sys.argv.pop(1) if len(sys.argv) > 1 else "./curate")
+DAY = "2026-01-05"
+
+
+class StandIn:
+    """Threaded HTTP/1.1 server; routes map a path to handler(conn, req) -> keep connection open."""
+
+    def __init__(self):
+        self.routes = {}
+        self.log = []  # (connection number, method, host, path, headers, time) per request
+        self.lock = threading.Lock()
+        self.sock = socket.socket()
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.sock.bind(("127.0.0.1", 0))
+        self.sock.listen(64)
+        self.port = self.sock.getsockname()[1]
+        self.conns = 0
+        self.busy, self.peak = {}, {}  # requests in progress per host, and the most at once
+        self.pages = {}  # /page/NAME → (status, body), changed by tests
+        threading.Thread(target=self._accept, daemon=True).start()
+
+    def url(self):
+        return f"http://127.0.0.1:{self.port}"
+
+    def requests(self, host=None):
+        with self.lock:
+            return [r for r in self.log if host is None or r[2] == host]
+
+    def reset(self):
+        with self.lock:
+            self.log.clear()
+            self.peak.clear()
+
+    def _accept(self):
+        while True:
+            conn, _ = self.sock.accept()
+            with self.lock:
+                self.conns += 1
+                n = self.conns
+            threading.Thread(target=self._serve, args=(conn, n), daemon=True).start()
+
+    def _serve(self, conn, n):
+        buf = b""
+        try:
+            while True:
+                while b"\r\n\r\n" not in buf:
+                    data = conn.recv(65536)
+                    if not data:
+                        return
+                    buf += data
+                head, buf = buf.split(b"\r\n\r\n", 1)
+                lines = head.decode("latin-1").split("\r\n")
+                method, target, _ = lines[0].split(" ", 2)
+                headers = {k.strip().lower(): v.strip() for k, _, v in (l.partition(":") for l in lines[1:])}
+                host = headers.get("host", "")
+                if "://" in target:  # absolute form, through --proxy
+                    host, _, path = target.split("://", 1)[1].partition("/")
+                    path = "/" + path
+                else:
+                    path = target
+                with self.lock:
+                    self.log.append((n, method, host, path, headers, time.monotonic()))
+                    self.busy[host] = self.busy.get(host, 0) + 1
+                    self.peak[host] = max(self.peak.get(host, 0), self.busy[host])
+                route = self.routes.get(path) or self.routes.get(path.rsplit("/", 1)[0] + "/*")
+                req = {"method": method, "host": host, "path": path, "headers": headers}
+                try:
+                    keep = route(conn, req) if route else reply(conn, 404, "<title>Not found</title>", method=method)
+                finally:
+                    with self.lock:
+                        self.busy[host] -= 1
+                if not keep:
+                    return
+        except OSError:
+            pass
+        finally:
+            conn.close()
+
+
+def reply(conn, status, body="", headers=(), method="GET", keep=True):
+    body = body.encode()
+    head = f"HTTP/1.1 {status} X\r\nContent-Type: text/html\r\nContent-Length: {len(body)}\r\n"
+    head += "".join(f"{h}\r\n" for h in headers)
+    head += "Connection: keep-alive\r\n\r\n" if keep else "Connection: close\r\n\r\n"
+    conn.sendall(head.encode() + (b"" if method == "HEAD" else body))
+    return keep
+
+
+def page(title):
+    return f"<html><head><title>{title}</title></head><body><main><p>{title} text</p></main></body></html>"
+
+
+def closed_port():
+    s = socket.socket()
+    s.bind(("127.0.0.1", 0))
+    port = s.getsockname()[1]
+    s.close()
+    return port
+
+
+SERVER = None
+
+
+def setUpModule():
+    global SERVER
+    SERVER = StandIn()
+    r = SERVER.routes
+
+    r["/title/*"] = lambda c, q: reply(c, 200, page(q["path"].rsplit("/", 1)[1]), method=q["method"])
+
+    def chunked(c, q):
+        parts = [b"<html><head><tit", b"le>Chunked ", b"page</title></head>", b"<body>rest</body></html>"]
+        c.sendall(b"HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nTransfer-Encoding: chunked\r\n\r\n")
+        for p in parts:
+            c.sendall(b"%x\r\n%s\r\n" % (len(p), p))
+            time.sleep(0.02)
+        c.sendall(b"0\r\n\r\n")
+        return True
+    r["/chunked"] = chunked
+
+    r["/moved"] = lambda c, q: reply(c, 301, headers=["Location: /title/landed"], method=q["method"])
+    r["/moved-away"] = lambda c, q: reply(c, 302, headers=["Location: http://b.test/title/elsewhere"], method=q["method"])
+    r["/gone"] = lambda c, q: reply(c, 410, method=q["method"])
+
+    # Rejects HEAD, like some servers do; a ranged GET gets the first byte.
+    def no_head(c, q):
+        if q["method"] == "HEAD":
+            return reply(c, 405, headers=["Allow: GET"], method="HEAD")
+        if q["headers"].get("range") == "bytes=0-0":
+            return reply(c, 206, "<", headers=["Content-Range: bytes 0-0/99"])
+        return reply(c, 200, page("no head"))
+    r["/no-head"] = no_head
+
+    def stored_page(c, q):
+        status, body = SERVER.pages.get(q["path"].rsplit("/", 1)[1], (404, ""))
+        return reply(c, status, body, method=q["method"])
+    r["/page/*"] = stored_page
+
+    # Promises a body and hangs up halfway through it.
+    def cut(c, q):
+        c.sendall(b"HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nContent-Length: 5000\r\n\r\n<html><body>")
+        return False
+    r["/cut"] = cut
+
+    def hold(c, q):
+        time.sleep(0.2)
+        return reply(c, 200, page("held"), method=q["method"])
+    r["/hold/*"] = hold
+
+    def interim(c, q):
+        c.sendall(b"HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 103 Early Hints\r\nLink: </s.css>; rel=preload\r\n\r\n")
+        return reply(c, 200, page("after hints"))
+    r["/interim"] = interim
+
+    def slow(c, q):
+        time.sleep(5)
+        return False
+    r["/slow"] = slow
+
+    # Answers with keep-alive but hangs up right after, so a parked connection is dead.
+    def bye(c, q):
+        reply(c, 200, page("bye " + q["path"].rsplit("/", 1)[1]), method=q["method"])
+        return False
+    r["/bye/*"] = bye
+
+
+class Home:
+    def __init__(self, urls):
+        self.dir = tempfile.TemporaryDirectory()
+        self.path = self.dir.name
+        with open(self.file("inbox.tsv"), "w") as f:
+            for u in urls:
+                f.write(f"{DAY}\tlink\t{u}\t\t\n")
+
+    def file(self, name):
+        return os.path.join(self.path, name)
+
+    def run(self, *args, check=True):
+        env = dict(os.environ, CURATE_HOME=self.path, CURATE_NO_DAEMON="1")
+        env.pop("CURATE_HTTP_PROXY", None)
+        p = subprocess.run([CURATE, *args], env=env, capture_output=True, text=True, timeout=60)
+        if check and p.returncode != 0:
+            raise AssertionError(f"curate {' '.join(args)} exited {p.returncode}:\n{p.stderr}")
+        return p
+
+    def tsv(self, name):
+        with open(self.file(name)) as f:
+            return [l.rstrip("\n").split("\t") for l in f if l.strip() and not l.startswith("#")]
+
+    def titles(self):
+        return {r[2]: r[3] for r in self.tsv("inbox.tsv")}
+
+
+class CurateTest(unittest.TestCase):
+    def setUp(self):
+        SERVER.reset()
+
+    def home(self, urls):
+        h = Home(urls)
+        self.addCleanup(h.dir.cleanup)
+        return h
+
+
+class TitlesFill(CurateTest):
+    def test_keep_alive_reuses_one_connection(self):
+        urls = [f"http://a.test/title/{n}" for n in ("one", "two", "three")]
+        h = self.home(urls)
+        h.run("titles", "fill", "--proxy", SERVER.url(), "--per-host", "1", "--concurrency", "1")
+        self.assertEqual(h.titles(), {u: u.rsplit("/", 1)[1] for u in urls})
+        self.assertEqual(len({r[0] for r in SERVER.requests("a.test")}), 1)
+
+    def test_chunked_redirect_and_interim_responses(self):
+        h = self.home(["http://a.test/chunked", "http://a.test/moved", "http://a.test/interim"])
+        h.run("titles", "fill", "--proxy", SERVER.url())
+        self.assertEqual(h.titles(), {"http://a.test/chunked": "Chunked page", "http://a.test/moved": "landed",
+                                      "http://a.test/interim": "after hints"})
+
+    def test_server_closing_parked_connections(self):
+        urls = [f"http://a.test/bye/{n}" for n in range(6)]
+        h = self.home(urls)
+        h.run("titles", "fill", "--proxy", SERVER.url(), "--per-host", "1")
+        self.assertEqual(h.titles(), {u: "bye " + u.rsplit("/", 1)[1] for u in urls})
+        self.assertEqual(len(SERVER.requests("a.test")), 6)  # no request was lost on a dead connection
+
+    def test_refused_and_timeout(self):
+        refused = f"http://127.0.0.1:{closed_port()}/x"
+        slow = f"http://127.0.0.1:{SERVER.port}/slow"
+        h = self.home([refused, slow, f"http://127.0.0.1:{SERVER.port}/title/fine"])
+        p = h.run("titles", "fill", "--timeout", "1", "-v")
+        self.assertIn(f"{refused}: Connection refused", p.stderr)
+        self.assertIn(f"{slow}: timeout", p.stderr)
+        self.assertIn("Filled 1 of 3 empty titles", p.stdout)
+        cache = {r[0]: r for r in h.tsv("titles.tsv")}
+        self.assertEqual(cache[refused][2], "0")
+        self.assertEqual(cache[slow][2], "0")
+        # failures are not fetched again within a week
+        SERVER.reset()
+        p = h.run("titles", "fill", "--timeout", "1")
+        self.assertIn("fetched 0 URLs", p.stdout)
+        self.assertEqual(SERVER.requests(), [])
+
+
+class CheckLinks(CurateTest):
+    def status(self, h):
+        return {r[0]: r for r in h.tsv("linkstatus.tsv")}
+
+    def test_fallback_redirect_dead_and_refused(self):
+        base = f"http://127.0.0.1:{SERVER.port}"
+        refused = f"http://127.0.0.1:{closed_port()}/x"
+        h = self.home([f"{base}/no-head", f"{base}/moved", f"{base}/missing", f"{base}/gone", refused])
+        p = h.run("check-links", "--rate", "0", "-v")
+        lines = set(p.stdout.splitlines())
+        self.assertIn(f"ok\t206\t{base}/no-head\t", lines)
+        self.assertIn(f"moved\t200\t{base}/moved\t{base}/title/landed", lines)
+        self.assertIn(f"dead\t404\t{base}/missing\t", lines)
+        self.assertIn(f"dead\t410\t{base}/gone\t", lines)
+        self.assertIn(f"error\t0\t{refused}\tConnection refused", lines)
+        self.assertIn("Checked 5 of 5 URLs: 1 ok, 1 redirected, 2 dead, 1 failing", p.stderr)
+        seen = [(r[1], r[4].get("range")) for r in SERVER.requests() if r[3] == "/no-head"]
+        self.assertEqual(seen, [("HEAD", None), ("GET", "bytes=0-0")])
+        st = self.status(h)
+        self.assertEqual(st[f"{base}/moved"][4], f"{base}/title/landed")
+        self.assertEqual(st[refused][2], "0")
+        self.assertEqual(st[refused][5], "Connection refused")
+
+    def test_redirect_to_another_host(self):
+        h = self.home(["http://a.test/moved-away"])
+        p = h.run("check-links", "--proxy", SERVER.url(), "--rate", "0", "-v")
+        self.assertIn("moved\t200\thttp://a.test/moved-away\thttp://b.test/title/elsewhere", p.stdout.splitlines())
+        self.assertEqual([(r[2], r[3]) for r in SERVER.requests()], [("a.test", "/moved-away"), ("b.test", "/title/elsewhere")])
+
+    def test_max_age_skips_recent_results(self):
+        h = self.home([f"http://127.0.0.1:{SERVER.port}/title/{n}" for n in range(3)])
+        h.run("check-links", "--rate", "0")
+        self.assertEqual(len(SERVER.requests()), 3)
+        SERVER.reset()
+        p = h.run("check-links", "--rate", "0")
+        self.assertIn("Checked 0 of 3 URLs", p.stderr)
+        self.assertIn("3 checked in the last 7 days", p.stderr)
+        self.assertEqual(SERVER.requests(), [])
+        p = h.run("check-links", "--rate", "0", "--max-age", "0")
+        self.assertIn("Checked 3 of 3 URLs: 3 ok", p.stderr)
+        self.assertEqual(len(SERVER.requests()), 3)
+
+    def test_per_host_cap(self):
+        urls = [f"http://{host}/hold/{n}" for host in ("a.test", "b.test") for n in range(6)]
+        h = self.home(urls)
+        h.run("check-links", "--proxy", SERVER.url(), "--rate", "0", "--per-host", "2", "--concurrency", "16")
+        self.assertEqual(len(SERVER.requests()), 12)
+        self.assertEqual(SERVER.peak, {"a.test": 2, "b.test": 2})
+
+    def test_rate_spaces_request_starts(self):
+        urls = [f"http://h{n}.test/title/{n}" for n in range(6)]
+        h = self.home(urls)
+        h.run("check-links", "--proxy", SERVER.url(), "--rate", "5")
+        starts = sorted(r[5] for r in SERVER.requests())
+        self.assertEqual(len(starts), 6)
+        gaps = [b - a for a, b in zip(starts, starts[1:])]
+        self.assertGreater(min(gaps), 0.15)  # 1/5 s apart, less scheduling jitter
+
+    def test_rate_with_parked_connections_closed_by_server(self):
+        urls = [f"http://a.test/bye/{n}" for n in range(3)]
+        h = self.home(urls)
+        p = h.run("check-links", "--proxy", SERVER.url(), "--rate", "5", "--per-host", "1")
+        self.assertEqual(p.stdout, "")
+        self.assertIn("Checked 3 of 3 URLs: 3 ok", p.stderr)
+        self.assertEqual(len({r[0] for r in SERVER.requests()}), 3)
+
+
+BOILERPLATE = "".join(f"<p>Shared paragraph {n} that every page of the site repeats word for word.</p>" for n in range(60))
+
+
+def article(title, body):
+    return f"<html><head><title>{title}</title></head><body><nav>menu</nav><main><h1>{title}</h1><p>{body}</p>" \
+           f"{BOILERPLATE}</main><footer>foot</footer></body></html>"
+
+
+class Snapshot(CurateTest):
+    def setUp(self):
+        super().setUp()
+        SERVER.pages.clear()
+
+    def url(self, name):
+        return f"http://127.0.0.1:{SERVER.port}/page/{name}"
+
+    def index(self, h):
+        return {r[0]: r for r in h.tsv("snapshots/index.tsv")}
+
+    def show(self, h, key):
+        return h.run("snapshot", "show", key).stdout
+
+    def assert_store_consistent(self, h):
+        """Every chunks.idx record lies inside chunks.pack and every indexed id reads back."""
+        pack = os.path.getsize(h.file("snapshots/chunks.pack"))
+        with open(h.file("snapshots/chunks.idx"), "rb") as f:
+            idx = f.read()
+        self.assertEqual(len(idx) % 44, 0)
+        for at in range(0, len(idx), 44):
+            off = int.from_bytes(idx[at+32:at+40], "little")
+            length = int.from_bytes(idx[at+40:at+44], "little")
+            self.assertLessEqual(off + length, pack)
+        for url, row in self.index(h).items():
+            if row[3]:
+                self.show(h, row[3])
+        return pack, len(idx)
+
+    def test_store_dedupe_and_show(self):
+        SERVER.pages["a"] = (200, article("First", "Only the first page says this."))
+        SERVER.pages["b"] = (200, article("Second", "Only the second page says that."))
+        SERVER.pages["copy"] = SERVER.pages["a"]
+        h = self.home([self.url("a"), self.url("b"), self.url("copy")])
+        p = h.run("snapshot", "--per-host", "1", "--concurrency", "1")
+        self.assertIn("Snapshotted 3 of 3 pages (0 failed)", p.stdout)
+        saved = int(p.stdout.split("dedupe saved ")[1].split("%")[0])
+        self.assertGreater(saved, 50)  # boilerplate and the copy are stored once
+        idx = self.index(h)
+        self.assertEqual(idx[self.url("a")][3], idx[self.url("copy")][3])
+        self.assertNotEqual(idx[self.url("a")][3], idx[self.url("b")][3])
+        self.assertEqual(idx[self.url("b")][5], "Second")
+        text = self.show(h, self.url("b"))
+        self.assertTrue(text.startswith("Second\nOnly the second page says that.\nShared paragraph 0"))
+        self.assertNotIn("menu", text)
+        self.assertNotIn("foot", text)
+        self.assertEqual(self.show(h, idx[self.url("b")][3]), text)
+        self.assertEqual(int(idx[self.url("b")][4]), len(text.encode()))
+        self.assert_store_consistent(h)
+        self.assertNotEqual(h.run("snapshot", "show", "0" * 64, check=False).returncode, 0)
+
+    def test_refresh(self):
+        SERVER.pages["a"] = (200, article("Draft", "First version."))
+        h = self.home([self.url("a")])
+        h.run("snapshot")
+        old = self.index(h)[self.url("a")][3]
+        SERVER.pages["a"] = (200, article("Final", "Second version, rewritten."))
+        SERVER.reset()
+        p = h.run("snapshot")
+        self.assertIn("1 of 1 URLs already stored", p.stdout)
+        self.assertEqual(SERVER.requests(), [])
+        p = h.run("snapshot", "--refresh")
+        self.assertIn("Snapshotted 1 of 1 pages", p.stdout)
+        new = self.index(h)[self.url("a")][3]
+        self.assertNotEqual(new, old)
+        self.assertIn("Second version, rewritten.", self.show(h, self.url("a")))
+        self.assertIn("First version.", self.show(h, old))  # older snapshots stay readable by id
+        saved = int(p.stdout.split("dedupe saved ")[1].split("%")[0])
+        self.assertGreater(saved, 50)  # only the chunks around the edit are new
+        self.assert_store_consistent(h)
+
+    def test_failed_fetch_leaves_store_consistent(self):
+        SERVER.pages["a"] = (200, article("Kept", "Stored before the site broke."))
+        h = self.home([self.url("a"), self.url("never"), f"http://127.0.0.1:{SERVER.port}/cut"])
+        p = h.run("snapshot", "-v")
+        self.assertIn("Snapshotted 1 of 3 pages (2 failed)", p.stdout)
+        self.assertIn(f"{self.url('never')}: HTTP 404", p.stderr)
+        self.assertIn(f"http://127.0.0.1:{SERVER.port}/cut: connection closed mid-response", p.stderr)
+        before = self.assert_store_consistent(h)
+        idx = self.index(h)
+        self.assertEqual(idx[self.url("never")][2:4], ["404", ""])
+        kept = idx[self.url("a")][3]
+
+        SERVER.pages["a"] = (500, "")
+        p = h.run("snapshot", "--refresh")
+        self.assertIn("Snapshotted 0 of 3 pages (3 failed)", p.stdout)
+        self.assertEqual(self.assert_store_consistent(h), before)  # nothing was appended
+        self.assertEqual(self.index(h)[self.url("a")][3], kept)  # the stored snapshot is kept
+        self.assertIn("Stored before the site broke.", self.show(h, self.url("a")))
+        # failures without a snapshot are retried only after a week
+        SERVER.reset()
+        p = h.run("snapshot")
+        self.assertIn("2 failed in the last 7 days", p.stdout)
+        self.assertEqual(SERVER.requests(), [])
+
+
+if __name__ == "__main__":
+    unittest.main(verbosity=2)